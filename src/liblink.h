@@ -0,0 +1,234 @@
+/**
+ * @file
+ * @brief embeddable ln library
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ *
+ * Creates links in-process with the same logic as the ln utility, for
+ * programs that would otherwise run ln once for each link. The library does
+ * not exit the process, and only prints error messages if asked to with
+ * @ref LN_FLAG_WARN.
+ *
+ * Build src/ln.c, src/reflink.c, and src/uring.c with LINK_LIBRARY defined.
+ */
+#ifndef LINK_LIBLINK_H
+#define LINK_LIBLINK_H
+
+#include <stddef.h>
+
+/**
+ * @defgroup ln_flag ln flags
+ *
+ * Option flags when running ln, also accepted by @ref ln_lib_new.
+ */
+
+/**
+ * Replace the destination path if it already exists.
+ *
+ * Corresponds to argument (-f).
+ *
+ * @ingroup ln_flag
+ */
+#define LN_FLAG_REMOVE_DEST ((unsigned int)(1 << 0))
+
+/**
+ * Specifies whether ln creates a hard link to the symbolic link or to the
+ * file pointed to by the symbolic link.
+ *
+ * Corresponds to argument (-L) if set.
+ *
+ * Corresponds to argument (-P) if unset.
+ *
+ * @ingroup ln_flag
+ */
+#define LN_FLAG_FOLLOW_SYMBOLIC ((unsigned int)(1 << 1))
+
+/**
+ * Create symbolic links (ln creates hard links by default).
+ *
+ * Corresponds to argument (-s).
+ *
+ * @ingroup ln_flag
+ */
+#define LN_FLAG_SYMBOLIC ((unsigned int)(1 << 2))
+
+/**
+ * Entries in the operand list file get separated by a null character instead
+ * of a newline.
+ *
+ * Corresponds to argument (-0).
+ *
+ * @ingroup ln_flag
+ */
+#define LN_FLAG_LIST_NUL ((unsigned int)(1 << 3))
+
+/**
+ * Submit the links inside a target directory in batches through io_uring.
+ *
+ * Falls back to creating the links with blocking system calls if io_uring
+ * not available, or if ln not built with LINK_IO_URING.
+ *
+ * Corresponds to argument (-u).
+ *
+ * @ingroup ln_flag
+ */
+#define LN_FLAG_URING ((unsigned int)(1 << 4))
+
+/**
+ * Mirror the directory structure of a source directory and link every file
+ * inside it.
+ *
+ * Corresponds to argument (-R).
+ *
+ * @ingroup ln_flag
+ */
+#define LN_FLAG_RECURSIVE ((unsigned int)(1 << 5))
+
+/**
+ * Print an error message to STDERR for each failure.
+ *
+ * Always set by the ln utility. The library only prints error messages if
+ * this flag gets passed to @ref ln_lib_new.
+ *
+ * @ingroup ln_flag
+ */
+#define LN_FLAG_WARN ((unsigned int)(1 << 6))
+
+/**
+ * Replace duplicate files inside directory trees with hard links to a
+ * single copy, or with (-c) share their extents instead, which requires ln
+ * built with LINK_REFLINK.
+ *
+ * Corresponds to argument (-D). Not supported by @ref ln_lib_new.
+ *
+ * @ingroup ln_flag
+ */
+#define LN_FLAG_DEDUP ((unsigned int)(1 << 7))
+
+/**
+ * Create copy-on-write clones that share the data extents of the source
+ * file instead of hard links, so each file keeps its own inode and can get
+ * modified without affecting the other. Requires a filesystem with
+ * copy-on-write extents and ln built with LINK_REFLINK.
+ *
+ * Corresponds to argument (-c).
+ *
+ * @ingroup ln_flag
+ */
+#define LN_FLAG_REFLINK ((unsigned int)(1 << 8))
+
+/**
+ * When a hard link fails because the source and the new link are on
+ * different filesystems (EXDEV), or a copy-on-write clone fails, fall back
+ * to a copy-on-write clone and then to a copy of the source file. The copy
+ * keeps any holes of the source and lets the kernel copy the data where it
+ * can. Symbolic links only get copied when followed.
+ *
+ * Corresponds to argument (-C).
+ *
+ * @ingroup ln_flag
+ */
+#define LN_FLAG_COPY ((unsigned int)(1 << 9))
+
+/**
+ * Library context holding the options and the combined status of every
+ * link created with it.
+ */
+struct ln_ctx;
+
+/**
+ * Link operation submitted to @ref ln_lib_submit.
+ */
+struct ln_lib_op{
+  /**
+   * File to point the new link to.
+   */
+  const char *source;
+
+  /**
+   * Path of the new link. Unlike the ln utility, the link does not get
+   * created inside @ref dest if it names an existing directory.
+   */
+  const char *dest;
+
+  /**
+   * Set to 0 if the link got created, or to an errno value describing why
+   * it did not.
+   */
+  int error;
+};
+
+/**
+ * Create a new library context.
+ *
+ * @param[in] flags         Any of @ref LN_FLAG_REMOVE_DEST,
+ *                          @ref LN_FLAG_FOLLOW_SYMBOLIC,
+ *                          @ref LN_FLAG_SYMBOLIC or @ref LN_FLAG_REFLINK,
+ *                          @ref LN_FLAG_COPY, and @ref LN_FLAG_WARN.
+ * @param[in] nthread       Maximum number of threads creating the links of
+ *                          each @ref ln_lib_submit call. Treated as 1 if 0.
+ * @retval    struct ln_ctx* New context. Free with @ref ln_lib_free.
+ * @retval    NULL          Unsupported flags or too many threads
+ *                          (EINVAL), or failed to allocate memory
+ *                          (ENOMEM).
+ */
+struct ln_ctx *
+ln_lib_new(const unsigned int flags,
+           const size_t nthread);
+
+/**
+ * Create a list of links.
+ *
+ * Every operation gets attempted, even after a failure, and its result
+ * gets stored in @ref ln_lib_op::error.
+ *
+ * @param[in,out] ln_ctx  See @ref ln_ctx.
+ * @param[in,out] op_list Operations to run.
+ * @param[in]     nop     Number of operations in @p op_list.
+ * @return                Number of operations that failed.
+ */
+size_t
+ln_lib_submit(struct ln_ctx *const ln_ctx,
+              struct ln_lib_op *const op_list,
+              const size_t nop);
+
+/**
+ * Create a list of links, with relative paths resolved against a directory.
+ *
+ * Same as @ref ln_lib_submit, except that relative paths in @p op_list get
+ * resolved against @p dirfd instead of the current working directory. The
+ * source paths of symbolic links (@ref LN_FLAG_SYMBOLIC) still get stored
+ * in the new links exactly as given.
+ *
+ * @param[in,out] ln_ctx  See @ref ln_ctx.
+ * @param[in]     dirfd   Open directory file descriptor, or AT_FDCWD.
+ * @param[in,out] op_list Operations to run.
+ * @param[in]     nop     Number of operations in @p op_list.
+ * @return                Number of operations that failed.
+ */
+size_t
+ln_lib_submit_at(struct ln_ctx *const ln_ctx,
+                 const int dirfd,
+                 struct ln_lib_op *const op_list,
+                 const size_t nop);
+
+/**
+ * Get the combined status of every operation submitted so far.
+ *
+ * @param[in] ln_ctx       See @ref ln_ctx.
+ * @retval    EXIT_SUCCESS Created all links.
+ * @retval    EXIT_FAILURE Failed to create at least one link.
+ */
+int
+ln_lib_status(struct ln_ctx *const ln_ctx);
+
+/**
+ * Release a library context.
+ *
+ * @param[in] ln_ctx Context created by @ref ln_lib_new, or NULL.
+ */
+void
+ln_lib_free(struct ln_ctx *const ln_ctx);
+
+#endif /* LINK_LIBLINK_H */
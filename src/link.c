@@ -7,7 +7,10 @@
  */
 
 #include <err.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #ifdef TEST
@@ -17,44 +20,287 @@
  */
 # define LINKAGE extern
 # include "../test/seams.h"
-#else /* !(TEST) */
+#elif defined(LINK_BENCH) || defined(LINK_MULTICALL)
+/**
+ * Declare some functions with extern linkage, allowing the benchmark and the
+ * multi-call binary to call those functions.
+ */
+# define LINKAGE extern
+#else /* !(TEST) && !(LINK_BENCH) && !(LINK_MULTICALL) */
 /**
  * Define all functions as static when not testing.
  */
 # define LINKAGE static
-#endif /* TEST */
+#endif /* TEST, LINK_BENCH, LINK_MULTICALL */
+
+/**
+ * @defgroup link_flag link flags
+ *
+ * Option flags when running link.
+ */
+
+/**
+ * Create a hard link for each (file1, file2) pair read from a list.
+ *
+ * Corresponds to argument (-b).
+ *
+ * @ingroup link_flag
+ */
+#define LINK_FLAG_BATCH    ((unsigned int)(1 << 0))
+
+/**
+ * Entries in the pair list get separated by a null character instead of a
+ * newline.
+ *
+ * Corresponds to argument (-0).
+ *
+ * @ingroup link_flag
+ */
+#define LINK_FLAG_LIST_NUL ((unsigned int)(1 << 1))
+
+/**
+ * Pair of entries being read from a list in batch mode.
+ */
+struct link_batch{
+  /**
+   * First entry of the current pair, or NULL if the next entry starts a new
+   * pair. Points to @ref buf1, or to an empty string.
+   */
+  const char *file1;
+
+  /**
+   * Buffer holding a non-empty @ref file1.
+   */
+  char *buf1;
+
+  /**
+   * Size of @ref buf1 in bytes.
+   */
+  size_t buf1_sz;
+
+  /**
+   * Number of pairs processed.
+   */
+  size_t npair;
+
+  /**
+   * Number of pairs that failed.
+   */
+  size_t nfail;
+};
+
+/**
+ * Add the next entry of a list to the current pair, and create the link
+ * once the pair is complete.
+ *
+ * An empty entry still takes up its place in the pair, so the following
+ * entries stay paired the same way, and the pair gets reported as failed.
+ *
+ * @param[in,out] batch    See @ref link_batch.
+ * @param[in,out] entry    Buffer holding the entry, see getdelim. Gets
+ *                         swapped with @ref link_batch::buf1 when the entry
+ *                         starts a new pair.
+ * @param[in,out] entry_sz Size of @p entry, see getdelim.
+ * @param[in]     empty    The entry is empty, @p entry does not get used.
+ */
+static void
+link_batch_add(struct link_batch *const batch,
+               char **const entry,
+               size_t *const entry_sz,
+               const bool empty){
+  const char *file2;
+  char *buf;
+  size_t buf_sz;
+
+  if(batch->file1 == NULL && empty){
+    batch->file1 = "";
+  }
+  else if(batch->file1 == NULL){
+    buf = batch->buf1;
+    buf_sz = batch->buf1_sz;
+    batch->buf1 = *entry;
+    batch->buf1_sz = *entry_sz;
+    *entry = buf;
+    *entry_sz = buf_sz;
+    batch->file1 = batch->buf1;
+  }
+  else{
+    file2 = empty ? "" : *entry;
+    batch->npair += 1;
+    if(batch->file1[0] == '\0' || file2[0] == '\0'){
+      batch->nfail += 1;
+      warnx("empty entry in pair: \'%s\' - \'%s\'", batch->file1, file2);
+    }
+    else if(link(batch->file1, file2) != 0){
+      batch->nfail += 1;
+      warn("failed to create link: \'%s\' - \'%s\'", batch->file1, file2);
+    }
+    batch->file1 = NULL;
+  }
+}
+
+/**
+ * Create a hard link for each pair of entries in a list.
+ *
+ * The list alternates between an existing file and the new link to create
+ * for it. Each entry gets terminated by a newline, or by a null character
+ * if (-0) set. Empty entries at the end of the list get ignored, while any
+ * other empty entry fails its pair. Failures get reported per pair without
+ * stopping the batch.
+ *
+ * @param[in] flags        See @ref link_flag.
+ * @param[in] path_list    File containing the list of pairs, or "-" to
+ *                         read the list from STDIN.
+ * @retval    EXIT_SUCCESS Created all links.
+ * @retval    EXIT_FAILURE Failed to create at least one link.
+ */
+static int
+link_batch(const unsigned int flags,
+           const char *const path_list){
+  int status_code;
+  FILE *fp;
+  struct link_batch batch;
+  char *entry;
+  size_t entry_sz;
+  ssize_t len;
+  size_t nempty;
+  int delim;
+
+  status_code = EXIT_SUCCESS;
+  if(strcmp(path_list, "-") == 0){
+    fp = stdin;
+  }
+  else{
+    fp = fopen(path_list, "r");
+  }
+  if(fp == NULL){
+    status_code = EXIT_FAILURE;
+    warn("fopen(%s)", path_list);
+  }
+  else{
+    if(flags & LINK_FLAG_LIST_NUL){
+      delim = '\0';
+    }
+    else{
+      delim = '\n';
+    }
+    memset(&batch, 0, sizeof(batch));
+    entry = NULL;
+    entry_sz = 0;
+    nempty = 0;
+    while((len = getdelim(&entry, &entry_sz, delim, fp)) > 0){
+      if(entry[len - 1] == delim){
+        entry[--len] = '\0';
+      }
+      if(len == 0){
+        /* Only counts once another entry follows. */
+        nempty += 1;
+      }
+      else{
+        for(; nempty > 0; nempty--){
+          link_batch_add(&batch, &entry, &entry_sz, true);
+        }
+        link_batch_add(&batch, &entry, &entry_sz, false);
+      }
+    }
+    if(batch.file1){
+      batch.npair += 1;
+      batch.nfail += 1;
+      warnx("missing new link for: \'%s\'", batch.file1);
+    }
+    if(ferror(fp)){
+      status_code = EXIT_FAILURE;
+      warn("read(%s)", path_list);
+    }
+    free(entry);
+    free(batch.buf1);
+    if(fp != stdin && fclose(fp) != 0){
+      status_code = EXIT_FAILURE;
+      warn("fclose(%s)", path_list);
+    }
+    if(batch.nfail > 0){
+      status_code = EXIT_FAILURE;
+      warnx("failed to create %zu of %zu links", batch.nfail, batch.npair);
+    }
+  }
+  return status_code;
+}
 
 /**
  * Main entry point for link utility.
  *
  * Usage:
+ *
  * link file1 file2
  *
+ * link -b [-0] [-l list_file]
+ *
+ * Options only get parsed if the first argument is exactly -b, so the file
+ * operands may start with a '-' like POSIX requires.
+ *
  * @param[in] argc         Number of arguments in @p argv.
  * @param[in] argv         Argument list.
  * @retval    EXIT_SUCCESS Successful.
  * @retval    EXIT_FAILURE Error occurred.
  */
 LINKAGE int
-link_main(const int argc,
+link_main(int argc,
           char *const argv[]){
+  int c;
+  int nopt;
   int status_code;
+  unsigned int flags;
+  const char *path_list;
 
   status_code = EXIT_SUCCESS;
-  if(argc != 3){
-    status_code = EXIT_FAILURE;
-    warnx("must have exactly two file operands");
+  flags = 0;
+  path_list = NULL;
+  nopt = argc > 0 ? 1 : 0;
+  if(argc > 1 && strcmp(argv[1], "-b") == 0){
+    while((c = getopt(argc, argv, "0bl:")) != -1){
+      switch(c){
+        case '0':
+          flags |= LINK_FLAG_LIST_NUL;
+          break;
+        case 'b':
+          flags |= LINK_FLAG_BATCH;
+          break;
+        case 'l':
+          path_list = optarg;
+          break;
+        default:
+          status_code = EXIT_FAILURE;
+          break;
+      }
+    }
+    nopt = optind;
   }
-  else{
-    if(link(argv[1], argv[2]) != 0){
+  argc -= nopt;
+  argv += nopt;
+
+  if(status_code == EXIT_SUCCESS){
+    if(flags & LINK_FLAG_BATCH){
+      if(argc != 0){
+        status_code = EXIT_FAILURE;
+        warnx("no file operands allowed with -b");
+      }
+      else{
+        status_code = link_batch(flags, path_list ? path_list : "-");
+      }
+    }
+    else if(argc != 2 || path_list){
+      status_code = EXIT_FAILURE;
+      warnx("must have exactly two file operands");
+    }
+    else if(link(argv[0], argv[1]) != 0){
       status_code = EXIT_FAILURE;
-      warn("failed to create link: \'%s\' - \'%s\'", argv[1], argv[2]);
+      warn("failed to create link: \'%s\' - \'%s\'", argv[0], argv[1]);
     }
   }
   return status_code;
 }
 
-#ifndef TEST
+#if !defined(TEST) && !defined(LINK_BENCH) && !defined(LINK_MULTICALL)
 /**
  * Main program entry point.
  *
@@ -67,5 +313,5 @@ main(int argc,
      char *argv[]){
   return link_main(argc, argv);
 }
-#endif /* TEST */
+#endif /* !(TEST) && !(LINK_BENCH) && !(LINK_MULTICALL) */
 
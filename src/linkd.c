@@ -0,0 +1,1424 @@
+/**
+ * @file
+ * @brief link daemon and client
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ *
+ * The daemon keeps one pool of worker threads warm and serves ln, link, and
+ * unlink requests from any number of clients over an AF_UNIX socket, so
+ * that tools creating links constantly do not pay process start-up for
+ * every link.
+ *
+ * Each client first sends its current working directory as an open file
+ * descriptor, which the daemon caches for the lifetime of the connection
+ * and resolves all relative paths against. The client then streams
+ * requests without waiting for each reply, and the daemon streams back the
+ * status of each request as soon as it completes, possibly out of order.
+ *
+ * Build:
+ *
+ * cc -std=c99 -D_POSIX_C_SOURCE=200809L -DLINK_LIBRARY -o linkd
+ *   src/ln.c src/reflink.c src/uring.c src/linkd.c -lpthread
+ *
+ * Every request runs with the privileges of the daemon, so the daemon
+ * creates its socket with mode 0600 and closes any connection from a peer
+ * running as a different user.
+ */
+
+#ifdef __linux__
+/**
+ * Required for struct ucred.
+ */
+# ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+# endif /* _GNU_SOURCE */
+#endif /* __linux__ */
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "liblink.h"
+
+#ifdef TEST
+/**
+ * Declare some functions with extern linkage, allowing the test suite to call
+ * those functions.
+ */
+# define LINKAGE extern
+# include "../test/seams.h"
+#else /* !(TEST) */
+/**
+ * Define all functions as static when not testing.
+ */
+# define LINKAGE static
+#endif /* TEST */
+
+/**
+ * Maximum length of a path in a request, excluding the null terminator.
+ */
+#define LINKD_PATH_MAX 4096
+
+/**
+ * Number of requests allowed in the daemon queue per worker thread before
+ * the connections stop reading new requests.
+ */
+#define LINKD_QUEUE_PER_THREAD 64
+
+/**
+ * Maximum number of requests a client has in flight at the same time.
+ *
+ * Keeps the replies the daemon has not delivered yet small enough to fit
+ * in the socket buffer, so the daemon never blocks writing a reply while
+ * the client blocks writing a request.
+ */
+#define LINKD_WINDOW 256
+
+/**
+ * Maximum number of worker threads allowed by (-j) argument.
+ */
+#define LINKD_THREAD_MAX 1024
+
+/**
+ * @defgroup linkd_op linkd request operations
+ *
+ * Operation performed by a request.
+ */
+
+/**
+ * Create a link with the same logic as ln, using the request
+ * @ref ln_flag.
+ *
+ * @ingroup linkd_op
+ */
+#define LINKD_OP_LN     1
+
+/**
+ * Remove the source path with unlink.
+ *
+ * @ingroup linkd_op
+ */
+#define LINKD_OP_UNLINK 2
+
+/**
+ * Flags a request may set for @ref LINKD_OP_LN.
+ */
+#define LINKD_LN_FLAGS (LN_FLAG_REMOVE_DEST |     \
+                        LN_FLAG_FOLLOW_SYMBOLIC | \
+                        LN_FLAG_SYMBOLIC)
+
+/**
+ * Number of library contexts, one for each combination of
+ * @ref LINKD_LN_FLAGS.
+ */
+#define LINKD_NCTX (LINKD_LN_FLAGS + 1)
+
+/**
+ * Fixed size header of a request, followed by the source path and then the
+ * destination path without null terminators.
+ */
+struct linkd_req{
+  /**
+   * Chosen by the client and returned in the reply.
+   */
+  uint32_t id;
+
+  /**
+   * See @ref linkd_op.
+   */
+  uint32_t op;
+
+  /**
+   * See @ref ln_flag. Only @ref LINKD_LN_FLAGS allowed.
+   */
+  uint32_t flags;
+
+  /**
+   * Length of the source path.
+   */
+  uint32_t len_source;
+
+  /**
+   * Length of the destination path, or 0 for @ref LINKD_OP_UNLINK.
+   */
+  uint32_t len_dest;
+};
+
+/**
+ * Reply to a request.
+ */
+struct linkd_rsp{
+  /**
+   * See @ref linkd_req::id.
+   */
+  uint32_t id;
+
+  /**
+   * 0 if the request succeeded, or an errno value describing the failure.
+   */
+  int32_t error;
+};
+
+struct linkd_server;
+
+/**
+ * Client connection.
+ *
+ * Freed by the thread reading its requests once the client has closed the
+ * connection and every queued request has been answered.
+ */
+struct linkd_conn{
+  /**
+   * See @ref linkd_server.
+   */
+  struct linkd_server *server;
+
+  /**
+   * Connected socket.
+   */
+  int fd;
+
+  /**
+   * Current working directory of the client.
+   */
+  int dirfd;
+
+  /**
+   * Serializes the replies written by the worker threads, and protects
+   * @ref npending.
+   */
+  pthread_mutex_t mutex;
+
+  /**
+   * Signaled when @ref npending reaches 0.
+   */
+  pthread_cond_t cond;
+
+  /**
+   * Number of requests queued but not answered yet.
+   */
+  size_t npending;
+};
+
+/**
+ * Request waiting in the daemon queue.
+ */
+struct linkd_job{
+  /**
+   * Next request in the queue.
+   */
+  struct linkd_job *next;
+
+  /**
+   * Connection that sent the request.
+   */
+  struct linkd_conn *conn;
+
+  /**
+   * See @ref linkd_req.
+   */
+  struct linkd_req req;
+
+  /**
+   * Null terminated source path, stored after this structure.
+   */
+  char *source;
+
+  /**
+   * Null terminated destination path, stored after @ref source.
+   */
+  char *dest;
+};
+
+/**
+ * Link daemon.
+ */
+struct linkd_server{
+  /**
+   * Listening socket.
+   */
+  int listen_fd;
+
+  /**
+   * Path of the listening socket, removed when the daemon stops.
+   */
+  const char *path;
+
+  /**
+   * Library context for each combination of @ref LINKD_LN_FLAGS.
+   */
+  struct ln_ctx *ctx_list[LINKD_NCTX];
+
+  /**
+   * Protects the queue and @ref nconn.
+   */
+  pthread_mutex_t mutex;
+
+  /**
+   * Signaled when a request gets pushed onto the queue, or the queue
+   * closes.
+   */
+  pthread_cond_t cond_push;
+
+  /**
+   * Signaled when a request gets popped off the queue, or a connection
+   * closes.
+   */
+  pthread_cond_t cond_pop;
+
+  /**
+   * Oldest request in the queue.
+   */
+  struct linkd_job *head;
+
+  /**
+   * Newest request in the queue.
+   */
+  struct linkd_job *tail;
+
+  /**
+   * Number of requests in the queue.
+   */
+  size_t nqueue;
+
+  /**
+   * Number of requests allowed in the queue.
+   */
+  size_t queue_max;
+
+  /**
+   * Set when the worker threads should exit.
+   */
+  bool closed;
+
+  /**
+   * Number of open connections.
+   */
+  size_t nconn;
+
+  /**
+   * Worker threads.
+   */
+  pthread_t *thread_list;
+
+  /**
+   * Number of started threads in @ref thread_list.
+   */
+  size_t nthread;
+};
+
+/**
+ * Listening socket of the running daemon, shut down by the signal handler.
+ */
+static volatile sig_atomic_t g_linkd_listen_fd = -1;
+
+/**
+ * Set by the signal handler when asked to terminate, in case the signal
+ * arrives before @ref g_linkd_listen_fd gets set.
+ */
+static volatile sig_atomic_t g_linkd_stop = 0;
+
+/**
+ * Read exactly the requested number of bytes.
+ *
+ * @param[in]  fd    Socket to read from.
+ * @param[out] buf   Store the bytes here.
+ * @param[in]  len   Number of bytes to read.
+ * @retval     1     Read all bytes.
+ * @retval     0     End of file before the first byte.
+ * @retval     -1    Read error, or end of file after the first byte.
+ */
+static int
+linkd_read_all(const int fd,
+               void *const buf,
+               const size_t len){
+  size_t off;
+  ssize_t rc;
+  int status;
+
+  status = 1;
+  off = 0;
+  while(off < len && status == 1){
+    rc = read(fd, (char *)buf + off, len - off);
+    if(rc > 0){
+      off += (size_t)rc;
+    }
+    else if(rc == 0){
+      status = off == 0 ? 0 : -1;
+    }
+    else if(errno != EINTR){
+      status = -1;
+    }
+  }
+  return status;
+}
+
+/**
+ * Write all bytes, without raising SIGPIPE if the peer has gone away.
+ *
+ * @param[in] fd    Socket to write to.
+ * @param[in] buf   Bytes to write.
+ * @param[in] len   Number of bytes to write.
+ * @retval    true  Wrote all bytes.
+ * @retval    false Write error, errno set.
+ */
+static bool
+linkd_write_all(const int fd,
+                const void *const buf,
+                const size_t len){
+  size_t off;
+  ssize_t rc;
+  bool ok;
+
+  ok = true;
+  off = 0;
+  while(off < len && ok){
+    rc = send(fd, (const char *)buf + off, len - off, MSG_NOSIGNAL);
+    if(rc >= 0){
+      off += (size_t)rc;
+    }
+    else if(errno != EINTR){
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+/**
+ * Fill in the address of the daemon socket.
+ *
+ * @param[out] sun   Socket address.
+ * @param[in]  path  Path of the socket.
+ * @retval     true  Stored the address.
+ * @retval     false @p path too long, errno set.
+ */
+static bool
+linkd_addr(struct sockaddr_un *const sun,
+           const char *const path){
+  bool ok;
+
+  memset(sun, 0, sizeof(*sun));
+  sun->sun_family = AF_UNIX;
+  ok = strlen(path) < sizeof(sun->sun_path);
+  if(ok){
+    strcpy(sun->sun_path, path);
+  }
+  else{
+    errno = ENAMETOOLONG;
+  }
+  return ok;
+}
+
+/**
+ * Run one request and send its reply.
+ *
+ * @param[in,out] server See @ref linkd_server.
+ * @param[in]     job    See @ref linkd_job.
+ */
+static void
+linkd_job_run(struct linkd_server *const server,
+              struct linkd_job *const job){
+  struct linkd_conn *conn;
+  struct ln_lib_op op;
+  struct linkd_rsp rsp;
+
+  conn = job->conn;
+  rsp.id = job->req.id;
+  if(job->req.op == LINKD_OP_LN){
+    op.source = job->source;
+    op.dest = job->dest;
+    op.error = 0;
+    ln_lib_submit_at(server->ctx_list[job->req.flags], conn->dirfd, &op, 1);
+    rsp.error = op.error;
+  }
+  else if(unlinkat(conn->dirfd, job->source, 0) != 0){
+    rsp.error = errno;
+  }
+  else{
+    rsp.error = 0;
+  }
+  pthread_mutex_lock(&conn->mutex);
+  /* A client that has gone away loses its replies. */
+  linkd_write_all(conn->fd, &rsp, sizeof(rsp));
+  conn->npending -= 1;
+  if(conn->npending == 0){
+    pthread_cond_signal(&conn->cond);
+  }
+  pthread_mutex_unlock(&conn->mutex);
+  free(job);
+}
+
+/**
+ * Worker thread entry point which runs each request popped off the queue
+ * until the queue closes.
+ *
+ * @param[in,out] arg  See @ref linkd_server.
+ * @retval        NULL Always returns NULL.
+ */
+static void *
+linkd_worker(void *arg){
+  struct linkd_server *server;
+  struct linkd_job *job;
+
+  server = arg;
+  pthread_mutex_lock(&server->mutex);
+  while(server->head || !server->closed){
+    if(server->head == NULL){
+      pthread_cond_wait(&server->cond_push, &server->mutex);
+    }
+    else{
+      job = server->head;
+      server->head = job->next;
+      if(server->head == NULL){
+        server->tail = NULL;
+      }
+      server->nqueue -= 1;
+      pthread_cond_signal(&server->cond_pop);
+      pthread_mutex_unlock(&server->mutex);
+      linkd_job_run(server, job);
+      pthread_mutex_lock(&server->mutex);
+    }
+  }
+  pthread_mutex_unlock(&server->mutex);
+  return NULL;
+}
+
+/**
+ * Receive the current working directory sent by a new client.
+ *
+ * @param[in] fd Connected socket.
+ * @return       Directory file descriptor, or -1 if the client did not send
+ *               one.
+ */
+static int
+linkd_recv_dirfd(const int fd){
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union{
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  char byte;
+  int dirfd;
+
+  dirfd = -1;
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  if(recvmsg(fd, &msg, 0) == 1){
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if(cmsg &&
+       cmsg->cmsg_level == SOL_SOCKET &&
+       cmsg->cmsg_type == SCM_RIGHTS &&
+       cmsg->cmsg_len == CMSG_LEN(sizeof(int))){
+      memcpy(&dirfd, CMSG_DATA(cmsg), sizeof(dirfd));
+    }
+  }
+  return dirfd;
+}
+
+/**
+ * Check that the peer of a new connection runs as the same user as the
+ * daemon.
+ *
+ * @param[in] fd    Connected socket.
+ * @retval    true  Peer runs as the same user.
+ * @retval    false Peer runs as a different user, or failed to get its
+ *                  credentials, error printed.
+ */
+static bool
+linkd_peer_ok(const int fd){
+#ifdef __linux__
+  struct ucred cred;
+  socklen_t len;
+#else /* !(__linux__) */
+  gid_t gid;
+#endif /* __linux__ */
+  uid_t uid;
+  bool ok;
+
+#ifdef __linux__
+  len = sizeof(cred);
+  ok = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0;
+  uid = cred.uid;
+#else /* !(__linux__) */
+  ok = getpeereid(fd, &uid, &gid) == 0;
+#endif /* __linux__ */
+  if(!ok){
+    warn("peer credentials");
+  }
+  else if(uid != geteuid()){
+    warnx("rejected connection from uid %lu", (unsigned long)uid);
+    ok = false;
+  }
+  return ok;
+}
+
+/**
+ * Read the next request from a connection.
+ *
+ * @param[in] conn  See @ref linkd_conn.
+ * @retval    struct linkd_job* New request, free with free.
+ * @retval    NULL  Client closed the connection, or sent an invalid
+ *                  request.
+ */
+static struct linkd_job *
+linkd_conn_read(struct linkd_conn *const conn){
+  struct linkd_req req;
+  struct linkd_job *job;
+  bool ok;
+
+  job = NULL;
+  ok = linkd_read_all(conn->fd, &req, sizeof(req)) == 1;
+  if(ok){
+    if(req.op == LINKD_OP_LN){
+      ok = (req.flags & ~LINKD_LN_FLAGS) == 0 && req.len_dest > 0;
+    }
+    else{
+      ok = req.op == LINKD_OP_UNLINK && req.flags == 0 && req.len_dest == 0;
+    }
+    ok = ok &&
+         req.len_source > 0 &&
+         req.len_source <= LINKD_PATH_MAX &&
+         req.len_dest <= LINKD_PATH_MAX;
+  }
+  if(ok){
+    job = malloc(sizeof(*job) + req.len_source + req.len_dest + 2);
+  }
+  if(job){
+    job->next = NULL;
+    job->conn = conn;
+    job->req = req;
+    job->source = (char *)(job + 1);
+    job->dest = job->source + req.len_source + 1;
+    if(linkd_read_all(conn->fd, job->source, req.len_source) != 1 ||
+       linkd_read_all(conn->fd, job->dest, req.len_dest) != 1){
+      free(job);
+      job = NULL;
+    }
+    else{
+      job->source[req.len_source] = '\0';
+      job->dest[req.len_dest] = '\0';
+    }
+  }
+  return job;
+}
+
+/**
+ * Connection thread entry point which queues each request sent by the
+ * client until the client closes the connection.
+ *
+ * @param[in,out] arg  See @ref linkd_conn.
+ * @retval        NULL Always returns NULL.
+ */
+static void *
+linkd_conn_run(void *arg){
+  struct linkd_conn *conn;
+  struct linkd_server *server;
+  struct linkd_job *job;
+
+  conn = arg;
+  server = conn->server;
+  conn->dirfd = linkd_recv_dirfd(conn->fd);
+  if(conn->dirfd >= 0){
+    while((job = linkd_conn_read(conn)) != NULL){
+      pthread_mutex_lock(&conn->mutex);
+      conn->npending += 1;
+      pthread_mutex_unlock(&conn->mutex);
+      pthread_mutex_lock(&server->mutex);
+      while(server->nqueue >= server->queue_max){
+        pthread_cond_wait(&server->cond_pop, &server->mutex);
+      }
+      if(server->tail){
+        server->tail->next = job;
+      }
+      else{
+        server->head = job;
+      }
+      server->tail = job;
+      server->nqueue += 1;
+      pthread_cond_signal(&server->cond_push);
+      pthread_mutex_unlock(&server->mutex);
+    }
+    pthread_mutex_lock(&conn->mutex);
+    while(conn->npending > 0){
+      pthread_cond_wait(&conn->cond, &conn->mutex);
+    }
+    pthread_mutex_unlock(&conn->mutex);
+    close(conn->dirfd);
+  }
+  close(conn->fd);
+  pthread_cond_destroy(&conn->cond);
+  pthread_mutex_destroy(&conn->mutex);
+  free(conn);
+
+  pthread_mutex_lock(&server->mutex);
+  server->nconn -= 1;
+  pthread_cond_broadcast(&server->cond_pop);
+  pthread_mutex_unlock(&server->mutex);
+  return NULL;
+}
+
+/**
+ * Release the resources of a daemon after its connections have closed.
+ *
+ * @param[in,out] server See @ref linkd_server.
+ */
+static void
+linkd_server_close(struct linkd_server *const server){
+  size_t i;
+
+  pthread_mutex_lock(&server->mutex);
+  while(server->nconn > 0){
+    pthread_cond_wait(&server->cond_pop, &server->mutex);
+  }
+  server->closed = true;
+  pthread_cond_broadcast(&server->cond_push);
+  pthread_mutex_unlock(&server->mutex);
+  for(i = 0; i < server->nthread; i++){
+    pthread_join(server->thread_list[i], NULL);
+  }
+  free(server->thread_list);
+  for(i = 0; i < LINKD_NCTX; i++){
+    ln_lib_free(server->ctx_list[i]);
+  }
+  if(server->listen_fd >= 0){
+    close(server->listen_fd);
+    unlink(server->path);
+  }
+  pthread_cond_destroy(&server->cond_pop);
+  pthread_cond_destroy(&server->cond_push);
+  pthread_mutex_destroy(&server->mutex);
+}
+
+/**
+ * Start the worker threads and listen on the daemon socket.
+ *
+ * @param[out] server  See @ref linkd_server.
+ * @param[in]  path    Path of the socket to create.
+ * @param[in]  nthread Number of worker threads.
+ * @retval     true    Daemon ready to accept connections.
+ * @retval     false   Failed to start the daemon, error printed. Call
+ *                     @ref linkd_server_close anyway.
+ */
+static bool
+linkd_server_open(struct linkd_server *const server,
+                  const char *const path,
+                  const size_t nthread){
+  struct sockaddr_un sun;
+  size_t i;
+  mode_t mask;
+  int rc;
+  bool ok;
+
+  memset(server, 0, sizeof(*server));
+  pthread_mutex_init(&server->mutex, NULL);
+  pthread_cond_init(&server->cond_push, NULL);
+  pthread_cond_init(&server->cond_pop, NULL);
+  server->path = path;
+  server->queue_max = nthread * LINKD_QUEUE_PER_THREAD;
+  server->listen_fd = -1;
+  ok = true;
+  for(i = 0; i < LINKD_NCTX && ok; i++){
+    server->ctx_list[i] = ln_lib_new((unsigned int)i, 1);
+    if(server->ctx_list[i] == NULL){
+      warn("ln_lib_new");
+      ok = false;
+    }
+  }
+  if(ok){
+    server->thread_list = malloc(nthread * sizeof(*server->thread_list));
+    if(server->thread_list == NULL){
+      warn("alloc");
+      ok = false;
+    }
+  }
+  for(i = 0; i < nthread && ok; i++){
+    rc = pthread_create(&server->thread_list[i], NULL, linkd_worker, server);
+    if(rc != 0){
+      errno = rc;
+      warn("pthread_create");
+      ok = false;
+    }
+    else{
+      server->nthread += 1;
+    }
+  }
+  if(ok && !linkd_addr(&sun, path)){
+    warn("socket path: %s", path);
+    ok = false;
+  }
+  if(ok){
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(server->listen_fd < 0){
+      warn("socket");
+      ok = false;
+    }
+    else{
+      /* Only the owner may connect to the new socket. */
+      mask = umask(0177);
+      rc = bind(server->listen_fd, (struct sockaddr *)&sun, sizeof(sun));
+      umask(mask);
+      if(rc != 0){
+        warn("bind(%s)", path);
+        close(server->listen_fd);
+        server->listen_fd = -1;
+        ok = false;
+      }
+    }
+    if(ok && listen(server->listen_fd, SOMAXCONN) != 0){
+      warn("listen(%s)", path);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+/**
+ * Accept connections until the listening socket gets shut down.
+ *
+ * @param[in,out] server See @ref linkd_server.
+ */
+static void
+linkd_server_run(struct linkd_server *const server){
+  struct linkd_conn *conn;
+  pthread_t thread;
+  pthread_attr_t attr;
+  int fd;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  for(;;){
+    fd = accept(server->listen_fd, NULL, NULL);
+    if(fd < 0){
+      if(errno == EINTR || errno == ECONNABORTED){
+        continue;
+      }
+      break;
+    }
+    if(!linkd_peer_ok(fd)){
+      close(fd);
+      continue;
+    }
+    conn = malloc(sizeof(*conn));
+    if(conn == NULL){
+      warn("alloc");
+      close(fd);
+      continue;
+    }
+    memset(conn, 0, sizeof(*conn));
+    conn->server = server;
+    conn->fd = fd;
+    pthread_mutex_init(&conn->mutex, NULL);
+    pthread_cond_init(&conn->cond, NULL);
+    pthread_mutex_lock(&server->mutex);
+    server->nconn += 1;
+    pthread_mutex_unlock(&server->mutex);
+    if(pthread_create(&thread, &attr, linkd_conn_run, conn) != 0){
+      warn("pthread_create");
+      pthread_mutex_lock(&server->mutex);
+      server->nconn -= 1;
+      pthread_mutex_unlock(&server->mutex);
+      pthread_cond_destroy(&conn->cond);
+      pthread_mutex_destroy(&conn->mutex);
+      free(conn);
+      close(fd);
+    }
+  }
+  pthread_attr_destroy(&attr);
+}
+
+/**
+ * Stop accepting connections when asked to terminate.
+ *
+ * @param[in] signum Signal number.
+ */
+static void
+linkd_signal(int signum){
+  int fd;
+
+  (void)signum;
+  g_linkd_stop = 1;
+  fd = g_linkd_listen_fd;
+  if(fd >= 0){
+    shutdown(fd, SHUT_RDWR);
+  }
+}
+
+/**
+ * Run the daemon until SIGINT or SIGTERM.
+ *
+ * @param[in] path    Path of the socket to create.
+ * @param[in] nthread Number of worker threads.
+ * @return            Exit status.
+ */
+LINKAGE int
+linkd_server(const char *const path,
+             const size_t nthread){
+  struct linkd_server server;
+  struct sigaction sa;
+  int status_code;
+
+  status_code = EXIT_FAILURE;
+  g_linkd_stop = 0;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = linkd_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  if(linkd_server_open(&server, path, nthread)){
+    g_linkd_listen_fd = server.listen_fd;
+    if(g_linkd_stop){
+      shutdown(server.listen_fd, SHUT_RDWR);
+    }
+    linkd_server_run(&server);
+    g_linkd_listen_fd = -1;
+    status_code = EXIT_SUCCESS;
+  }
+  linkd_server_close(&server);
+  return status_code;
+}
+
+/**
+ * Request built by the client, kept until its reply arrives.
+ */
+struct linkd_client_op{
+  /**
+   * See @ref linkd_req.
+   */
+  struct linkd_req req;
+
+  /**
+   * Source path, or the file to remove.
+   */
+  const char *source;
+
+  /**
+   * Destination path, or NULL for @ref LINKD_OP_UNLINK.
+   */
+  char *dest;
+};
+
+/**
+ * Client context.
+ */
+struct linkd_client{
+  /**
+   * Connected socket.
+   */
+  int fd;
+
+  /**
+   * Name of the utility the client runs as.
+   */
+  const char *util;
+
+  /**
+   * Requests in the order given on the command line.
+   */
+  struct linkd_client_op *op_list;
+
+  /**
+   * Number of requests in @ref op_list.
+   */
+  size_t nop;
+
+  /**
+   * Exit status.
+   */
+  int status_code;
+};
+
+/**
+ * Connect to the daemon and send the current working directory.
+ *
+ * @param[in] path Path of the daemon socket.
+ * @return         Connected socket, or -1 with errno set.
+ */
+static int
+linkd_client_connect(const char *const path){
+  struct sockaddr_un sun;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union{
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  char byte;
+  int fd;
+  int dirfd;
+  int errno_save;
+
+  fd = -1;
+  dirfd = open(".", O_RDONLY | O_DIRECTORY);
+  if(dirfd >= 0 && linkd_addr(&sun, path)){
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  }
+  if(fd >= 0){
+    byte = 0;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &dirfd, sizeof(dirfd));
+    if(connect(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0 ||
+       sendmsg(fd, &msg, MSG_NOSIGNAL) != 1){
+      errno_save = errno;
+      close(fd);
+      fd = -1;
+      errno = errno_save;
+    }
+  }
+  if(dirfd >= 0){
+    errno_save = errno;
+    close(dirfd);
+    errno = errno_save;
+  }
+  return fd;
+}
+
+/**
+ * Add a request to the client list.
+ *
+ * @param[in,out] client See @ref linkd_client.
+ * @param[in]     op     See @ref linkd_op.
+ * @param[in]     flags  See @ref ln_flag.
+ * @param[in]     source Source path, or the file to remove.
+ * @param[in]     dir    Directory to create the link in, or NULL to use
+ *                       @p dest as the destination path.
+ * @param[in]     dest   Destination path, or NULL for
+ *                       @ref LINKD_OP_UNLINK.
+ */
+static void
+linkd_client_add(struct linkd_client *const client,
+                 const uint32_t op,
+                 const uint32_t flags,
+                 const char *const source,
+                 const char *const dir,
+                 const char *const dest){
+  struct linkd_client_op *cop;
+  const char *bname;
+  const char *end;
+  size_t dir_len;
+  size_t bname_len;
+
+  cop = &client->op_list[client->nop];
+  cop->source = source;
+  cop->dest = NULL;
+  if(dir){
+    /* [dir]/basename(source), the same as ln target_dir. */
+    end = source + strlen(source);
+    while(end - source > 1 && end[-1] == '/'){
+      end -= 1;
+    }
+    bname = end;
+    while(bname > source && bname[-1] != '/'){
+      bname -= 1;
+    }
+    if(bname == end){
+      bname = end > source ? end - 1 : ".";
+      end = bname + 1;
+    }
+    dir_len = strlen(dir);
+    bname_len = (size_t)(end - bname);
+    cop->dest = malloc(dir_len + bname_len + 2);
+    if(cop->dest == NULL){
+      err(EXIT_FAILURE, "alloc");
+    }
+    memcpy(cop->dest, dir, dir_len);
+    if(dir_len == 0 || dir[dir_len - 1] != '/'){
+      cop->dest[dir_len++] = '/';
+    }
+    memcpy(&cop->dest[dir_len], bname, bname_len);
+    cop->dest[dir_len + bname_len] = '\0';
+  }
+  else if(dest){
+    cop->dest = malloc(strlen(dest) + 1);
+    if(cop->dest == NULL){
+      err(EXIT_FAILURE, "alloc");
+    }
+    strcpy(cop->dest, dest);
+  }
+  cop->req.id = (uint32_t)client->nop;
+  cop->req.op = op;
+  cop->req.flags = flags;
+  cop->req.len_source = (uint32_t)strlen(cop->source);
+  cop->req.len_dest = cop->dest ? (uint32_t)strlen(cop->dest) : 0;
+  if(cop->req.len_source == 0 ||
+     cop->req.len_source > LINKD_PATH_MAX ||
+     cop->req.len_dest > LINKD_PATH_MAX ||
+     (op == LINKD_OP_LN && cop->req.len_dest == 0)){
+    warnx("invalid path: \'%s\'", source);
+    client->status_code = EXIT_FAILURE;
+    free(cop->dest);
+  }
+  else{
+    client->nop += 1;
+  }
+}
+
+/**
+ * Read one reply and report the request if it failed.
+ *
+ * @param[in,out] client See @ref linkd_client.
+ * @retval        true   Got a reply.
+ * @retval        false  Connection to the daemon lost.
+ */
+static bool
+linkd_client_reply(struct linkd_client *const client){
+  struct linkd_rsp rsp;
+  struct linkd_client_op *cop;
+  bool ok;
+
+  ok = linkd_read_all(client->fd, &rsp, sizeof(rsp)) == 1 &&
+       rsp.id < client->nop;
+  if(ok && rsp.error != 0){
+    client->status_code = EXIT_FAILURE;
+    cop = &client->op_list[rsp.id];
+    errno = rsp.error;
+    if(cop->req.op == LINKD_OP_UNLINK){
+      warn("failed to unlink: \'%s\'", cop->source);
+    }
+    else{
+      warn("failed to create link: \'%s\' - \'%s\'", cop->source, cop->dest);
+    }
+  }
+  return ok;
+}
+
+/**
+ * Send every request, keeping at most @ref LINKD_WINDOW in flight, and wait
+ * for all replies.
+ *
+ * @param[in,out] client See @ref linkd_client.
+ */
+static void
+linkd_client_send(struct linkd_client *const client){
+  struct linkd_client_op *cop;
+  size_t nsent;
+  size_t nreply;
+  bool ok;
+
+  ok = true;
+  nreply = 0;
+  for(nsent = 0; nsent < client->nop && ok; nsent++){
+    if(nsent - nreply == LINKD_WINDOW){
+      ok = linkd_client_reply(client);
+      nreply += 1;
+    }
+    cop = &client->op_list[nsent];
+    ok = ok &&
+         linkd_write_all(client->fd, &cop->req, sizeof(cop->req)) &&
+         linkd_write_all(client->fd, cop->source, cop->req.len_source) &&
+         linkd_write_all(client->fd, cop->dest, cop->req.len_dest);
+  }
+  while(nreply < client->nop && ok){
+    ok = linkd_client_reply(client);
+    nreply += 1;
+  }
+  if(!ok){
+    warnx("connection to daemon lost");
+    client->status_code = EXIT_FAILURE;
+  }
+}
+
+/**
+ * Build the requests for the ln utility.
+ *
+ * Supports the options of ln that apply to each link:
+ *
+ * ln [-fs] [-L|-P] source_file target_file
+ *
+ * ln [-fs] [-L|-P] source_file... target_dir
+ *
+ * @param[in,out] client See @ref linkd_client.
+ * @param[in]     argc   Number of arguments in @p argv.
+ * @param[in]     argv   Argument list, starting with the utility name.
+ */
+static void
+linkd_client_ln(struct linkd_client *const client,
+                int argc,
+                char *argv[]){
+  struct stat sb;
+  uint32_t flags;
+  int c;
+  int i;
+
+  flags = 0;
+  optind = 1;
+  while((c = getopt(argc, argv, "fLPs")) != -1){
+    switch(c){
+      case 'f':
+        flags |= LN_FLAG_REMOVE_DEST;
+        break;
+      case 'L':
+        flags |= LN_FLAG_FOLLOW_SYMBOLIC;
+        break;
+      case 'P':
+        flags &= ~(LN_FLAG_FOLLOW_SYMBOLIC);
+        break;
+      case 's':
+        flags |= LN_FLAG_SYMBOLIC;
+        break;
+      default:
+        client->status_code = EXIT_FAILURE;
+        break;
+    }
+  }
+  argc -= optind;
+  argv += optind;
+  if(client->status_code == EXIT_SUCCESS && argc < 2){
+    warnx("must have >=2 file arguments");
+    client->status_code = EXIT_FAILURE;
+  }
+  if(client->status_code != EXIT_SUCCESS){
+    /* Nothing to send. */
+  }
+  else if(stat(argv[argc - 1], &sb) == 0 && S_ISDIR(sb.st_mode)){
+    for(i = 0; i < argc - 1; i++){
+      linkd_client_add(client,
+                       LINKD_OP_LN,
+                       flags,
+                       argv[i],
+                       argv[argc - 1],
+                       NULL);
+    }
+  }
+  else if(argc != 2){
+    warnx("final operand must be directory if > 2 operands");
+    client->status_code = EXIT_FAILURE;
+  }
+  else{
+    linkd_client_add(client, LINKD_OP_LN, flags, argv[0], NULL, argv[1]);
+  }
+}
+
+/**
+ * Build the requests for the link or unlink utility.
+ *
+ * link file1 file2
+ *
+ * unlink [-b] file...
+ *
+ * @param[in,out] client See @ref linkd_client.
+ * @param[in]     argc   Number of arguments in @p argv.
+ * @param[in]     argv   Argument list, starting with the utility name.
+ */
+static void
+linkd_client_link(struct linkd_client *const client,
+                  int argc,
+                  char *argv[]){
+  bool is_unlink;
+  bool batch;
+  int nopt;
+  int c;
+  int i;
+
+  is_unlink = strcmp(client->util, "unlink") == 0;
+  batch = false;
+  nopt = 1;
+  /*
+   * Only parse options for unlink -b, so that link and unlink keep taking
+   * operands which begin with '-'.
+   */
+  if(is_unlink && argc > 1 && strcmp(argv[1], "-b") == 0){
+    optind = 1;
+    while((c = getopt(argc, argv, "b")) != -1){
+      if(c == 'b'){
+        batch = true;
+      }
+      else{
+        client->status_code = EXIT_FAILURE;
+      }
+    }
+    nopt = optind;
+  }
+  argc -= nopt;
+  argv += nopt;
+  if(client->status_code != EXIT_SUCCESS){
+    /* Nothing to send. */
+  }
+  else if(!is_unlink && argc != 2){
+    warnx("must have exactly two file operands");
+    client->status_code = EXIT_FAILURE;
+  }
+  else if(is_unlink && (argc < 1 || (argc > 1 && !batch))){
+    warnx("must have exactly one file operand unless -b");
+    client->status_code = EXIT_FAILURE;
+  }
+  else if(!is_unlink){
+    /* Hard link without following a symbolic link, the same as link(). */
+    linkd_client_add(client, LINKD_OP_LN, 0, argv[0], NULL, argv[1]);
+  }
+  else{
+    for(i = 0; i < argc; i++){
+      linkd_client_add(client, LINKD_OP_UNLINK, 0, argv[i], NULL, NULL);
+    }
+  }
+}
+
+/**
+ * Run a utility through the daemon.
+ *
+ * @param[in] path Path of the daemon socket.
+ * @param[in] argc Number of arguments in @p argv.
+ * @param[in] argv Utility name followed by its arguments.
+ * @return         Exit status.
+ */
+static int
+linkd_client(const char *const path,
+             int argc,
+             char *argv[]){
+  struct linkd_client client;
+  size_t i;
+
+  memset(&client, 0, sizeof(client));
+  client.fd = -1;
+  client.util = argv[0];
+  client.op_list = malloc((size_t)argc * sizeof(*client.op_list));
+  if(client.op_list == NULL){
+    warn("alloc");
+    client.status_code = EXIT_FAILURE;
+  }
+  else if(strcmp(client.util, "ln") == 0){
+    linkd_client_ln(&client, argc, argv);
+  }
+  else if(strcmp(client.util, "link") == 0 ||
+          strcmp(client.util, "unlink") == 0){
+    linkd_client_link(&client, argc, argv);
+  }
+  else{
+    warnx("unknown utility: %s", client.util);
+    client.status_code = EXIT_FAILURE;
+  }
+  if(client.nop > 0){
+    client.fd = linkd_client_connect(path);
+    if(client.fd < 0){
+      warn("connect(%s)", path);
+      client.status_code = EXIT_FAILURE;
+    }
+    else{
+      linkd_client_send(&client);
+      close(client.fd);
+    }
+  }
+  for(i = 0; i < client.nop; i++){
+    free(client.op_list[i].dest);
+  }
+  free(client.op_list);
+  return client.status_code;
+}
+
+/**
+ * Main entry point for the link daemon.
+ *
+ * Usage:
+ *
+ * linkd [-j nthread] -s socket
+ *
+ * linkd -c socket ln|link|unlink [argument...]
+ *
+ * With (-s), serves requests on a new socket until SIGINT or SIGTERM, using
+ * (-j) worker threads, 4 by default. With (-c), runs the utility through
+ * the daemon listening on the socket.
+ *
+ * @param[in]     argc         Number of arguments in @p argv.
+ * @param[in,out] argv         Argument list.
+ * @retval        EXIT_SUCCESS Daemon stopped, or all requests succeeded.
+ * @retval        EXIT_FAILURE Failed to start the daemon, or at least one
+ *                             request failed.
+ */
+LINKAGE int
+linkd_main(int argc,
+           char *argv[]){
+  const char *path_server;
+  const char *path_client;
+  unsigned long nthread;
+  char *end;
+  int c;
+  int status_code;
+
+  path_server = NULL;
+  path_client = NULL;
+  nthread = 4;
+  status_code = EXIT_SUCCESS;
+  while(status_code == EXIT_SUCCESS &&
+        path_client == NULL &&
+        (c = getopt(argc, argv, "c:j:s:")) != -1){
+    switch(c){
+      case 'c':
+        path_client = optarg;
+        break;
+      case 'j':
+        errno = 0;
+        nthread = strtoul(optarg, &end, 10);
+        if(errno != 0 || end == optarg || *end != '\0' ||
+           nthread < 1 || nthread > LINKD_THREAD_MAX){
+          warnx("invalid number of threads: %s", optarg);
+          status_code = EXIT_FAILURE;
+        }
+        break;
+      case 's':
+        path_server = optarg;
+        break;
+      default:
+        status_code = EXIT_FAILURE;
+        break;
+    }
+  }
+  if(status_code != EXIT_SUCCESS){
+    /* Invalid argument. */
+  }
+  else if(path_client && path_server == NULL && optind < argc){
+    status_code = linkd_client(path_client, argc - optind, &argv[optind]);
+  }
+  else if(path_server && path_client == NULL && optind == argc){
+    status_code = linkd_server(path_server, nthread);
+  }
+  else{
+    warnx("usage: linkd [-j nthread] -s socket |"
+          " -c socket ln|link|unlink [argument...]");
+    status_code = EXIT_FAILURE;
+  }
+  return status_code;
+}
+
+#ifndef TEST
+/**
+ * Main program entry point.
+ *
+ * @param[in]     argc See @ref linkd_main.
+ * @param[in,out] argv See @ref linkd_main.
+ * @return             See @ref linkd_main.
+ */
+int
+main(int argc,
+     char *argv[]){
+  return linkd_main(argc, argv);
+}
+#endif /* TEST */
@@ -6,16 +6,37 @@
  * This software has been placed into the public domain using CC0.
  */
 
+#ifndef _XOPEN_SOURCE
+/**
+ * Required for realpath().
+ */
+# define _XOPEN_SOURCE 700
+#endif /* _XOPEN_SOURCE */
+#ifndef _DEFAULT_SOURCE
+/**
+ * Required for the d_type field of struct dirent.
+ */
+# define _DEFAULT_SOURCE
+#endif /* _DEFAULT_SOURCE */
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
-#include <libgen.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "liblink.h"
+#include "reflink.h"
+#include "uring.h"
+
 #ifdef TEST
 /**
  * Declare some functions with extern linkage, allowing the test suite to call
@@ -23,48 +44,115 @@
  */
 # define LINKAGE extern
 # include "../test/seams.h"
-#else /* !(TEST) */
+#elif defined(LINK_BENCH) || defined(LINK_MULTICALL) || defined(LINK_LIBRARY)
+/**
+ * Declare some functions with extern linkage, allowing the benchmark, the
+ * multi-call binary, and the library to call those functions.
+ */
+# define LINKAGE extern
+#else /* !(TEST) && !(LINK_BENCH) && !(LINK_MULTICALL) && !(LINK_LIBRARY) */
 /**
  * Define all functions as static when not testing.
  */
 # define LINKAGE static
-#endif /* TEST */
+#endif /* TEST, LINK_BENCH, LINK_MULTICALL, LINK_LIBRARY */
 
 /**
- * @defgroup ln_flag ln flags
- *
- * Option flags when running ln.
+ * Maximum number of worker threads allowed by (-j) argument.
+ */
+#define LN_THREAD_MAX 1024
+
+/**
+ * Number of queued source files allowed per worker thread before the thread
+ * reading the operands blocks.
+ */
+#define LN_POOL_QUEUE_PER_THREAD 64
+
+/**
+ * Number of bytes copied at a time by each thread when falling back to
+ * copying a file (-C).
  */
+#define LN_COPY_CHUNK ((off_t)8 * 1024 * 1024)
 
 /**
- * Remove the destination path if it already exists.
+ * Number of io_uring submission queue entries used by (-u) argument.
+ */
+#define LN_URING_ENTRIES 4096
+
+/**
+ * Maximum number of link requests in flight through io_uring (-u).
  *
- * Corresponds to argument (-f).
+ * Each link request has at most two io_uring requests in flight at the same
+ * time.
+ */
+#define LN_URING_NOP (LN_URING_ENTRIES / 2)
+
+/**
+ * @defgroup ln_uring_req ln io_uring request types
  *
- * @ingroup ln_flag
+ * Requests that make up a link request submitted through io_uring. The
+ * request type gets stored in the io_uring user data along with the index of
+ * the link request.
  */
-#define LN_FLAG_REMOVE_DEST ((unsigned int)(1 << 0))
 
 /**
- * Specifies whether ln creates a hard link to the symbolic link or to the
- * file pointed to by the symbolic link.
+ * Get the status of the source file.
  *
- * Corresponds to argument (-L) if set.
+ * @ingroup ln_uring_req
+ */
+#define LN_URING_REQ_STAT_SOURCE 0
+
+/**
+ * Get the status of the destination file.
  *
- * Corresponds to argument (-P) if unset.
+ * @ingroup ln_uring_req
+ */
+#define LN_URING_REQ_STAT_DEST   1
+
+/**
+ * Create the link, or create it under a temporary name if replacing the
+ * destination (-f).
  *
- * @ingroup ln_flag
+ * @ingroup ln_uring_req
  */
-#define LN_FLAG_FOLLOW_SYMBOLIC ((unsigned int)(1 << 1))
+#define LN_URING_REQ_LINK        2
 
 /**
- * Create symbolic links (ln creates hard links by default).
+ * Rename the temporary link over the destination, chained to
+ * @ref LN_URING_REQ_LINK.
  *
- * Corresponds to argument (-s).
+ * @ingroup ln_uring_req
+ */
+#define LN_URING_REQ_RENAME      3
+
+/**
+ * Number of io_uring request types.
  *
- * @ingroup ln_flag
+ * @ingroup ln_uring_req
+ */
+#define LN_URING_REQ_COUNT       4
+
+/**
+ * Size of the buffer holding a temporary link name, including the null
+ * terminator.
+ */
+#define LN_TMP_NAME_SZ 48
+
+/**
+ * Number of temporary link names to try before giving up on replacing a
+ * destination file.
+ */
+#define LN_TMP_ATTEMPTS 16
+
+/**
+ * Flags used to open a directory file descriptor that only gets used as the
+ * base of the *at() functions.
  */
-#define LN_FLAG_SYMBOLIC ((unsigned int)(1 << 2))
+#ifdef O_PATH
+# define LN_O_DIRFD (O_DIRECTORY | O_PATH)
+#else /* !(O_PATH) */
+# define LN_O_DIRFD (O_DIRECTORY | O_RDONLY)
+#endif /* O_PATH */
 
 /**
  * ln utility context.
@@ -81,10 +169,88 @@ struct ln_ctx{
    * See @ref ln_flag.
    */
   unsigned int flags;
+
+  /**
+   * Read additional source_file operands from this file, or from STDIN if
+   * set to "-".
+   *
+   * Corresponds to argument (-l). Set to NULL if not used.
+   */
+  const char *path_list;
+
+  /**
+   * Reuse the file hashes stored in this index from a previous run, and
+   * store the hashes of this run in it.
+   *
+   * Corresponds to argument (-I). Set to NULL if not used.
+   */
+  const char *dedup_index;
+
+  /**
+   * Link the objects of a store into a tree as listed in this manifest
+   * file, or in STDIN if set to "-".
+   *
+   * Corresponds to argument (-M). Set to NULL if not used.
+   */
+  const char *checkout;
+
+  /**
+   * Number of worker threads used to create links inside a target
+   * directory.
+   *
+   * Corresponds to argument (-j).
+   */
+  size_t nthread;
+
+  /**
+   * Set if every source_file operand lives on a different device than the
+   * target directory, so the copy fallback (-C) gets used without trying
+   * a hard link first. See @ref ln_target_dir_preflight.
+   */
+  bool xdev;
+
+  /**
+   * Serializes updates to @ref status_code, @ref tmp_seq, and error messages
+   * between the worker threads.
+   */
+  pthread_mutex_t mutex;
+
+  /**
+   * Process ID included in temporary link names.
+   */
+  pid_t pid;
+
+  /**
+   * Sequence number of the next temporary link name.
+   */
+  unsigned long tmp_seq;
 };
 
 /**
- * Print an error message to STDERR and set an error status code.
+ * Location of a source file or a new link.
+ */
+struct ln_path{
+  /**
+   * Directory file descriptor that @ref name gets resolved relative to, or
+   * AT_FDCWD.
+   */
+  int dirfd;
+
+  /**
+   * Path of the file relative to @ref dirfd.
+   */
+  const char *name;
+
+  /**
+   * Full path of the file shown in error messages. For a source file, this
+   * also gets stored in new symbolic links (-s).
+   */
+  const char *path;
+};
+
+/**
+ * Set an error status code, and print an error message to STDERR if
+ * @ref LN_FLAG_WARN set.
  *
  * @param[in,out] ln_ctx    See @ref ln_ctx.
  * @param[in]     errno_msg Include a standard message describing errno.
@@ -96,15 +262,19 @@ ln_warn(struct ln_ctx *const ln_ctx,
         const char *const fmt, ...){
   va_list ap;
 
+  pthread_mutex_lock(&ln_ctx->mutex);
   ln_ctx->status_code = EXIT_FAILURE;
-  va_start(ap, fmt);
-  if(errno_msg){
-    vwarn(fmt, ap);
-  }
-  else{
-    vwarnx(fmt, ap);
+  if(ln_ctx->flags & LN_FLAG_WARN){
+    va_start(ap, fmt);
+    if(errno_msg){
+      vwarn(fmt, ap);
+    }
+    else{
+      vwarnx(fmt, ap);
+    }
+    va_end(ap);
   }
-  va_end(ap);
+  pthread_mutex_unlock(&ln_ctx->mutex);
 }
 
 /**
@@ -138,53 +308,183 @@ si_add_size_t(const size_t a,
   return !(wrap);
 }
 
+/**
+ * Reusable buffer holding paths that all start with the same directory
+ * prefix.
+ *
+ * The prefix only gets copied once, and each new path only overwrites the
+ * part after the prefix. The buffer only gets reallocated when a path does
+ * not fit, so building a path does not allocate memory in the steady state.
+ */
+struct ln_path_buf{
+  /**
+   * Directory prefix, followed by the most recently built name.
+   */
+  char *buf;
+
+  /**
+   * Size of @ref buf in bytes.
+   */
+  size_t sz;
+
+  /**
+   * Length of the directory prefix, including the separating slash.
+   */
+  size_t prefix_len;
+};
+
+/**
+ * Make sure a reusable buffer can hold at least a given number of bytes.
+ *
+ * The buffer at least doubles in size when it grows, so a buffer reused for
+ * paths of increasing length only gets reallocated a few times.
+ *
+ * @param[in,out] buf    Buffer grown with realloc if needed.
+ * @param[in,out] buf_sz Size of @p buf in bytes.
+ * @param[in]     sz     Required size in bytes.
+ * @retval        true   @p buf can hold @p sz bytes.
+ * @retval        false  Failed to allocate memory.
+ */
+static bool
+ln_buf_reserve(char **const buf,
+               size_t *const buf_sz,
+               const size_t sz){
+  char *new_buf;
+  size_t new_sz;
+  bool ok;
+
+  ok = true;
+  if(sz > *buf_sz){
+    new_sz = sz;
+    if(*buf_sz <= SIZE_MAX / 2 && *buf_sz * 2 > sz){
+      new_sz = *buf_sz * 2;
+    }
+    new_buf = realloc(*buf, new_sz);
+    if(new_buf == NULL){
+      ok = false;
+    }
+    else{
+      *buf = new_buf;
+      *buf_sz = new_sz;
+    }
+  }
+  return ok;
+}
+
+/**
+ * Store the directory prefix of a path buffer.
+ *
+ * A slash gets appended if @p dir does not already end with a slash. The
+ * buffer must be zeroed before first use, and can then get reused with a
+ * different prefix.
+ *
+ * @param[in,out] pb    See @ref ln_path_buf.
+ * @param[in]     dir   Directory prefix of each path.
+ * @retval        true  Stored the prefix.
+ * @retval        false Failed to allocate memory.
+ */
+static bool
+ln_path_buf_prefix(struct ln_path_buf *const pb,
+                   const char *const dir){
+  size_t dir_len;
+  size_t sz;
+  bool ok;
+
+  dir_len = strlen(dir);
+  ok = si_add_size_t(dir_len, 2, &sz) && ln_buf_reserve(&pb->buf, &pb->sz, sz);
+  if(!ok){
+    pb->prefix_len = 0;
+  }
+  else{
+    memcpy(pb->buf, dir, dir_len);
+    pb->prefix_len = dir_len;
+    if(dir_len == 0 || dir[dir_len - 1] != '/'){
+      pb->buf[pb->prefix_len++] = '/';
+    }
+    pb->buf[pb->prefix_len] = '\0';
+  }
+  return ok;
+}
+
+/**
+ * Release the memory held by a path buffer.
+ *
+ * @param[in,out] pb See @ref ln_path_buf.
+ */
+static void
+ln_path_buf_free(struct ln_path_buf *const pb){
+  free(pb->buf);
+  pb->buf = NULL;
+  pb->sz = 0;
+}
+
+/**
+ * Build [prefix]/name in a path buffer.
+ *
+ * @param[in,out] pb       See @ref ln_path_buf.
+ * @param[in]     name     Append this to the prefix. Does not need to be null
+ *                         terminated.
+ * @param[in]     name_len Number of bytes in @p name.
+ * @retval        char*    Full path stored in @p pb. The name starts at
+ *                         @ref ln_path_buf::prefix_len.
+ * @retval        NULL     Failed to allocate memory.
+ */
+static const char *
+ln_path_buf_name(struct ln_path_buf *const pb,
+                 const char *const name,
+                 const size_t name_len){
+  size_t sz;
+  const char *path;
+
+  path = NULL;
+  if(si_add_size_t(pb->prefix_len, name_len, &sz) &&
+     si_add_size_t(sz, 1, &sz) &&
+     ln_buf_reserve(&pb->buf, &pb->sz, sz)){
+    memcpy(&pb->buf[pb->prefix_len], name, name_len);
+    pb->buf[pb->prefix_len + name_len] = '\0';
+    path = pb->buf;
+  }
+  return path;
+}
+
 /**
  * Get the concatenation of the target_dir and source_file.
  *
  * [target_dir]/basename(source_file)
  *
- * @param[in] target_dir  First part of new path.
- * @param[in] source_file Append the basename of this to @p target_dir.
- * @retval    char*       New target path. Caller must free this memory after
- *                        use.
- * @retval    NULL        Failed to allocate memory for new path.
+ * The basename gets found by scanning @p source_file in place, which unlike
+ * basename() does not need a modifiable copy and is safe to call from
+ * multiple threads.
+ *
+ * @param[in,out] pb          Path buffer holding the target_dir prefix.
+ * @param[in]     source_file Append the basename of this to the prefix.
+ * @retval        char*       New target path stored in @p pb.
+ * @retval        NULL        Failed to allocate memory for new path.
  */
-static char *
-ln_path_target_concat(const char *const target_dir,
+static const char *
+ln_path_target_concat(struct ln_path_buf *const pb,
                       const char *const source_file){
-  char *source_file_copy;
-  char *bname_source_file;
-  size_t slen_target_dir;
-  size_t slen_bname_source_file;
-  size_t concat_len;
-  char *path_concat;
-  char *path_cpy;
-
-  path_concat = NULL;
-  source_file_copy = strdup(source_file);
-  if(source_file_copy){
-    bname_source_file = basename(source_file_copy);
-    slen_target_dir = strlen(target_dir);
-    slen_bname_source_file = strlen(bname_source_file);
-    /*
-     * concat_len = strlen(target_dir) + '/' + strlen(bname_source_file) + \0
-     * concat_len = slen_target_dir    +  1  + slen_bname_source_file    + 1
-     */
-    if(si_add_size_t(slen_target_dir, slen_bname_source_file, &concat_len) &&
-       si_add_size_t(concat_len, 2, &concat_len)){
-      path_concat = malloc(concat_len);
-      if(path_concat){
-        path_cpy = stpcpy(path_concat, target_dir);
-        /* Append a slash if target_dir does not already end with a slash. */
-        if(target_dir[slen_target_dir - 1] != '/'){
-          path_cpy = stpcpy(path_cpy, "/");
-        }
-        stpcpy(path_cpy, bname_source_file);
-      }
-    }
-    free(source_file_copy);
+  const char *end;
+  const char *bname;
+
+  end = source_file + strlen(source_file);
+  /* Ignore trailing slashes, but keep a lone slash. */
+  while(end - source_file > 1 && end[-1] == '/'){
+    end -= 1;
+  }
+  bname = end;
+  while(bname > source_file && bname[-1] != '/'){
+    bname -= 1;
   }
-  return path_concat;
+  if(bname == end && end > source_file){
+    /* Path only made up of slashes. */
+    bname = end - 1;
+  }
+  else if(bname == end){
+    bname = ".";
+    end = bname + 1;
+  }
+  return ln_path_buf_name(pb, bname, (size_t)(end - bname));
 }
 
 /**
@@ -213,159 +513,4104 @@ ln_same_file(const struct stat *const sb1,
 }
 
 /**
- * Try to remove the destination file if (-f) argument set.
+ * Generate a temporary name for a new link inside the destination directory.
+ *
+ * The name includes the process ID and a sequence number so that
+ * concurrent ln processes and threads do not pick the same name.
+ *
+ * @param[in,out] ln_ctx   See @ref ln_ctx.
+ * @param[out]    tmp_name Buffer of @ref LN_TMP_NAME_SZ bytes to store the
+ *                         name.
+ */
+static void
+ln_tmp_name(struct ln_ctx *const ln_ctx,
+            char *const tmp_name){
+  unsigned long seq;
+
+  pthread_mutex_lock(&ln_ctx->mutex);
+  seq = ln_ctx->tmp_seq++;
+  pthread_mutex_unlock(&ln_ctx->mutex);
+  snprintf(tmp_name,
+           LN_TMP_NAME_SZ,
+           ".ln-%ld-%lu",
+           (long)ln_ctx->pid,
+           seq);
+}
+
+/**
+ * Check if the destination path already exists.
+ *
+ * The destination must not be the file that the new link points to, which
+ * is the target of @p source if it is a symbolic link and (-L) argument
+ * set. Renaming a link over another link to the same file does nothing.
+ * A hard link to a symbolic link itself also gets compared with the
+ * destination link, which the first status of the destination follows.
  *
  * @param[in,out] ln_ctx    See @ref ln_ctx.
- * @param[in]     source_sb Source file info.
- * @param[in]     path_dest Destination file to remove.
- * @retval        true      Successfully removed destination file or file
- *                          does not exit.
- * @retval        false     Error occurred while removing destination file.
+ * @param[in]     source    File to point the new link to.
+ * @param[in]     source_sb Source file info, not following symbolic links.
+ * @param[in]     dest      Destination file to check.
+ * @param[out]    replace   Set to true if the destination exists and should
+ *                          get replaced because (-f) argument set.
+ * @retval        0         Destination does not exist, or it exists and
+ *                          should get replaced.
+ * @retval        EEXIST    Destination exists and cannot get replaced.
  */
-static bool
-ln_remove_dest(struct ln_ctx *const ln_ctx,
-               const struct stat *const source_sb,
-               const char *const path_dest){
+static int
+ln_check_dest(struct ln_ctx *const ln_ctx,
+              const struct ln_path *const source,
+              const struct stat *const source_sb,
+              const struct ln_path *const dest,
+              bool *const replace){
   struct stat dest_sb;
-  bool removed;
+  struct stat follow_sb;
+  const struct stat *link_sb;
+  bool same;
+  int error;
 
-  removed = true;
-  if(stat(path_dest, &dest_sb) == 0){
+  error = 0;
+  *replace = false;
+  if(fstatat(dest->dirfd, dest->name, &dest_sb, 0) == 0){
     if(ln_ctx->flags & LN_FLAG_REMOVE_DEST){
-      if(ln_same_file(source_sb, &dest_sb)){
-        ln_warn(ln_ctx, false, "source and destination same: %s", path_dest);
-        removed = false;
+      link_sb = source_sb;
+      if(S_ISLNK(source_sb->st_mode) &&
+         (ln_ctx->flags & LN_FLAG_FOLLOW_SYMBOLIC) &&
+         fstatat(source->dirfd, source->name, &follow_sb, 0) == 0){
+        link_sb = &follow_sb;
+      }
+      same = ln_same_file(link_sb, &dest_sb);
+      if(!same &&
+         S_ISLNK(link_sb->st_mode) &&
+         (ln_ctx->flags & (LN_FLAG_SYMBOLIC | LN_FLAG_REFLINK)) == 0 &&
+         fstatat(dest->dirfd,
+                 dest->name,
+                 &dest_sb,
+                 AT_SYMLINK_NOFOLLOW) == 0){
+        same = ln_same_file(link_sb, &dest_sb);
+      }
+      if(same){
+        ln_warn(ln_ctx, false, "source and destination same: %s", dest->path);
+        error = EEXIST;
       }
       else{
-        if(unlink(path_dest) != 0){
-          ln_warn(ln_ctx, true, "failed to unlink destination: %s", path_dest);
-          removed = false;
-        }
+        *replace = true;
       }
     }
     else{
-      ln_warn(ln_ctx, false, "destination already exists: %s", path_dest);
-      removed = false;
+      ln_warn(ln_ctx, false, "destination already exists: %s", dest->path);
+      error = EEXIST;
     }
   }
-  return removed;
+  return error;
 }
 
 /**
- * Create the requested link file type.
- *
- * The following link functions will get called.
- *   - link    - If source is not a symbolic link.
- *   - linkat  - If source is a symbolic link.
- *   - symlink - Corresponds to (-s) argument.
+ * Shared state of the threads copying one file (-C).
+ */
+struct ln_copy{
+  /**
+   * Open file descriptor of the source file.
+   */
+  int src_fd;
+
+  /**
+   * Destination file opened for writing.
+   */
+  int dest_fd;
+
+  /**
+   * Size of the source file.
+   */
+  off_t size;
+
+  /**
+   * Offset of the next chunk to copy.
+   */
+  off_t next;
+
+  /**
+   * errno value of the first failed chunk, or 0.
+   */
+  int error;
+
+  /**
+   * Protects @ref next and @ref error.
+   */
+  pthread_mutex_t mutex;
+};
+
+/**
+ * Worker thread entry point which copies chunks of @ref LN_COPY_CHUNK
+ * bytes until none remain or a chunk fails.
  *
- * @param[in,out] ln_ctx      See @ref ln_ctx.
- * @param[in]     path_source Path to point the new link to.
- * @param[in]     path_dest   New link to create, pointing to @p path_source.
+ * @param[in,out] arg  See @ref ln_copy.
+ * @retval        NULL Always returns NULL.
  */
-static void
-ln_create_link(struct ln_ctx *const ln_ctx,
-               const char *const path_source,
-               const char *const path_dest){
+static void *
+ln_copy_worker(void *arg){
+  struct ln_copy *copy;
+  off_t offset;
+  off_t len;
   int rc;
-  int linkat_flag;
-  struct stat source_sb;
 
-  if(lstat(path_source, &source_sb) != 0){
-    ln_warn(ln_ctx, true, "lstat(%s)", path_source);
+  copy = arg;
+  rc = 0;
+  while(rc == 0){
+    pthread_mutex_lock(&copy->mutex);
+    offset = copy->next;
+    if(copy->error != 0){
+      offset = copy->size;
+    }
+    copy->next = offset + LN_COPY_CHUNK;
+    pthread_mutex_unlock(&copy->mutex);
+    if(offset >= copy->size){
+      break;
+    }
+    len = copy->size - offset;
+    if(len > LN_COPY_CHUNK){
+      len = LN_COPY_CHUNK;
+    }
+    rc = reflink_copy(copy->src_fd, copy->dest_fd, offset, len);
+    if(rc != 0){
+      pthread_mutex_lock(&copy->mutex);
+      if(copy->error == 0){
+        copy->error = errno;
+      }
+      pthread_mutex_unlock(&copy->mutex);
+    }
   }
-  else{
-    if(ln_remove_dest(ln_ctx, &source_sb, path_dest)){
-      if(ln_ctx->flags & LN_FLAG_SYMBOLIC){
-        rc = symlink(path_source, path_dest);
+  return NULL;
+}
+
+/**
+ * Copy the data of a source file into an empty destination file (-C).
+ *
+ * Files larger than @ref LN_COPY_CHUNK get copied in chunks by up to (-j)
+ * threads. The copy continues on fewer threads if some of them fail to
+ * start.
+ *
+ * @param[in] ln_ctx  See @ref ln_ctx.
+ * @param[in] src_fd  Open file descriptor of the source file.
+ * @param[in] dest_fd Destination file opened for writing.
+ * @param[in] size    Size of the source file.
+ * @retval    0       Copied the file.
+ * @retval    -1      Failed to copy the file, errno set.
+ */
+static int
+ln_copy_data(const struct ln_ctx *const ln_ctx,
+             const int src_fd,
+             const int dest_fd,
+             const off_t size){
+  struct ln_copy copy;
+  pthread_t *thread_list;
+  size_t nthread;
+  size_t nchunk;
+  size_t i;
+  int rc;
+
+  memset(&copy, 0, sizeof(copy));
+  copy.src_fd = src_fd;
+  copy.dest_fd = dest_fd;
+  copy.size = size;
+  pthread_mutex_init(&copy.mutex, NULL);
+  nchunk = (size_t)((size + LN_COPY_CHUNK - 1) / LN_COPY_CHUNK);
+  nthread = 0;
+  thread_list = NULL;
+  if(ln_ctx->nthread > 1 && nchunk > 1){
+    if(nchunk > ln_ctx->nthread){
+      nchunk = ln_ctx->nthread;
+    }
+    thread_list = malloc((nchunk - 1) * sizeof(*thread_list));
+    if(thread_list){
+      for(i = 0; i < nchunk - 1; i++){
+        if(pthread_create(&thread_list[i],
+                          NULL,
+                          ln_copy_worker,
+                          &copy) != 0){
+          break;
+        }
+        nthread += 1;
       }
-      else{
-        if(S_ISLNK(source_sb.st_mode)){
-          if(ln_ctx->flags & LN_FLAG_FOLLOW_SYMBOLIC){
-            linkat_flag = AT_SYMLINK_FOLLOW;
-          }
-          else{
-            linkat_flag = 0;
-          }
-          rc = linkat(AT_FDCWD, path_source, AT_FDCWD, path_dest, linkat_flag);
+    }
+  }
+  ln_copy_worker(&copy);
+  for(i = 0; i < nthread; i++){
+    pthread_join(thread_list[i], NULL);
+  }
+  free(thread_list);
+  pthread_mutex_destroy(&copy.mutex);
+  rc = 0;
+  if(copy.error != 0){
+    errno = copy.error;
+    rc = -1;
+  }
+  return rc;
+}
+
+/**
+ * Create a copy-on-write clone of a source file (-c), or a copy of it if
+ * cloning fails and (-C) argument set.
+ *
+ * The new file gets the permissions of the source, less the umask, and
+ * shares all of its extents. Symbolic links get followed because only the
+ * data of a regular file can get shared. Any other file type fails with
+ * EINVAL before @p name gets created. The source gets opened non-blocking
+ * so a FIFO without a writer can not stall the run. Like linkat, this
+ * fails with EEXIST if @p name already exists.
+ *
+ * A copy keeps the holes of a sparse source, and the kernel may still
+ * share the extents or copy them without passing the data through user
+ * space. See @ref reflink_copy.
+ *
+ * @param[in] ln_ctx See @ref ln_ctx.
+ * @param[in] source File to clone.
+ * @param[in] dirfd  Directory file descriptor that @p name gets resolved
+ *                   relative to.
+ * @param[in] name   New file to create.
+ * @retval    0      Created the clone or the copy.
+ * @retval    -1     Failed to create the clone, errno set.
+ */
+static int
+ln_clone_at(const struct ln_ctx *const ln_ctx,
+            const struct ln_path *const source,
+            const int dirfd,
+            const char *const name){
+  struct stat sb;
+  int src_fd;
+  int dest_fd;
+  int rc;
+  int error;
+
+  rc = -1;
+  src_fd = openat(source->dirfd, source->name, O_RDONLY | O_NONBLOCK);
+  if(src_fd >= 0){
+    if(fstat(src_fd, &sb) != 0){
+      /* Skip. */
+    }
+    else if(!S_ISREG(sb.st_mode)){
+      errno = EINVAL;
+    }
+    else{
+      dest_fd = openat(dirfd,
+                       name,
+                       O_WRONLY | O_CREAT | O_EXCL,
+                       sb.st_mode & 0777);
+      if(dest_fd >= 0){
+        rc = reflink_clone(src_fd, dest_fd);
+        if(rc != 0 &&
+           (ln_ctx->flags & LN_FLAG_COPY) &&
+           ftruncate(dest_fd, sb.st_size) == 0){
+          rc = ln_copy_data(ln_ctx, src_fd, dest_fd, sb.st_size);
         }
-        else{
-          rc = link(path_source, path_dest);
+        error = errno;
+        close(dest_fd);
+        if(rc != 0){
+          unlinkat(dirfd, name, 0);
+          errno = error;
         }
       }
-      if(rc != 0){
-        ln_warn(ln_ctx,
-                true,
-                "failed to create link: %s - %s",
-                path_source,
-                path_dest);
-      }
     }
+    error = errno;
+    close(src_fd);
+    errno = error;
   }
+  return rc;
 }
 
 /**
- * Store a link of a file inside a directory.
+ * Create the requested link file type at the given location.
  *
- * @param[in,out] ln_ctx      See @ref ln_ctx.
- * @param[in]     source_file Create a link of this file in @p target_dir.
- * @param[in]     target_dir  Store a new link of @p source_file in this
- *                            directory.
+ * The following link functions will get called.
+ *   - linkat      - Hard link, following @p source if it is a symbolic link
+ *                   and (-L) argument set.
+ *   - symlinkat   - Corresponds to (-s) argument.
+ *   - ln_clone_at - Corresponds to (-c) argument, or when linkat fails
+ *                   with EXDEV and (-C) argument set. Only regular files
+ *                   and followed symbolic links get copied, so a FIFO or
+ *                   device node keeps failing with EXDEV.
+ *
+ * @param[in] ln_ctx    See @ref ln_ctx.
+ * @param[in] source    File to point the new link to.
+ * @param[in] source_sb Source file info.
+ * @param[in] dirfd     Directory file descriptor that @p name gets resolved
+ *                      relative to.
+ * @param[in] name      New link to create, pointing to @p source.
+ * @return              See linkat.
  */
-static void
-ln_target_dir(struct ln_ctx *const ln_ctx,
-              const char *const source_file,
-              const char *const target_dir){
-  char *path_dest;
+static int
+ln_link_at(const struct ln_ctx *const ln_ctx,
+           const struct ln_path *const source,
+           const struct stat *const source_sb,
+           const int dirfd,
+           const char *const name){
+  int rc;
+  int linkat_flag;
 
-  path_dest = ln_path_target_concat(target_dir, source_file);
-  if(path_dest == NULL){
-    ln_warn(ln_ctx, true, "alloc");
+  if(ln_ctx->flags & LN_FLAG_SYMBOLIC){
+    rc = symlinkat(source->path, dirfd, name);
+  }
+  else if((ln_ctx->flags & LN_FLAG_REFLINK) ||
+          (ln_ctx->xdev && S_ISREG(source_sb->st_mode))){
+    rc = ln_clone_at(ln_ctx, source, dirfd, name);
   }
   else{
-    ln_create_link(ln_ctx, source_file, path_dest);
-    free(path_dest);
+    if(S_ISLNK(source_sb->st_mode) &&
+       (ln_ctx->flags & LN_FLAG_FOLLOW_SYMBOLIC)){
+      linkat_flag = AT_SYMLINK_FOLLOW;
+    }
+    else{
+      linkat_flag = 0;
+    }
+    rc = linkat(source->dirfd, source->name, dirfd, name, linkat_flag);
+    if(rc != 0 &&
+       errno == EXDEV &&
+       (ln_ctx->flags & LN_FLAG_COPY) &&
+       (S_ISREG(source_sb->st_mode) || linkat_flag)){
+      rc = ln_clone_at(ln_ctx, source, dirfd, name);
+    }
   }
+  return rc;
 }
 
 /**
- * Main entry point for ln utility.
- *
- * Usage:
- *
- * ln [-fs] [-L|-P] source_file target_file
+ * Atomically replace an existing destination file with a new link (-f).
  *
- * ln [-fs] [-L|-P] source_file... target_dir
+ * The new link first gets created under a temporary name in the same
+ * directory and then gets renamed over the destination, so the destination
+ * path always exists while it gets replaced. @ref ln_check_dest already
+ * refused a destination linking to the same file, which would make the
+ * rename do nothing and leave the temporary name behind.
  *
- * @param[in]     argc         Number of arguments in @p argv.
- * @param[in,out] argv         Argument list.
- * @retval        EXIT_SUCCESS All links created.
- * @retval        EXIT_FAILURE Failed to create at least one link.
+ * @param[in,out] ln_ctx      See @ref ln_ctx.
+ * @param[in]     source      File to point the new link to.
+ * @param[in]     source_sb   Source file info.
+ * @param[in]     dest        Existing destination file to replace.
+ * @retval        0           Replaced the destination.
+ * @retval        int         errno value describing the failure.
  */
-LINKAGE int
-ln_main(int argc,
-        char *argv[]){
+static int
+ln_replace_dest(struct ln_ctx *const ln_ctx,
+                const struct ln_path *const source,
+                const struct stat *const source_sb,
+                const struct ln_path *const dest){
+  char tmp_name[LN_TMP_NAME_SZ];
+  char *tmp_path;
+  char *tmp_base;
+  const char *slash;
+  size_t prefix_len;
+  size_t tmp_path_sz;
+  int i;
+  int rc;
+  int error;
+
+  /*
+   * The temporary link must get created in the same directory as the
+   * destination, so keep any directory prefix of the destination name.
+   */
+  tmp_path = tmp_name;
+  tmp_base = tmp_name;
+  slash = strrchr(dest->name, '/');
+  if(slash){
+    prefix_len = (size_t)(slash - dest->name) + 1;
+    if(si_add_size_t(prefix_len, LN_TMP_NAME_SZ, &tmp_path_sz)){
+      tmp_path = malloc(tmp_path_sz);
+    }
+    else{
+      tmp_path = NULL;
+    }
+    if(tmp_path){
+      memcpy(tmp_path, dest->name, prefix_len);
+      tmp_base = &tmp_path[prefix_len];
+    }
+  }
+  error = 0;
+  if(tmp_path == NULL){
+    error = ENOMEM;
+    errno = error;
+    ln_warn(ln_ctx, true, "alloc");
+  }
+  else{
+    rc = -1;
+    for(i = 0; i < LN_TMP_ATTEMPTS; i++){
+      ln_tmp_name(ln_ctx, tmp_base);
+      rc = ln_link_at(ln_ctx, source, source_sb, dest->dirfd, tmp_path);
+      if(rc == 0 || errno != EEXIST){
+        break;
+      }
+    }
+    if(rc != 0){
+      error = errno;
+      ln_warn(ln_ctx,
+              true,
+              "failed to create link: %s - %s",
+              source->path,
+              dest->path);
+    }
+    else if(renameat(dest->dirfd, tmp_path, dest->dirfd, dest->name) != 0){
+      error = errno;
+      unlinkat(dest->dirfd, tmp_path, 0);
+      errno = error;
+      ln_warn(ln_ctx, true, "failed to replace destination: %s", dest->path);
+    }
+    if(tmp_path != tmp_name){
+      free(tmp_path);
+    }
+  }
+  return error;
+}
+
+/**
+ * Create the requested link file type.
+ *
+ * The link first gets created without checking the source or destination,
+ * which only takes one system call in the common case:
+ *   - Hard link     - linkat, without a previous lstat of the source.
+ *   - Symbolic link - lstat of the source, then symlinkat (-s).
+ *   - Clone         - lstat of the source, then @ref ln_clone_at (-c).
+ *
+ * If that fails for any reason, the source and destination get checked
+ * before creating the link again, which reports the same errors as creating
+ * the link without the optimistic attempt. If the destination exists and
+ * (-f) argument set, the destination gets replaced by
+ * @ref ln_replace_dest. The optimistic attempt gets skipped with (-f)
+ * because the destination usually exists in that case.
+ *
+ * @param[in,out] ln_ctx See @ref ln_ctx.
+ * @param[in]     source File to point the new link to.
+ * @param[in]     dest   New link to create, pointing to @p source.
+ * @retval        0      Created the link.
+ * @retval        int    errno value describing the failure.
+ */
+static int
+ln_create_link(struct ln_ctx *const ln_ctx,
+               const struct ln_path *const source,
+               const struct ln_path *const dest){
+  struct stat source_sb;
+  bool replace;
+  bool created;
+  int linkat_flag;
+  int error;
+
+  created = false;
+  error = 0;
+  if((ln_ctx->flags & (LN_FLAG_REMOVE_DEST |
+                       LN_FLAG_SYMBOLIC |
+                       LN_FLAG_REFLINK)) == 0 &&
+     !ln_ctx->xdev){
+    /*
+     * AT_SYMLINK_FOLLOW has no effect if the source is not a symbolic link,
+     * so the lstat of the source is not needed to pick the flag.
+     */
+    if(ln_ctx->flags & LN_FLAG_FOLLOW_SYMBOLIC){
+      linkat_flag = AT_SYMLINK_FOLLOW;
+    }
+    else{
+      linkat_flag = 0;
+    }
+    if(linkat(source->dirfd,
+              source->name,
+              dest->dirfd,
+              dest->name,
+              linkat_flag) == 0){
+      created = true;
+    }
+  }
+  if(created == false){
+    if(fstatat(source->dirfd,
+               source->name,
+               &source_sb,
+               AT_SYMLINK_NOFOLLOW) != 0){
+      error = errno;
+      ln_warn(ln_ctx, true, "lstat(%s)", source->path);
+    }
+    else if((ln_ctx->flags & LN_FLAG_SYMBOLIC) &&
+            (ln_ctx->flags & LN_FLAG_REMOVE_DEST) == 0 &&
+            symlinkat(source->path, dest->dirfd, dest->name) == 0){
+      created = true;
+    }
+    else if((ln_ctx->flags & LN_FLAG_REFLINK) &&
+            (ln_ctx->flags & LN_FLAG_REMOVE_DEST) == 0 &&
+            ln_clone_at(ln_ctx, source, dest->dirfd, dest->name) == 0){
+      created = true;
+    }
+    else{
+      error = ln_check_dest(ln_ctx, source, &source_sb, dest, &replace);
+      if(error == 0 && replace){
+        error = ln_replace_dest(ln_ctx, source, &source_sb, dest);
+      }
+      else if(error == 0 && ln_link_at(ln_ctx,
+                                       source,
+                                       &source_sb,
+                                       dest->dirfd,
+                                       dest->name) != 0){
+        error = errno;
+        ln_warn(ln_ctx,
+                true,
+                "failed to create link: %s - %s",
+                source->path,
+                dest->path);
+      }
+    }
+  }
+  return error;
+}
+
+/**
+ * Store a link of a file inside a directory.
+ *
+ * @param[in,out] ln_ctx       See @ref ln_ctx.
+ * @param[in]     source_file  Create a link of this file in the target
+ *                             directory.
+ * @param[in,out] pb           Path buffer holding the target directory
+ *                             prefix, owned by the calling thread.
+ * @param[in]     target_dirfd Open directory file descriptor of the target
+ *                             directory.
+ */
+static void
+ln_target_dir(struct ln_ctx *const ln_ctx,
+              const char *const source_file,
+              struct ln_path_buf *const pb,
+              const int target_dirfd){
+  const char *path_dest;
+  struct ln_path source;
+  struct ln_path dest;
+
+  path_dest = ln_path_target_concat(pb, source_file);
+  if(path_dest == NULL){
+    ln_warn(ln_ctx, true, "alloc");
+  }
+  else{
+    source.dirfd = AT_FDCWD;
+    source.name = source_file;
+    source.path = source_file;
+    dest.dirfd = target_dirfd;
+    dest.name = &path_dest[pb->prefix_len];
+    dest.path = path_dest;
+    ln_create_link(ln_ctx, &source, &dest);
+  }
+}
+
+/**
+ * Link request submitted through io_uring (-u).
+ */
+struct ln_uring_op{
+  /**
+   * Set while the link request is in flight.
+   */
+  bool active;
+
+  /**
+   * Copy of the source_file operand, reused by the following requests.
+   */
+  char *path_source;
+
+  /**
+   * Size of @ref path_source in bytes.
+   */
+  size_t path_source_sz;
+
+  /**
+   * Source file referring to @ref path_source.
+   */
+  struct ln_path source;
+
+  /**
+   * Full path of the new link built by @ref ln_path_target_concat.
+   */
+  struct ln_path_buf path_dest;
+
+  /**
+   * New link inside the target directory.
+   */
+  struct ln_path dest;
+
+  /**
+   * Number of io_uring requests in flight for this link request.
+   */
+  unsigned int npending;
+
+  /**
+   * Set once the request that creates the link has been queued.
+   */
+  bool linking;
+
+  /**
+   * Set if the link gets created under @ref tmp_name and then renamed over
+   * the existing destination (-f).
+   */
+  bool replacing;
+
+  /**
+   * Temporary name of the new link if @ref replacing.
+   */
+  char tmp_name[LN_TMP_NAME_SZ];
+
+  /**
+   * Result of the @ref LN_URING_REQ_STAT_SOURCE request.
+   */
+  int res_source;
+
+  /**
+   * Result of the @ref LN_URING_REQ_STAT_DEST request.
+   */
+  int res_dest;
+
+  /**
+   * Result of the @ref LN_URING_REQ_LINK request.
+   */
+  int res_link;
+
+  /**
+   * Result of the @ref LN_URING_REQ_RENAME request.
+   */
+  int res_rename;
+
+  /**
+   * Status of the source file, following symbolic links only if (-L)
+   * argument set.
+   */
+  struct uring_statx sx_source;
+
+  /**
+   * Status of the existing destination file.
+   */
+  struct uring_statx sx_dest;
+};
+
+/**
+ * Slot in the queue of the worker thread pool.
+ *
+ * The buffer stays allocated when the slot gets popped. The worker thread
+ * swaps it with a buffer of its own, so the queue never allocates memory
+ * once each buffer has grown to fit the longest source file.
+ */
+struct ln_pool_entry{
+  /**
+   * Source file waiting to get linked.
+   */
+  char *buf;
+
+  /**
+   * Size of @ref buf in bytes.
+   */
+  size_t sz;
+};
+
+/**
+ * Worker thread pool that creates links inside a target directory.
+ *
+ * The thread reading the operands pushes each source_file onto a bounded
+ * queue, and the worker threads pop entries off the queue and call
+ * @ref ln_target_dir.
+ *
+ * If (-u) argument set and io_uring available, the link requests get
+ * submitted in batches through @ref ring instead, and the worker threads do
+ * not get used.
+ */
+struct ln_pool{
+  /**
+   * See @ref ln_ctx.
+   */
+  struct ln_ctx *ln_ctx;
+
+  /**
+   * Store the new links in this directory.
+   */
+  const char *target_dir;
+
+  /**
+   * Open directory file descriptor of @ref target_dir.
+   */
+  int target_dirfd;
+
+  /**
+   * Path buffer used by the calling thread.
+   */
+  struct ln_path_buf path_dest;
+
+  /**
+   * Number of threads in @ref thread_list. Set to 0 when processing the
+   * operands serially in the calling thread.
+   */
+  size_t nthread;
+
+  /**
+   * Worker thread identifiers.
+   */
+  pthread_t *thread_list;
+
+  /**
+   * Protects the queue members below.
+   */
+  pthread_mutex_t mutex;
+
+  /**
+   * Signaled when an entry gets pushed onto the queue or the queue closes.
+   */
+  pthread_cond_t cond_push;
+
+  /**
+   * Signaled when an entry gets popped off the queue.
+   */
+  pthread_cond_t cond_pop;
+
+  /**
+   * Ring buffer of source files waiting to get linked.
+   */
+  struct ln_pool_entry *queue;
+
+  /**
+   * Maximum number of entries in @ref queue.
+   */
+  size_t queue_sz;
+
+  /**
+   * Index of the next entry to pop off @ref queue.
+   */
+  size_t queue_head;
+
+  /**
+   * Number of entries currently in @ref queue.
+   */
+  size_t queue_len;
+
+  /**
+   * Set after the last entry has been pushed onto @ref queue.
+   */
+  bool queue_closed;
+
+  /**
+   * io_uring instance used if (-u) argument set, otherwise NULL.
+   */
+  struct uring *ring;
+
+  /**
+   * Link requests that can be in flight through @ref ring, indexed by the
+   * io_uring user data value.
+   */
+  struct ln_uring_op *op_list;
+
+  /**
+   * Stack of indexes into @ref op_list not currently in flight.
+   */
+  size_t *op_free;
+
+  /**
+   * Number of indexes in @ref op_free.
+   */
+  size_t nop_free;
+};
+
+/**
+ * Exchange the buffers of two queue entries.
+ *
+ * @param[in,out] e1 Swap with @p e2.
+ * @param[in,out] e2 Swap with @p e1.
+ */
+static void
+ln_pool_entry_swap(struct ln_pool_entry *const e1,
+                   struct ln_pool_entry *const e2){
+  struct ln_pool_entry tmp;
+
+  tmp = *e1;
+  *e1 = *e2;
+  *e2 = tmp;
+}
+
+/**
+ * Worker thread entry point which links each source file popped off the
+ * queue until the queue closes.
+ *
+ * @param[in,out] arg  See @ref ln_pool.
+ * @retval        NULL Always returns NULL.
+ */
+static void *
+ln_pool_worker(void *arg){
+  struct ln_pool *pool;
+  struct ln_pool_entry entry;
+  struct ln_pool_entry *slot;
+  struct ln_path_buf path_dest;
+  bool ok;
+
+  pool = arg;
+  memset(&entry, 0, sizeof(entry));
+  memset(&path_dest, 0, sizeof(path_dest));
+  ok = ln_path_buf_prefix(&path_dest, pool->target_dir);
+  if(!ok){
+    ln_warn(pool->ln_ctx, true, "alloc");
+  }
+  while(true){
+    pthread_mutex_lock(&pool->mutex);
+    while(pool->queue_len == 0 && pool->queue_closed == false){
+      pthread_cond_wait(&pool->cond_push, &pool->mutex);
+    }
+    if(pool->queue_len == 0){
+      pthread_mutex_unlock(&pool->mutex);
+      break;
+    }
+    slot = &pool->queue[pool->queue_head];
+    ln_pool_entry_swap(&entry, slot);
+    pool->queue_head = (pool->queue_head + 1) % pool->queue_sz;
+    pool->queue_len -= 1;
+    pthread_cond_signal(&pool->cond_pop);
+    pthread_mutex_unlock(&pool->mutex);
+
+    if(ok){
+      ln_target_dir(pool->ln_ctx,
+                    entry.buf,
+                    &path_dest,
+                    pool->target_dirfd);
+    }
+    else{
+      ln_warn(pool->ln_ctx, true, "alloc");
+    }
+  }
+  free(entry.buf);
+  ln_path_buf_free(&path_dest);
+  return NULL;
+}
+
+/**
+ * Make an io_uring link request available for the next request.
+ *
+ * The path buffers of the request stay allocated for reuse.
+ *
+ * @param[in,out] pool See @ref ln_pool.
+ * @param[in]     idx  Index into @ref ln_pool::op_list.
+ */
+static void
+ln_pool_uring_release(struct ln_pool *const pool,
+                      const size_t idx){
+  struct ln_uring_op *op;
+
+  op = &pool->op_list[idx];
+  op->active = false;
+  pool->op_free[pool->nop_free++] = idx;
+}
+
+/**
+ * Handle a link request that could not get completed through io_uring.
+ *
+ * The request gets handled again by @ref ln_create_link, which either
+ * succeeds or reports the same error as it would have without io_uring.
+ *
+ * @param[in,out] pool See @ref ln_pool.
+ * @param[in]     idx  Index into @ref ln_pool::op_list.
+ */
+static void
+ln_pool_uring_fallback(struct ln_pool *const pool,
+                       const size_t idx){
+  struct ln_uring_op *op;
+
+  op = &pool->op_list[idx];
+  ln_create_link(pool->ln_ctx, &op->source, &op->dest);
+  ln_pool_uring_release(pool, idx);
+}
+
+/**
+ * Queue an io_uring request.
+ *
+ * @param[in,out] pool See @ref ln_pool.
+ * @param[in]     idx  Index into @ref ln_pool::op_list.
+ * @param[in]     req  See @ref ln_uring_req.
+ */
+static void
+ln_pool_uring_queue(struct ln_pool *const pool,
+                    const size_t idx,
+                    const unsigned int req){
+  struct ln_uring_op *op;
+  uint64_t user_data;
+  int linkat_flag;
+  const char *name;
+
+  op = &pool->op_list[idx];
+  user_data = (uint64_t)idx * LN_URING_REQ_COUNT + req;
+  op->npending += 1;
+  if(req == LN_URING_REQ_STAT_SOURCE){
+    /*
+     * With (-L), compare the file a symbolic link points to with the
+     * destination, because that file is what the new link points to.
+     */
+    uring_statx(pool->ring,
+                op->source.dirfd,
+                op->source.name,
+                (pool->ln_ctx->flags & LN_FLAG_FOLLOW_SYMBOLIC) ?
+                0 : AT_SYMLINK_NOFOLLOW,
+                &op->sx_source,
+                user_data);
+  }
+  else if(req == LN_URING_REQ_STAT_DEST){
+    uring_statx(pool->ring,
+                op->dest.dirfd,
+                op->dest.name,
+                0,
+                &op->sx_dest,
+                user_data);
+  }
+  else if(req == LN_URING_REQ_RENAME){
+    uring_renameat(pool->ring,
+                   op->dest.dirfd,
+                   op->tmp_name,
+                   op->dest.dirfd,
+                   op->dest.name,
+                   user_data);
+  }
+  else{
+    op->linking = true;
+    if(op->replacing){
+      name = op->tmp_name;
+    }
+    else{
+      name = op->dest.name;
+    }
+    if(pool->ln_ctx->flags & LN_FLAG_SYMBOLIC){
+      uring_symlinkat(pool->ring,
+                      op->source.path,
+                      op->dest.dirfd,
+                      name,
+                      user_data);
+    }
+    else{
+      if(pool->ln_ctx->flags & LN_FLAG_FOLLOW_SYMBOLIC){
+        linkat_flag = AT_SYMLINK_FOLLOW;
+      }
+      else{
+        linkat_flag = 0;
+      }
+      uring_linkat(pool->ring,
+                   op->source.dirfd,
+                   op->source.name,
+                   op->dest.dirfd,
+                   name,
+                   linkat_flag,
+                   user_data);
+    }
+    if(op->replacing){
+      uring_link_next(pool->ring);
+    }
+  }
+}
+
+/**
+ * Handle the result of a completed io_uring request.
+ *
+ * Once both status requests of a link request complete, the link gets
+ * queued. If (-f) argument set and the destination exists, the link gets
+ * created under a temporary name with a chained rename over the destination,
+ * so the rename only runs if the link succeeds and without another round
+ * trip through this function. See @ref ln_replace_dest.
+ *
+ * @param[in,out] pool      See @ref ln_pool.
+ * @param[in]     user_data See @ref ln_pool_uring_queue.
+ * @param[in]     res       0 on success, or a negated errno value.
+ */
+static void
+ln_pool_uring_complete(struct ln_pool *const pool,
+                       const uint64_t user_data,
+                       const int res){
+  size_t idx;
+  unsigned int req;
+  struct ln_uring_op *op;
+
+  idx = (size_t)(user_data / LN_URING_REQ_COUNT);
+  req = (unsigned int)(user_data % LN_URING_REQ_COUNT);
+  op = &pool->op_list[idx];
+  op->npending -= 1;
+  if(req == LN_URING_REQ_STAT_SOURCE){
+    op->res_source = res;
+  }
+  else if(req == LN_URING_REQ_STAT_DEST){
+    op->res_dest = res;
+  }
+  else if(req == LN_URING_REQ_LINK){
+    op->res_link = res;
+  }
+  else{
+    op->res_rename = res;
+  }
+  if(op->npending == 0){
+    if(op->linking){
+      if(op->res_link == 0 && op->res_rename != 0){
+        unlinkat(op->dest.dirfd, op->tmp_name, 0);
+      }
+      if(op->res_link != 0 || op->res_rename != 0){
+        ln_pool_uring_fallback(pool, idx);
+      }
+      else{
+        ln_pool_uring_release(pool, idx);
+      }
+    }
+    else if(op->res_source != 0){
+      ln_pool_uring_fallback(pool, idx);
+    }
+    else if((pool->ln_ctx->flags & LN_FLAG_REMOVE_DEST) &&
+            op->res_dest == 0){
+      /*
+       * The status of the destination follows symbolic links, so a hard
+       * link to a symbolic link itself gets checked by the fallback.
+       */
+      if(uring_statx_same(&op->sx_source, &op->sx_dest) ||
+         ((pool->ln_ctx->flags & LN_FLAG_SYMBOLIC) == 0 &&
+          uring_statx_is_link(&op->sx_source))){
+        ln_pool_uring_fallback(pool, idx);
+      }
+      else{
+        op->replacing = true;
+        ln_tmp_name(pool->ln_ctx, op->tmp_name);
+        ln_pool_uring_queue(pool, idx, LN_URING_REQ_LINK);
+        ln_pool_uring_queue(pool, idx, LN_URING_REQ_RENAME);
+      }
+    }
+    else{
+      ln_pool_uring_queue(pool, idx, LN_URING_REQ_LINK);
+    }
+  }
+}
+
+/**
+ * Submit the queued io_uring requests and handle the completed ones.
+ *
+ * If io_uring_enter fails, all link requests still in flight get handled by
+ * @ref ln_create_link and the remaining links get created without io_uring.
+ *
+ * @param[in,out] pool    See @ref ln_pool.
+ * @param[in]     wait_nr Block until at least this many requests complete.
+ */
+static void
+ln_pool_uring_reap(struct ln_pool *const pool,
+                   const unsigned int wait_nr){
+  uint64_t user_data;
+  int res;
+  size_t i;
+
+  if(uring_submit(pool->ring, wait_nr) != 0){
+    ln_warn(pool->ln_ctx, true, "io_uring_enter");
+    uring_free(pool->ring);
+    pool->ring = NULL;
+    for(i = 0; i < LN_URING_NOP; i++){
+      if(pool->op_list[i].active){
+        if(pool->op_list[i].replacing){
+          unlinkat(pool->op_list[i].dest.dirfd, pool->op_list[i].tmp_name, 0);
+        }
+        ln_pool_uring_fallback(pool, i);
+      }
+    }
+  }
+  else{
+    while(uring_reap(pool->ring, &user_data, &res)){
+      ln_pool_uring_complete(pool, user_data, res);
+    }
+  }
+}
+
+/**
+ * Queue a link request for a source file through io_uring.
+ *
+ * Hard links without (-f) argument get created without first checking the
+ * source or destination. Otherwise, the status of the source file and, if
+ * (-f) argument set, the destination get requested first so that the link
+ * gets handled the same way as without io_uring.
+ *
+ * @param[in,out] pool        See @ref ln_pool.
+ * @param[in]     source_file Create a link of this file in the target
+ *                            directory.
+ */
+static void
+ln_pool_uring_submit(struct ln_pool *const pool,
+                     const char *const source_file){
+  size_t idx;
+  struct ln_uring_op *op;
+  size_t source_len;
+  const char *path_dest;
+
+  while(pool->ring && pool->nop_free == 0){
+    ln_pool_uring_reap(pool, 1);
+  }
+  if(pool->ring == NULL){
+    ln_target_dir(pool->ln_ctx,
+                  source_file,
+                  &pool->path_dest,
+                  pool->target_dirfd);
+  }
+  else{
+    idx = pool->op_free[--pool->nop_free];
+    op = &pool->op_list[idx];
+    op->active = true;
+    source_len = strlen(source_file);
+    if(!ln_buf_reserve(&op->path_source,
+                       &op->path_source_sz,
+                       source_len + 1) ||
+       (op->path_dest.buf == NULL &&
+        !ln_path_buf_prefix(&op->path_dest, pool->target_dir)) ||
+       (path_dest = ln_path_target_concat(&op->path_dest,
+                                          source_file)) == NULL){
+      ln_warn(pool->ln_ctx, true, "alloc");
+      ln_pool_uring_release(pool, idx);
+    }
+    else{
+      memcpy(op->path_source, source_file, source_len + 1);
+      op->source.dirfd = AT_FDCWD;
+      op->source.name = op->path_source;
+      op->source.path = op->path_source;
+      op->dest.dirfd = pool->target_dirfd;
+      op->dest.name = &path_dest[op->path_dest.prefix_len];
+      op->dest.path = path_dest;
+      op->npending = 0;
+      op->linking = false;
+      op->replacing = false;
+      op->res_source = 0;
+      op->res_dest = 0;
+      op->res_rename = 0;
+      if(pool->ln_ctx->flags & (LN_FLAG_REMOVE_DEST | LN_FLAG_SYMBOLIC)){
+        ln_pool_uring_queue(pool, idx, LN_URING_REQ_STAT_SOURCE);
+        if(pool->ln_ctx->flags & LN_FLAG_REMOVE_DEST){
+          ln_pool_uring_queue(pool, idx, LN_URING_REQ_STAT_DEST);
+        }
+      }
+      else{
+        ln_pool_uring_queue(pool, idx, LN_URING_REQ_LINK);
+      }
+    }
+  }
+}
+
+/**
+ * Set up io_uring for the (-u) argument.
+ *
+ * Leaves @ref ln_pool::ring set to NULL if io_uring not available.
+ *
+ * @param[in,out] pool See @ref ln_pool.
+ */
+static void
+ln_pool_uring_start(struct ln_pool *const pool){
+  size_t i;
+
+  pool->ring = uring_new(LN_URING_ENTRIES);
+  if(pool->ring){
+    pool->op_list = malloc(LN_URING_NOP * sizeof(*pool->op_list));
+    pool->op_free = malloc(LN_URING_NOP * sizeof(*pool->op_free));
+    if(pool->op_list == NULL || pool->op_free == NULL){
+      ln_warn(pool->ln_ctx, true, "alloc");
+      uring_free(pool->ring);
+      pool->ring = NULL;
+    }
+    else{
+      memset(pool->op_list, 0, LN_URING_NOP * sizeof(*pool->op_list));
+      for(i = 0; i < LN_URING_NOP; i++){
+        pool->op_free[i] = LN_URING_NOP - 1 - i;
+      }
+      pool->nop_free = LN_URING_NOP;
+    }
+  }
+}
+
+/**
+ * Wait for all io_uring link requests in flight to complete.
+ *
+ * @param[in,out] pool See @ref ln_pool.
+ */
+static void
+ln_pool_uring_finish(struct ln_pool *const pool){
+  size_t i;
+
+  while(pool->ring && pool->nop_free < LN_URING_NOP){
+    ln_pool_uring_reap(pool, 1);
+  }
+  uring_free(pool->ring);
+  if(pool->op_list && pool->op_free){
+    for(i = 0; i < LN_URING_NOP; i++){
+      free(pool->op_list[i].path_source);
+      ln_path_buf_free(&pool->op_list[i].path_dest);
+    }
+  }
+  free(pool->op_free);
+  free(pool->op_list);
+}
+
+/**
+ * Start the worker threads if (-j) argument requested more than one thread,
+ * or set up io_uring if (-u) argument set.
+ *
+ * If the threads could not get started, the operands get processed serially
+ * in the calling thread instead. Call @ref ln_pool_finish regardless of the
+ * return value.
+ *
+ * @param[out]    pool         See @ref ln_pool.
+ * @param[in,out] ln_ctx       See @ref ln_ctx.
+ * @param[in]     target_dir   Store the new links in this directory.
+ * @param[in]     target_dirfd Open directory file descriptor of
+ *                             @p target_dir.
+ * @retval        true         Ready to submit source files.
+ * @retval        false        Failed to allocate the path buffer.
+ */
+static bool
+ln_pool_start(struct ln_pool *const pool,
+              struct ln_ctx *const ln_ctx,
+              const char *const target_dir,
+              const int target_dirfd){
+  size_t i;
+  int rc;
+  bool ok;
+
+  memset(pool, 0, sizeof(*pool));
+  pool->ln_ctx = ln_ctx;
+  pool->target_dir = target_dir;
+  pool->target_dirfd = target_dirfd;
+  ok = ln_path_buf_prefix(&pool->path_dest, target_dir);
+  if(!ok){
+    ln_warn(ln_ctx, true, "alloc");
+  }
+  else if((ln_ctx->flags & (LN_FLAG_URING | LN_FLAG_REFLINK)) ==
+          LN_FLAG_URING &&
+          !ln_ctx->xdev){
+    /*
+     * io_uring has no clone or copy request, so clones (-c) and copies
+     * (-C) use the threads.
+     */
+    ln_pool_uring_start(pool);
+  }
+  if(ok && pool->ring == NULL && ln_ctx->nthread > 1){
+    pool->queue_sz = ln_ctx->nthread * LN_POOL_QUEUE_PER_THREAD;
+    pool->queue = malloc(pool->queue_sz * sizeof(*pool->queue));
+    pool->thread_list = malloc(ln_ctx->nthread * sizeof(*pool->thread_list));
+    if(pool->queue == NULL || pool->thread_list == NULL){
+      ln_warn(ln_ctx, true, "alloc");
+    }
+    else{
+      memset(pool->queue, 0, pool->queue_sz * sizeof(*pool->queue));
+      pthread_mutex_init(&pool->mutex, NULL);
+      pthread_cond_init(&pool->cond_push, NULL);
+      pthread_cond_init(&pool->cond_pop, NULL);
+      for(i = 0; i < ln_ctx->nthread; i++){
+        rc = pthread_create(&pool->thread_list[i],
+                            NULL,
+                            ln_pool_worker,
+                            pool);
+        if(rc != 0){
+          errno = rc;
+          ln_warn(ln_ctx, true, "pthread_create");
+          break;
+        }
+        pool->nthread += 1;
+      }
+    }
+  }
+  return ok;
+}
+
+/**
+ * Link a source file into the target directory using the worker pool.
+ *
+ * Blocks while the queue is full.
+ *
+ * @param[in,out] pool        See @ref ln_pool.
+ * @param[in]     source_file Create a link of this file in the target
+ *                            directory.
+ */
+static void
+ln_pool_submit(struct ln_pool *const pool,
+               const char *const source_file){
+  struct ln_pool_entry *slot;
+  size_t source_sz;
+
+  if(pool->ring){
+    ln_pool_uring_submit(pool, source_file);
+  }
+  else if(pool->nthread == 0){
+    ln_target_dir(pool->ln_ctx,
+                  source_file,
+                  &pool->path_dest,
+                  pool->target_dirfd);
+  }
+  else{
+    source_sz = strlen(source_file) + 1;
+    pthread_mutex_lock(&pool->mutex);
+    while(pool->queue_len == pool->queue_sz){
+      pthread_cond_wait(&pool->cond_pop, &pool->mutex);
+    }
+    slot = &pool->queue[(pool->queue_head + pool->queue_len) %
+                        pool->queue_sz];
+    if(!ln_buf_reserve(&slot->buf, &slot->sz, source_sz)){
+      ln_warn(pool->ln_ctx, true, "alloc");
+    }
+    else{
+      memcpy(slot->buf, source_file, source_sz);
+      pool->queue_len += 1;
+      pthread_cond_signal(&pool->cond_push);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+  }
+}
+
+/**
+ * Wait for the worker threads to drain the queue and exit.
+ *
+ * @param[in,out] pool See @ref ln_pool.
+ */
+static void
+ln_pool_finish(struct ln_pool *const pool){
+  size_t i;
+
+  ln_pool_uring_finish(pool);
+  if(pool->nthread > 0){
+    pthread_mutex_lock(&pool->mutex);
+    pool->queue_closed = true;
+    pthread_cond_broadcast(&pool->cond_push);
+    pthread_mutex_unlock(&pool->mutex);
+    for(i = 0; i < pool->nthread; i++){
+      pthread_join(pool->thread_list[i], NULL);
+    }
+  }
+  if(pool->queue && pool->thread_list){
+    pthread_cond_destroy(&pool->cond_pop);
+    pthread_cond_destroy(&pool->cond_push);
+    pthread_mutex_destroy(&pool->mutex);
+    for(i = 0; i < pool->queue_sz; i++){
+      free(pool->queue[i].buf);
+    }
+  }
+  free(pool->thread_list);
+  free(pool->queue);
+  ln_path_buf_free(&pool->path_dest);
+}
+
+/**
+ * Store a link inside a directory for each source_file listed in a file.
+ *
+ * Each entry in the list file gets terminated by a newline, or by a null
+ * character if (-0) set. Empty entries get skipped. Only one entry gets held
+ * in memory at a time, so the list can have any number of entries.
+ *
+ * @param[in,out] ln_ctx    See @ref ln_ctx.
+ * @param[in]     path_list File containing the list of source files, or "-"
+ *                          to read the list from STDIN.
+ * @param[in,out] pool      Submit each source file to this worker pool.
+ */
+static void
+ln_target_dir_list(struct ln_ctx *const ln_ctx,
+                   const char *const path_list,
+                   struct ln_pool *const pool){
+  FILE *fp;
+  char *entry;
+  size_t entry_sz;
+  ssize_t entry_len;
+  int delim;
+
+  if(strcmp(path_list, "-") == 0){
+    fp = stdin;
+  }
+  else{
+    fp = fopen(path_list, "r");
+  }
+  if(fp == NULL){
+    ln_warn(ln_ctx, true, "fopen(%s)", path_list);
+  }
+  else{
+    if(ln_ctx->flags & LN_FLAG_LIST_NUL){
+      delim = '\0';
+    }
+    else{
+      delim = '\n';
+    }
+    entry = NULL;
+    entry_sz = 0;
+    while((entry_len = getdelim(&entry, &entry_sz, delim, fp)) > 0){
+      if(entry[entry_len - 1] == delim){
+        entry[--entry_len] = '\0';
+      }
+      if(entry_len > 0){
+        ln_pool_submit(pool, entry);
+      }
+    }
+    if(ferror(fp)){
+      ln_warn(ln_ctx, true, "read(%s)", path_list);
+    }
+    free(entry);
+    if(fp != stdin && fclose(fp) != 0){
+      ln_warn(ln_ctx, true, "fclose(%s)", path_list);
+    }
+  }
+}
+
+/**
+ * Check which source_file operands live on a different device than the
+ * target directory before creating any links.
+ *
+ * The device of an operand gets taken from its parent directory. Only the
+ * last parent gets cached, so a parent only gets checked once for
+ * consecutive operands sharing it, and again each time it comes back after
+ * a different one. Only the operands whose parent crosses devices then get
+ * checked themselves, because a source can be a mount point or get
+ * followed (-L) to another device. Any other operand that still crosses
+ * devices fails with EXDEV when linked and gets handled like any other
+ * failed link. Operands that cannot get checked count as the same device,
+ * so they fail later with the real error. Symbolic links (-s) can cross
+ * devices, so they do not get checked.
+ *
+ * Hard links and clones (-c) cannot cross devices. If some operands do and
+ * the copy fallback (-C) is not set, the run fails before creating any
+ * link. If every operand crosses devices, (-C) set, and no list file (-l)
+ * used, @ref ln_ctx.xdev gets set so the files get copied without trying
+ * a hard link first.
+ *
+ * @param[in,out] ln_ctx       See @ref ln_ctx.
+ * @param[in]     nsource      Number of files in @p source_list.
+ * @param[in]     source_list  List of source_file operands.
+ * @param[in]     target_dir   Directory the new links get stored in.
+ * @param[in]     target_dirfd Open directory file descriptor of
+ *                             @p target_dir.
+ * @retval        true         Create the links.
+ * @retval        false        Some operands cross devices, error reported.
+ */
+static bool
+ln_target_dir_preflight(struct ln_ctx *const ln_ctx,
+                        const int nsource,
+                        char *const source_list[],
+                        const char *const target_dir,
+                        const int target_dirfd){
+  struct ln_path_buf pb;
+  struct stat sb;
+  dev_t target_dev;
+  const char *path_dest;
+  const char *parent;
+  const char *prev;
+  const char *sep;
+  size_t len;
+  size_t prev_len;
+  bool parent_cross;
+  bool cross;
+  int ncross;
+  int rc;
+  int i;
+  bool ok;
+
+  ok = true;
+  memset(&pb, 0, sizeof(pb));
+  if(nsource > 0 &&
+     (ln_ctx->flags & LN_FLAG_SYMBOLIC) == 0 &&
+     fstat(target_dirfd, &sb) == 0){
+    target_dev = sb.st_dev;
+    prev = NULL;
+    prev_len = 0;
+    parent_cross = false;
+    ncross = 0;
+    for(i = 0; i < nsource && ok; i++){
+      sep = strrchr(source_list[i], '/');
+      if(sep == NULL){
+        parent = ".";
+        len = 1;
+      }
+      else if(sep == source_list[i]){
+        parent = "/";
+        len = 1;
+      }
+      else{
+        parent = source_list[i];
+        len = (size_t)(sep - source_list[i]);
+      }
+      if(prev == NULL || len != prev_len || strncmp(parent, prev, len) != 0){
+        prev = parent;
+        prev_len = len;
+        parent_cross = false;
+        if(ln_buf_reserve(&pb.buf, &pb.sz, len + 1)){
+          memcpy(pb.buf, parent, len);
+          pb.buf[len] = '\0';
+          parent_cross = stat(pb.buf, &sb) == 0 && sb.st_dev != target_dev;
+        }
+      }
+      cross = false;
+      if(parent_cross){
+        if(ln_ctx->flags & LN_FLAG_FOLLOW_SYMBOLIC){
+          rc = stat(source_list[i], &sb);
+        }
+        else{
+          rc = lstat(source_list[i], &sb);
+        }
+        cross = rc == 0 && sb.st_dev != target_dev;
+      }
+      if(cross){
+        ncross += 1;
+        if((ln_ctx->flags & LN_FLAG_COPY) == 0){
+          /* The run stops here, so the parent cache can get reused. */
+          path_dest = NULL;
+          if(ln_path_buf_prefix(&pb, target_dir)){
+            path_dest = ln_path_target_concat(&pb, source_list[i]);
+          }
+          if(path_dest == NULL){
+            ln_warn(ln_ctx, true, "alloc");
+          }
+          else{
+            errno = EXDEV;
+            ln_warn(ln_ctx,
+                    true,
+                    "failed to create link: %s - %s",
+                    source_list[i],
+                    path_dest);
+          }
+          ok = false;
+        }
+      }
+    }
+    if(ok && ncross == nsource && ln_ctx->path_list == NULL){
+      ln_ctx->xdev = true;
+    }
+  }
+  ln_path_buf_free(&pb);
+  return ok;
+}
+
+/**
+ * Store a link inside a directory for each source_file operand and for each
+ * entry in the list file (-l).
+ *
+ * The target directory gets opened once, and all new links get created
+ * relative to that directory file descriptor. The links get created by a
+ * pool of worker threads if (-j) argument set, after
+ * @ref ln_target_dir_preflight checks the source_file operands.
+ *
+ * @param[in,out] ln_ctx      See @ref ln_ctx.
+ * @param[in]     nsource     Number of files in @p source_list.
+ * @param[in]     source_list List of source_file operands.
+ * @param[in]     target_dir  Store the new links in this directory.
+ */
+static void
+ln_target_dir_all(struct ln_ctx *const ln_ctx,
+                  const int nsource,
+                  char *const source_list[],
+                  const char *const target_dir){
+  int target_dirfd;
+  int i;
+  struct ln_pool pool;
+
+  target_dirfd = open(target_dir, LN_O_DIRFD);
+  if(target_dirfd < 0){
+    ln_warn(ln_ctx, true, "open(%s)", target_dir);
+  }
+  else{
+    if(ln_target_dir_preflight(ln_ctx,
+                               nsource,
+                               source_list,
+                               target_dir,
+                               target_dirfd)){
+      if(ln_pool_start(&pool, ln_ctx, target_dir, target_dirfd)){
+        for(i = 0; i < nsource; i++){
+          ln_pool_submit(&pool, source_list[i]);
+        }
+        if(ln_ctx->path_list){
+          ln_target_dir_list(ln_ctx, ln_ctx->path_list, &pool);
+        }
+      }
+      ln_pool_finish(&pool);
+    }
+    if(close(target_dirfd) != 0){
+      ln_warn(ln_ctx, true, "close(%s)", target_dir);
+    }
+  }
+}
+
+/**
+ * Directory waiting to get mirrored by the recursive walker (-R).
+ */
+struct ln_tree_dir{
+  /**
+   * Next directory on the @ref ln_tree::stack.
+   */
+  struct ln_tree_dir *next;
+
+  /**
+   * Path of the source directory, stored in the same allocation.
+   */
+  char *path_source;
+
+  /**
+   * Path of the matching target directory, stored in the same allocation.
+   */
+  char *path_target;
+
+  /**
+   * Owner permission bits added when creating the target directory, which
+   * get cleared again once its entries have been linked. See
+   * @ref ln_tree_mkdir.
+   */
+  mode_t mode_clear;
+};
+
+/**
+ * Shared state of the recursive walker (-R).
+ *
+ * Directories still waiting to get processed sit on a shared stack. Each
+ * worker thread pops a directory, links every file inside it, and pushes
+ * the subdirectories back onto the stack, so the other threads can pick up
+ * any part of the tree as soon as it gets discovered. Popping the most
+ * recently pushed directory first keeps the walk depth-first, which bounds
+ * the size of the stack on wide trees.
+ */
+struct ln_tree{
+  /**
+   * See @ref ln_ctx.
+   */
+  struct ln_ctx *ln_ctx;
+
+  /**
+   * Device ID of the target root directory.
+   */
+  dev_t target_dev;
+
+  /**
+   * Inode number of the target root directory, which does not get descended
+   * into if it lives inside the source tree.
+   */
+  ino_t target_ino;
+
+  /**
+   * Protects @ref stack and @ref nactive.
+   */
+  pthread_mutex_t mutex;
+
+  /**
+   * Signaled when a directory gets pushed or the walk finishes.
+   */
+  pthread_cond_t cond;
+
+  /**
+   * Directories waiting to get processed.
+   */
+  struct ln_tree_dir *stack;
+
+  /**
+   * Number of threads currently processing a directory. The walk finishes
+   * once the stack is empty and no threads are active.
+   */
+  size_t nactive;
+};
+
+/**
+ * Push a directory onto the stack of the recursive walker.
+ *
+ * @param[in,out] tree        See @ref ln_tree.
+ * @param[in]     path_source Source directory to mirror.
+ * @param[in]     path_target Existing target directory to store the links.
+ * @param[in]     mode_clear  See @ref ln_tree_dir::mode_clear.
+ */
+static void
+ln_tree_push(struct ln_tree *const tree,
+             const char *const path_source,
+             const char *const path_target,
+             const mode_t mode_clear){
+  struct ln_tree_dir *dir;
+  size_t source_sz;
+  size_t target_sz;
+  size_t sz;
+
+  source_sz = strlen(path_source) + 1;
+  target_sz = strlen(path_target) + 1;
+  if(!si_add_size_t(source_sz, target_sz, &sz) ||
+     !si_add_size_t(sz, sizeof(*dir), &sz) ||
+     (dir = malloc(sz)) == NULL){
+    ln_warn(tree->ln_ctx, true, "alloc");
+  }
+  else{
+    dir->path_source = (char *)(dir + 1);
+    dir->path_target = dir->path_source + source_sz;
+    memcpy(dir->path_source, path_source, source_sz);
+    memcpy(dir->path_target, path_target, target_sz);
+    dir->mode_clear = mode_clear;
+    pthread_mutex_lock(&tree->mutex);
+    dir->next = tree->stack;
+    tree->stack = dir;
+    pthread_cond_signal(&tree->cond);
+    pthread_mutex_unlock(&tree->mutex);
+  }
+}
+
+/**
+ * Create a target directory with the permissions of a source directory.
+ *
+ * The owner always gets write and search permission at first, so that the
+ * entries of a read-only source directory can still get linked into the
+ * new directory.
+ *
+ * @param[in]  dirfd      Directory to create @p name in, or AT_FDCWD.
+ * @param[in]  name       Directory to create.
+ * @param[in]  mode       Mode of the source directory.
+ * @param[out] mode_clear Owner permission bits to clear once the entries
+ *                        have been linked, or 0 if none or the directory
+ *                        already existed.
+ * @retval     0          Created the directory, or it already exists.
+ * @retval     -1         Failed to create the directory, errno set.
+ */
+static int
+ln_tree_mkdir(const int dirfd,
+              const char *const name,
+              const mode_t mode,
+              mode_t *const mode_clear){
+  int rc;
+
+  *mode_clear = 0;
+  rc = mkdirat(dirfd, name, S_IRWXU | (mode & 07777));
+  if(rc == 0){
+    *mode_clear = S_IRWXU & ~mode;
+  }
+  else if(errno == EEXIST){
+    rc = 0;
+  }
+  return rc;
+}
+
+/**
+ * Check if a directory entry refers to a directory, without following
+ * symbolic links.
+ *
+ * Uses the file type returned along with the entry when available to avoid
+ * calling fstatat on every entry.
+ *
+ * @param[in]  dirfd  Directory containing @p ent.
+ * @param[in]  ent    Entry returned by readdir.
+ * @param[out] is_dir Set to true if @p ent is a directory.
+ * @retval     true   Got the file type of @p ent.
+ * @retval     false  Failed to get the file type, errno set.
+ */
+static bool
+ln_tree_is_dir(const int dirfd,
+               const struct dirent *const ent,
+               bool *const is_dir){
+  struct stat sb;
+  bool ok;
+
+  ok = true;
+#ifdef DT_DIR
+  if(ent->d_type != DT_UNKNOWN){
+    *is_dir = (ent->d_type == DT_DIR);
+  }
+  else
+#endif /* DT_DIR */
+  if(fstatat(dirfd, ent->d_name, &sb, AT_SYMLINK_NOFOLLOW) == 0){
+    *is_dir = S_ISDIR(sb.st_mode);
+  }
+  else{
+    ok = false;
+  }
+  return ok;
+}
+
+/**
+ * Mirror a subdirectory of the source tree into the target tree.
+ *
+ * Creates the target directory with the same permissions as the source
+ * directory, see @ref ln_tree_mkdir, and pushes it onto the stack. An
+ * existing target directory gets reused.
+ *
+ * @param[in,out] tree         See @ref ln_tree.
+ * @param[in]     source_dirfd Directory containing the subdirectory.
+ * @param[in]     target_dirfd Directory to create the subdirectory in.
+ * @param[in]     name         Name of the subdirectory.
+ * @param[in]     path_source  Full path of the source subdirectory.
+ * @param[in]     path_target  Full path of the target subdirectory.
+ */
+static void
+ln_tree_subdir(struct ln_tree *const tree,
+               const int source_dirfd,
+               const int target_dirfd,
+               const char *const name,
+               const char *const path_source,
+               const char *const path_target){
+  struct stat sb;
+  mode_t mode_clear;
+
+  if(fstatat(source_dirfd, name, &sb, AT_SYMLINK_NOFOLLOW) != 0){
+    ln_warn(tree->ln_ctx, true, "lstat(%s)", path_source);
+  }
+  else if(sb.st_dev == tree->target_dev && sb.st_ino == tree->target_ino){
+    /* Do not mirror the target tree into itself. */
+  }
+  else if(ln_tree_mkdir(target_dirfd, name, sb.st_mode, &mode_clear) != 0){
+    ln_warn(tree->ln_ctx, true, "mkdir(%s)", path_target);
+  }
+  else{
+    ln_tree_push(tree, path_source, path_target, mode_clear);
+  }
+}
+
+/**
+ * Link every file inside a source directory into the target directory, and
+ * push each subdirectory onto the stack.
+ *
+ * Each file gets linked by @ref ln_create_link relative to the open source
+ * and target directories, so the (-f), (-L), (-P), and (-s) arguments apply
+ * the same way as for a single file. Symbolic links to directories get
+ * linked like any other file and never get descended into. Afterwards, the
+ * owner permission bits added by @ref ln_tree_mkdir get cleared again.
+ *
+ * @param[in,out] tree        See @ref ln_tree.
+ * @param[in]     dir         Directory popped off the stack.
+ * @param[in,out] path_source Path buffer of the calling thread used for the
+ *                            entries in the source directory.
+ * @param[in,out] path_target Path buffer of the calling thread used for the
+ *                            entries in the target directory.
+ */
+static void
+ln_tree_dir(struct ln_tree *const tree,
+            const struct ln_tree_dir *const dir,
+            struct ln_path_buf *const path_source,
+            struct ln_path_buf *const path_target){
+  int source_dirfd;
+  int target_dirfd;
+  DIR *dp;
+  struct dirent *ent;
+  const char *path_source_ent;
+  const char *path_target_ent;
+  size_t name_len;
+  bool is_dir;
+  struct ln_path source;
+  struct ln_path dest;
+  struct stat sb;
+
+  dp = NULL;
+  source_dirfd = -1;
+  target_dirfd = -1;
+  if(!ln_path_buf_prefix(path_source, dir->path_source) ||
+     !ln_path_buf_prefix(path_target, dir->path_target)){
+    ln_warn(tree->ln_ctx, true, "alloc");
+  }
+  else if((source_dirfd = open(dir->path_source,
+                               O_RDONLY | O_DIRECTORY)) < 0){
+    ln_warn(tree->ln_ctx, true, "open(%s)", dir->path_source);
+  }
+  else if((target_dirfd = open(dir->path_target, LN_O_DIRFD)) < 0){
+    ln_warn(tree->ln_ctx, true, "open(%s)", dir->path_target);
+    close(source_dirfd);
+  }
+  else if((dp = fdopendir(source_dirfd)) == NULL){
+    ln_warn(tree->ln_ctx, true, "opendir(%s)", dir->path_source);
+    close(source_dirfd);
+  }
+  if(dp){
+    errno = 0;
+    while((ent = readdir(dp)) != NULL){
+      name_len = strlen(ent->d_name);
+      if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0){
+        /* Skip. */
+      }
+      else if((path_source_ent = ln_path_buf_name(path_source,
+                                                  ent->d_name,
+                                                  name_len)) == NULL ||
+              (path_target_ent = ln_path_buf_name(path_target,
+                                                  ent->d_name,
+                                                  name_len)) == NULL){
+        ln_warn(tree->ln_ctx, true, "alloc");
+      }
+      else if(!ln_tree_is_dir(source_dirfd, ent, &is_dir)){
+        ln_warn(tree->ln_ctx, true, "lstat(%s)", path_source_ent);
+      }
+      else if(is_dir){
+        ln_tree_subdir(tree,
+                       source_dirfd,
+                       target_dirfd,
+                       ent->d_name,
+                       path_source_ent,
+                       path_target_ent);
+      }
+      else{
+        source.dirfd = source_dirfd;
+        source.name = ent->d_name;
+        source.path = path_source_ent;
+        dest.dirfd = target_dirfd;
+        dest.name = ent->d_name;
+        dest.path = path_target_ent;
+        ln_create_link(tree->ln_ctx, &source, &dest);
+      }
+      errno = 0;
+    }
+    if(errno != 0){
+      ln_warn(tree->ln_ctx, true, "readdir(%s)", dir->path_source);
+    }
+    closedir(dp);
+  }
+  if(target_dirfd >= 0){
+    close(target_dirfd);
+  }
+  if(dir->mode_clear != 0 &&
+     (fstatat(AT_FDCWD, dir->path_target, &sb, 0) != 0 ||
+      fchmodat(AT_FDCWD,
+               dir->path_target,
+               sb.st_mode & 07777 & ~dir->mode_clear,
+               0) != 0)){
+    ln_warn(tree->ln_ctx, true, "chmod(%s)", dir->path_target);
+  }
+}
+
+/**
+ * Worker thread entry point of the recursive walker, which processes
+ * directories off the stack until the whole tree has been walked.
+ *
+ * @param[in,out] arg  See @ref ln_tree.
+ * @retval        NULL Always returns NULL.
+ */
+static void *
+ln_tree_worker(void *arg){
+  struct ln_tree *tree;
+  struct ln_tree_dir *dir;
+  struct ln_path_buf path_source;
+  struct ln_path_buf path_target;
+
+  tree = arg;
+  memset(&path_source, 0, sizeof(path_source));
+  memset(&path_target, 0, sizeof(path_target));
+  pthread_mutex_lock(&tree->mutex);
+  while(true){
+    while(tree->stack == NULL && tree->nactive > 0){
+      pthread_cond_wait(&tree->cond, &tree->mutex);
+    }
+    if(tree->stack == NULL){
+      break;
+    }
+    dir = tree->stack;
+    tree->stack = dir->next;
+    tree->nactive += 1;
+    pthread_mutex_unlock(&tree->mutex);
+
+    ln_tree_dir(tree, dir, &path_source, &path_target);
+    free(dir);
+
+    pthread_mutex_lock(&tree->mutex);
+    tree->nactive -= 1;
+    if(tree->stack == NULL && tree->nactive == 0){
+      pthread_cond_broadcast(&tree->cond);
+    }
+  }
+  pthread_mutex_unlock(&tree->mutex);
+  ln_path_buf_free(&path_source);
+  ln_path_buf_free(&path_target);
+  return NULL;
+}
+
+/**
+ * Mirror the directory structure of a source tree into a target directory
+ * and link every file inside it (-R).
+ *
+ * The target directory gets created if it does not exist. The tree gets
+ * walked by the calling thread plus any additional threads requested by the
+ * (-j) argument.
+ *
+ * @param[in,out] ln_ctx      See @ref ln_ctx.
+ * @param[in]     source_dir  Root of the source tree.
+ * @param[in]     target_dir  Root of the target tree.
+ */
+static void
+ln_tree(struct ln_ctx *const ln_ctx,
+        const char *const source_dir,
+        const char *const target_dir){
+  struct ln_tree tree;
+  struct stat sb;
+  char *path_source;
+  mode_t mode_clear;
+  pthread_t *thread_list;
+  size_t nthread;
+  size_t i;
+  int rc;
+
+  path_source = NULL;
+  if(stat(source_dir, &sb) != 0){
+    ln_warn(ln_ctx, true, "stat(%s)", source_dir);
+  }
+  else if(!S_ISDIR(sb.st_mode)){
+    ln_warn(ln_ctx, false, "not a directory: %s", source_dir);
+  }
+  else if(ln_tree_mkdir(AT_FDCWD, target_dir, sb.st_mode, &mode_clear) != 0){
+    ln_warn(ln_ctx, true, "mkdir(%s)", target_dir);
+  }
+  else if(stat(target_dir, &sb) != 0 || !S_ISDIR(sb.st_mode)){
+    ln_warn(ln_ctx, false, "not a directory: %s", target_dir);
+  }
+  else if((ln_ctx->flags & LN_FLAG_SYMBOLIC) &&
+          (path_source = realpath(source_dir, NULL)) == NULL){
+    ln_warn(ln_ctx, true, "realpath(%s)", source_dir);
+  }
+  else{
+    memset(&tree, 0, sizeof(tree));
+    tree.ln_ctx = ln_ctx;
+    tree.target_dev = sb.st_dev;
+    tree.target_ino = sb.st_ino;
+    pthread_mutex_init(&tree.mutex, NULL);
+    pthread_cond_init(&tree.cond, NULL);
+    ln_tree_push(&tree,
+                 path_source ? path_source : source_dir,
+                 target_dir,
+                 mode_clear);
+
+    nthread = 0;
+    thread_list = NULL;
+    if(ln_ctx->nthread > 1){
+      thread_list = malloc((ln_ctx->nthread - 1) * sizeof(*thread_list));
+      if(thread_list == NULL){
+        ln_warn(ln_ctx, true, "alloc");
+      }
+      else{
+        for(i = 0; i < ln_ctx->nthread - 1; i++){
+          rc = pthread_create(&thread_list[i], NULL, ln_tree_worker, &tree);
+          if(rc != 0){
+            errno = rc;
+            ln_warn(ln_ctx, true, "pthread_create");
+            break;
+          }
+          nthread += 1;
+        }
+      }
+    }
+    ln_tree_worker(&tree);
+    for(i = 0; i < nthread; i++){
+      pthread_join(thread_list[i], NULL);
+    }
+    free(thread_list);
+    pthread_cond_destroy(&tree.cond);
+    pthread_mutex_destroy(&tree.mutex);
+  }
+  free(path_source);
+}
+
+/**
+ * Number of bytes at the start of a file covered by the partial hash of
+ * the deduplication mode (-D).
+ */
+#define LN_DEDUP_PARTIAL_SZ 4096
+
+/**
+ * Size of the read buffers used to hash and compare files (-D).
+ */
+#define LN_DEDUP_BUF_SZ (256 * 1024)
+
+/**
+ * Maximum number of files open at the same time while sharing the extents
+ * of one run of duplicates (-c).
+ */
+#define LN_DEDUP_SHARE_BATCH 64
+
+/**
+ * Identifies a deduplication index file (-I).
+ */
+#define LN_DEDUP_INDEX_MAGIC "LNDEDUP\n"
+
+/**
+ * Format version of the deduplication index file (-I).
+ */
+#define LN_DEDUP_INDEX_VERSION 1
+
+/**
+ * Set in @ref ln_dedup_index_entry::flags if the partial hash is valid.
+ */
+#define LN_DEDUP_INDEX_PARTIAL ((uint32_t)(1 << 0))
+
+/**
+ * Set in @ref ln_dedup_index_entry::flags if the full hash is valid.
+ */
+#define LN_DEDUP_INDEX_FULL ((uint32_t)(1 << 1))
+
+/**
+ * Header at the start of a deduplication index file (-I).
+ *
+ * The header gets followed by @ref nentry entries sorted by device and
+ * inode number, so the file can get mapped into memory and searched in
+ * place. The index only describes the local machine and gets stored in
+ * native byte order.
+ */
+struct ln_dedup_index_hdr{
+  /**
+   * Set to @ref LN_DEDUP_INDEX_MAGIC.
+   */
+  char magic[8];
+
+  /**
+   * Set to @ref LN_DEDUP_INDEX_VERSION.
+   */
+  uint32_t version;
+
+  /**
+   * Size of each entry in bytes.
+   */
+  uint32_t entry_sz;
+
+  /**
+   * Number of entries following the header.
+   */
+  uint64_t nentry;
+
+  /**
+   * Hash of all entries, which detects a truncated or damaged index.
+   */
+  uint64_t checksum;
+};
+
+/**
+ * Hashes of one inode stored in a deduplication index file (-I).
+ *
+ * An entry only gets used if the size, modification time, and status change
+ * time of the inode still match. Writing to a file or changing its link
+ * count updates the status change time, so a stale entry gets detected
+ * without reading the file.
+ */
+struct ln_dedup_index_entry{
+  /**
+   * Device ID.
+   */
+  uint64_t dev;
+
+  /**
+   * Inode number.
+   */
+  uint64_t ino;
+
+  /**
+   * File size.
+   */
+  uint64_t size;
+
+  /**
+   * Last modification time in nanoseconds.
+   */
+  uint64_t mtime_ns;
+
+  /**
+   * Last status change time in nanoseconds.
+   */
+  uint64_t ctime_ns;
+
+  /**
+   * See @ref ln_dedup_file::hash_partial.
+   */
+  uint64_t hash_partial;
+
+  /**
+   * See @ref ln_dedup_file::hash_full.
+   */
+  uint64_t hash_full;
+
+  /**
+   * @ref LN_DEDUP_INDEX_PARTIAL and @ref LN_DEDUP_INDEX_FULL.
+   */
+  uint32_t flags;
+
+  /**
+   * Set to zero.
+   */
+  uint32_t reserved;
+};
+
+/**
+ * Regular file found by the deduplication mode (-D).
+ */
+struct ln_dedup_file{
+  /**
+   * Path of the file.
+   */
+  char *path;
+
+  /**
+   * Hash of the first @ref LN_DEDUP_PARTIAL_SZ bytes.
+   */
+  uint64_t hash_partial;
+
+  /**
+   * Hash of the whole file.
+   */
+  uint64_t hash_full;
+
+  /**
+   * File size.
+   */
+  off_t size;
+
+  /**
+   * Last modification time, checked again before replacing the file.
+   */
+  struct timespec mtime;
+
+  /**
+   * Last status change time, used to find stale index entries (-I).
+   */
+  struct timespec ctime;
+
+  /**
+   * Device ID.
+   */
+  dev_t dev;
+
+  /**
+   * Inode number.
+   */
+  ino_t ino;
+
+  /**
+   * Number of hard links, used to pick the inode the others get linked to.
+   */
+  nlink_t nlink;
+
+  /**
+   * File mode. Only files with the same mode, owner, and group get linked
+   * together, so replacing a file does not change its permissions.
+   */
+  mode_t mode;
+
+  /**
+   * Owner.
+   */
+  uid_t uid;
+
+  /**
+   * Group.
+   */
+  gid_t gid;
+
+  /**
+   * Set on the first path of each inode that needs hashing in the current
+   * pass.
+   */
+  bool want_hash;
+
+  /**
+   * Set if the file could not get read, excluding it from linking.
+   */
+  bool skip;
+
+  /**
+   * Set if @ref hash_partial holds a valid hash.
+   */
+  bool hashed_partial;
+
+  /**
+   * Set if @ref hash_full holds a valid hash.
+   */
+  bool hashed_full;
+
+  /**
+   * Set if the path got replaced by a link to another inode.
+   */
+  bool linked;
+};
+
+/**
+ * Shared state of the deduplication mode (-D).
+ *
+ * Finds identical files in three passes over the file list, each one only
+ * looking at the files that still might have a duplicate:
+ *   1. Group by device, size, mode, owner, and group.
+ *   2. Hash the first @ref LN_DEDUP_PARTIAL_SZ bytes.
+ *   3. Hash the whole file.
+ *
+ * The files of each hashing pass get spread across the worker threads.
+ * Paths that already share an inode count as one file, so they only get
+ * read once and do not get linked again.
+ */
+struct ln_dedup{
+  /**
+   * See @ref ln_ctx.
+   */
+  struct ln_ctx *ln_ctx;
+
+  /**
+   * Regular files found in the trees.
+   */
+  struct ln_dedup_file *file_list;
+
+  /**
+   * Number of files in @ref file_list.
+   */
+  size_t nfile;
+
+  /**
+   * Allocated number of files in @ref file_list.
+   */
+  size_t file_sz;
+
+  /**
+   * Directories waiting to get read.
+   */
+  char **dir_list;
+
+  /**
+   * Number of directories in @ref dir_list.
+   */
+  size_t ndir;
+
+  /**
+   * Allocated number of directories in @ref dir_list.
+   */
+  size_t dir_sz;
+
+  /**
+   * Protects @ref next.
+   */
+  pthread_mutex_t mutex;
+
+  /**
+   * Index of the next file to check in the current hashing pass.
+   */
+  size_t next;
+
+  /**
+   * Set if the current hashing pass hashes whole files.
+   */
+  bool full;
+
+  /**
+   * Entries of the index file mapped into memory (-I), or NULL.
+   */
+  const struct ln_dedup_index_entry *index;
+
+  /**
+   * Number of entries in @ref index.
+   */
+  size_t nindex;
+
+  /**
+   * Memory mapping of the index file, or NULL.
+   */
+  void *index_map;
+
+  /**
+   * Size of @ref index_map in bytes.
+   */
+  size_t index_map_sz;
+};
+
+/**
+ * Mix a buffer into a hash, eight bytes at a time.
+ *
+ * Not a cryptographic hash. Files with matching hashes always get compared
+ * byte by byte before getting linked.
+ *
+ * @param[in] hash Hash of the preceding bytes.
+ * @param[in] buf  Bytes to add.
+ * @param[in] len  Number of bytes in @p buf.
+ * @return         Updated hash.
+ */
+static uint64_t
+ln_dedup_hash_buf(uint64_t hash,
+                  const unsigned char *const buf,
+                  const size_t len){
+  uint64_t word;
+  size_t i;
+
+  for(i = 0; i + sizeof(word) <= len; i += sizeof(word)){
+    memcpy(&word, &buf[i], sizeof(word));
+    hash = (hash ^ word) * UINT64_C(0x9e3779b97f4a7c15);
+    hash ^= hash >> 29;
+  }
+  for(; i < len; i++){
+    hash = (hash ^ buf[i]) * UINT64_C(0x100000001b3);
+  }
+  return hash;
+}
+
+/**
+ * Hash the start of a file, or the whole file.
+ *
+ * @param[in,out] file See @ref ln_dedup_file.
+ * @param[in]     full Hash the whole file instead of its start.
+ * @param[out]    buf  Read buffer of @ref LN_DEDUP_BUF_SZ bytes.
+ * @retval        true  Stored the hash in @p file.
+ * @retval        false Failed to read the file, errno set.
+ */
+static bool
+ln_dedup_hash_file(struct ln_dedup_file *const file,
+                   const bool full,
+                   unsigned char *const buf){
+  uint64_t hash;
+  ssize_t rc;
+  int fd;
+  bool ok;
+
+  hash = UINT64_C(0xcbf29ce484222325);
+  fd = open(file->path, O_RDONLY);
+  ok = fd >= 0;
+  if(ok && full){
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    while((rc = read(fd, buf, LN_DEDUP_BUF_SZ)) > 0){
+      hash = ln_dedup_hash_buf(hash, buf, (size_t)rc);
+    }
+    ok = rc == 0;
+    file->hash_full = hash;
+    file->hashed_full = ok;
+  }
+  else if(ok){
+    rc = read(fd, buf, LN_DEDUP_PARTIAL_SZ);
+    ok = rc >= 0;
+    if(ok){
+      file->hash_partial = ln_dedup_hash_buf(hash, buf, (size_t)rc);
+      file->hashed_partial = true;
+    }
+  }
+  if(fd >= 0){
+    close(fd);
+  }
+  return ok;
+}
+
+/**
+ * Convert a file timestamp to nanoseconds.
+ *
+ * @param[in] ts Timestamp.
+ * @return       Nanoseconds since the epoch.
+ */
+static uint64_t
+ln_dedup_ns(const struct timespec *const ts){
+  return (uint64_t)ts->tv_sec * UINT64_C(1000000000) + (uint64_t)ts->tv_nsec;
+}
+
+/**
+ * Order index entries by device and inode number.
+ *
+ * @param[in] a  First entry.
+ * @param[in] b  Second entry.
+ * @retval    -1 @p a sorts before @p b.
+ * @retval    0  Same inode.
+ * @retval    1  @p a sorts after @p b.
+ */
+static int
+ln_dedup_index_cmp(const void *a,
+                   const void *b){
+  const struct ln_dedup_index_entry *ea;
+  const struct ln_dedup_index_entry *eb;
+  int cmp;
+
+  ea = a;
+  eb = b;
+  cmp = (ea->dev > eb->dev) - (ea->dev < eb->dev);
+  if(cmp == 0){
+    cmp = (ea->ino > eb->ino) - (ea->ino < eb->ino);
+  }
+  return cmp;
+}
+
+/**
+ * Map the index file from a previous run into memory (-I).
+ *
+ * A missing index counts as empty. An index that fails validation, for
+ * example one written by a different version, gets ignored and then
+ * replaced at the end of the run.
+ *
+ * @param[in,out] dedup See @ref ln_dedup.
+ * @param[in]     path  Path of the index file.
+ */
+static void
+ln_dedup_index_load(struct ln_dedup *const dedup,
+                    const char *const path){
+  const struct ln_dedup_index_hdr *hdr;
+  const struct ln_dedup_index_entry *entry_list;
+  struct stat sb;
+  void *map;
+  size_t map_sz;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if(fd < 0){
+    if(errno != ENOENT){
+      ln_warn(dedup->ln_ctx, true, "open(%s)", path);
+    }
+  }
+  else if(fstat(fd, &sb) != 0){
+    ln_warn(dedup->ln_ctx, true, "fstat(%s)", path);
+  }
+  else if(sb.st_size >= (off_t)sizeof(*hdr) &&
+          (uintmax_t)sb.st_size <= SIZE_MAX){
+    map_sz = (size_t)sb.st_size;
+    map = mmap(NULL, map_sz, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED){
+      ln_warn(dedup->ln_ctx, true, "mmap(%s)", path);
+    }
+    else{
+      hdr = map;
+      entry_list = (const void *)&hdr[1];
+      if(memcmp(hdr->magic, LN_DEDUP_INDEX_MAGIC, sizeof(hdr->magic)) == 0 &&
+         hdr->version == LN_DEDUP_INDEX_VERSION &&
+         hdr->entry_sz == sizeof(*entry_list) &&
+         hdr->nentry == (map_sz - sizeof(*hdr)) / sizeof(*entry_list) &&
+         (map_sz - sizeof(*hdr)) % sizeof(*entry_list) == 0 &&
+         hdr->checksum == ln_dedup_hash_buf(0,
+                                            (const void *)entry_list,
+                                            map_sz - sizeof(*hdr))){
+        dedup->index = entry_list;
+        dedup->nindex = (size_t)hdr->nentry;
+      }
+      dedup->index_map = map;
+      dedup->index_map_sz = map_sz;
+    }
+  }
+  if(fd >= 0){
+    close(fd);
+  }
+}
+
+/**
+ * Find the index entry of a file (-I).
+ *
+ * @param[in] dedup                        See @ref ln_dedup.
+ * @param[in] file                         See @ref ln_dedup_file.
+ * @retval    const ln_dedup_index_entry*  Current entry of the inode.
+ * @retval    NULL                         No entry, or the inode changed
+ *                                         since the entry got stored.
+ */
+static const struct ln_dedup_index_entry *
+ln_dedup_index_find(const struct ln_dedup *const dedup,
+                    const struct ln_dedup_file *const file){
+  const struct ln_dedup_index_entry *entry;
+  struct ln_dedup_index_entry key;
+
+  entry = NULL;
+  if(dedup->nindex > 0){
+    key.dev = (uint64_t)file->dev;
+    key.ino = (uint64_t)file->ino;
+    entry = bsearch(&key,
+                    dedup->index,
+                    dedup->nindex,
+                    sizeof(*dedup->index),
+                    ln_dedup_index_cmp);
+    if(entry &&
+       (entry->size != (uint64_t)file->size ||
+        entry->mtime_ns != ln_dedup_ns(&file->mtime) ||
+        entry->ctime_ns != ln_dedup_ns(&file->ctime))){
+      entry = NULL;
+    }
+  }
+  return entry;
+}
+
+/**
+ * Get a hash from the index instead of reading the file (-I).
+ *
+ * @param[in]     dedup See @ref ln_dedup.
+ * @param[in,out] file  Store the hash in this file if found.
+ * @param[in]     full  Get the full hash instead of the partial hash.
+ * @retval        true  Found a current entry with the requested hash.
+ * @retval        false Must hash the file.
+ */
+static bool
+ln_dedup_index_get(const struct ln_dedup *const dedup,
+                   struct ln_dedup_file *const file,
+                   const bool full){
+  const struct ln_dedup_index_entry *entry;
+  bool found;
+
+  entry = ln_dedup_index_find(dedup, file);
+  found = entry &&
+          (entry->flags & (full ? LN_DEDUP_INDEX_FULL :
+                                  LN_DEDUP_INDEX_PARTIAL));
+  if(found && full){
+    file->hash_full = entry->hash_full;
+    file->hashed_full = true;
+  }
+  else if(found){
+    file->hash_partial = entry->hash_partial;
+    file->hashed_partial = true;
+  }
+  return found;
+}
+
+/**
+ * Write the hashes of every inode found in this run to the index file (-I).
+ *
+ * The new index gets written to a temporary file, flushed to disk, and then
+ * renamed over the old index. The directory holding the index gets flushed
+ * after the rename, so a crash leaves either the old or the new index in
+ * place. Current entries of inodes that did not need hashing in
+ * this run get carried over, while inodes not found in this run get
+ * dropped from the index.
+ *
+ * @param[in,out] dedup See @ref ln_dedup.
+ * @param[in]     path  Path of the index file.
+ */
+static void
+ln_dedup_index_save(struct ln_dedup *const dedup,
+                    const char *const path){
+  struct ln_dedup_index_hdr hdr;
+  struct ln_dedup_index_entry *entry_list;
+  struct ln_dedup_index_entry *entry;
+  const struct ln_dedup_index_entry *old_entry;
+  const struct ln_dedup_file *file;
+  FILE *fp;
+  const char *sep;
+  char *tmp_path;
+  size_t tmp_path_sz;
+  size_t nentry;
+  size_t nkeep;
+  size_t i;
+  int dirfd;
+  bool ok;
+
+  tmp_path = NULL;
+  entry_list = malloc((dedup->nfile + 1) * sizeof(*entry_list));
+  if(si_add_size_t(strlen(path), LN_TMP_NAME_SZ, &tmp_path_sz)){
+    tmp_path = malloc(tmp_path_sz);
+  }
+  if(entry_list == NULL || tmp_path == NULL){
+    ln_warn(dedup->ln_ctx, true, "alloc");
+  }
+  else{
+    nentry = 0;
+    for(i = 0; i < dedup->nfile; i++){
+      file = &dedup->file_list[i];
+      if(!file->linked && file->hashed_partial){
+        entry = &entry_list[nentry++];
+        memset(entry, 0, sizeof(*entry));
+        entry->dev = (uint64_t)file->dev;
+        entry->ino = (uint64_t)file->ino;
+        entry->size = (uint64_t)file->size;
+        entry->mtime_ns = ln_dedup_ns(&file->mtime);
+        entry->ctime_ns = ln_dedup_ns(&file->ctime);
+        entry->hash_partial = file->hash_partial;
+        entry->flags = LN_DEDUP_INDEX_PARTIAL;
+        if(file->hashed_full){
+          entry->hash_full = file->hash_full;
+          entry->flags |= LN_DEDUP_INDEX_FULL;
+        }
+      }
+      else if(!file->linked &&
+              (old_entry = ln_dedup_index_find(dedup, file)) != NULL){
+        entry_list[nentry++] = *old_entry;
+      }
+    }
+
+    /* Keep one entry for each inode with multiple paths. */
+    qsort(entry_list, nentry, sizeof(*entry_list), ln_dedup_index_cmp);
+    nkeep = 0;
+    for(i = 0; i < nentry; i++){
+      if(nkeep == 0 ||
+         ln_dedup_index_cmp(&entry_list[nkeep - 1], &entry_list[i]) != 0){
+        entry_list[nkeep++] = entry_list[i];
+      }
+    }
+    nentry = nkeep;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, LN_DEDUP_INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = LN_DEDUP_INDEX_VERSION;
+    hdr.entry_sz = sizeof(*entry_list);
+    hdr.nentry = nentry;
+    hdr.checksum = ln_dedup_hash_buf(0,
+                                     (const void *)entry_list,
+                                     nentry * sizeof(*entry_list));
+    sprintf(tmp_path, "%s.%ld.tmp", path, (long)dedup->ln_ctx->pid);
+    fp = fopen(tmp_path, "w");
+    ok = fp &&
+         fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+         fwrite(entry_list, sizeof(*entry_list), nentry, fp) == nentry &&
+         fflush(fp) == 0 &&
+         fsync(fileno(fp)) == 0;
+    if(fp && fclose(fp) != 0){
+      ok = false;
+    }
+    if(!ok || rename(tmp_path, path) != 0){
+      ln_warn(dedup->ln_ctx, true, "failed to write index: %s", path);
+      remove(tmp_path);
+    }
+    else{
+      /* The temporary path buffer holds any prefix of the index path. */
+      sep = strrchr(path, '/');
+      if(sep == NULL){
+        strcpy(tmp_path, ".");
+      }
+      else if(sep == path){
+        strcpy(tmp_path, "/");
+      }
+      else{
+        memcpy(tmp_path, path, (size_t)(sep - path));
+        tmp_path[sep - path] = '\0';
+      }
+      dirfd = open(tmp_path, O_RDONLY | O_DIRECTORY);
+      if(dirfd < 0 || fsync(dirfd) != 0){
+        ln_warn(dedup->ln_ctx, true, "fsync(%s)", tmp_path);
+      }
+      if(dirfd >= 0){
+        close(dirfd);
+      }
+    }
+  }
+  free(entry_list);
+  free(tmp_path);
+}
+
+/**
+ * Worker thread entry point which hashes each file marked in the current
+ * pass until none remain.
+ *
+ * @param[in,out] arg  See @ref ln_dedup.
+ * @retval        NULL Always returns NULL.
+ */
+static void *
+ln_dedup_hash_worker(void *arg){
+  struct ln_dedup *dedup;
+  struct ln_dedup_file *file;
+  unsigned char *buf;
+  size_t i;
+
+  dedup = arg;
+  buf = malloc(LN_DEDUP_BUF_SZ);
+  if(buf == NULL){
+    ln_warn(dedup->ln_ctx, true, "alloc");
+  }
+  while(buf){
+    pthread_mutex_lock(&dedup->mutex);
+    while(dedup->next < dedup->nfile &&
+          !dedup->file_list[dedup->next].want_hash){
+      dedup->next += 1;
+    }
+    i = dedup->next;
+    if(i < dedup->nfile){
+      dedup->next += 1;
+    }
+    pthread_mutex_unlock(&dedup->mutex);
+    if(i == dedup->nfile){
+      break;
+    }
+    file = &dedup->file_list[i];
+    if(!ln_dedup_index_get(dedup, file, dedup->full) &&
+       !ln_dedup_hash_file(file, dedup->full, buf)){
+      ln_warn(dedup->ln_ctx, true, "read(%s)", file->path);
+      file->skip = true;
+    }
+  }
+  free(buf);
+  return NULL;
+}
+
+/**
+ * Order files so that candidate duplicates end up next to each other, with
+ * all paths of the same inode together.
+ *
+ * @param[in] a  First file.
+ * @param[in] b  Second file.
+ * @retval    -1 @p a sorts before @p b.
+ * @retval    0  Same inode.
+ * @retval    1  @p a sorts after @p b.
+ */
+static int
+ln_dedup_cmp(const void *a,
+             const void *b){
+  const struct ln_dedup_file *fa;
+  const struct ln_dedup_file *fb;
+  int cmp;
+
+  fa = a;
+  fb = b;
+  cmp = (fa->dev > fb->dev) - (fa->dev < fb->dev);
+  if(cmp == 0){
+    cmp = (fa->size > fb->size) - (fa->size < fb->size);
+  }
+  if(cmp == 0){
+    cmp = (fa->mode > fb->mode) - (fa->mode < fb->mode);
+  }
+  if(cmp == 0){
+    cmp = (fa->uid > fb->uid) - (fa->uid < fb->uid);
+  }
+  if(cmp == 0){
+    cmp = (fa->gid > fb->gid) - (fa->gid < fb->gid);
+  }
+  if(cmp == 0){
+    cmp = (fa->hash_partial > fb->hash_partial) -
+          (fa->hash_partial < fb->hash_partial);
+  }
+  if(cmp == 0){
+    cmp = (fa->hash_full > fb->hash_full) - (fa->hash_full < fb->hash_full);
+  }
+  if(cmp == 0){
+    cmp = (fa->ino > fb->ino) - (fa->ino < fb->ino);
+  }
+  return cmp;
+}
+
+/**
+ * Check if two files are the same inode.
+ *
+ * @param[in] fa    Compare with @p fb.
+ * @param[in] fb    Compare with @p fa.
+ * @retval    true  Same device and inode number.
+ * @retval    false Different files.
+ */
+static bool
+ln_dedup_same_inode(const struct ln_dedup_file *const fa,
+                    const struct ln_dedup_file *const fb){
+  return fa->dev == fb->dev && fa->ino == fb->ino;
+}
+
+/**
+ * Find the end of a run of files that might be duplicates of each other.
+ *
+ * @param[in] dedup See @ref ln_dedup.
+ * @param[in] first Index of the first file in the run.
+ * @param[out] ninode Number of different inodes in the run.
+ * @return          Index one past the last file in the run.
+ */
+static size_t
+ln_dedup_run(const struct ln_dedup *const dedup,
+             const size_t first,
+             size_t *const ninode){
+  const struct ln_dedup_file *fa;
+  const struct ln_dedup_file *fb;
+  size_t last;
+
+  *ninode = 1;
+  for(last = first + 1; last < dedup->nfile; last++){
+    fa = &dedup->file_list[last - 1];
+    fb = &dedup->file_list[last];
+    if(fa->dev != fb->dev ||
+       fa->size != fb->size ||
+       fa->mode != fb->mode ||
+       fa->uid != fb->uid ||
+       fa->gid != fb->gid ||
+       fa->hash_partial != fb->hash_partial ||
+       fa->hash_full != fb->hash_full){
+      break;
+    }
+    if(!ln_dedup_same_inode(fa, fb)){
+      *ninode += 1;
+    }
+  }
+  return last;
+}
+
+/**
+ * Run a worker function on the calling thread and on (-j) - 1 additional
+ * threads, and wait for all of them to finish.
+ *
+ * The work continues on the remaining threads if some of them fail to
+ * start.
+ *
+ * @param[in,out] ln_ctx See @ref ln_ctx.
+ * @param[in]     worker Thread entry point, given @p arg.
+ * @param[in,out] arg    Shared state of the workers.
+ */
+static void
+ln_parallel(struct ln_ctx *const ln_ctx,
+            void *(*worker)(void *),
+            void *const arg){
+  pthread_t *thread_list;
+  size_t nthread;
+  size_t i;
+  int rc;
+
+  nthread = 0;
+  thread_list = NULL;
+  if(ln_ctx->nthread > 1){
+    thread_list = malloc((ln_ctx->nthread - 1) * sizeof(*thread_list));
+    if(thread_list == NULL){
+      ln_warn(ln_ctx, true, "alloc");
+    }
+    else{
+      for(i = 0; i < ln_ctx->nthread - 1; i++){
+        rc = pthread_create(&thread_list[i], NULL, worker, arg);
+        if(rc != 0){
+          errno = rc;
+          ln_warn(ln_ctx, true, "pthread_create");
+          break;
+        }
+        nthread += 1;
+      }
+    }
+  }
+  worker(arg);
+  for(i = 0; i < nthread; i++){
+    pthread_join(thread_list[i], NULL);
+  }
+  free(thread_list);
+}
+
+/**
+ * Run one hashing pass over every inode that still might have a duplicate.
+ *
+ * Afterwards, the hash gets copied to the other paths of the same inode and
+ * the file list gets sorted again so that files with matching hashes end up
+ * next to each other.
+ *
+ * @param[in,out] dedup See @ref ln_dedup.
+ * @param[in]     full  Hash whole files instead of their start.
+ */
+static void
+ln_dedup_pass(struct ln_dedup *const dedup,
+              const bool full){
+  struct ln_dedup_file *file;
+  size_t first;
+  size_t last;
+  size_t ninode;
+  size_t i;
+
+  for(first = 0; first < dedup->nfile; first = last){
+    last = ln_dedup_run(dedup, first, &ninode);
+    for(i = first; i < last; i++){
+      file = &dedup->file_list[i];
+      file->want_hash = ninode > 1 &&
+                        (i == first ||
+                         !ln_dedup_same_inode(&file[-1], file));
+      if(file->want_hash && full && file->size <= LN_DEDUP_PARTIAL_SZ){
+        /* The partial hash already covers the whole file. */
+        file->want_hash = false;
+        file->hash_full = file->hash_partial;
+        file->hashed_full = file->hashed_partial;
+      }
+    }
+  }
+
+  dedup->next = 0;
+  dedup->full = full;
+  ln_parallel(dedup->ln_ctx, ln_dedup_hash_worker, dedup);
+
+  for(i = 1; i < dedup->nfile; i++){
+    file = &dedup->file_list[i];
+    if(ln_dedup_same_inode(&file[-1], file)){
+      file->hash_partial = file[-1].hash_partial;
+      file->hash_full = file[-1].hash_full;
+      file->hashed_partial = file[-1].hashed_partial;
+      file->hashed_full = file[-1].hashed_full;
+      file->skip = file[-1].skip;
+    }
+  }
+  qsort(dedup->file_list,
+        dedup->nfile,
+        sizeof(*dedup->file_list),
+        ln_dedup_cmp);
+}
+
+/**
+ * Compare the contents of two files byte by byte.
+ *
+ * @param[in,out] dedup  See @ref ln_dedup.
+ * @param[in]     fa     Compare with @p fb.
+ * @param[in]     fb     Compare with @p fa.
+ * @param[out]    buf_a  Read buffer of @ref LN_DEDUP_BUF_SZ bytes.
+ * @param[out]    buf_b  Read buffer of @ref LN_DEDUP_BUF_SZ bytes.
+ * @retval        true   Files have identical contents.
+ * @retval        false  Contents differ, or failed to read the files.
+ */
+static bool
+ln_dedup_equal(struct ln_dedup *const dedup,
+               const struct ln_dedup_file *const fa,
+               const struct ln_dedup_file *const fb,
+               unsigned char *const buf_a,
+               unsigned char *const buf_b){
+  int fd_a;
+  int fd_b;
+  ssize_t rc_a;
+  ssize_t rc_b;
+  bool equal;
+
+  equal = false;
+  fd_a = open(fa->path, O_RDONLY);
+  fd_b = fd_a < 0 ? -1 : open(fb->path, O_RDONLY);
+  if(fd_a < 0 || fd_b < 0){
+    ln_warn(dedup->ln_ctx, true, "open(%s)", fd_a < 0 ? fa->path : fb->path);
+  }
+  else{
+    do{
+      rc_a = read(fd_a, buf_a, LN_DEDUP_BUF_SZ);
+      rc_b = rc_a <= 0 ? rc_a : read(fd_b, buf_b, (size_t)rc_a);
+      equal = rc_a >= 0 &&
+              rc_a == rc_b &&
+              memcmp(buf_a, buf_b, (size_t)rc_a) == 0;
+    } while(equal && rc_a > 0);
+    if(rc_a < 0 || rc_b < 0){
+      ln_warn(dedup->ln_ctx,
+              true,
+              "read(%s)",
+              rc_a < 0 ? fa->path : fb->path);
+    }
+  }
+  if(fd_a >= 0){
+    close(fd_a);
+  }
+  if(fd_b >= 0){
+    close(fd_b);
+  }
+  return equal;
+}
+
+/**
+ * Check that a file has not changed since it got found.
+ *
+ * @param[in]  file  See @ref ln_dedup_file.
+ * @param[out] sb    Current file status.
+ * @retval     true  Same inode, size, and modification time.
+ * @retval     false File changed or removed.
+ */
+static bool
+ln_dedup_unchanged(const struct ln_dedup_file *const file,
+                   struct stat *const sb){
+  return fstatat(AT_FDCWD, file->path, sb, AT_SYMLINK_NOFOLLOW) == 0 &&
+         sb->st_dev == file->dev &&
+         sb->st_ino == file->ino &&
+         sb->st_size == file->size &&
+         sb->st_mtim.tv_sec == file->mtime.tv_sec &&
+         sb->st_mtim.tv_nsec == file->mtime.tv_nsec;
+}
+
+/**
+ * Link the duplicates in a run of files with matching hashes.
+ *
+ * The inode with the most hard links gets kept, and every path of each
+ * other inode with identical contents gets atomically replaced by a hard
+ * link to it with @ref ln_replace_dest. Files that changed since they got
+ * hashed get left alone. Since the inode with the most links gets kept,
+ * new duplicates get linked to the inode that earlier runs already linked
+ * their copies to.
+ *
+ * @param[in,out] dedup See @ref ln_dedup.
+ * @param[in]     first Index of the first file in the run.
+ * @param[in]     last  Index one past the last file in the run.
+ * @param[out]    buf_a Read buffer of @ref LN_DEDUP_BUF_SZ bytes.
+ * @param[out]    buf_b Read buffer of @ref LN_DEDUP_BUF_SZ bytes.
+ */
+static void
+ln_dedup_link_run(struct ln_dedup *const dedup,
+                  const size_t first,
+                  const size_t last,
+                  unsigned char *const buf_a,
+                  unsigned char *const buf_b){
+  struct ln_dedup_file *keep;
+  struct ln_dedup_file *file;
+  struct stat source_sb;
+  struct stat dest_sb;
+  struct ln_path source;
+  struct ln_path dest;
+  size_t i;
+  bool equal;
+  bool relinked;
+
+  keep = NULL;
+  for(i = first; i < last; i++){
+    file = &dedup->file_list[i];
+    if(!file->skip && (keep == NULL || file->nlink > keep->nlink)){
+      keep = file;
+    }
+  }
+  dest.dirfd = AT_FDCWD;
+  equal = false;
+  relinked = false;
+  for(i = first; i < last; i++){
+    file = &dedup->file_list[i];
+    if(keep == NULL || file->skip || ln_dedup_same_inode(file, keep)){
+      /* Skip. */
+    }
+    else{
+      source.dirfd = AT_FDCWD;
+      source.name = keep->path;
+      source.path = keep->path;
+      if(i == first || !ln_dedup_same_inode(&file[-1], file)){
+        equal = ln_dedup_equal(dedup, keep, file, buf_a, buf_b);
+      }
+      if(equal &&
+         ln_dedup_unchanged(keep, &source_sb) &&
+         ln_dedup_unchanged(file, &dest_sb)){
+        dest.name = file->path;
+        dest.path = file->path;
+        if(ln_replace_dest(dedup->ln_ctx, &source, &source_sb, &dest) == 0){
+          file->linked = true;
+          relinked = true;
+        }
+      }
+    }
+  }
+
+  /*
+   * Adding links changed the status change time of the kept inode, so
+   * refresh it to keep its index entry current (-I).
+   */
+  if(relinked &&
+     fstatat(AT_FDCWD, keep->path, &source_sb, AT_SYMLINK_NOFOLLOW) == 0 &&
+     source_sb.st_dev == keep->dev &&
+     source_sb.st_ino == keep->ino){
+    for(i = first; i < last; i++){
+      file = &dedup->file_list[i];
+      if(ln_dedup_same_inode(file, keep)){
+        file->ctime = source_sb.st_ctim;
+      }
+    }
+  }
+}
+
+/**
+ * Share the extents of a source file with a batch of open duplicates (-c).
+ *
+ * @param[in,out] dedup     See @ref ln_dedup.
+ * @param[in]     keep      Source file.
+ * @param[in]     src_fd    Open file descriptor of @p keep.
+ * @param[in,out] dest_list Open duplicates, closed before returning.
+ * @param[in]     dest_file Duplicate file of each entry in @p dest_list.
+ * @param[in]     ndest     Number of duplicates in @p dest_list.
+ */
+static void
+ln_dedup_share_batch(struct ln_dedup *const dedup,
+                     const struct ln_dedup_file *const keep,
+                     const int src_fd,
+                     struct reflink_dest *const dest_list,
+                     const struct ln_dedup_file *const *const dest_file,
+                     const size_t ndest){
+  size_t i;
+
+  reflink_dedupe(src_fd, dest_list, ndest, (uint64_t)keep->size);
+  for(i = 0; i < ndest; i++){
+    if(dest_list[i].error != 0 && dest_list[i].error != REFLINK_DIFFERS){
+      errno = dest_list[i].error;
+      ln_warn(dedup->ln_ctx,
+              true,
+              "failed to share extents: %s - %s",
+              keep->path,
+              dest_file[i]->path);
+    }
+    close(dest_list[i].fd);
+  }
+}
+
+/**
+ * Share the extents of the duplicates in a run of files with matching
+ * hashes (-c).
+ *
+ * Unlike @ref ln_dedup_link_run, every file keeps its own inode. The kernel
+ * compares the contents of each range before sharing it, so the files do
+ * not get compared here. Contents that differ, for example because a file
+ * changed since it got hashed, just do not get shared.
+ *
+ * @param[in,out] dedup See @ref ln_dedup.
+ * @param[in]     first Index of the first file in the run.
+ * @param[in]     last  Index one past the last file in the run.
+ */
+static void
+ln_dedup_share_run(struct ln_dedup *const dedup,
+                   const size_t first,
+                   const size_t last){
+  struct reflink_dest dest_list[LN_DEDUP_SHARE_BATCH];
+  const struct ln_dedup_file *dest_file[LN_DEDUP_SHARE_BATCH];
+  const struct ln_dedup_file *keep;
+  const struct ln_dedup_file *file;
+  size_t ndest;
+  size_t i;
+  int src_fd;
+  int fd;
+
+  keep = NULL;
+  src_fd = -1;
+  ndest = 0;
+  for(i = first; i < last && (keep == NULL || src_fd >= 0); i++){
+    file = &dedup->file_list[i];
+    if(file->skip ||
+       (i > first && ln_dedup_same_inode(&file[-1], file))){
+      /* Skip. */
+    }
+    else if(keep == NULL){
+      keep = file;
+      src_fd = open(keep->path, O_RDONLY);
+      if(src_fd < 0){
+        ln_warn(dedup->ln_ctx, true, "open(%s)", keep->path);
+      }
+    }
+    else if((fd = open(file->path, O_RDONLY)) < 0){
+      ln_warn(dedup->ln_ctx, true, "open(%s)", file->path);
+    }
+    else{
+      dest_list[ndest].fd = fd;
+      dest_file[ndest++] = file;
+      if(ndest == LN_DEDUP_SHARE_BATCH){
+        ln_dedup_share_batch(dedup, keep, src_fd, dest_list, dest_file, ndest);
+        ndest = 0;
+      }
+    }
+  }
+  if(ndest > 0){
+    ln_dedup_share_batch(dedup, keep, src_fd, dest_list, dest_file, ndest);
+  }
+  if(src_fd >= 0){
+    close(src_fd);
+  }
+}
+
+/**
+ * Worker thread entry point which deduplicates each run of files with
+ * matching hashes until none remain.
+ *
+ * @param[in,out] arg  See @ref ln_dedup.
+ * @retval        NULL Always returns NULL.
+ */
+static void *
+ln_dedup_link_worker(void *arg){
+  struct ln_dedup *dedup;
+  unsigned char *buf_a;
+  unsigned char *buf_b;
+  size_t first;
+  size_t last;
+  size_t ninode;
+
+  dedup = arg;
+  buf_a = malloc(LN_DEDUP_BUF_SZ);
+  buf_b = malloc(LN_DEDUP_BUF_SZ);
+  if(buf_a == NULL || buf_b == NULL){
+    ln_warn(dedup->ln_ctx, true, "alloc");
+  }
+  else{
+    do{
+      pthread_mutex_lock(&dedup->mutex);
+      last = dedup->nfile;
+      for(first = dedup->next; first < dedup->nfile; first = last){
+        last = ln_dedup_run(dedup, first, &ninode);
+        if(ninode > 1){
+          break;
+        }
+      }
+      dedup->next = last;
+      pthread_mutex_unlock(&dedup->mutex);
+      if(first == dedup->nfile){
+        /* No runs remaining. */
+      }
+      else if(dedup->ln_ctx->flags & LN_FLAG_REFLINK){
+        ln_dedup_share_run(dedup, first, last);
+      }
+      else{
+        ln_dedup_link_run(dedup, first, last, buf_a, buf_b);
+      }
+    } while(first < dedup->nfile);
+  }
+  free(buf_a);
+  free(buf_b);
+  return NULL;
+}
+
+/**
+ * Add a directory to the list of directories waiting to get read.
+ *
+ * @param[in,out] dedup See @ref ln_dedup.
+ * @param[in]     path  Path of the directory, owned by @p dedup on success.
+ * @retval        true  Added the directory.
+ * @retval        false Failed to allocate memory.
+ */
+static bool
+ln_dedup_push_dir(struct ln_dedup *const dedup,
+                  char *const path){
+  char **dir_list;
+  size_t dir_sz;
+  bool ok;
+
+  ok = true;
+  if(dedup->ndir == dedup->dir_sz){
+    dir_sz = dedup->dir_sz ? dedup->dir_sz * 2 : 16;
+    dir_list = realloc(dedup->dir_list, dir_sz * sizeof(*dir_list));
+    if(dir_list == NULL){
+      ok = false;
+    }
+    else{
+      dedup->dir_list = dir_list;
+      dedup->dir_sz = dir_sz;
+    }
+  }
+  if(ok){
+    dedup->dir_list[dedup->ndir++] = path;
+  }
+  return ok;
+}
+
+/**
+ * Add an entry found while reading a directory.
+ *
+ * Subdirectories get queued, and regular files that are not empty get
+ * added to the file list. Everything else, including symbolic links, gets
+ * ignored.
+ *
+ * @param[in,out] dedup See @ref ln_dedup.
+ * @param[in]     dirfd Directory containing the entry.
+ * @param[in]     name  Name of the entry inside @p dirfd.
+ * @param[in]     path  Path of the entry, owned by @p dedup.
+ */
+static void
+ln_dedup_add(struct ln_dedup *const dedup,
+             const int dirfd,
+             const char *const name,
+             char *const path){
+  struct ln_dedup_file *file_list;
+  struct ln_dedup_file *file;
+  struct stat sb;
+  size_t file_sz;
+  bool keep;
+
+  keep = false;
+  if(fstatat(dirfd, name, &sb, AT_SYMLINK_NOFOLLOW) != 0){
+    ln_warn(dedup->ln_ctx, true, "lstat(%s)", path);
+  }
+  else if(S_ISDIR(sb.st_mode)){
+    keep = ln_dedup_push_dir(dedup, path);
+    if(!keep){
+      ln_warn(dedup->ln_ctx, true, "alloc");
+    }
+  }
+  else if(S_ISREG(sb.st_mode) && sb.st_size > 0){
+    if(dedup->nfile == dedup->file_sz){
+      file_sz = dedup->file_sz ? dedup->file_sz * 2 : 256;
+      file_list = realloc(dedup->file_list, file_sz * sizeof(*file_list));
+      if(file_list){
+        dedup->file_list = file_list;
+        dedup->file_sz = file_sz;
+      }
+    }
+    if(dedup->nfile == dedup->file_sz){
+      ln_warn(dedup->ln_ctx, true, "alloc");
+    }
+    else{
+      file = &dedup->file_list[dedup->nfile++];
+      memset(file, 0, sizeof(*file));
+      file->path = path;
+      file->size = sb.st_size;
+      file->mtime = sb.st_mtim;
+      file->ctime = sb.st_ctim;
+      file->dev = sb.st_dev;
+      file->ino = sb.st_ino;
+      file->nlink = sb.st_nlink;
+      /*
+       * Files with shared extents keep their own inode, so they do not
+       * need the same mode, owner, and group (-c).
+       */
+      if((dedup->ln_ctx->flags & LN_FLAG_REFLINK) == 0){
+        file->mode = sb.st_mode;
+        file->uid = sb.st_uid;
+        file->gid = sb.st_gid;
+      }
+      keep = true;
+    }
+  }
+  if(!keep){
+    free(path);
+  }
+}
+
+/**
+ * Read one directory, adding its entries with @ref ln_dedup_add.
+ *
+ * @param[in,out] dedup See @ref ln_dedup.
+ * @param[in]     dir   Path of the directory.
+ */
+static void
+ln_dedup_dir(struct ln_dedup *const dedup,
+             const char *const dir){
+  DIR *dp;
+  struct dirent *ent;
+  struct ln_path_buf pb;
+  char *path;
+
+  memset(&pb, 0, sizeof(pb));
+  dp = opendir(dir);
+  if(dp == NULL){
+    ln_warn(dedup->ln_ctx, true, "opendir(%s)", dir);
+  }
+  else if(!ln_path_buf_prefix(&pb, dir)){
+    ln_warn(dedup->ln_ctx, true, "alloc");
+  }
+  else{
+    errno = 0;
+    while((ent = readdir(dp)) != NULL){
+      if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0){
+        /* Skip. */
+      }
+      else if(ln_path_buf_name(&pb, ent->d_name, strlen(ent->d_name)) == NULL ||
+              (path = malloc(strlen(pb.buf) + 1)) == NULL){
+        ln_warn(dedup->ln_ctx, true, "alloc");
+      }
+      else{
+        strcpy(path, pb.buf);
+        ln_dedup_add(dedup, dirfd(dp), ent->d_name, path);
+      }
+      errno = 0;
+    }
+    if(errno != 0){
+      ln_warn(dedup->ln_ctx, true, "readdir(%s)", dir);
+    }
+  }
+  if(dp){
+    closedir(dp);
+  }
+  ln_path_buf_free(&pb);
+}
+
+/**
+ * Replace duplicate files inside directory trees with hard links (-D).
+ *
+ * @param[in,out] ln_ctx See @ref ln_ctx.
+ * @param[in]     argc   Number of directories in @p argv.
+ * @param[in]     argv   Directories to deduplicate.
+ */
+static void
+ln_dedup(struct ln_ctx *const ln_ctx,
+         const int argc,
+         char *const argv[]){
+  struct ln_dedup dedup;
+  struct stat sb;
+  char *path;
+  size_t i;
+  int a;
+
+  memset(&dedup, 0, sizeof(dedup));
+  dedup.ln_ctx = ln_ctx;
+  pthread_mutex_init(&dedup.mutex, NULL);
+  for(a = 0; a < argc; a++){
+    if(stat(argv[a], &sb) != 0){
+      ln_warn(ln_ctx, true, "stat(%s)", argv[a]);
+    }
+    else if(!S_ISDIR(sb.st_mode)){
+      ln_warn(ln_ctx, false, "not a directory: %s", argv[a]);
+    }
+    else if((path = malloc(strlen(argv[a]) + 1)) == NULL){
+      ln_warn(ln_ctx, true, "alloc");
+    }
+    else{
+      strcpy(path, argv[a]);
+      if(!ln_dedup_push_dir(&dedup, path)){
+        ln_warn(ln_ctx, true, "alloc");
+        free(path);
+      }
+    }
+  }
+  while(dedup.ndir > 0){
+    path = dedup.dir_list[--dedup.ndir];
+    ln_dedup_dir(&dedup, path);
+    free(path);
+  }
+
+  if(ln_ctx->dedup_index){
+    ln_dedup_index_load(&dedup, ln_ctx->dedup_index);
+  }
+  if(dedup.nfile > 1){
+    qsort(dedup.file_list,
+          dedup.nfile,
+          sizeof(*dedup.file_list),
+          ln_dedup_cmp);
+    ln_dedup_pass(&dedup, false);
+    ln_dedup_pass(&dedup, true);
+    dedup.next = 0;
+    ln_parallel(ln_ctx, ln_dedup_link_worker, &dedup);
+  }
+  if(ln_ctx->dedup_index){
+    ln_dedup_index_save(&dedup, ln_ctx->dedup_index);
+  }
+  if(dedup.index_map){
+    munmap(dedup.index_map, dedup.index_map_sz);
+  }
+  for(i = 0; i < dedup.nfile; i++){
+    free(dedup.file_list[i].path);
+  }
+  free(dedup.file_list);
+  free(dedup.dir_list);
+  pthread_mutex_destroy(&dedup.mutex);
+}
+
+/**
+ * Number of consecutive manifest entries taken at a time by each checkout
+ * thread (-M).
+ */
+#define LN_CHECKOUT_BATCH 64
+
+/**
+ * Entry of a checkout manifest (-M).
+ */
+struct ln_checkout_entry{
+  /**
+   * Name of the object in the store. Also holds the allocation that
+   * @ref path points into.
+   */
+  char *hash;
+
+  /**
+   * Path of the new link relative to the target directory.
+   */
+  char *path;
+
+  /**
+   * Length of the directory part of @ref path, or 0 if the link goes
+   * directly into the target directory.
+   */
+  size_t dir_len;
+};
+
+/**
+ * State shared by the threads checking out a manifest (-M).
+ */
+struct ln_checkout{
+  /**
+   * See @ref ln_ctx.
+   */
+  struct ln_ctx *ln_ctx;
+
+  /**
+   * Path of the store shown in error messages, and stored in new symbolic
+   * links (-s).
+   */
+  const char *store_dir;
+
+  /**
+   * Path of the target directory shown in error messages.
+   */
+  const char *target_dir;
+
+  /**
+   * Open directory file descriptor of @ref store_dir.
+   */
+  int store_dirfd;
+
+  /**
+   * Open directory file descriptor of @ref target_dir.
+   */
+  int target_dirfd;
+
+  /**
+   * Entries read from the manifest, sorted by @ref ln_checkout_cmp.
+   */
+  struct ln_checkout_entry *entry_list;
+
+  /**
+   * Number of entries in @ref entry_list.
+   */
+  size_t nentry;
+
+  /**
+   * Number of entries allocated in @ref entry_list.
+   */
+  size_t entry_sz;
+
+  /**
+   * Index of the next entry to link.
+   */
+  size_t next;
+
+  /**
+   * Protects @ref next.
+   */
+  pthread_mutex_t mutex;
+};
+
+/**
+ * Split a manifest record into an object name and a link path.
+ *
+ * The object name must not contain a slash, and the link path must be a
+ * relative path to a file that stays inside the target directory.
+ *
+ * @param[in,out] record Manifest record, split in place.
+ * @param[out]    entry  Points into @p record on success.
+ * @retval        true   Valid record.
+ * @retval        false  Invalid record.
+ */
+static bool
+ln_checkout_parse(char *const record,
+                  struct ln_checkout_entry *const entry){
+  char *path;
+  const char *name;
+  size_t name_len;
+  bool valid;
+
+  path = record + strcspn(record, " \t");
+  valid = path != record && *path != '\0';
+  if(valid){
+    *path++ = '\0';
+    path += strspn(path, " \t");
+    entry->hash = record;
+    entry->path = path;
+    entry->dir_len = 0;
+    valid = strchr(record, '/') == NULL &&
+            strcmp(record, ".") != 0 &&
+            strcmp(record, "..") != 0 &&
+            *path != '\0' &&
+            *path != '/';
+    name = path;
+    while(valid){
+      /* Reject empty, ".", and ".." path components. */
+      name_len = strcspn(name, "/");
+      valid = name_len > 0 &&
+              strncmp(name, ".", name_len) != 0 &&
+              strncmp(name, "..", name_len) != 0;
+      if(name[name_len] == '\0'){
+        break;
+      }
+      entry->dir_len = (size_t)(name + name_len - path);
+      name += name_len + 1;
+    }
+  }
+  return valid;
+}
+
+/**
+ * Make room for one more entry in the checkout manifest (-M).
+ *
+ * @param[in,out] checkout See @ref ln_checkout.
+ * @retval        true     Room for another entry.
+ * @retval        false    Failed to allocate memory.
+ */
+static bool
+ln_checkout_reserve(struct ln_checkout *const checkout){
+  struct ln_checkout_entry *entry_list;
+  size_t entry_sz;
+  bool ok;
+
+  ok = true;
+  if(checkout->nentry == checkout->entry_sz){
+    entry_sz = checkout->entry_sz ? checkout->entry_sz * 2 : 64;
+    entry_list = realloc(checkout->entry_list,
+                         entry_sz * sizeof(*entry_list));
+    if(entry_list == NULL){
+      ok = false;
+    }
+    else{
+      checkout->entry_list = entry_list;
+      checkout->entry_sz = entry_sz;
+    }
+  }
+  return ok;
+}
+
+/**
+ * Read all entries of a checkout manifest (-M).
+ *
+ * Each record holds the name of an object in the store, followed by
+ * spaces or tabs and then the path of the new link. Records get
+ * terminated by a newline, or by a null character if (-0) set. Empty
+ * records get skipped.
+ *
+ * @param[in,out] checkout See @ref ln_checkout.
+ * @param[in]     manifest Manifest file, or "-" to read from STDIN.
+ * @retval        true     Read every entry.
+ * @retval        false    Failed to read the manifest, or it has invalid
+ *                         entries. Every invalid entry gets reported.
+ */
+static bool
+ln_checkout_read(struct ln_checkout *const checkout,
+                 const char *const manifest){
+  FILE *fp;
+  char *record;
+  size_t record_sz;
+  ssize_t record_len;
+  char *copy;
+  int delim;
+  bool valid;
+  bool ok;
+
+  ok = false;
+  valid = true;
+  if(strcmp(manifest, "-") == 0){
+    fp = stdin;
+  }
+  else{
+    fp = fopen(manifest, "r");
+  }
+  if(fp == NULL){
+    ln_warn(checkout->ln_ctx, true, "fopen(%s)", manifest);
+  }
+  else{
+    if(checkout->ln_ctx->flags & LN_FLAG_LIST_NUL){
+      delim = '\0';
+    }
+    else{
+      delim = '\n';
+    }
+    ok = true;
+    record = NULL;
+    record_sz = 0;
+    while(ok && (record_len = getdelim(&record, &record_sz, delim, fp)) > 0){
+      if(record[record_len - 1] == delim){
+        record[--record_len] = '\0';
+      }
+      if(record_len == 0){
+        /* Skip. */
+      }
+      else if(!ln_checkout_reserve(checkout) ||
+              (copy = malloc((size_t)record_len + 1)) == NULL){
+        ln_warn(checkout->ln_ctx, true, "alloc");
+        ok = false;
+      }
+      else{
+        memcpy(copy, record, (size_t)record_len + 1);
+        if(ln_checkout_parse(copy,
+                             &checkout->entry_list[checkout->nentry])){
+          checkout->nentry += 1;
+        }
+        else{
+          ln_warn(checkout->ln_ctx,
+                  false,
+                  "invalid manifest entry: %s",
+                  record);
+          free(copy);
+          valid = false;
+        }
+      }
+    }
+    if(ferror(fp)){
+      ln_warn(checkout->ln_ctx, true, "read(%s)", manifest);
+      ok = false;
+    }
+    free(record);
+    if(fp != stdin && fclose(fp) != 0){
+      ln_warn(checkout->ln_ctx, true, "fclose(%s)", manifest);
+      ok = false;
+    }
+  }
+  return ok && valid;
+}
+
+/**
+ * Sort manifest entries by directory and then by name, so that all links
+ * going into the same directory sit next to each other.
+ *
+ * @param[in] a  See @ref ln_checkout_entry.
+ * @param[in] b  See @ref ln_checkout_entry.
+ * @retval    <0 @p a sorts before @p b.
+ * @retval    0  Same path.
+ * @retval    >0 @p a sorts after @p b.
+ */
+static int
+ln_checkout_cmp(const void *const a,
+                const void *const b){
+  const struct ln_checkout_entry *ea;
+  const struct ln_checkout_entry *eb;
+  size_t len;
+  int cmp;
+
+  ea = a;
+  eb = b;
+  len = ea->dir_len < eb->dir_len ? ea->dir_len : eb->dir_len;
+  cmp = memcmp(ea->path, eb->path, len);
+  if(cmp == 0 && ea->dir_len != eb->dir_len){
+    cmp = ea->dir_len < eb->dir_len ? -1 : 1;
+  }
+  if(cmp == 0){
+    cmp = strcmp(ea->path + ea->dir_len, eb->path + eb->dir_len);
+  }
+  return cmp;
+}
+
+/**
+ * Open a directory inside the target directory, creating it and any
+ * missing parent directories first (-M).
+ *
+ * @param[in]     checkout See @ref ln_checkout.
+ * @param[in,out] dir      Path relative to the target directory. Gets
+ *                         modified while creating the parent directories,
+ *                         and restored before returning.
+ * @retval        >=0      Open directory file descriptor.
+ * @retval        -1       Failed to create or open the directory, errno
+ *                         set.
+ */
+static int
+ln_checkout_open_dir(const struct ln_checkout *const checkout,
+                     char *const dir){
+  char *sep;
+  int dirfd;
+  int rc;
+
+  dirfd = openat(checkout->target_dirfd, dir, LN_O_DIRFD);
+  if(dirfd < 0 && errno == ENOENT){
+    rc = 0;
+    sep = dir;
+    while(rc == 0 && sep){
+      sep = strchr(sep + 1, '/');
+      if(sep){
+        *sep = '\0';
+      }
+      rc = mkdirat(checkout->target_dirfd, dir, 0777);
+      if(rc != 0 && errno == EEXIST){
+        rc = 0;
+      }
+      if(sep){
+        *sep = '/';
+      }
+    }
+    if(rc == 0){
+      dirfd = openat(checkout->target_dirfd, dir, LN_O_DIRFD);
+    }
+  }
+  return dirfd;
+}
+
+/**
+ * Worker thread entry point of the checkout (-M), which links batches of
+ * @ref LN_CHECKOUT_BATCH entries until none remain.
+ *
+ * Each thread keeps the directory of the previous entry open, so the
+ * sorted entries of one directory all get linked relative to the same
+ * directory file descriptor.
+ *
+ * @param[in,out] arg  See @ref ln_checkout.
+ * @retval        NULL Always returns NULL.
+ */
+static void *
+ln_checkout_worker(void *arg){
+  struct ln_checkout *checkout;
+  struct ln_checkout_entry *entry;
+  const struct ln_checkout_entry *dir_entry;
+  struct ln_path_buf path_source;
+  struct ln_path_buf path_dest;
+  const char *path_dir;
+  struct ln_path source;
+  struct ln_path dest;
+  int dirfd;
+  size_t i;
+  size_t last;
+  bool ok;
+
+  checkout = arg;
+  memset(&path_source, 0, sizeof(path_source));
+  memset(&path_dest, 0, sizeof(path_dest));
+  dir_entry = NULL;
+  dirfd = checkout->target_dirfd;
+  ok = ln_path_buf_prefix(&path_source, checkout->store_dir) &&
+       ln_path_buf_prefix(&path_dest, checkout->target_dir);
+  if(!ok){
+    ln_warn(checkout->ln_ctx, true, "alloc");
+  }
+  while(ok){
+    pthread_mutex_lock(&checkout->mutex);
+    i = checkout->next;
+    last = checkout->nentry;
+    if(last - i > LN_CHECKOUT_BATCH){
+      last = i + LN_CHECKOUT_BATCH;
+    }
+    checkout->next = last;
+    pthread_mutex_unlock(&checkout->mutex);
+    if(i == last){
+      break;
+    }
+    for(; i < last; i++){
+      entry = &checkout->entry_list[i];
+      if(dir_entry == NULL ||
+         dir_entry->dir_len != entry->dir_len ||
+         memcmp(dir_entry->path, entry->path, entry->dir_len) != 0){
+        if(dirfd >= 0 && dirfd != checkout->target_dirfd){
+          close(dirfd);
+        }
+        dirfd = checkout->target_dirfd;
+        if(entry->dir_len > 0){
+          entry->path[entry->dir_len] = '\0';
+          dirfd = ln_checkout_open_dir(checkout, entry->path);
+          entry->path[entry->dir_len] = '/';
+          if(dirfd < 0){
+            path_dir = ln_path_buf_name(&path_dest,
+                                        entry->path,
+                                        entry->dir_len);
+            ln_warn(checkout->ln_ctx,
+                    true,
+                    "mkdir(%s)",
+                    path_dir ? path_dir : entry->path);
+          }
+        }
+        dir_entry = entry;
+      }
+      if(dirfd < 0){
+        /* Skip. */
+      }
+      else if((source.path = ln_path_buf_name(&path_source,
+                                              entry->hash,
+                                              strlen(entry->hash))) == NULL ||
+              (dest.path = ln_path_buf_name(&path_dest,
+                                            entry->path,
+                                            strlen(entry->path))) == NULL){
+        ln_warn(checkout->ln_ctx, true, "alloc");
+      }
+      else{
+        source.dirfd = checkout->store_dirfd;
+        source.name = entry->hash;
+        dest.dirfd = dirfd;
+        dest.name = entry->path;
+        if(entry->dir_len > 0){
+          dest.name += entry->dir_len + 1;
+        }
+        ln_create_link(checkout->ln_ctx, &source, &dest);
+      }
+    }
+  }
+  if(dirfd >= 0 && dirfd != checkout->target_dirfd){
+    close(dirfd);
+  }
+  ln_path_buf_free(&path_source);
+  ln_path_buf_free(&path_dest);
+  return NULL;
+}
+
+/**
+ * Link objects from a content-addressable store into a tree as listed in
+ * the manifest named by @ref ln_ctx::checkout (-M).
+ *
+ * The whole manifest gets read and checked before anything gets created.
+ * The target directory and the directories inside it get created as
+ * needed. Each link gets created by @ref ln_create_link relative to the
+ * open store and directory file descriptors, so the (-c), (-C), (-f), and
+ * (-s) arguments apply the same way as for a single file. The links get
+ * created by the calling thread plus any additional threads requested by
+ * the (-j) argument.
+ *
+ * @param[in,out] ln_ctx     See @ref ln_ctx.
+ * @param[in]     store_dir  Directory holding an object named after each
+ *                           hash in the manifest.
+ * @param[in]     target_dir Root of the tree to create the links in.
+ */
+static void
+ln_checkout(struct ln_ctx *const ln_ctx,
+            const char *const store_dir,
+            const char *const target_dir){
+  struct ln_checkout checkout;
+  char *path_store;
+  size_t i;
+
+  memset(&checkout, 0, sizeof(checkout));
+  checkout.ln_ctx = ln_ctx;
+  checkout.store_dir = store_dir;
+  checkout.target_dir = target_dir;
+  checkout.store_dirfd = -1;
+  checkout.target_dirfd = -1;
+  pthread_mutex_init(&checkout.mutex, NULL);
+  path_store = NULL;
+  if((ln_ctx->flags & LN_FLAG_SYMBOLIC) &&
+     (path_store = realpath(store_dir, NULL)) == NULL){
+    ln_warn(ln_ctx, true, "realpath(%s)", store_dir);
+  }
+  else if((checkout.store_dirfd = open(store_dir, LN_O_DIRFD)) < 0){
+    ln_warn(ln_ctx, true, "open(%s)", store_dir);
+  }
+  else if(!ln_checkout_read(&checkout, ln_ctx->checkout)){
+    /* Skip. */
+  }
+  else if(mkdir(target_dir, 0777) != 0 && errno != EEXIST){
+    ln_warn(ln_ctx, true, "mkdir(%s)", target_dir);
+  }
+  else if((checkout.target_dirfd = open(target_dir, LN_O_DIRFD)) < 0){
+    ln_warn(ln_ctx, true, "open(%s)", target_dir);
+  }
+  else if(checkout.nentry > 0){
+    if(path_store){
+      checkout.store_dir = path_store;
+    }
+    qsort(checkout.entry_list,
+          checkout.nentry,
+          sizeof(*checkout.entry_list),
+          ln_checkout_cmp);
+    ln_parallel(ln_ctx, ln_checkout_worker, &checkout);
+  }
+  if(checkout.target_dirfd >= 0){
+    close(checkout.target_dirfd);
+  }
+  if(checkout.store_dirfd >= 0){
+    close(checkout.store_dirfd);
+  }
+  for(i = 0; i < checkout.nentry; i++){
+    free(checkout.entry_list[i].hash);
+  }
+  free(checkout.entry_list);
+  free(path_store);
+  pthread_mutex_destroy(&checkout.mutex);
+}
+
+/**
+ * Parse the number of worker threads given by the (-j) argument.
+ *
+ * @param[in]  str     Decimal number of threads, from 1 to
+ *                     @ref LN_THREAD_MAX.
+ * @param[out] nthread Store the parsed number of threads here.
+ * @retval     true    Parsed a valid number of threads.
+ * @retval     false   @p str not a valid number of threads.
+ */
+static bool
+ln_parse_nthread(const char *const str,
+                 size_t *const nthread){
+  unsigned long val;
+  char *end;
+  bool valid;
+
+  valid = false;
+  errno = 0;
+  val = strtoul(str, &end, 10);
+  if(errno == 0 && end != str && *end == '\0' &&
+     val >= 1 && val <= LN_THREAD_MAX){
+    *nthread = val;
+    valid = true;
+  }
+  return valid;
+}
+
+/**
+ * Main entry point for ln utility.
+ *
+ * Usage:
+ *
+ * ln [-cCfs] [-L|-P] [-j nthread] source_file target_file
+ *
+ * ln [-cCfsu] [-L|-P] [-j nthread] source_file... target_dir
+ *
+ * ln [-cCfsu0] [-L|-P] [-j nthread] -l list_file [source_file...] target_dir
+ *
+ * ln -R [-cCfs] [-L|-P] [-j nthread] source_dir target_dir
+ *
+ * ln -D [-c] [-j nthread] [-I index_file] dir...
+ *
+ * ln -M manifest_file [-cCfs0] [-L|-P] [-j nthread] store_dir target_dir
+ *
+ * (-u) only submits the links through io_uring if built with LINK_IO_URING,
+ * otherwise the links get created with blocking system calls.
+ *
+ * (-c) and (-D -c) only share extents if built with LINK_REFLINK,
+ * otherwise each clone fails with EOPNOTSUPP and each duplicate gets left
+ * alone. (-C) then copies the data with pread and pwrite instead of
+ * copy_file_range.
+ *
+ * @param[in]     argc         Number of arguments in @p argv.
+ * @param[in,out] argv         Argument list.
+ * @retval        EXIT_SUCCESS All links created.
+ * @retval        EXIT_FAILURE Failed to create at least one link.
+ */
+LINKAGE int
+ln_main(int argc,
+        char *argv[]){
   int c;
-  int i;
   bool is_target_dir;
   struct ln_ctx ln_ctx;
   struct stat target_sb;
+  struct ln_path source;
+  struct ln_path dest;
 
   memset(&ln_ctx, 0, sizeof(ln_ctx));
-  while((c = getopt(argc, argv, "fLPs")) != -1){
+  pthread_mutex_init(&ln_ctx.mutex, NULL);
+  ln_ctx.pid = getpid();
+  ln_ctx.flags = LN_FLAG_WARN;
+  while((c = getopt(argc, argv, "0cCDfI:j:l:LM:PRsu")) != -1){
     switch(c){
+      case '0':
+        ln_ctx.flags |= LN_FLAG_LIST_NUL;
+        break;
+      case 'c':
+        ln_ctx.flags |= LN_FLAG_REFLINK;
+        break;
+      case 'C':
+        ln_ctx.flags |= LN_FLAG_COPY;
+        break;
+      case 'D':
+        ln_ctx.flags |= LN_FLAG_DEDUP;
+        break;
       case 'f':
         ln_ctx.flags |= LN_FLAG_REMOVE_DEST;
         break;
+      case 'I':
+        ln_ctx.dedup_index = optarg;
+        break;
+      case 'j':
+        if(!ln_parse_nthread(optarg, &ln_ctx.nthread)){
+          ln_warn(&ln_ctx, false, "invalid number of threads: %s", optarg);
+        }
+        break;
+      case 'l':
+        ln_ctx.path_list = optarg;
+        break;
       case 'L':
         ln_ctx.flags |= LN_FLAG_FOLLOW_SYMBOLIC;
         break;
+      case 'M':
+        ln_ctx.checkout = optarg;
+        break;
       case 'P':
         ln_ctx.flags &= ~(LN_FLAG_FOLLOW_SYMBOLIC);
         break;
+      case 'R':
+        ln_ctx.flags |= LN_FLAG_RECURSIVE;
+        break;
       case 's':
         ln_ctx.flags |= LN_FLAG_SYMBOLIC;
         break;
+      case 'u':
+        ln_ctx.flags |= LN_FLAG_URING;
+        break;
       default:
         ln_ctx.status_code = EXIT_FAILURE;
         break;
@@ -375,7 +4620,59 @@ ln_main(int argc,
   argv += optind;
 
   if(ln_ctx.status_code == EXIT_SUCCESS){
-    if(argc < 2){
+    if(ln_ctx.flags & LN_FLAG_DEDUP){
+      if(argc < 1 ||
+         ln_ctx.path_list ||
+         ln_ctx.checkout ||
+         (ln_ctx.flags & (LN_FLAG_SYMBOLIC | LN_FLAG_RECURSIVE))){
+        ln_warn(&ln_ctx, false, "must have only dir arguments with -D");
+      }
+      else{
+        ln_dedup(&ln_ctx, argc, argv);
+      }
+    }
+    else if(ln_ctx.dedup_index){
+      ln_warn(&ln_ctx, false, "index file only used with -D");
+    }
+    else if((ln_ctx.flags & (LN_FLAG_REFLINK | LN_FLAG_SYMBOLIC)) ==
+            (LN_FLAG_REFLINK | LN_FLAG_SYMBOLIC)){
+      ln_warn(&ln_ctx, false, "-c and -s cannot both be used");
+    }
+    else if(ln_ctx.checkout){
+      if(argc != 2 || ln_ctx.path_list || (ln_ctx.flags & LN_FLAG_RECURSIVE)){
+        ln_warn(&ln_ctx,
+                false,
+                "must have exactly store_dir and target_dir with -M");
+      }
+      else{
+        ln_checkout(&ln_ctx, argv[0], argv[1]);
+      }
+    }
+    else if(ln_ctx.flags & LN_FLAG_RECURSIVE){
+      if(argc != 2 || ln_ctx.path_list){
+        ln_warn(&ln_ctx,
+                false,
+                "must have exactly source_dir and target_dir with -R");
+      }
+      else{
+        ln_tree(&ln_ctx, argv[0], argv[1]);
+      }
+    }
+    else if(ln_ctx.path_list){
+      if(argc < 1){
+        ln_warn(&ln_ctx, false, "must have a target_dir argument");
+      }
+      else if(stat(argv[argc - 1], &target_sb) != 0 ||
+              !S_ISDIR(target_sb.st_mode)){
+        ln_warn(&ln_ctx,
+                false,
+                "final operand must be directory if list file used");
+      }
+      else{
+        ln_target_dir_all(&ln_ctx, argc - 1, argv, argv[argc - 1]);
+      }
+    }
+    else if(argc < 2){
       ln_warn(&ln_ctx, false, "must have >=2 file arguments");
     }
     else{
@@ -383,9 +4680,7 @@ ln_main(int argc,
       if(stat(argv[argc - 1], &target_sb) == 0){
         if(S_ISDIR(target_sb.st_mode)){
           is_target_dir = true;
-          for(i = 0; i < argc - 1; i++){
-            ln_target_dir(&ln_ctx, argv[i], argv[argc - 1]);
-          }
+          ln_target_dir_all(&ln_ctx, argc - 1, argv, argv[argc - 1]);
         }
         else if(argc > 2){
           ln_warn(&ln_ctx,
@@ -400,15 +4695,226 @@ ln_main(int argc,
                   "only 2 operands allowed if final operand not a directory");
         }
         else{
-          ln_create_link(&ln_ctx, argv[0], argv[1]);
+          source.dirfd = AT_FDCWD;
+          source.name = argv[0];
+          source.path = argv[0];
+          dest.dirfd = AT_FDCWD;
+          dest.name = argv[1];
+          dest.path = argv[1];
+          ln_create_link(&ln_ctx, &source, &dest);
         }
       }
     }
   }
+  pthread_mutex_destroy(&ln_ctx.mutex);
   return ln_ctx.status_code;
 }
 
-#ifndef TEST
+#if defined(TEST) || defined(LINK_LIBRARY)
+/**
+ * Share of the operations of a @ref ln_lib_submit call handled by one
+ * thread.
+ */
+struct ln_lib_worker{
+  /**
+   * See @ref ln_ctx.
+   */
+  struct ln_ctx *ln_ctx;
+
+  /**
+   * Operations passed to @ref ln_lib_submit.
+   */
+  struct ln_lib_op *op_list;
+
+  /**
+   * Number of operations in @ref op_list.
+   */
+  size_t nop;
+
+  /**
+   * Directory that relative paths in @ref op_list get resolved against, or
+   * AT_FDCWD.
+   */
+  int dirfd;
+
+  /**
+   * Index of the first operation handled by this thread.
+   */
+  size_t first;
+
+  /**
+   * Distance between the operations handled by this thread.
+   */
+  size_t stride;
+
+  /**
+   * Thread running @ref ln_lib_worker_run.
+   */
+  pthread_t thread;
+
+  /**
+   * Set if @ref thread got started and needs to get joined.
+   */
+  bool started;
+};
+
+/**
+ * Run the share of operations belonging to one thread.
+ *
+ * @param[in,out] worker See @ref ln_lib_worker.
+ */
+static void
+ln_lib_worker_ops(struct ln_lib_worker *const worker){
+  struct ln_lib_op *op;
+  struct ln_path source;
+  struct ln_path dest;
+  size_t i;
+
+  source.dirfd = worker->dirfd;
+  dest.dirfd = worker->dirfd;
+  for(i = worker->first; i < worker->nop; i += worker->stride){
+    op = &worker->op_list[i];
+    source.name = op->source;
+    source.path = op->source;
+    dest.name = op->dest;
+    dest.path = op->dest;
+    op->error = ln_create_link(worker->ln_ctx, &source, &dest);
+  }
+}
+
+/**
+ * Thread entry point of a @ref ln_lib_worker.
+ *
+ * @param[in,out] arg See @ref ln_lib_worker.
+ * @retval        NULL Always returns NULL.
+ */
+static void *
+ln_lib_worker_run(void *arg){
+  ln_lib_worker_ops(arg);
+  return NULL;
+}
+
+struct ln_ctx *
+ln_lib_new(const unsigned int flags,
+           const size_t nthread){
+  struct ln_ctx *ln_ctx;
+
+  ln_ctx = NULL;
+  if((flags & ~(LN_FLAG_REMOVE_DEST |
+                LN_FLAG_FOLLOW_SYMBOLIC |
+                LN_FLAG_SYMBOLIC |
+                LN_FLAG_REFLINK |
+                LN_FLAG_COPY |
+                LN_FLAG_WARN)) != 0 ||
+     (flags & (LN_FLAG_SYMBOLIC | LN_FLAG_REFLINK)) ==
+     (LN_FLAG_SYMBOLIC | LN_FLAG_REFLINK) ||
+     nthread > LN_THREAD_MAX){
+    errno = EINVAL;
+  }
+  else{
+    ln_ctx = malloc(sizeof(*ln_ctx));
+    if(ln_ctx){
+      memset(ln_ctx, 0, sizeof(*ln_ctx));
+      pthread_mutex_init(&ln_ctx->mutex, NULL);
+      ln_ctx->pid = getpid();
+      ln_ctx->flags = flags;
+      ln_ctx->nthread = nthread;
+      if(ln_ctx->nthread == 0){
+        ln_ctx->nthread = 1;
+      }
+    }
+  }
+  return ln_ctx;
+}
+
+size_t
+ln_lib_submit_at(struct ln_ctx *const ln_ctx,
+                 const int dirfd,
+                 struct ln_lib_op *const op_list,
+                 const size_t nop){
+  struct ln_lib_worker single;
+  struct ln_lib_worker *worker_list;
+  size_t nworker;
+  size_t i;
+  size_t nfail;
+
+  nworker = ln_ctx->nthread;
+  if(nworker > nop){
+    nworker = nop;
+  }
+  worker_list = NULL;
+  if(nworker > 1){
+    worker_list = malloc(nworker * sizeof(*worker_list));
+  }
+  if(worker_list == NULL){
+    /* Run every operation on the calling thread. */
+    worker_list = &single;
+    nworker = 1;
+  }
+  for(i = 0; i < nworker; i++){
+    worker_list[i].ln_ctx = ln_ctx;
+    worker_list[i].op_list = op_list;
+    worker_list[i].nop = nop;
+    worker_list[i].dirfd = dirfd;
+    worker_list[i].first = i;
+    worker_list[i].stride = nworker;
+    worker_list[i].started = false;
+  }
+  for(i = 1; i < nworker; i++){
+    worker_list[i].started = pthread_create(&worker_list[i].thread,
+                                            NULL,
+                                            ln_lib_worker_run,
+                                            &worker_list[i]) == 0;
+  }
+  ln_lib_worker_ops(&worker_list[0]);
+  for(i = 1; i < nworker; i++){
+    if(worker_list[i].started){
+      pthread_join(worker_list[i].thread, NULL);
+    }
+    else{
+      ln_lib_worker_ops(&worker_list[i]);
+    }
+  }
+  if(worker_list != &single){
+    free(worker_list);
+  }
+  nfail = 0;
+  for(i = 0; i < nop; i++){
+    if(op_list[i].error != 0){
+      nfail += 1;
+    }
+  }
+  return nfail;
+}
+
+size_t
+ln_lib_submit(struct ln_ctx *const ln_ctx,
+              struct ln_lib_op *const op_list,
+              const size_t nop){
+  return ln_lib_submit_at(ln_ctx, AT_FDCWD, op_list, nop);
+}
+
+int
+ln_lib_status(struct ln_ctx *const ln_ctx){
+  int status_code;
+
+  pthread_mutex_lock(&ln_ctx->mutex);
+  status_code = ln_ctx->status_code;
+  pthread_mutex_unlock(&ln_ctx->mutex);
+  return status_code;
+}
+
+void
+ln_lib_free(struct ln_ctx *const ln_ctx){
+  if(ln_ctx){
+    pthread_mutex_destroy(&ln_ctx->mutex);
+    free(ln_ctx);
+  }
+}
+#endif /* TEST, LINK_LIBRARY */
+
+#if !defined(TEST) && !defined(LINK_BENCH) && !defined(LINK_MULTICALL) && \
+    !defined(LINK_LIBRARY)
 /**
  * Main program entry point.
  *
@@ -421,5 +4927,6 @@ main(int argc,
      char *argv[]){
   return ln_main(argc, argv);
 }
-#endif /* TEST */
+#endif /* !(TEST) && !(LINK_BENCH) && !(LINK_MULTICALL) &&
+          !(LINK_LIBRARY) */
 
@@ -0,0 +1,129 @@
+/**
+ * @file
+ * @brief multi-call binary for the link, ln, and unlink utilities
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ *
+ * Runs the utility named by the final path component of argv[0], so that
+ * link, ln, and unlink can all be links to the one binary and share a single
+ * text image in the page cache. If argv[0] does not name a utility, then the
+ * first argument does instead, for example: linkutils ln -s a b.
+ *
+ * Build:
+ *
+ * cc -std=c99 -D_POSIX_C_SOURCE=200809L -DLINK_MULTICALL -o linkutils
+ *   src/link.c src/ln.c src/unlink.c src/reflink.c src/uring.c
+ *   src/multicall.c -lpthread
+ */
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef TEST
+/**
+ * Declare some functions with extern linkage, allowing the test suite to call
+ * those functions.
+ */
+# define LINKAGE extern
+#else /* !(TEST) */
+/**
+ * Define all functions as static when not testing.
+ */
+# define LINKAGE static
+#endif /* TEST */
+
+int
+link_main(int argc,
+          char *const argv[]);
+
+int
+ln_main(int argc,
+        char *argv[]);
+
+int
+unlink_main(int argc,
+            char *const argv[]);
+
+/**
+ * Run a utility by name.
+ *
+ * @param[in]     name         Name of the utility.
+ * @param[in]     argc         Number of arguments in @p argv.
+ * @param[in,out] argv         Argument list passed to the utility.
+ * @param[out]    exit_status  Exit status of the utility.
+ * @retval        true         Ran the utility.
+ * @retval        false        @p name does not name a utility.
+ */
+static bool
+multicall_run(const char *const name,
+              int argc,
+              char *argv[],
+              int *const exit_status){
+  bool found;
+
+  found = true;
+  if(strcmp(name, "link") == 0){
+    *exit_status = link_main(argc, argv);
+  }
+  else if(strcmp(name, "ln") == 0){
+    *exit_status = ln_main(argc, argv);
+  }
+  else if(strcmp(name, "unlink") == 0){
+    *exit_status = unlink_main(argc, argv);
+  }
+  else{
+    found = false;
+  }
+  return found;
+}
+
+/**
+ * Dispatch to the utility named by argv[0] or by the first argument.
+ *
+ * @param[in]     argc         Number of arguments in @p argv.
+ * @param[in,out] argv         Argument list.
+ * @retval        EXIT_SUCCESS Utility completed successfully.
+ * @retval        EXIT_FAILURE Utility failed, or no utility named.
+ */
+LINKAGE int
+multicall_main(int argc,
+               char *argv[]){
+  const char *name;
+  int exit_status;
+
+  exit_status = EXIT_FAILURE;
+  name = "";
+  if(argc > 0){
+    name = strrchr(argv[0], '/');
+    if(name){
+      name += 1;
+    }
+    else{
+      name = argv[0];
+    }
+  }
+  if(!multicall_run(name, argc, argv, &exit_status)){
+    if(argc < 2 || !multicall_run(argv[1], argc - 1, argv + 1, &exit_status)){
+      warnx("usage: linkutils link|ln|unlink [argument...]");
+    }
+  }
+  return exit_status;
+}
+
+#ifndef TEST
+/**
+ * Main program entry point.
+ *
+ * @param[in] argc See @ref multicall_main.
+ * @param[in] argv See @ref multicall_main.
+ * @return         See @ref multicall_main.
+ */
+int
+main(int argc,
+     char *argv[]){
+  return multicall_main(argc, argv);
+}
+#endif /* TEST */
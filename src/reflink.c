@@ -0,0 +1,356 @@
+/**
+ * @file
+ * @brief copy-on-write extent sharing and in-kernel copies between files
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ */
+
+#ifdef LINK_REFLINK
+/**
+ * Required for copy_file_range(), SEEK_DATA, and SEEK_HOLE.
+ */
+# ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+# endif /* _GNU_SOURCE */
+# include <linux/fs.h>
+# include <sys/ioctl.h>
+#endif /* LINK_REFLINK */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef TEST
+# include "../test/seams.h"
+#endif /* TEST */
+
+#include "reflink.h"
+
+/**
+ * Size of the buffer used when copying with pread and pwrite.
+ */
+#define REFLINK_COPY_BUF_SZ (128 * 1024)
+
+/**
+ * Check if a buffer only holds zero bytes.
+ *
+ * @param[in] buf   Buffer to check.
+ * @param[in] len   Number of bytes in @p buf.
+ * @retval    true  Every byte is zero.
+ * @retval    false At least one byte is not zero.
+ */
+static bool
+reflink_is_zero(const char *const buf,
+                const size_t len){
+  size_t i;
+
+  for(i = 0; i < len && buf[i] == 0; i++){
+    /* Skip. */
+  }
+  return i == len;
+}
+
+/**
+ * Copy a range with pread and pwrite.
+ *
+ * Blocks of zeros do not get written, so they stay holes in the
+ * destination even where the source does not report its holes.
+ *
+ * @param[in] src_fd  See @ref reflink_copy.
+ * @param[in] dest_fd See @ref reflink_copy.
+ * @param[in] offset  Start of the range in bytes.
+ * @param[in] end     End of the range in bytes.
+ * @retval    0       Copied the range, or reached the end of the source.
+ * @retval    -1      Failed to copy the range, errno set.
+ */
+static int
+reflink_copy_rw(const int src_fd,
+                const int dest_fd,
+                off_t offset,
+                const off_t end){
+  char *buf;
+  size_t len;
+  ssize_t nread;
+  ssize_t nwrite;
+  int rc;
+
+  rc = 0;
+  buf = malloc(REFLINK_COPY_BUF_SZ);
+  if(buf == NULL){
+    rc = -1;
+  }
+  while(rc == 0 && offset < end){
+    len = REFLINK_COPY_BUF_SZ;
+    if(end - offset < (off_t)len){
+      len = (size_t)(end - offset);
+    }
+    nread = pread(src_fd, buf, len, offset);
+    if(nread <= 0){
+      rc = nread < 0 ? -1 : 0;
+      break;
+    }
+    nwrite = nread;
+    if(!reflink_is_zero(buf, (size_t)nread)){
+      nwrite = pwrite(dest_fd, buf, (size_t)nread, offset);
+    }
+    if(nwrite != nread){
+      if(nwrite >= 0){
+        errno = EIO;
+      }
+      rc = -1;
+    }
+    offset += nread;
+  }
+  free(buf);
+  return rc;
+}
+
+#ifdef LINK_REFLINK
+
+/**
+ * Maximum number of bytes shared by a single FIDEDUPERANGE request. Some
+ * filesystems silently share less than requested above this size.
+ */
+#define REFLINK_DEDUPE_CHUNK ((uint64_t)16 * 1024 * 1024)
+
+/**
+ * Maximum number of destinations in a single FIDEDUPERANGE request, which
+ * keeps the request within the one page limit of the kernel.
+ */
+#define REFLINK_DEDUPE_BATCH 64
+
+/**
+ * Share the extents of a source file with a batch of destinations.
+ *
+ * @param[in]     src_fd    See @ref reflink_dedupe.
+ * @param[in,out] dest_list See @ref reflink_dedupe.
+ * @param[in]     ndest     Number of destinations in @p dest_list, up to
+ *                          @ref REFLINK_DEDUPE_BATCH.
+ * @param[in]     size      See @ref reflink_dedupe.
+ * @param[in,out] range     Request buffer with room for @p ndest
+ *                          destinations.
+ */
+static void
+reflink_dedupe_batch(const int src_fd,
+                     struct reflink_dest *const dest_list,
+                     const size_t ndest,
+                     const uint64_t size,
+                     struct file_dedupe_range *const range){
+  struct file_dedupe_range_info *info;
+  struct reflink_dest *active[REFLINK_DEDUPE_BATCH];
+  uint64_t offset;
+  uint64_t len;
+  uint64_t advance;
+  size_t nactive;
+  size_t nnext;
+  size_t i;
+
+  nactive = 0;
+  for(i = 0; i < ndest; i++){
+    dest_list[i].error = 0;
+    active[nactive++] = &dest_list[i];
+  }
+  offset = 0;
+  while(offset < size && nactive > 0){
+    len = size - offset;
+    if(len > REFLINK_DEDUPE_CHUNK){
+      len = REFLINK_DEDUPE_CHUNK;
+    }
+    memset(range, 0, sizeof(*range) + nactive * sizeof(*info));
+    range->src_offset = offset;
+    range->src_length = len;
+    range->dest_count = (uint16_t)nactive;
+    for(i = 0; i < nactive; i++){
+      range->info[i].dest_fd = active[i]->fd;
+      range->info[i].dest_offset = offset;
+    }
+    if(ioctl(src_fd, FIDEDUPERANGE, range) != 0){
+      for(i = 0; i < nactive; i++){
+        active[i]->error = errno;
+      }
+      nactive = 0;
+    }
+
+    /*
+     * Continue from the shortest range shared with any destination. Ranges
+     * that already got shared with the other destinations just get compared
+     * and shared again.
+     */
+    advance = len;
+    nnext = 0;
+    for(i = 0; i < nactive; i++){
+      info = &range->info[i];
+      if(info->status < 0){
+        active[i]->error = -info->status;
+      }
+      else if(info->status == FILE_DEDUPE_RANGE_DIFFERS){
+        active[i]->error = REFLINK_DIFFERS;
+      }
+      else if(info->bytes_deduped == 0){
+        active[i]->error = EINVAL;
+      }
+      else{
+        if(info->bytes_deduped < advance){
+          advance = info->bytes_deduped;
+        }
+        active[nnext++] = active[i];
+      }
+    }
+    nactive = nnext;
+    offset += advance;
+  }
+}
+
+int
+reflink_clone(const int src_fd,
+              const int dest_fd){
+  return ioctl(dest_fd, FICLONE, src_fd);
+}
+
+void
+reflink_dedupe(const int src_fd,
+               struct reflink_dest *const dest_list,
+               const size_t ndest,
+               const uint64_t size){
+  struct file_dedupe_range *range;
+  size_t first;
+  size_t n;
+  size_t i;
+
+  range = malloc(sizeof(*range) +
+                 REFLINK_DEDUPE_BATCH * sizeof(range->info[0]));
+  if(range == NULL){
+    for(i = 0; i < ndest; i++){
+      dest_list[i].error = ENOMEM;
+    }
+  }
+  else{
+    for(first = 0; first < ndest; first += n){
+      n = ndest - first;
+      if(n > REFLINK_DEDUPE_BATCH){
+        n = REFLINK_DEDUPE_BATCH;
+      }
+      reflink_dedupe_batch(src_fd, &dest_list[first], n, size, range);
+    }
+    free(range);
+  }
+}
+
+/**
+ * Copy a range that holds data with copy_file_range.
+ *
+ * Falls back to @ref reflink_copy_rw if the kernel or the filesystems do
+ * not support copy_file_range between these files.
+ *
+ * @param[in] src_fd  See @ref reflink_copy.
+ * @param[in] dest_fd See @ref reflink_copy.
+ * @param[in] offset  Start of the range in bytes.
+ * @param[in] end     End of the range in bytes.
+ * @retval    0       Copied the range, or reached the end of the source.
+ * @retval    -1      Failed to copy the range, errno set.
+ */
+static int
+reflink_copy_data(const int src_fd,
+                  const int dest_fd,
+                  const off_t offset,
+                  const off_t end){
+  loff_t off_in;
+  loff_t off_out;
+  ssize_t rc;
+
+  off_in = offset;
+  off_out = offset;
+  rc = 1;
+  while(rc > 0 && off_in < end){
+    rc = copy_file_range(src_fd,
+                         &off_in,
+                         dest_fd,
+                         &off_out,
+                         (size_t)(end - off_in),
+                         0);
+  }
+  if(rc < 0 &&
+     (errno == EXDEV ||
+      errno == ENOSYS ||
+      errno == EOPNOTSUPP ||
+      errno == EINVAL)){
+    rc = reflink_copy_rw(src_fd, dest_fd, off_in, end);
+  }
+  return rc < 0 ? -1 : 0;
+}
+
+int
+reflink_copy(const int src_fd,
+             const int dest_fd,
+             const off_t offset,
+             const off_t len){
+  off_t pos;
+  off_t end;
+  off_t data;
+  off_t hole;
+  int rc;
+
+  rc = 0;
+  pos = offset;
+  end = offset + len;
+  while(rc == 0 && pos < end){
+    data = lseek(src_fd, pos, SEEK_DATA);
+    if(data < 0 && errno == ENXIO){
+      /* Only a hole remains. */
+      break;
+    }
+    else if(data < 0){
+      /* Holes not supported, so copy everything. */
+      data = pos;
+      hole = end;
+    }
+    else{
+      hole = lseek(src_fd, data, SEEK_HOLE);
+      if(hole < 0 || hole > end){
+        hole = end;
+      }
+    }
+    if(data < end){
+      rc = reflink_copy_data(src_fd, dest_fd, data, hole);
+    }
+    pos = hole;
+  }
+  return rc;
+}
+
+#else /* !(LINK_REFLINK) */
+
+int
+reflink_clone(const int src_fd,
+              const int dest_fd){
+  (void)src_fd;
+  (void)dest_fd;
+  errno = EOPNOTSUPP;
+  return -1;
+}
+
+void
+reflink_dedupe(const int src_fd,
+               struct reflink_dest *const dest_list,
+               const size_t ndest,
+               const uint64_t size){
+  size_t i;
+
+  (void)src_fd;
+  (void)size;
+  for(i = 0; i < ndest; i++){
+    dest_list[i].error = EOPNOTSUPP;
+  }
+}
+
+int
+reflink_copy(const int src_fd,
+             const int dest_fd,
+             const off_t offset,
+             const off_t len){
+  return reflink_copy_rw(src_fd, dest_fd, offset, offset + len);
+}
+
+#endif /* LINK_REFLINK */
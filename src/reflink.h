@@ -0,0 +1,110 @@
+/**
+ * @file
+ * @brief copy-on-write extent sharing and in-kernel copies between files
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ *
+ * Shares the data blocks of one file with another on filesystems that
+ * support copy-on-write extents, such as btrfs and XFS. Both files keep
+ * their own inode, so changing the mode, owner, or contents of one file
+ * does not affect the other. A clone of a large file takes about as long
+ * as a hard link.
+ *
+ * The reflink backend only gets compiled in when LINK_REFLINK has been
+ * defined. Otherwise, every clone or dedupe request fails with EOPNOTSUPP
+ * and @ref reflink_copy copies the data with pread and pwrite.
+ */
+#ifndef LINK_REFLINK_H
+#define LINK_REFLINK_H
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Set in @ref reflink_dest::error if the destination contents differ from
+ * the source, so nothing got shared.
+ */
+#define REFLINK_DIFFERS (-1)
+
+/**
+ * Destination file of @ref reflink_dedupe.
+ */
+struct reflink_dest{
+  /**
+   * Open file descriptor of the destination file.
+   */
+  int fd;
+
+  /**
+   * Result for this destination:
+   *   - 0               - Shares every extent with the source.
+   *   - REFLINK_DIFFERS - Contents differ from the source.
+   *   - errno value     - Failed to share the extents.
+   */
+  int error;
+};
+
+/**
+ * Make an empty destination file share every extent of a source file.
+ *
+ * @param[in] src_fd  Open file descriptor of the source file.
+ * @param[in] dest_fd Destination file opened for writing.
+ * @retval    0       Destination now has the same contents as the source.
+ * @retval    -1      Failed to clone the source, errno set.
+ */
+int
+reflink_clone(const int src_fd,
+              const int dest_fd);
+
+/**
+ * Share the extents of a source file with destination files that have the
+ * same contents.
+ *
+ * The kernel compares the contents of each range before sharing it, so the
+ * contents of a destination never change even if it got modified after the
+ * caller compared it. Up to one page worth of destinations get submitted
+ * together, so the source range only gets read once for all of them.
+ *
+ * @param[in]     src_fd    Open file descriptor of the source file.
+ * @param[in,out] dest_list Destination files, with the result of each one
+ *                          stored in @ref reflink_dest::error.
+ * @param[in]     ndest     Number of destinations in @p dest_list.
+ * @param[in]     size      Number of bytes to share, from the start of
+ *                          each file.
+ */
+void
+reflink_dedupe(const int src_fd,
+               struct reflink_dest *const dest_list,
+               const size_t ndest,
+               const uint64_t size);
+
+/**
+ * Copy a range of a source file to the same offset of a destination file.
+ *
+ * Uses copy_file_range, so the kernel copies the data without passing it
+ * through user space and may share the extents instead. Holes in the
+ * source get skipped, so they stay holes in the destination. The
+ * destination must already have the size of the source, for example from
+ * ftruncate, so that skipped holes read back as zeros. Falls back to pread
+ * and pwrite where copy_file_range not available, which skips writing
+ * blocks of zeros instead.
+ *
+ * Different ranges of the same files can get copied from multiple threads
+ * at the same time.
+ *
+ * @param[in] src_fd  Open file descriptor of the source file.
+ * @param[in] dest_fd Destination file opened for writing.
+ * @param[in] offset  Start of the range in bytes.
+ * @param[in] len     Length of the range in bytes.
+ * @retval    0       Copied the range.
+ * @retval    -1      Failed to copy the range, errno set.
+ */
+int
+reflink_copy(const int src_fd,
+             const int dest_fd,
+             const off_t offset,
+             const off_t len);
+
+#endif /* LINK_REFLINK_H */
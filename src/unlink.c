@@ -7,9 +7,17 @@
  */
 
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include "uring.h"
+
 #ifdef TEST
 /**
  * Declare some functions with extern linkage, allowing the test suite to call
@@ -17,41 +25,587 @@
  */
 # define LINKAGE extern
 # include "../test/seams.h"
-#else /* !(TEST) */
+#elif defined(LINK_BENCH) || defined(LINK_MULTICALL)
+/**
+ * Declare some functions with extern linkage, allowing the benchmark and the
+ * multi-call binary to call those functions.
+ */
+# define LINKAGE extern
+#else /* !(TEST) && !(LINK_BENCH) && !(LINK_MULTICALL) */
 /**
  * Define all functions as static when not testing.
  */
 # define LINKAGE static
-#endif /* TEST */
+#endif /* TEST, LINK_BENCH, LINK_MULTICALL */
+
+/**
+ * Number of io_uring submission queue entries used by (-u) argument, which
+ * is also the maximum number of unlinkat requests in flight.
+ */
+#define UNLINK_URING_ENTRIES 1024
+
+/**
+ * @defgroup unlink_flag unlink flags
+ *
+ * Option flags when running unlink.
+ */
+
+/**
+ * Remove any number of files instead of exactly one.
+ *
+ * Corresponds to argument (-b).
+ *
+ * @ingroup unlink_flag
+ */
+#define UNLINK_FLAG_BATCH    ((unsigned int)(1 << 0))
+
+/**
+ * Entries in the list file get separated by a null character instead of a
+ * newline.
+ *
+ * Corresponds to argument (-0).
+ *
+ * @ingroup unlink_flag
+ */
+#define UNLINK_FLAG_LIST_NUL ((unsigned int)(1 << 1))
+
+/**
+ * Submit the unlinkat requests through io_uring if available.
+ *
+ * Corresponds to argument (-u).
+ *
+ * @ingroup unlink_flag
+ */
+#define UNLINK_FLAG_URING    ((unsigned int)(1 << 2))
+
+/**
+ * Flags used to open a directory file descriptor that only gets used as the
+ * base of unlinkat().
+ */
+#ifdef O_PATH
+# define UNLINK_O_DIRFD (O_DIRECTORY | O_PATH)
+#else /* !(O_PATH) */
+# define UNLINK_O_DIRFD (O_DIRECTORY | O_RDONLY)
+#endif /* O_PATH */
+
+/**
+ * unlinkat request submitted through io_uring (-u).
+ */
+struct unlink_uring_op{
+  /**
+   * Copy of the path to remove, kept until the request completes.
+   */
+  char *path;
+
+  /**
+   * Size of the @ref path buffer in bytes.
+   */
+  size_t path_sz;
+
+  /**
+   * Set while the request is in flight.
+   */
+  bool active;
+};
+
+/**
+ * unlink utility context.
+ */
+struct unlink_ctx{
+  /**
+   * Exit status set to one of the following values.
+   *   - EXIT_SUCCESS
+   *   - EXIT_FAILURE
+   */
+  int status_code;
+
+  /**
+   * See @ref unlink_flag.
+   */
+  unsigned int flags;
+
+  /**
+   * Read additional file operands from this file, or from STDIN if set to
+   * "-".
+   *
+   * Corresponds to argument (-l). Set to NULL if not used.
+   */
+  const char *path_list;
+
+  /**
+   * Open directory file descriptor of @ref dir, or -1 if no directory
+   * cached.
+   */
+  int dirfd;
+
+  /**
+   * Parent directory of the most recently removed file.
+   */
+  char *dir;
+
+  /**
+   * Size of the @ref dir buffer in bytes.
+   */
+  size_t dir_sz;
+
+  /**
+   * Number of files processed in batch mode.
+   */
+  size_t nfile;
+
+  /**
+   * Number of files that could not get removed in batch mode.
+   */
+  size_t nfail;
+
+  /**
+   * io_uring instance used if (-u) argument set and io_uring available,
+   * otherwise NULL.
+   */
+  struct uring *ring;
+
+  /**
+   * List of @ref UNLINK_URING_ENTRIES requests, indexed by the io_uring user
+   * data.
+   */
+  struct unlink_uring_op *op_list;
+
+  /**
+   * Stack of the indexes in @ref op_list not in flight.
+   */
+  size_t *op_free;
+
+  /**
+   * Number of indexes in @ref op_free.
+   */
+  size_t nop_free;
+};
+
+/**
+ * Open the parent directory of a file, reusing the directory file descriptor
+ * cached from the previous file if it has the same parent.
+ *
+ * @param[in,out] unlink_ctx See @ref unlink_ctx.
+ * @param[in]     path       File to remove.
+ * @param[in]     dir_len    Length of the parent directory prefix of
+ *                           @p path, excluding the final slash.
+ * @retval        true       @ref unlink_ctx::dirfd refers to the parent.
+ * @retval        false      Failed to open the parent directory.
+ */
+static bool
+unlink_batch_dir(struct unlink_ctx *const unlink_ctx,
+                 const char *const path,
+                 const size_t dir_len){
+  char *dir;
+  bool ok;
+
+  ok = true;
+  if(unlink_ctx->dirfd < 0 ||
+     strncmp(unlink_ctx->dir, path, dir_len) != 0 ||
+     unlink_ctx->dir[dir_len] != '\0'){
+    if(unlink_ctx->dirfd >= 0){
+      close(unlink_ctx->dirfd);
+      unlink_ctx->dirfd = -1;
+    }
+    if(dir_len + 1 > unlink_ctx->dir_sz){
+      dir = realloc(unlink_ctx->dir, dir_len + 1);
+      if(dir == NULL){
+        ok = false;
+      }
+      else{
+        unlink_ctx->dir = dir;
+        unlink_ctx->dir_sz = dir_len + 1;
+      }
+    }
+    if(ok){
+      memcpy(unlink_ctx->dir, path, dir_len);
+      unlink_ctx->dir[dir_len] = '\0';
+      unlink_ctx->dirfd = open(dir_len == 0 ? "/" : unlink_ctx->dir,
+                               UNLINK_O_DIRFD);
+      if(unlink_ctx->dirfd < 0){
+        ok = false;
+      }
+    }
+  }
+  return ok;
+}
+
+/**
+ * Remove one file in batch mode with a blocking system call.
+ *
+ * The file gets removed with unlinkat relative to its parent directory.
+ * Consecutive files inside the same directory share one open directory file
+ * descriptor, so the parent path only gets resolved once per directory when
+ * the input has been grouped by directory. Failures get reported and
+ * counted without stopping the batch.
+ *
+ * @param[in,out] unlink_ctx See @ref unlink_ctx.
+ * @param[in]     path       File to remove.
+ */
+static void
+unlink_batch_now(struct unlink_ctx *const unlink_ctx,
+                 const char *const path){
+  const char *name;
+  int rc;
+
+  name = strrchr(path, '/');
+  if(name == NULL){
+    rc = unlinkat(AT_FDCWD, path, 0);
+  }
+  else if(name[1] == '\0'){
+    rc = unlink(path);
+  }
+  else if(unlink_batch_dir(unlink_ctx, path, (size_t)(name - path))){
+    rc = unlinkat(unlink_ctx->dirfd, name + 1, 0);
+  }
+  else{
+    rc = -1;
+  }
+  if(rc != 0){
+    unlink_ctx->nfail += 1;
+    warn("failed to unlink: %s", path);
+  }
+}
+
+/**
+ * Set up io_uring for the (-u) argument.
+ *
+ * Leaves @ref unlink_ctx::ring set to NULL if io_uring not available, so
+ * the files get removed with blocking system calls instead.
+ *
+ * @param[in,out] unlink_ctx See @ref unlink_ctx.
+ */
+static void
+unlink_uring_start(struct unlink_ctx *const unlink_ctx){
+  size_t i;
+
+  unlink_ctx->ring = uring_new(UNLINK_URING_ENTRIES);
+  if(unlink_ctx->ring){
+    unlink_ctx->op_list = malloc(UNLINK_URING_ENTRIES *
+                                 sizeof(*unlink_ctx->op_list));
+    unlink_ctx->op_free = malloc(UNLINK_URING_ENTRIES *
+                                 sizeof(*unlink_ctx->op_free));
+    if(unlink_ctx->op_list == NULL || unlink_ctx->op_free == NULL){
+      warn("alloc");
+      uring_free(unlink_ctx->ring);
+      unlink_ctx->ring = NULL;
+    }
+    else{
+      memset(unlink_ctx->op_list,
+             0,
+             UNLINK_URING_ENTRIES * sizeof(*unlink_ctx->op_list));
+      for(i = 0; i < UNLINK_URING_ENTRIES; i++){
+        unlink_ctx->op_free[i] = UNLINK_URING_ENTRIES - 1 - i;
+      }
+      unlink_ctx->nop_free = UNLINK_URING_ENTRIES;
+    }
+  }
+}
+
+/**
+ * Hand the queued unlinkat requests to the kernel and process the requests
+ * that completed.
+ *
+ * If io_uring_enter fails, io_uring gets shut down and the requests in
+ * flight get retried with blocking system calls.
+ *
+ * @param[in,out] unlink_ctx See @ref unlink_ctx.
+ * @param[in]     wait_nr    Block until at least this many requests have
+ *                           completed.
+ */
+static void
+unlink_uring_reap(struct unlink_ctx *const unlink_ctx,
+                  const unsigned int wait_nr){
+  struct unlink_uring_op *op;
+  uint64_t user_data;
+  int res;
+  size_t i;
+
+  if(uring_submit(unlink_ctx->ring, wait_nr) != 0){
+    warn("io_uring_enter");
+    uring_free(unlink_ctx->ring);
+    unlink_ctx->ring = NULL;
+    for(i = 0; i < UNLINK_URING_ENTRIES; i++){
+      op = &unlink_ctx->op_list[i];
+      if(op->active){
+        op->active = false;
+        unlink_ctx->op_free[unlink_ctx->nop_free++] = i;
+        unlink_batch_now(unlink_ctx, op->path);
+      }
+    }
+  }
+  else{
+    while(uring_reap(unlink_ctx->ring, &user_data, &res)){
+      op = &unlink_ctx->op_list[user_data];
+      op->active = false;
+      unlink_ctx->op_free[unlink_ctx->nop_free++] = (size_t)user_data;
+      if(res < 0){
+        unlink_ctx->nfail += 1;
+        errno = -res;
+        warn("failed to unlink: %s", op->path);
+      }
+    }
+  }
+}
+
+/**
+ * Queue one unlinkat request through io_uring (-u).
+ *
+ * The kernel resolves the whole path relative to the working directory, so
+ * the request does not depend on a cached directory file descriptor staying
+ * open. Falls back to @ref unlink_batch_now if io_uring has been shut down
+ * or the path could not get copied.
+ *
+ * @param[in,out] unlink_ctx See @ref unlink_ctx.
+ * @param[in]     path       File to remove.
+ */
+static void
+unlink_uring_queue(struct unlink_ctx *const unlink_ctx,
+                   const char *const path){
+  struct unlink_uring_op *op;
+  char *buf;
+  size_t idx;
+  size_t len;
+
+  while(unlink_ctx->ring && unlink_ctx->nop_free == 0){
+    unlink_uring_reap(unlink_ctx, 1);
+  }
+  if(unlink_ctx->ring == NULL){
+    unlink_batch_now(unlink_ctx, path);
+  }
+  else{
+    idx = unlink_ctx->op_free[unlink_ctx->nop_free - 1];
+    op = &unlink_ctx->op_list[idx];
+    len = strlen(path);
+    if(len + 1 > op->path_sz){
+      buf = realloc(op->path, len + 1);
+      if(buf){
+        op->path = buf;
+        op->path_sz = len + 1;
+      }
+    }
+    if(len + 1 > op->path_sz){
+      unlink_batch_now(unlink_ctx, path);
+    }
+    else{
+      unlink_ctx->nop_free -= 1;
+      memcpy(op->path, path, len + 1);
+      op->active = true;
+      uring_unlinkat(unlink_ctx->ring, AT_FDCWD, op->path, 0, idx);
+    }
+  }
+}
+
+/**
+ * Wait for all unlinkat requests in flight to complete and release
+ * io_uring.
+ *
+ * @param[in,out] unlink_ctx See @ref unlink_ctx.
+ */
+static void
+unlink_uring_finish(struct unlink_ctx *const unlink_ctx){
+  size_t i;
+
+  while(unlink_ctx->ring && unlink_ctx->nop_free < UNLINK_URING_ENTRIES){
+    unlink_uring_reap(unlink_ctx, 1);
+  }
+  uring_free(unlink_ctx->ring);
+  if(unlink_ctx->op_list && unlink_ctx->op_free){
+    for(i = 0; i < UNLINK_URING_ENTRIES; i++){
+      free(unlink_ctx->op_list[i].path);
+    }
+  }
+  free(unlink_ctx->op_free);
+  free(unlink_ctx->op_list);
+}
+
+/**
+ * Remove one file in batch mode, through io_uring if (-u) set and
+ * available.
+ *
+ * @param[in,out] unlink_ctx See @ref unlink_ctx.
+ * @param[in]     path       File to remove.
+ */
+static void
+unlink_batch_file(struct unlink_ctx *const unlink_ctx,
+                  const char *const path){
+  unlink_ctx->nfile += 1;
+  if(unlink_ctx->ring){
+    unlink_uring_queue(unlink_ctx, path);
+  }
+  else{
+    unlink_batch_now(unlink_ctx, path);
+  }
+}
+
+/**
+ * Remove each file listed in a file in batch mode.
+ *
+ * Each entry in the list file gets terminated by a newline, or by a null
+ * character if (-0) set. Empty entries get skipped.
+ *
+ * @param[in,out] unlink_ctx See @ref unlink_ctx.
+ */
+static void
+unlink_batch_list(struct unlink_ctx *const unlink_ctx){
+  FILE *fp;
+  char *entry;
+  size_t entry_sz;
+  ssize_t entry_len;
+  int delim;
+
+  if(strcmp(unlink_ctx->path_list, "-") == 0){
+    fp = stdin;
+  }
+  else{
+    fp = fopen(unlink_ctx->path_list, "r");
+  }
+  if(fp == NULL){
+    unlink_ctx->status_code = EXIT_FAILURE;
+    warn("fopen(%s)", unlink_ctx->path_list);
+  }
+  else{
+    if(unlink_ctx->flags & UNLINK_FLAG_LIST_NUL){
+      delim = '\0';
+    }
+    else{
+      delim = '\n';
+    }
+    entry = NULL;
+    entry_sz = 0;
+    while((entry_len = getdelim(&entry, &entry_sz, delim, fp)) > 0){
+      if(entry[entry_len - 1] == delim){
+        entry[--entry_len] = '\0';
+      }
+      if(entry_len > 0){
+        unlink_batch_file(unlink_ctx, entry);
+      }
+    }
+    if(ferror(fp)){
+      unlink_ctx->status_code = EXIT_FAILURE;
+      warn("read(%s)", unlink_ctx->path_list);
+    }
+    free(entry);
+    if(fp != stdin && fclose(fp) != 0){
+      unlink_ctx->status_code = EXIT_FAILURE;
+      warn("fclose(%s)", unlink_ctx->path_list);
+    }
+  }
+}
+
+/**
+ * Remove each file operand and each entry in the list file (-l).
+ *
+ * @param[in,out] unlink_ctx See @ref unlink_ctx.
+ * @param[in]     nfile      Number of files in @p file_list.
+ * @param[in]     file_list  File operands to remove.
+ */
+static void
+unlink_batch(struct unlink_ctx *const unlink_ctx,
+             const int nfile,
+             char *const file_list[]){
+  int i;
+
+  unlink_ctx->dirfd = -1;
+  if(unlink_ctx->flags & UNLINK_FLAG_URING){
+    unlink_uring_start(unlink_ctx);
+  }
+  for(i = 0; i < nfile; i++){
+    unlink_batch_file(unlink_ctx, file_list[i]);
+  }
+  if(unlink_ctx->path_list){
+    unlink_batch_list(unlink_ctx);
+  }
+  unlink_uring_finish(unlink_ctx);
+  if(unlink_ctx->dirfd >= 0){
+    close(unlink_ctx->dirfd);
+  }
+  free(unlink_ctx->dir);
+  if(unlink_ctx->nfail > 0){
+    unlink_ctx->status_code = EXIT_FAILURE;
+    warnx("failed to unlink %zu of %zu files",
+          unlink_ctx->nfail,
+          unlink_ctx->nfile);
+  }
+}
 
 /**
  * Main entry point for unlink utility.
  *
+ * Usage:
+ *
+ * unlink file
+ *
+ * unlink -b [-0u] [-l list_file] [file...]
+ *
+ * With (-u), the files get removed through io_uring, many unlinkat requests
+ * per system call, if built with LINK_IO_URING and the kernel supports it.
+ *
+ * Options only get parsed if the first argument is exactly -b, so the
+ * single file operand may start with a '-' like POSIX requires.
+ *
  * @param[in] argc         Number of arguments in @p argv.
  * @param[in] argv         Argument list.
  * @retval    EXIT_SUCCESS Successful.
  * @retval    EXIT_FAILURE Error occurred.
  */
 LINKAGE int
-unlink_main(const int argc,
+unlink_main(int argc,
             char *const argv[]){
-  int status_code;
+  int c;
+  int nopt;
+  struct unlink_ctx unlink_ctx;
 
-  status_code = EXIT_SUCCESS;
-  if(argc != 2){
-    status_code = EXIT_FAILURE;
-    warnx("must have exactly one file operand");
+  memset(&unlink_ctx, 0, sizeof(unlink_ctx));
+  nopt = argc > 0 ? 1 : 0;
+  if(argc > 1 && strcmp(argv[1], "-b") == 0){
+    while((c = getopt(argc, argv, "0bl:u")) != -1){
+      switch(c){
+        case '0':
+          unlink_ctx.flags |= UNLINK_FLAG_LIST_NUL;
+          break;
+        case 'b':
+          unlink_ctx.flags |= UNLINK_FLAG_BATCH;
+          break;
+        case 'l':
+          unlink_ctx.path_list = optarg;
+          break;
+        case 'u':
+          unlink_ctx.flags |= UNLINK_FLAG_URING;
+          break;
+        default:
+          unlink_ctx.status_code = EXIT_FAILURE;
+          break;
+      }
+    }
+    nopt = optind;
   }
-  else{
-    if(unlink(argv[1]) != 0){
-      status_code = EXIT_FAILURE;
-      warn("failed to unlink: %s", argv[1]);
+  argc -= nopt;
+  argv += nopt;
+
+  if(unlink_ctx.status_code == EXIT_SUCCESS){
+    if(unlink_ctx.flags & UNLINK_FLAG_BATCH){
+      if(argc < 1 && unlink_ctx.path_list == NULL){
+        unlink_ctx.status_code = EXIT_FAILURE;
+        warnx("must have a file operand or list file");
+      }
+      else{
+        unlink_batch(&unlink_ctx, argc, argv);
+      }
+    }
+    else if(argc != 1 || unlink_ctx.path_list){
+      unlink_ctx.status_code = EXIT_FAILURE;
+      warnx("must have exactly one file operand");
+    }
+    else if(unlink(argv[0]) != 0){
+      unlink_ctx.status_code = EXIT_FAILURE;
+      warn("failed to unlink: %s", argv[0]);
     }
   }
-  return status_code;
+  return unlink_ctx.status_code;
 }
 
-#ifndef TEST
+#if !defined(TEST) && !defined(LINK_BENCH) && !defined(LINK_MULTICALL)
 /**
  * Main program entry point.
  *
@@ -64,5 +618,4 @@ main(int argc,
      char *argv[]){
   return unlink_main(argc, argv);
 }
-#endif /* TEST */
-
+#endif /* !(TEST) && !(LINK_BENCH) && !(LINK_MULTICALL) */
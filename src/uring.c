@@ -0,0 +1,549 @@
+/**
+ * @file
+ * @brief io_uring submission of link operations
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ */
+
+#ifdef LINK_IO_URING
+/**
+ * Required for syscall().
+ */
+# ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+# endif /* _GNU_SOURCE */
+# include <linux/io_uring.h>
+# include <linux/stat.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <sys/syscall.h>
+#endif /* LINK_IO_URING */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef TEST
+# include "../test/seams.h"
+#endif /* TEST */
+
+#include "uring.h"
+
+#ifdef LINK_IO_URING
+
+/**
+ * Memory-mapped submission and completion rings shared with the kernel.
+ */
+struct uring{
+  /**
+   * File descriptor returned by io_uring_setup.
+   */
+  int fd;
+
+  /**
+   * Submission queue ring mapping.
+   */
+  void *sq_ring;
+
+  /**
+   * Size of @ref sq_ring in bytes.
+   */
+  size_t sq_ring_sz;
+
+  /**
+   * Completion queue ring mapping.
+   */
+  void *cq_ring;
+
+  /**
+   * Size of @ref cq_ring in bytes.
+   */
+  size_t cq_ring_sz;
+
+  /**
+   * Submission queue entry array mapping.
+   */
+  struct io_uring_sqe *sqes;
+
+  /**
+   * Size of @ref sqes in bytes.
+   */
+  size_t sqes_sz;
+
+  /**
+   * Kernel-owned submission queue head.
+   */
+  unsigned int *sq_head;
+
+  /**
+   * Application-owned submission queue tail.
+   */
+  unsigned int *sq_tail;
+
+  /**
+   * Submission queue index mask.
+   */
+  unsigned int sq_mask;
+
+  /**
+   * Indirection array from the submission ring into @ref sqes.
+   */
+  unsigned int *sq_array;
+
+  /**
+   * Application-owned completion queue head.
+   */
+  unsigned int *cq_head;
+
+  /**
+   * Kernel-owned completion queue tail.
+   */
+  unsigned int *cq_tail;
+
+  /**
+   * Completion queue index mask.
+   */
+  unsigned int cq_mask;
+
+  /**
+   * Completion queue entry array.
+   */
+  struct io_uring_cqe *cqes;
+
+  /**
+   * Submission queue tail including the requests queued since the last
+   * call to @ref uring_submit.
+   */
+  unsigned int sq_tail_next;
+};
+
+/**
+ * Wrapper for the io_uring_setup system call.
+ *
+ * @param[in]     entries See io_uring_setup.
+ * @param[in,out] p       See io_uring_setup.
+ * @return                See io_uring_setup.
+ */
+static int
+uring_sys_setup(const unsigned int entries,
+                struct io_uring_params *const p){
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+/**
+ * Wrapper for the io_uring_enter system call.
+ *
+ * @param[in] fd           See io_uring_enter.
+ * @param[in] to_submit    See io_uring_enter.
+ * @param[in] min_complete See io_uring_enter.
+ * @param[in] flags        See io_uring_enter.
+ * @return                 See io_uring_enter.
+ */
+static int
+uring_sys_enter(const int fd,
+                const unsigned int to_submit,
+                const unsigned int min_complete,
+                const unsigned int flags){
+  return (int)syscall(__NR_io_uring_enter,
+                      fd,
+                      to_submit,
+                      min_complete,
+                      flags,
+                      NULL,
+                      0);
+}
+
+struct uring *
+uring_new(unsigned int entries){
+  struct uring *ring;
+  struct io_uring_params params;
+  int errno_save;
+
+  ring = malloc(sizeof(*ring));
+  if(ring){
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    ring->sq_ring = MAP_FAILED;
+    ring->cq_ring = MAP_FAILED;
+    ring->sqes = MAP_FAILED;
+    ring->fd = uring_sys_setup(entries, &params);
+    if(ring->fd >= 0){
+      ring->sq_ring_sz = params.sq_off.array +
+                         params.sq_entries * sizeof(unsigned int);
+      ring->cq_ring_sz = params.cq_off.cqes +
+                         params.cq_entries * sizeof(struct io_uring_cqe);
+      ring->sqes_sz = params.sq_entries * sizeof(struct io_uring_sqe);
+      ring->sq_ring = mmap(NULL,
+                           ring->sq_ring_sz,
+                           PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE,
+                           ring->fd,
+                           IORING_OFF_SQ_RING);
+      ring->cq_ring = mmap(NULL,
+                           ring->cq_ring_sz,
+                           PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE,
+                           ring->fd,
+                           IORING_OFF_CQ_RING);
+      ring->sqes = mmap(NULL,
+                        ring->sqes_sz,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        ring->fd,
+                        IORING_OFF_SQES);
+    }
+    if(ring->fd < 0 ||
+       ring->sq_ring == MAP_FAILED ||
+       ring->cq_ring == MAP_FAILED ||
+       ring->sqes == MAP_FAILED){
+      errno_save = errno;
+      uring_free(ring);
+      errno = errno_save;
+      ring = NULL;
+    }
+    else{
+      ring->sq_head = (unsigned int *)((char *)ring->sq_ring +
+                                       params.sq_off.head);
+      ring->sq_tail = (unsigned int *)((char *)ring->sq_ring +
+                                       params.sq_off.tail);
+      ring->sq_mask = *(unsigned int *)((char *)ring->sq_ring +
+                                        params.sq_off.ring_mask);
+      ring->sq_tail_next = *ring->sq_tail;
+      ring->sq_array = (unsigned int *)((char *)ring->sq_ring +
+                                        params.sq_off.array);
+      ring->cq_head = (unsigned int *)((char *)ring->cq_ring +
+                                       params.cq_off.head);
+      ring->cq_tail = (unsigned int *)((char *)ring->cq_ring +
+                                       params.cq_off.tail);
+      ring->cq_mask = *(unsigned int *)((char *)ring->cq_ring +
+                                        params.cq_off.ring_mask);
+      ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring +
+                                           params.cq_off.cqes);
+    }
+  }
+  return ring;
+}
+
+void
+uring_free(struct uring *const ring){
+  if(ring){
+    if(ring->sqes != MAP_FAILED){
+      munmap(ring->sqes, ring->sqes_sz);
+    }
+    if(ring->cq_ring != MAP_FAILED){
+      munmap(ring->cq_ring, ring->cq_ring_sz);
+    }
+    if(ring->sq_ring != MAP_FAILED){
+      munmap(ring->sq_ring, ring->sq_ring_sz);
+    }
+    if(ring->fd >= 0){
+      close(ring->fd);
+    }
+    free(ring);
+  }
+}
+
+/**
+ * Get the next free submission queue entry.
+ *
+ * The caller limits the number of requests in flight to the number of
+ * entries given to @ref uring_new, so a free entry always exists.
+ *
+ * @param[in,out] ring                 See @ref uring.
+ * @param[in]     opcode               io_uring operation.
+ * @param[in]     user_data            Returned by @ref uring_reap.
+ * @retval        struct io_uring_sqe* Cleared entry to fill in.
+ */
+static struct io_uring_sqe *
+uring_get_sqe(struct uring *const ring,
+              const unsigned int opcode,
+              const uint64_t user_data){
+  unsigned int idx;
+  struct io_uring_sqe *sqe;
+
+  idx = ring->sq_tail_next & ring->sq_mask;
+  sqe = &ring->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = (__u8)opcode;
+  sqe->user_data = user_data;
+  ring->sq_array[idx] = idx;
+  ring->sq_tail_next += 1;
+  return sqe;
+}
+
+void
+uring_linkat(struct uring *const ring,
+             const int olddirfd,
+             const char *const oldpath,
+             const int newdirfd,
+             const char *const newpath,
+             const int flags,
+             const uint64_t user_data){
+  struct io_uring_sqe *sqe;
+
+  sqe = uring_get_sqe(ring, IORING_OP_LINKAT, user_data);
+  sqe->fd = olddirfd;
+  sqe->addr = (uintptr_t)oldpath;
+  sqe->len = (__u32)newdirfd;
+  sqe->addr2 = (uintptr_t)newpath;
+  sqe->hardlink_flags = (__u32)flags;
+}
+
+void
+uring_symlinkat(struct uring *const ring,
+                const char *const target,
+                const int newdirfd,
+                const char *const linkpath,
+                const uint64_t user_data){
+  struct io_uring_sqe *sqe;
+
+  sqe = uring_get_sqe(ring, IORING_OP_SYMLINKAT, user_data);
+  sqe->fd = newdirfd;
+  sqe->addr = (uintptr_t)target;
+  sqe->addr2 = (uintptr_t)linkpath;
+}
+
+void
+uring_unlinkat(struct uring *const ring,
+               const int dirfd,
+               const char *const path,
+               const int flags,
+               const uint64_t user_data){
+  struct io_uring_sqe *sqe;
+
+  sqe = uring_get_sqe(ring, IORING_OP_UNLINKAT, user_data);
+  sqe->fd = dirfd;
+  sqe->addr = (uintptr_t)path;
+  sqe->unlink_flags = (__u32)flags;
+}
+
+void
+uring_renameat(struct uring *const ring,
+               const int olddirfd,
+               const char *const oldpath,
+               const int newdirfd,
+               const char *const newpath,
+               const uint64_t user_data){
+  struct io_uring_sqe *sqe;
+
+  sqe = uring_get_sqe(ring, IORING_OP_RENAMEAT, user_data);
+  sqe->fd = olddirfd;
+  sqe->addr = (uintptr_t)oldpath;
+  sqe->len = (__u32)newdirfd;
+  sqe->addr2 = (uintptr_t)newpath;
+}
+
+void
+uring_statx(struct uring *const ring,
+            const int dirfd,
+            const char *const path,
+            const int flags,
+            struct uring_statx *const sx,
+            const uint64_t user_data){
+  struct io_uring_sqe *sqe;
+
+  sqe = uring_get_sqe(ring, IORING_OP_STATX, user_data);
+  sqe->fd = dirfd;
+  sqe->addr = (uintptr_t)path;
+  sqe->len = STATX_INO;
+  sqe->off = (uintptr_t)sx->buf;
+  sqe->statx_flags = (__u32)flags;
+}
+
+bool
+uring_statx_same(const struct uring_statx *const sx1,
+                 const struct uring_statx *const sx2){
+  const struct statx *stx1;
+  const struct statx *stx2;
+
+  stx1 = (const struct statx *)sx1->buf;
+  stx2 = (const struct statx *)sx2->buf;
+  return stx1->stx_dev_major == stx2->stx_dev_major &&
+         stx1->stx_dev_minor == stx2->stx_dev_minor &&
+         stx1->stx_ino == stx2->stx_ino;
+}
+
+bool
+uring_statx_is_link(const struct uring_statx *const sx){
+  const struct statx *stx;
+
+  stx = (const struct statx *)sx->buf;
+  return S_ISLNK(stx->stx_mode);
+}
+
+void
+uring_link_next(struct uring *const ring){
+  ring->sqes[(ring->sq_tail_next - 1) & ring->sq_mask].flags |=
+    IOSQE_IO_LINK;
+}
+
+int
+uring_submit(struct uring *const ring,
+             const unsigned int wait_nr){
+  unsigned int to_submit;
+  unsigned int flags;
+  int rc;
+
+  __atomic_store_n(ring->sq_tail, ring->sq_tail_next, __ATOMIC_RELEASE);
+  to_submit = ring->sq_tail_next -
+              __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  flags = 0;
+  if(wait_nr > 0){
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+  do{
+    rc = uring_sys_enter(ring->fd, to_submit, wait_nr, flags);
+  } while(rc < 0 && errno == EINTR);
+  if(rc > 0){
+    rc = 0;
+  }
+  return rc;
+}
+
+bool
+uring_reap(struct uring *const ring,
+           uint64_t *const user_data,
+           int *const res){
+  unsigned int head;
+  struct io_uring_cqe *cqe;
+  bool reaped;
+
+  reaped = false;
+  head = *ring->cq_head;
+  if(head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)){
+    cqe = &ring->cqes[head & ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    reaped = true;
+  }
+  return reaped;
+}
+
+#else /* !(LINK_IO_URING) */
+
+struct uring *
+uring_new(unsigned int entries){
+  (void)entries;
+  errno = ENOSYS;
+  return NULL;
+}
+
+void
+uring_free(struct uring *const ring){
+  (void)ring;
+}
+
+void
+uring_linkat(struct uring *const ring,
+             const int olddirfd,
+             const char *const oldpath,
+             const int newdirfd,
+             const char *const newpath,
+             const int flags,
+             const uint64_t user_data){
+  (void)ring;
+  (void)olddirfd;
+  (void)oldpath;
+  (void)newdirfd;
+  (void)newpath;
+  (void)flags;
+  (void)user_data;
+}
+
+void
+uring_symlinkat(struct uring *const ring,
+                const char *const target,
+                const int newdirfd,
+                const char *const linkpath,
+                const uint64_t user_data){
+  (void)ring;
+  (void)target;
+  (void)newdirfd;
+  (void)linkpath;
+  (void)user_data;
+}
+
+void
+uring_unlinkat(struct uring *const ring,
+               const int dirfd,
+               const char *const path,
+               const int flags,
+               const uint64_t user_data){
+  (void)ring;
+  (void)dirfd;
+  (void)path;
+  (void)flags;
+  (void)user_data;
+}
+
+void
+uring_renameat(struct uring *const ring,
+               const int olddirfd,
+               const char *const oldpath,
+               const int newdirfd,
+               const char *const newpath,
+               const uint64_t user_data){
+  (void)ring;
+  (void)olddirfd;
+  (void)oldpath;
+  (void)newdirfd;
+  (void)newpath;
+  (void)user_data;
+}
+
+void
+uring_statx(struct uring *const ring,
+            const int dirfd,
+            const char *const path,
+            const int flags,
+            struct uring_statx *const sx,
+            const uint64_t user_data){
+  (void)ring;
+  (void)dirfd;
+  (void)path;
+  (void)flags;
+  (void)sx;
+  (void)user_data;
+}
+
+bool
+uring_statx_same(const struct uring_statx *const sx1,
+                 const struct uring_statx *const sx2){
+  (void)sx1;
+  (void)sx2;
+  return false;
+}
+
+bool
+uring_statx_is_link(const struct uring_statx *const sx){
+  (void)sx;
+  return false;
+}
+
+void
+uring_link_next(struct uring *const ring){
+  (void)ring;
+}
+
+int
+uring_submit(struct uring *const ring,
+             const unsigned int wait_nr){
+  (void)ring;
+  (void)wait_nr;
+  errno = ENOSYS;
+  return -1;
+}
+
+bool
+uring_reap(struct uring *const ring,
+           uint64_t *const user_data,
+           int *const res){
+  (void)ring;
+  (void)user_data;
+  (void)res;
+  return false;
+}
+
+#endif /* LINK_IO_URING */
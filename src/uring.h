@@ -0,0 +1,218 @@
+/**
+ * @file
+ * @brief io_uring submission of link operations
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ *
+ * Batches linkat, symlinkat, renameat, and unlinkat requests so that many of
+ * them get handed to the kernel with a single io_uring_enter system call.
+ *
+ * The io_uring backend only gets compiled in when LINK_IO_URING has been
+ * defined. Otherwise, @ref uring_new always fails with ENOSYS and the
+ * utilities fall back to calling the blocking system calls directly.
+ */
+#ifndef LINK_URING_H
+#define LINK_URING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Opaque io_uring instance.
+ */
+struct uring;
+
+/**
+ * Storage for the file status written by a @ref uring_statx request.
+ */
+struct uring_statx{
+  /**
+   * Holds the kernel struct statx.
+   */
+  uint64_t buf[32];
+};
+
+/**
+ * Set up a new io_uring instance.
+ *
+ * @param[in] entries       Number of submission queue entries. The caller
+ *                          must not have more than this number of requests
+ *                          in flight at the same time.
+ * @retval    struct uring* New io_uring instance. Free with
+ *                          @ref uring_free.
+ * @retval    NULL          io_uring not available, errno set.
+ */
+struct uring *
+uring_new(unsigned int entries);
+
+/**
+ * Release all resources used by an io_uring instance.
+ *
+ * @param[in] ring io_uring created by @ref uring_new, or NULL.
+ */
+void
+uring_free(struct uring *const ring);
+
+/**
+ * Queue a linkat request.
+ *
+ * The path arguments must remain valid until the request completes.
+ *
+ * @param[in,out] ring      See @ref uring.
+ * @param[in]     olddirfd  See linkat.
+ * @param[in]     oldpath   See linkat.
+ * @param[in]     newdirfd  See linkat.
+ * @param[in]     newpath   See linkat.
+ * @param[in]     flags     See linkat.
+ * @param[in]     user_data Returned by @ref uring_reap when complete.
+ */
+void
+uring_linkat(struct uring *const ring,
+             const int olddirfd,
+             const char *const oldpath,
+             const int newdirfd,
+             const char *const newpath,
+             const int flags,
+             const uint64_t user_data);
+
+/**
+ * Queue a symlinkat request.
+ *
+ * The path arguments must remain valid until the request completes.
+ *
+ * @param[in,out] ring      See @ref uring.
+ * @param[in]     target    See symlinkat.
+ * @param[in]     newdirfd  See symlinkat.
+ * @param[in]     linkpath  See symlinkat.
+ * @param[in]     user_data Returned by @ref uring_reap when complete.
+ */
+void
+uring_symlinkat(struct uring *const ring,
+                const char *const target,
+                const int newdirfd,
+                const char *const linkpath,
+                const uint64_t user_data);
+
+/**
+ * Queue an unlinkat request.
+ *
+ * The path argument must remain valid until the request completes.
+ *
+ * @param[in,out] ring      See @ref uring.
+ * @param[in]     dirfd     See unlinkat.
+ * @param[in]     path      See unlinkat.
+ * @param[in]     flags     See unlinkat.
+ * @param[in]     user_data Returned by @ref uring_reap when complete.
+ */
+void
+uring_unlinkat(struct uring *const ring,
+               const int dirfd,
+               const char *const path,
+               const int flags,
+               const uint64_t user_data);
+
+/**
+ * Queue a renameat request.
+ *
+ * The path arguments must remain valid until the request completes.
+ *
+ * @param[in,out] ring      See @ref uring.
+ * @param[in]     olddirfd  See renameat.
+ * @param[in]     oldpath   See renameat.
+ * @param[in]     newdirfd  See renameat.
+ * @param[in]     newpath   See renameat.
+ * @param[in]     user_data Returned by @ref uring_reap when complete.
+ */
+void
+uring_renameat(struct uring *const ring,
+               const int olddirfd,
+               const char *const oldpath,
+               const int newdirfd,
+               const char *const newpath,
+               const uint64_t user_data);
+
+/**
+ * Queue a statx request.
+ *
+ * The path and @p sx arguments must remain valid until the request
+ * completes.
+ *
+ * @param[in,out] ring      See @ref uring.
+ * @param[in]     dirfd     See fstatat.
+ * @param[in]     path      See fstatat.
+ * @param[in]     flags     See fstatat.
+ * @param[out]    sx        File status written here on completion.
+ * @param[in]     user_data Returned by @ref uring_reap when complete.
+ */
+void
+uring_statx(struct uring *const ring,
+            const int dirfd,
+            const char *const path,
+            const int flags,
+            struct uring_statx *const sx,
+            const uint64_t user_data);
+
+/**
+ * Check if two completed @ref uring_statx requests refer to the same file.
+ *
+ * @param[in] sx1   Compare with @p sx2.
+ * @param[in] sx2   Compare with @p sx1.
+ * @retval    true  Device and inode numbers match.
+ * @retval    false Different files.
+ */
+bool
+uring_statx_same(const struct uring_statx *const sx1,
+                 const struct uring_statx *const sx2);
+
+/**
+ * Check if a completed @ref uring_statx request found a symbolic link.
+ *
+ * @param[in] sx    File status to check.
+ * @retval    true  Symbolic link.
+ * @retval    false Any other type of file.
+ */
+bool
+uring_statx_is_link(const struct uring_statx *const sx);
+
+/**
+ * Only start the next queued request after the most recently queued request
+ * succeeds.
+ *
+ * If the most recently queued request fails, the next request completes
+ * with -ECANCELED without running.
+ *
+ * @param[in,out] ring See @ref uring.
+ */
+void
+uring_link_next(struct uring *const ring);
+
+/**
+ * Hand all queued requests to the kernel and optionally wait for some of
+ * them to complete.
+ *
+ * @param[in,out] ring    See @ref uring.
+ * @param[in]     wait_nr Block until at least this many requests have
+ *                        completed.
+ * @retval        0       Submitted all queued requests.
+ * @retval        -1      io_uring_enter failed, errno set.
+ */
+int
+uring_submit(struct uring *const ring,
+             const unsigned int wait_nr);
+
+/**
+ * Get the result of the next completed request.
+ *
+ * @param[in,out] ring      See @ref uring.
+ * @param[out]    user_data Value given when the request got queued.
+ * @param[out]    res       0 on success, or a negated errno value.
+ * @retval        true      Got a completed request.
+ * @retval        false     No completed requests available.
+ */
+bool
+uring_reap(struct uring *const ring,
+           uint64_t *const user_data,
+           int *const res);
+
+#endif /* LINK_URING_H */
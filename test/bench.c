@@ -0,0 +1,1241 @@
+/**
+ * @file
+ * @brief benchmark suite
+ * @author James Humphrey (humphreyj@somnisoft.com)
+ *
+ * This software has been placed into the public domain using CC0.
+ *
+ * Measures the throughput of the ln, link, and unlink utilities by calling
+ * their entry points in-process, so that the numbers do not include the
+ * cost of starting a new process for each link.
+ *
+ * Build:
+ *
+ * cc -std=c99 -O2 -D_POSIX_C_SOURCE=200809L -DLINK_BENCH -o bench
+ *   src/link.c src/ln.c src/unlink.c src/reflink.c src/uring.c
+ *   test/bench.c -lpthread
+ *
+ * Each directory operand should be on the file system to measure, for
+ * example a tmpfs mount and ext4 or xfs loop images:
+ *
+ * truncate -s 8G ext4.img && mkfs.ext4 -q ext4.img
+ * mount -o loop ext4.img /mnt/ext4
+ *
+ * The scaling sweep (-S) fills the target directories with up to the
+ * largest (-d) number of entries, so an ext4 image for a 10M entry sweep
+ * needs enough inodes, for example mkfs.ext4 -q -N 24000000 ext4.img.
+ *
+ * The start-up sweep (-E) runs the utilities as separate processes instead.
+ * Compare a lean static build (see README.md) with the system utilities:
+ *
+ * bench -E build/lean /usr/bin
+ */
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+
+/**
+ * Maximum number of values given by each of the (-d), (-j), and (-n)
+ * arguments.
+ */
+#define BENCH_LIST_MAX 16
+
+/**
+ * Default number of shard directories in the scaling sweep.
+ */
+#define BENCH_NSHARD_DEFAULT 256
+
+/**
+ * Source file linked by the start-up sweep, in the current directory.
+ */
+#define BENCH_EXEC_SOURCE "bench-exec-src"
+
+/**
+ * Link created and removed by the start-up sweep, in the current directory.
+ */
+#define BENCH_EXEC_DEST "bench-exec-dst"
+
+/**
+ * Size of the buffers holding the paths passed to the utilities.
+ */
+#define BENCH_PATH_SZ 4096
+
+/**
+ * @defgroup bench_mode bench modes
+ *
+ * Operation measured in each run.
+ */
+
+/**
+ * ln source_file target_file
+ *
+ * @ingroup bench_mode
+ */
+#define BENCH_MODE_LN          0
+
+/**
+ * ln -s source_file target_file
+ *
+ * @ingroup bench_mode
+ */
+#define BENCH_MODE_LN_SYMBOLIC 1
+
+/**
+ * ln -f source_file target_file, with target_file already existing.
+ *
+ * @ingroup bench_mode
+ */
+#define BENCH_MODE_LN_REPLACE  2
+
+/**
+ * ln -L source_file target_file, with source_file a symbolic link.
+ *
+ * @ingroup bench_mode
+ */
+#define BENCH_MODE_LN_FOLLOW   3
+
+/**
+ * link file1 file2
+ *
+ * @ingroup bench_mode
+ */
+#define BENCH_MODE_LINK        4
+
+/**
+ * unlink file
+ *
+ * @ingroup bench_mode
+ */
+#define BENCH_MODE_UNLINK      5
+
+/**
+ * Number of benchmark modes.
+ *
+ * @ingroup bench_mode
+ */
+#define BENCH_MODE_COUNT       6
+
+/**
+ * Name of each benchmark mode written to the output.
+ */
+static const char *const
+g_bench_mode_name[BENCH_MODE_COUNT] = {
+  "ln",
+  "ln-s",
+  "ln-f",
+  "ln-L",
+  "link",
+  "unlink"
+};
+
+/**
+ * Values given by a repeated command line argument.
+ */
+struct bench_list{
+  /**
+   * Values in the order given.
+   */
+  size_t val[BENCH_LIST_MAX];
+
+  /**
+   * Number of values in @ref val.
+   */
+  size_t n;
+};
+
+/**
+ * Benchmark context.
+ */
+struct bench_ctx{
+  /**
+   * Results get appended to this file.
+   */
+  FILE *fp_out;
+
+  /**
+   * Latency of each operation in the current run, in nanoseconds.
+   */
+  uint64_t *lat_list;
+
+  /**
+   * Source files, in the bench-src directory.
+   */
+  char path_source[BENCH_PATH_SZ];
+
+  /**
+   * Symbolic links to the source files, in the bench-sym directory.
+   */
+  char path_sym[BENCH_PATH_SZ];
+
+  /**
+   * New links, in the bench-dst directory.
+   */
+  char path_dest[BENCH_PATH_SZ];
+
+  /**
+   * Argument list passed to the utilities.
+   */
+  char *argv[6];
+
+  /**
+   * Storage for the utility name and option in @ref argv.
+   */
+  char arg_list[2][8];
+};
+
+/**
+ * Get the current time of the monotonic clock.
+ *
+ * @return Time in nanoseconds.
+ */
+static uint64_t
+bench_now(void){
+  struct timespec ts;
+
+  if(clock_gettime(CLOCK_MONOTONIC, &ts) != 0){
+    err(EXIT_FAILURE, "clock_gettime");
+  }
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Build the path of the i-th file in a benchmark subdirectory.
+ *
+ * @param[out] path Store the path here, size of @ref BENCH_PATH_SZ.
+ * @param[in]  dir  Directory being measured.
+ * @param[in]  sub  Name of the subdirectory.
+ * @param[in]  i    Index of the file.
+ */
+static void
+bench_path(char *const path,
+           const char *const dir,
+           const char *const sub,
+           const size_t i){
+  int len;
+
+  len = snprintf(path, BENCH_PATH_SZ, "%s/%s/%zu", dir, sub, i);
+  if(len < 0 || len >= BENCH_PATH_SZ){
+    errx(EXIT_FAILURE, "path too long: %s", dir);
+  }
+}
+
+/**
+ * Create a benchmark subdirectory.
+ *
+ * @param[in] dir Directory being measured.
+ * @param[in] sub Name of the new subdirectory.
+ */
+static void
+bench_mkdir(const char *const dir,
+            const char *const sub){
+  char path[BENCH_PATH_SZ];
+
+  snprintf(path, sizeof(path), "%s/%s", dir, sub);
+  if(mkdir(path, 0777) != 0){
+    err(EXIT_FAILURE, "mkdir(%s)", path);
+  }
+}
+
+/**
+ * Remove a benchmark subdirectory along with the files inside it.
+ *
+ * @param[in] dir   Directory being measured.
+ * @param[in] sub   Name of the subdirectory.
+ * @param[in] nfile Number of files in the subdirectory.
+ * @param[in] rm    Remove the subdirectory itself after its files.
+ */
+static void
+bench_rm(const char *const dir,
+         const char *const sub,
+         const size_t nfile,
+         const bool rm){
+  char path[BENCH_PATH_SZ];
+  size_t i;
+
+  for(i = 0; i < nfile; i++){
+    bench_path(path, dir, sub, i);
+    unlink(path);
+  }
+  if(rm){
+    snprintf(path, sizeof(path), "%s/%s", dir, sub);
+    if(rmdir(path) != 0){
+      err(EXIT_FAILURE, "rmdir(%s)", path);
+    }
+  }
+}
+
+/**
+ * Fill a benchmark subdirectory with files.
+ *
+ * @param[in] dir   Directory being measured.
+ * @param[in] sub   Name of the subdirectory.
+ * @param[in] nfile Number of files to create.
+ * @param[in] sym   Create symbolic links to the source files instead of
+ *                  empty files.
+ */
+static void
+bench_fill(const char *const dir,
+           const char *const sub,
+           const size_t nfile,
+           const bool sym){
+  char path[BENCH_PATH_SZ];
+  char target[BENCH_PATH_SZ];
+  size_t i;
+  int fd;
+
+  for(i = 0; i < nfile; i++){
+    bench_path(path, dir, sub, i);
+    if(sym){
+      snprintf(target, sizeof(target), "../bench-src/%zu", i);
+      if(symlink(target, path) != 0){
+        err(EXIT_FAILURE, "symlink(%s)", path);
+      }
+    }
+    else{
+      fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+      if(fd < 0){
+        err(EXIT_FAILURE, "open(%s)", path);
+      }
+      close(fd);
+    }
+  }
+}
+
+/**
+ * Run one operation of a benchmark mode.
+ *
+ * @param[in,out] bench_ctx See @ref bench_ctx.
+ * @param[in]     mode      See @ref bench_mode.
+ * @return                  Exit status of the utility.
+ */
+static int
+bench_op(struct bench_ctx *const bench_ctx,
+         const int mode){
+  char **argv;
+  int argc;
+  int status_code;
+
+  argv = bench_ctx->argv;
+  argc = 0;
+  optind = 0;
+  argv[argc++] = bench_ctx->arg_list[0];
+  if(mode == BENCH_MODE_LINK){
+    strcpy(bench_ctx->arg_list[0], "link");
+    argv[argc++] = bench_ctx->path_source;
+    argv[argc++] = bench_ctx->path_dest;
+    argv[argc] = NULL;
+    status_code = link_main(argc, argv);
+  }
+  else if(mode == BENCH_MODE_UNLINK){
+    strcpy(bench_ctx->arg_list[0], "unlink");
+    argv[argc++] = bench_ctx->path_dest;
+    argv[argc] = NULL;
+    status_code = unlink_main(argc, argv);
+  }
+  else{
+    strcpy(bench_ctx->arg_list[0], "ln");
+    if(mode == BENCH_MODE_LN_SYMBOLIC){
+      strcpy(bench_ctx->arg_list[1], "-s");
+      argv[argc++] = bench_ctx->arg_list[1];
+    }
+    else if(mode == BENCH_MODE_LN_REPLACE){
+      strcpy(bench_ctx->arg_list[1], "-f");
+      argv[argc++] = bench_ctx->arg_list[1];
+    }
+    else if(mode == BENCH_MODE_LN_FOLLOW){
+      strcpy(bench_ctx->arg_list[1], "-L");
+      argv[argc++] = bench_ctx->arg_list[1];
+    }
+    if(mode == BENCH_MODE_LN_FOLLOW){
+      argv[argc++] = bench_ctx->path_sym;
+    }
+    else{
+      argv[argc++] = bench_ctx->path_source;
+    }
+    argv[argc++] = bench_ctx->path_dest;
+    argv[argc] = NULL;
+    status_code = ln_main(argc, argv);
+  }
+  return status_code;
+}
+
+/**
+ * Compare two latencies for qsort.
+ *
+ * @param[in] a  First latency.
+ * @param[in] b  Second latency.
+ * @retval    -1 @p a less than @p b.
+ * @retval    0  @p a equal to @p b.
+ * @retval    1  @p a greater than @p b.
+ */
+static int
+bench_lat_cmp(const void *a,
+              const void *b){
+  uint64_t lat_a;
+  uint64_t lat_b;
+
+  lat_a = *(const uint64_t *)a;
+  lat_b = *(const uint64_t *)b;
+  return (lat_a > lat_b) - (lat_a < lat_b);
+}
+
+/**
+ * Measure one benchmark mode and write the results.
+ *
+ * The files needed by the mode get created before the timed loop, and the
+ * new links get removed after it.
+ *
+ * @param[in,out] bench_ctx See @ref bench_ctx.
+ * @param[in]     dir       Directory being measured.
+ * @param[in]     nfile     Number of operations to run.
+ * @param[in]     mode      See @ref bench_mode.
+ */
+static void
+bench_run(struct bench_ctx *const bench_ctx,
+          const char *const dir,
+          const size_t nfile,
+          const int mode){
+  size_t i;
+  uint64_t start;
+  uint64_t total;
+  struct rusage ru;
+  double rate;
+
+  if(mode == BENCH_MODE_LN_REPLACE){
+    bench_fill(dir, "bench-dst", nfile, false);
+  }
+  else if(mode == BENCH_MODE_UNLINK){
+    for(i = 0; i < nfile; i++){
+      bench_path(bench_ctx->path_source, dir, "bench-src", i);
+      bench_path(bench_ctx->path_dest, dir, "bench-dst", i);
+      if(link(bench_ctx->path_source, bench_ctx->path_dest) != 0){
+        err(EXIT_FAILURE, "link(%s)", bench_ctx->path_dest);
+      }
+    }
+  }
+
+  total = 0;
+  for(i = 0; i < nfile; i++){
+    bench_path(bench_ctx->path_source, dir, "bench-src", i);
+    bench_path(bench_ctx->path_sym, dir, "bench-sym", i);
+    bench_path(bench_ctx->path_dest, dir, "bench-dst", i);
+    start = bench_now();
+    if(bench_op(bench_ctx, mode) != EXIT_SUCCESS){
+      errx(EXIT_FAILURE, "%s failed: %s", g_bench_mode_name[mode], dir);
+    }
+    bench_ctx->lat_list[i] = bench_now() - start;
+    total += bench_ctx->lat_list[i];
+  }
+
+  if(mode != BENCH_MODE_UNLINK){
+    bench_rm(dir, "bench-dst", nfile, false);
+  }
+  qsort(bench_ctx->lat_list,
+        nfile,
+        sizeof(*bench_ctx->lat_list),
+        bench_lat_cmp);
+  if(getrusage(RUSAGE_SELF, &ru) != 0){
+    err(EXIT_FAILURE, "getrusage");
+  }
+  rate = 0;
+  if(total > 0){
+    rate = (double)nfile * 1e9 / (double)total;
+  }
+  fprintf(bench_ctx->fp_out,
+          "%-24s %10zu %-8s %12.0f %10.2f %10.2f %10ld\n",
+          dir,
+          nfile,
+          g_bench_mode_name[mode],
+          rate,
+          (double)bench_ctx->lat_list[nfile / 2] / 1e3,
+          (double)bench_ctx->lat_list[nfile * 99 / 100] / 1e3,
+          ru.ru_maxrss);
+  fflush(bench_ctx->fp_out);
+}
+
+/**
+ * Measure all benchmark modes for one directory and number of files.
+ *
+ * @param[in,out] bench_ctx See @ref bench_ctx.
+ * @param[in]     dir       Directory on the file system to measure.
+ * @param[in]     nfile     Number of source files.
+ */
+static void
+bench_dir(struct bench_ctx *const bench_ctx,
+          const char *const dir,
+          const size_t nfile){
+  int mode;
+
+  bench_mkdir(dir, "bench-src");
+  bench_mkdir(dir, "bench-sym");
+  bench_mkdir(dir, "bench-dst");
+  bench_fill(dir, "bench-src", nfile, false);
+  bench_fill(dir, "bench-sym", nfile, true);
+  for(mode = 0; mode < BENCH_MODE_COUNT; mode++){
+    bench_run(bench_ctx, dir, nfile, mode);
+  }
+  bench_rm(dir, "bench-dst", 0, true);
+  bench_rm(dir, "bench-sym", nfile, true);
+  bench_rm(dir, "bench-src", nfile, true);
+}
+
+/**
+ * Run a utility as a new process and wait for it to exit.
+ *
+ * @param[in] path  Path to the utility.
+ * @param[in] argv  Argument list.
+ * @return          Time taken by fork, exec, and exit in nanoseconds.
+ */
+static uint64_t
+bench_exec_one(const char *const path,
+               char *const argv[]){
+  uint64_t start;
+  pid_t pid;
+  int status;
+
+  start = bench_now();
+  pid = fork();
+  if(pid < 0){
+    err(EXIT_FAILURE, "fork");
+  }
+  else if(pid == 0){
+    execv(path, argv);
+    _exit(127);
+  }
+  if(waitpid(pid, &status, 0) != pid){
+    err(EXIT_FAILURE, "waitpid");
+  }
+  if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS){
+    errx(EXIT_FAILURE, "%s failed", path);
+  }
+  return bench_now() - start;
+}
+
+/**
+ * Measure the start-up latency of the utilities in one directory.
+ *
+ * Each invocation does the same single operation as the in-process
+ * benchmark, so the difference between the two gives the cost of fork,
+ * exec, dynamic loading, and libc initialization. The files get created in
+ * the current directory, and the setup and cleanup of each invocation do
+ * not get included in the time.
+ *
+ * @param[in,out] bench_ctx See @ref bench_ctx.
+ * @param[in]     bindir    Directory containing ln, link, and unlink.
+ * @param[in]     nexec     Number of invocations of each utility.
+ */
+static void
+bench_exec(struct bench_ctx *const bench_ctx,
+           const char *const bindir,
+           const size_t nexec){
+  static const char *const util_list[] = {"ln", "link", "unlink"};
+  char path[BENCH_PATH_SZ];
+  char *argv[4];
+  size_t u;
+  size_t i;
+  int len;
+  uint64_t total;
+  int fd;
+
+  fd = open(BENCH_EXEC_SOURCE, O_WRONLY | O_CREAT | O_EXCL, 0666);
+  if(fd < 0){
+    err(EXIT_FAILURE, "open(%s)", BENCH_EXEC_SOURCE);
+  }
+  close(fd);
+  for(u = 0; u < sizeof(util_list) / sizeof(*util_list); u++){
+    len = snprintf(path, sizeof(path), "%s/%s", bindir, util_list[u]);
+    if(len < 0 || len >= BENCH_PATH_SZ){
+      errx(EXIT_FAILURE, "path too long: %s", bindir);
+    }
+    strcpy(bench_ctx->arg_list[0], util_list[u]);
+    argv[0] = bench_ctx->arg_list[0];
+    if(u == 2){
+      strcpy(bench_ctx->path_dest, BENCH_EXEC_DEST);
+      argv[1] = bench_ctx->path_dest;
+      argv[2] = NULL;
+    }
+    else{
+      strcpy(bench_ctx->path_source, BENCH_EXEC_SOURCE);
+      strcpy(bench_ctx->path_dest, BENCH_EXEC_DEST);
+      argv[1] = bench_ctx->path_source;
+      argv[2] = bench_ctx->path_dest;
+      argv[3] = NULL;
+    }
+    total = 0;
+    for(i = 0; i < nexec; i++){
+      if(u == 2 && link(BENCH_EXEC_SOURCE, BENCH_EXEC_DEST) != 0){
+        err(EXIT_FAILURE, "link(%s)", BENCH_EXEC_DEST);
+      }
+      bench_ctx->lat_list[i] = bench_exec_one(path, argv);
+      total += bench_ctx->lat_list[i];
+      if(u != 2 && unlink(BENCH_EXEC_DEST) != 0){
+        err(EXIT_FAILURE, "unlink(%s)", BENCH_EXEC_DEST);
+      }
+    }
+    qsort(bench_ctx->lat_list,
+          nexec,
+          sizeof(*bench_ctx->lat_list),
+          bench_lat_cmp);
+    fprintf(bench_ctx->fp_out,
+            "%-24s %-8s %10zu %12.0f %10.2f %10.2f\n",
+            bindir,
+            util_list[u],
+            nexec,
+            total > 0 ? (double)nexec * 1e9 / (double)total : 0,
+            (double)bench_ctx->lat_list[nexec / 2] / 1e3,
+            (double)bench_ctx->lat_list[nexec * 99 / 100] / 1e3);
+    fflush(bench_ctx->fp_out);
+  }
+  if(unlink(BENCH_EXEC_SOURCE) != 0){
+    err(EXIT_FAILURE, "unlink(%s)", BENCH_EXEC_SOURCE);
+  }
+}
+
+/**
+ * Parse a number given by a command line argument.
+ *
+ * @param[in] str  Decimal number.
+ * @param[in] min  Smallest valid number.
+ * @param[in] what Description of the number for error messages.
+ * @return         Parsed number.
+ */
+static size_t
+bench_parse_size(const char *const str,
+                 const size_t min,
+                 const char *const what){
+  unsigned long long val;
+  char *end;
+
+  errno = 0;
+  val = strtoull(str, &end, 10);
+  if(errno != 0 || end == str || *end != '\0' || val < min || val > SIZE_MAX){
+    errx(EXIT_FAILURE, "invalid %s: %s", what, str);
+  }
+  return (size_t)val;
+}
+
+/**
+ * Parse a number given by the (-d), (-j), or (-n) arguments and add it to a
+ * list.
+ *
+ * @param[in,out] list See @ref bench_list.
+ * @param[in]     str  Decimal number.
+ * @param[in]     min  Smallest valid number.
+ * @param[in]     what Description of the number for error messages.
+ */
+static void
+bench_list_add(struct bench_list *const list,
+               const char *const str,
+               const size_t min,
+               const char *const what){
+  if(list->n == BENCH_LIST_MAX){
+    errx(EXIT_FAILURE, "too many values for the %s", what);
+  }
+  list->val[list->n++] = bench_parse_size(str, min, what);
+}
+
+/**
+ * Use the default values for a list if none were given.
+ *
+ * @param[in,out] list See @ref bench_list.
+ * @param[in]     def  Default values.
+ * @param[in]     ndef Number of values in @p def.
+ */
+static void
+bench_list_default(struct bench_list *const list,
+                   const size_t *const def,
+                   const size_t ndef){
+  if(list->n == 0){
+    memcpy(list->val, def, ndef * sizeof(*def));
+    list->n = ndef;
+  }
+}
+
+/**
+ * Compare two sizes for qsort.
+ *
+ * @param[in] a  First size.
+ * @param[in] b  Second size.
+ * @retval    -1 @p a less than @p b.
+ * @retval    0  @p a equal to @p b.
+ * @retval    1  @p a greater than @p b.
+ */
+static int
+bench_size_cmp(const void *a,
+               const void *b){
+  size_t size_a;
+  size_t size_b;
+
+  size_a = *(const size_t *)a;
+  size_b = *(const size_t *)b;
+  return (size_a > size_b) - (size_a < size_b);
+}
+
+/**
+ * Build the path of a file or shard in the scaling sweep.
+ *
+ * The shards of a layout live in bench-scale-<nshard>/<shard>. Entry i
+ * always belongs to shard i % nshard.
+ *
+ * @param[out] path   Store the path here, size of @ref BENCH_PATH_SZ.
+ * @param[in]  dir    Directory being measured.
+ * @param[in]  nshard Number of shard directories in the layout.
+ * @param[in]  i      Index of the entry.
+ * @param[in]  prefix Name of the entry is @p prefix followed by @p i, or
+ *                    NULL for the path of the shard directory itself.
+ */
+static void
+bench_scale_path(char *const path,
+                 const char *const dir,
+                 const size_t nshard,
+                 const size_t i,
+                 const char *const prefix){
+  int len;
+
+  if(prefix){
+    len = snprintf(path,
+                   BENCH_PATH_SZ,
+                   "%s/bench-scale-%zu/%zu/%s%zu",
+                   dir,
+                   nshard,
+                   i % nshard,
+                   prefix,
+                   i);
+  }
+  else{
+    len = snprintf(path,
+                   BENCH_PATH_SZ,
+                   "%s/bench-scale-%zu/%zu",
+                   dir,
+                   nshard,
+                   i % nshard);
+  }
+  if(len < 0 || len >= BENCH_PATH_SZ){
+    errx(EXIT_FAILURE, "path too long: %s", dir);
+  }
+}
+
+/**
+ * Create or remove the directories of a scaling sweep layout.
+ *
+ * @param[in] dir    Directory being measured.
+ * @param[in] nshard Number of shard directories in the layout.
+ * @param[in] rm     Remove the directories instead of creating them.
+ */
+static void
+bench_scale_layout(const char *const dir,
+                   const size_t nshard,
+                   const bool rm){
+  char path[BENCH_PATH_SZ];
+  char path_list[BENCH_PATH_SZ + 8];
+  char sub[32];
+  size_t i;
+
+  snprintf(sub, sizeof(sub), "bench-scale-%zu", nshard);
+  if(!rm){
+    bench_mkdir(dir, sub);
+  }
+  for(i = 0; i < nshard; i++){
+    bench_scale_path(path, dir, nshard, i, NULL);
+    if(rm){
+      snprintf(path_list, sizeof(path_list), "%s.list", path);
+      unlink(path_list);
+      if(rmdir(path) != 0){
+        err(EXIT_FAILURE, "rmdir(%s)", path);
+      }
+    }
+    else if(mkdir(path, 0777) != 0){
+      err(EXIT_FAILURE, "mkdir(%s)", path);
+    }
+  }
+  if(rm){
+    bench_rm(dir, sub, 0, true);
+  }
+}
+
+/**
+ * Create or remove the filler entries that give the target directories
+ * their size.
+ *
+ * @param[in] dir    Directory being measured.
+ * @param[in] nshard Number of shard directories in the layout.
+ * @param[in] first  Index of the first entry.
+ * @param[in] last   One past the index of the last entry.
+ * @param[in] rm     Remove the entries instead of creating them.
+ */
+static void
+bench_scale_fill(const char *const dir,
+                 const size_t nshard,
+                 const size_t first,
+                 const size_t last,
+                 const bool rm){
+  char path[BENCH_PATH_SZ];
+  size_t i;
+  int fd;
+
+  for(i = first; i < last; i++){
+    bench_scale_path(path, dir, nshard, i, "f");
+    if(rm){
+      unlink(path);
+    }
+    else{
+      fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+      if(fd < 0){
+        err(EXIT_FAILURE, "open(%s)", path);
+      }
+      close(fd);
+    }
+  }
+}
+
+/**
+ * Write the list file (-l) of source files for each shard.
+ *
+ * Shard k gets the source files whose index i has i % nshard equal to k,
+ * so the new links get spread evenly across the shards.
+ *
+ * @param[in] dir    Directory being measured.
+ * @param[in] nshard Number of shard directories in the layout.
+ * @param[in] nfile  Number of links created in each measurement.
+ */
+static void
+bench_scale_list(const char *const dir,
+                 const size_t nshard,
+                 const size_t nfile){
+  char path[BENCH_PATH_SZ];
+  char path_list[BENCH_PATH_SZ + 8];
+  FILE *fp;
+  size_t shard;
+  size_t i;
+
+  for(shard = 0; shard < nshard && shard < nfile; shard++){
+    bench_scale_path(path, dir, nshard, shard, NULL);
+    snprintf(path_list, sizeof(path_list), "%s.list", path);
+    fp = fopen(path_list, "w");
+    if(fp == NULL){
+      err(EXIT_FAILURE, "fopen(%s)", path_list);
+    }
+    for(i = shard; i < nfile; i += nshard){
+      bench_path(path, dir, "bench-src", i);
+      fprintf(fp, "%s\n", path);
+    }
+    if(fclose(fp) != 0){
+      err(EXIT_FAILURE, "fclose(%s)", path_list);
+    }
+  }
+}
+
+/**
+ * Link the source files into the shards handled by one process.
+ *
+ * Runs ln -j nthread -l <shard>.list <shard> for each shard k where
+ * k % nproc equals @p proc.
+ *
+ * @param[in] dir     Directory being measured.
+ * @param[in] nshard  Number of shard directories in the layout.
+ * @param[in] nfile   Number of links created in each measurement.
+ * @param[in] nthread Number of ln worker threads.
+ * @param[in] nproc   Number of processes sharing the shards.
+ * @param[in] proc    Index of this process.
+ * @return            Exit status.
+ */
+static int
+bench_scale_ln(const char *const dir,
+               const size_t nshard,
+               const size_t nfile,
+               const size_t nthread,
+               const size_t nproc,
+               const size_t proc){
+  char path_list[BENCH_PATH_SZ + 8];
+  char path_target[BENCH_PATH_SZ];
+  char arg_list[4][32];
+  char *argv[7];
+  size_t shard;
+  int status_code;
+
+  status_code = EXIT_SUCCESS;
+  strcpy(arg_list[0], "ln");
+  strcpy(arg_list[1], "-j");
+  snprintf(arg_list[2], sizeof(arg_list[2]), "%zu", nthread);
+  strcpy(arg_list[3], "-l");
+  argv[0] = arg_list[0];
+  argv[1] = arg_list[1];
+  argv[2] = arg_list[2];
+  argv[3] = arg_list[3];
+  argv[4] = path_list;
+  argv[5] = path_target;
+  argv[6] = NULL;
+  for(shard = proc; shard < nshard && shard < nfile; shard += nproc){
+    bench_scale_path(path_target, dir, nshard, shard, NULL);
+    snprintf(path_list, sizeof(path_list), "%s.list", path_target);
+    optind = 0;
+    if(ln_main(6, argv) != EXIT_SUCCESS){
+      status_code = EXIT_FAILURE;
+    }
+  }
+  return status_code;
+}
+
+/**
+ * Measure the rate of creating links into one layout and directory size.
+ *
+ * The shards get split between min(nthread, nshard) processes, each
+ * running ln with an equal share of the @p nthread worker threads. The
+ * process start-up gets included in the time but does not depend on the
+ * directory size. The new links get removed after the measurement so that
+ * the directories return to their previous size.
+ *
+ * @param[in,out] bench_ctx See @ref bench_ctx.
+ * @param[in]     dir       Directory being measured.
+ * @param[in]     nshard    Number of shard directories in the layout.
+ * @param[in]     dirsize   Number of entries already in the layout.
+ * @param[in]     nthread   Total number of ln worker threads.
+ * @param[in]     nfile     Number of links to create.
+ */
+static void
+bench_scale_run(struct bench_ctx *const bench_ctx,
+                const char *const dir,
+                const size_t nshard,
+                const size_t dirsize,
+                const size_t nthread,
+                const size_t nfile){
+  char path[BENCH_PATH_SZ];
+  size_t nproc;
+  size_t proc;
+  size_t i;
+  pid_t pid;
+  int status;
+  bool ok;
+  uint64_t start;
+  uint64_t total;
+
+  nproc = nthread < nshard ? nthread : nshard;
+  fflush(NULL);
+  ok = true;
+  start = bench_now();
+  for(proc = 0; proc < nproc; proc++){
+    pid = fork();
+    if(pid < 0){
+      err(EXIT_FAILURE, "fork");
+    }
+    else if(pid == 0){
+      _exit(bench_scale_ln(dir, nshard, nfile, nthread / nproc, nproc, proc));
+    }
+  }
+  for(proc = 0; proc < nproc; proc++){
+    if(wait(&status) < 0){
+      err(EXIT_FAILURE, "wait");
+    }
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS){
+      ok = false;
+    }
+  }
+  total = bench_now() - start;
+  if(!ok){
+    errx(EXIT_FAILURE, "ln failed: %s", dir);
+  }
+
+  for(i = 0; i < nfile; i++){
+    bench_scale_path(path, dir, nshard, i, "");
+    if(unlink(path) != 0){
+      err(EXIT_FAILURE, "unlink(%s)", path);
+    }
+  }
+  fprintf(bench_ctx->fp_out,
+          "%-24s %8zu %10zu %8zu %10zu %12.0f\n",
+          dir,
+          nshard,
+          dirsize,
+          nthread,
+          nfile,
+          total > 0 ? (double)nfile * 1e9 / (double)total : 0);
+  fflush(bench_ctx->fp_out);
+}
+
+/**
+ * Sweep the directory size against the number of worker threads in one
+ * directory.
+ *
+ * Each layout, first a single flat directory and then @p nshard shard
+ * directories, gets filled up to each directory size in increasing order.
+ * At each size, every combination of batch size and thread count gets
+ * measured.
+ *
+ * @param[in,out] bench_ctx    See @ref bench_ctx.
+ * @param[in]     dir          Directory on the file system to measure.
+ * @param[in]     nshard       Number of shard directories.
+ * @param[in]     size_list    Directory sizes, sorted in increasing order.
+ * @param[in]     nthread_list Number of worker threads.
+ * @param[in]     nfile_list   Number of links created in each measurement.
+ */
+static void
+bench_scale(struct bench_ctx *const bench_ctx,
+            const char *const dir,
+            const size_t nshard,
+            const struct bench_list *const size_list,
+            const struct bench_list *const nthread_list,
+            const struct bench_list *const nfile_list){
+  size_t layout[2];
+  size_t nlayout;
+  size_t l;
+  size_t dirsize;
+  size_t s;
+  size_t t;
+  size_t n;
+  size_t nfile_max;
+
+  layout[0] = 1;
+  nlayout = 1;
+  if(nshard > 1){
+    layout[nlayout++] = nshard;
+  }
+  nfile_max = 0;
+  for(n = 0; n < nfile_list->n; n++){
+    if(nfile_list->val[n] > nfile_max){
+      nfile_max = nfile_list->val[n];
+    }
+  }
+  bench_mkdir(dir, "bench-src");
+  bench_fill(dir, "bench-src", nfile_max, false);
+  for(l = 0; l < nlayout; l++){
+    bench_scale_layout(dir, layout[l], false);
+    dirsize = 0;
+    for(s = 0; s < size_list->n; s++){
+      bench_scale_fill(dir, layout[l], dirsize, size_list->val[s], false);
+      dirsize = size_list->val[s];
+      for(n = 0; n < nfile_list->n; n++){
+        bench_scale_list(dir, layout[l], nfile_list->val[n]);
+        for(t = 0; t < nthread_list->n; t++){
+          bench_scale_run(bench_ctx,
+                          dir,
+                          layout[l],
+                          dirsize,
+                          nthread_list->val[t],
+                          nfile_list->val[n]);
+        }
+      }
+    }
+    bench_scale_fill(dir, layout[l], 0, dirsize, true);
+    bench_scale_layout(dir, layout[l], true);
+  }
+  bench_rm(dir, "bench-src", nfile_max, true);
+}
+
+/**
+ * Run the benchmarks.
+ *
+ * Usage:
+ *
+ * bench [-o output_file] [-n count]... [dir...]
+ *
+ * bench -S [-o output_file] [-s nshard] [-d dirsize]... [-j nthread]...
+ *       [-n count]... [dir...]
+ *
+ * bench -E [-o output_file] [-n count]... bindir...
+ *
+ * Measures each (-n) count of files in each directory. Defaults to 1000,
+ * 10000, and 100000 files in the current directory. The results get
+ * appended to bench_output.txt unless (-o) given.
+ *
+ * The scaling sweep (-S) instead measures the rate of ln target_dir with
+ * (-n) links, 10000 by default, into directories already holding each
+ * (-d) number of entries, from empty up to 10M by default. Each directory
+ * size gets measured with each (-j) number of worker threads, 1 to 16 by
+ * default, first with a single flat target directory and then with the
+ * entries and links spread across (-s) shard directories.
+ *
+ * The start-up sweep (-E) measures the latency of running ln, link, and
+ * unlink from each bindir as separate processes, (-n) times each with 1000
+ * by default, using files in the current directory.
+ *
+ * @param[in] argc Number of arguments in @p argv.
+ * @param[in] argv Argument list.
+ * @retval    0    All benchmarks completed.
+ */
+int
+main(int argc,
+     char *argv[]){
+  static const size_t count_default[] = {1000, 10000, 100000};
+  static const size_t exec_count_default[] = {1000};
+  static const size_t scale_count_default[] = {10000};
+  static const size_t scale_size_default[] = {
+    0, 10000, 100000, 1000000, 10000000
+  };
+  static const size_t scale_nthread_default[] = {1, 2, 4, 8, 16};
+  struct bench_ctx bench_ctx;
+  const char *path_out;
+  struct bench_list count_list;
+  struct bench_list size_list;
+  struct bench_list nthread_list;
+  size_t nshard;
+  bool scale;
+  bool exec;
+  size_t nfile_max;
+  size_t i;
+  int c;
+  int d;
+  char *const dir_default[] = {"."};
+  char *const *dir_list;
+  int ndir;
+  time_t now;
+
+  memset(&bench_ctx, 0, sizeof(bench_ctx));
+  memset(&count_list, 0, sizeof(count_list));
+  memset(&size_list, 0, sizeof(size_list));
+  memset(&nthread_list, 0, sizeof(nthread_list));
+  path_out = "bench_output.txt";
+  nshard = BENCH_NSHARD_DEFAULT;
+  scale = false;
+  exec = false;
+  while((c = getopt(argc, argv, "d:Ej:n:o:s:S")) != -1){
+    switch(c){
+      case 'd':
+        bench_list_add(&size_list, optarg, 0, "directory size");
+        break;
+      case 'E':
+        exec = true;
+        break;
+      case 'j':
+        bench_list_add(&nthread_list, optarg, 1, "number of threads");
+        break;
+      case 'n':
+        bench_list_add(&count_list, optarg, 1, "number of files");
+        break;
+      case 'o':
+        path_out = optarg;
+        break;
+      case 's':
+        nshard = bench_parse_size(optarg, 1, "number of shards");
+        break;
+      case 'S':
+        scale = true;
+        break;
+      default:
+        errx(EXIT_FAILURE,
+             "usage: bench [-E|-S] [-o output_file] [-s nshard]"
+             " [-d dirsize]... [-j nthread]... [-n count]... [dir...]");
+    }
+  }
+  if(exec && (scale || optind == argc)){
+    errx(EXIT_FAILURE, "-E needs bindir operands and excludes -S");
+  }
+  if(exec){
+    bench_list_default(&count_list,
+                       exec_count_default,
+                       sizeof(exec_count_default) /
+                       sizeof(*exec_count_default));
+  }
+  else if(scale){
+    bench_list_default(&count_list,
+                       scale_count_default,
+                       sizeof(scale_count_default) /
+                       sizeof(*scale_count_default));
+    bench_list_default(&size_list,
+                       scale_size_default,
+                       sizeof(scale_size_default) /
+                       sizeof(*scale_size_default));
+    bench_list_default(&nthread_list,
+                       scale_nthread_default,
+                       sizeof(scale_nthread_default) /
+                       sizeof(*scale_nthread_default));
+    qsort(size_list.val, size_list.n, sizeof(*size_list.val), bench_size_cmp);
+  }
+  else{
+    bench_list_default(&count_list,
+                       count_default,
+                       sizeof(count_default) / sizeof(*count_default));
+  }
+  if(optind < argc){
+    dir_list = &argv[optind];
+    ndir = argc - optind;
+  }
+  else{
+    dir_list = dir_default;
+    ndir = 1;
+  }
+
+  nfile_max = 0;
+  for(i = 0; i < count_list.n; i++){
+    if(count_list.val[i] > nfile_max){
+      nfile_max = count_list.val[i];
+    }
+  }
+  bench_ctx.lat_list = malloc(nfile_max * sizeof(*bench_ctx.lat_list));
+  if(bench_ctx.lat_list == NULL){
+    err(EXIT_FAILURE, "malloc");
+  }
+  bench_ctx.fp_out = fopen(path_out, "a");
+  if(bench_ctx.fp_out == NULL){
+    err(EXIT_FAILURE, "fopen(%s)", path_out);
+  }
+  now = time(NULL);
+  fprintf(bench_ctx.fp_out, "# %s", ctime(&now));
+  if(exec){
+    fprintf(bench_ctx.fp_out,
+            "# %-22s %-8s %10s %12s %10s %10s\n",
+            "bindir",
+            "util",
+            "execs",
+            "execs/sec",
+            "p50_us",
+            "p99_us");
+  }
+  else if(scale){
+    fprintf(bench_ctx.fp_out,
+            "# %-22s %8s %10s %8s %10s %12s\n",
+            "dir",
+            "shards",
+            "dirsize",
+            "threads",
+            "links",
+            "links/sec");
+  }
+  else{
+    fprintf(bench_ctx.fp_out,
+            "# %-22s %10s %-8s %12s %10s %10s %10s\n",
+            "dir",
+            "files",
+            "mode",
+            "ops/sec",
+            "p50_us",
+            "p99_us",
+            "maxrss_kb");
+  }
+  for(d = 0; d < ndir; d++){
+    if(exec){
+      for(i = 0; i < count_list.n; i++){
+        bench_exec(&bench_ctx, dir_list[d], count_list.val[i]);
+      }
+    }
+    else if(scale){
+      bench_scale(&bench_ctx,
+                  dir_list[d],
+                  nshard,
+                  &size_list,
+                  &nthread_list,
+                  &count_list);
+    }
+    else{
+      for(i = 0; i < count_list.n; i++){
+        bench_dir(&bench_ctx, dir_list[d], count_list.val[i]);
+      }
+    }
+  }
+  if(fclose(bench_ctx.fp_out) != 0){
+    err(EXIT_FAILURE, "fclose(%s)", path_out);
+  }
+  free(bench_ctx.lat_list);
+  return 0;
+}
@@ -9,14 +9,52 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "test.h"
 
+/**
+ * Serializes the error counters between the ln worker threads.
+ */
+static pthread_mutex_t g_test_seam_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+struct test_seam_count g_test_seam_count;
+
+int g_test_seam_errno = EIO;
+
+int g_test_seam_err_ctr_fstatat = -1;
+
+int g_test_seam_err_ctr_link = -1;
+
+int g_test_seam_err_ctr_linkat = -1;
+
+int g_test_seam_err_ctr_lstat = -1;
+
+int g_test_seam_err_ctr_mkdir = -1;
+
+int g_test_seam_err_ctr_mkdirat = -1;
+
+int g_test_seam_err_ctr_renameat = -1;
+
+int g_test_seam_err_ctr_stat = -1;
+
+int g_test_seam_err_ctr_symlink = -1;
+
+int g_test_seam_err_ctr_symlinkat = -1;
+
+int g_test_seam_err_ctr_unlink = -1;
+
+int g_test_seam_err_ctr_unlinkat = -1;
+
 int g_test_seam_err_ctr_malloc = -1;
 
+int g_test_seam_err_ctr_realloc = -1;
+
 int g_test_seam_err_ctr_si_add_size_t = -1;
 
 int g_test_seam_err_ctr_strdup = -1;
@@ -26,19 +64,242 @@ test_seam_dec_err_ctr(int *const err_ctr){
   bool reached_end;
 
   reached_end = false;
+  pthread_mutex_lock(&g_test_seam_mutex);
   if(*err_ctr >= 0){
     *err_ctr -= 1;
     if(*err_ctr < 0){
       reached_end = true;
     }
   }
+  pthread_mutex_unlock(&g_test_seam_mutex);
   return reached_end;
 }
 
+/**
+ * Increment a count in @ref g_test_seam_count.
+ *
+ * @param[in,out] count Count to increment.
+ */
+static void
+test_seam_count_inc(size_t *const count){
+  pthread_mutex_lock(&g_test_seam_mutex);
+  *count += 1;
+  pthread_mutex_unlock(&g_test_seam_mutex);
+}
+
+void
+test_seam_count_reset(void){
+  pthread_mutex_lock(&g_test_seam_mutex);
+  memset(&g_test_seam_count, 0, sizeof(g_test_seam_count));
+  pthread_mutex_unlock(&g_test_seam_mutex);
+}
+
+int
+test_seam_fstatat(int fd,
+                  const char *path,
+                  struct stat *buf,
+                  int flag){
+  int rc;
+
+  test_seam_count_inc(&g_test_seam_count.fstatat);
+  if(test_seam_dec_err_ctr(&g_test_seam_err_ctr_fstatat)){
+    rc = -1;
+    errno = g_test_seam_errno;
+  }
+  else{
+    rc = fstatat(fd, path, buf, flag);
+  }
+  return rc;
+}
+
+int
+test_seam_link(const char *path1,
+               const char *path2){
+  int rc;
+
+  test_seam_count_inc(&g_test_seam_count.link);
+  if(test_seam_dec_err_ctr(&g_test_seam_err_ctr_link)){
+    rc = -1;
+    errno = g_test_seam_errno;
+  }
+  else{
+    rc = link(path1, path2);
+  }
+  return rc;
+}
+
+int
+test_seam_linkat(int fd1,
+                 const char *path1,
+                 int fd2,
+                 const char *path2,
+                 int flag){
+  int rc;
+
+  test_seam_count_inc(&g_test_seam_count.linkat);
+  if(test_seam_dec_err_ctr(&g_test_seam_err_ctr_linkat)){
+    rc = -1;
+    errno = g_test_seam_errno;
+  }
+  else{
+    rc = linkat(fd1, path1, fd2, path2, flag);
+  }
+  return rc;
+}
+
+int
+test_seam_lstat(const char *path,
+                struct stat *buf){
+  int rc;
+
+  test_seam_count_inc(&g_test_seam_count.lstat);
+  if(test_seam_dec_err_ctr(&g_test_seam_err_ctr_lstat)){
+    rc = -1;
+    errno = g_test_seam_errno;
+  }
+  else{
+    rc = lstat(path, buf);
+  }
+  return rc;
+}
+
+int
+test_seam_mkdir(const char *path,
+                mode_t mode){
+  int rc;
+
+  test_seam_count_inc(&g_test_seam_count.mkdir);
+  if(test_seam_dec_err_ctr(&g_test_seam_err_ctr_mkdir)){
+    rc = -1;
+    errno = g_test_seam_errno;
+  }
+  else{
+    rc = mkdir(path, mode);
+  }
+  return rc;
+}
+
+int
+test_seam_mkdirat(int fd,
+                  const char *path,
+                  mode_t mode){
+  int rc;
+
+  test_seam_count_inc(&g_test_seam_count.mkdirat);
+  if(test_seam_dec_err_ctr(&g_test_seam_err_ctr_mkdirat)){
+    rc = -1;
+    errno = g_test_seam_errno;
+  }
+  else{
+    rc = mkdirat(fd, path, mode);
+  }
+  return rc;
+}
+
+int
+test_seam_renameat(int oldfd,
+                   const char *old,
+                   int newfd,
+                   const char *new){
+  int rc;
+
+  test_seam_count_inc(&g_test_seam_count.renameat);
+  if(test_seam_dec_err_ctr(&g_test_seam_err_ctr_renameat)){
+    rc = -1;
+    errno = g_test_seam_errno;
+  }
+  else{
+    rc = renameat(oldfd, old, newfd, new);
+  }
+  return rc;
+}
+
+int
+test_seam_stat(const char *path,
+               struct stat *buf){
+  int rc;
+
+  test_seam_count_inc(&g_test_seam_count.stat);
+  if(test_seam_dec_err_ctr(&g_test_seam_err_ctr_stat)){
+    rc = -1;
+    errno = g_test_seam_errno;
+  }
+  else{
+    rc = stat(path, buf);
+  }
+  return rc;
+}
+
+int
+test_seam_symlink(const char *path1,
+                  const char *path2){
+  int rc;
+
+  test_seam_count_inc(&g_test_seam_count.symlink);
+  if(test_seam_dec_err_ctr(&g_test_seam_err_ctr_symlink)){
+    rc = -1;
+    errno = g_test_seam_errno;
+  }
+  else{
+    rc = symlink(path1, path2);
+  }
+  return rc;
+}
+
+int
+test_seam_symlinkat(const char *path1,
+                    int fd,
+                    const char *path2){
+  int rc;
+
+  test_seam_count_inc(&g_test_seam_count.symlinkat);
+  if(test_seam_dec_err_ctr(&g_test_seam_err_ctr_symlinkat)){
+    rc = -1;
+    errno = g_test_seam_errno;
+  }
+  else{
+    rc = symlinkat(path1, fd, path2);
+  }
+  return rc;
+}
+
+int
+test_seam_unlink(const char *path){
+  int rc;
+
+  test_seam_count_inc(&g_test_seam_count.unlink);
+  if(test_seam_dec_err_ctr(&g_test_seam_err_ctr_unlink)){
+    rc = -1;
+    errno = g_test_seam_errno;
+  }
+  else{
+    rc = unlink(path);
+  }
+  return rc;
+}
+
+int
+test_seam_unlinkat(int fd,
+                   const char *path,
+                   int flag){
+  int rc;
+
+  test_seam_count_inc(&g_test_seam_count.unlinkat);
+  if(test_seam_dec_err_ctr(&g_test_seam_err_ctr_unlinkat)){
+    rc = -1;
+    errno = g_test_seam_errno;
+  }
+  else{
+    rc = unlinkat(fd, path, flag);
+  }
+  return rc;
+}
+
 void *
 test_seam_malloc(size_t size){
   void *alloc;
 
+  test_seam_count_inc(&g_test_seam_count.malloc);
   if(test_seam_dec_err_ctr(&g_test_seam_err_ctr_malloc)){
     alloc = NULL;
     errno = ENOMEM;
@@ -49,12 +310,30 @@ test_seam_malloc(size_t size){
   return alloc;
 }
 
+void *
+test_seam_realloc(void *ptr,
+                  size_t size){
+  void *alloc;
+
+  test_seam_count_inc(&g_test_seam_count.realloc);
+  if(test_seam_dec_err_ctr(&g_test_seam_err_ctr_realloc)){
+    alloc = NULL;
+    errno = ENOMEM;
+  }
+  else{
+    alloc = realloc(ptr, size);
+  }
+  return alloc;
+}
+
 char *
 test_seam_strdup(const char *s){
   void *alloc;
 
+  test_seam_count_inc(&g_test_seam_count.strdup);
   if(test_seam_dec_err_ctr(&g_test_seam_err_ctr_strdup)){
     alloc = NULL;
+    errno = ENOMEM;
   }
   else{
     alloc = strdup(s);
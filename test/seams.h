@@ -13,14 +13,98 @@
 /*
  * Redefine these functions to internal test seams.
  */
+#undef fstatat
+#undef link
+#undef linkat
+#undef lstat
 #undef malloc
+#undef mkdir
+#undef mkdirat
+#undef realloc
+#undef renameat
+#undef stat
 #undef strdup
+#undef symlink
+#undef symlinkat
+#undef unlink
+#undef unlinkat
+
+/**
+ * Inject a test seam to replace fstatat().
+ */
+#define fstatat test_seam_fstatat
+
+/**
+ * Inject a test seam to replace link().
+ */
+#define link test_seam_link
+
+/**
+ * Inject a test seam to replace linkat().
+ */
+#define linkat test_seam_linkat
+
+/**
+ * Inject a test seam to replace lstat().
+ *
+ * Defined as a function-like macro so that struct stat does not get
+ * renamed.
+ */
+#define lstat(path, buf) test_seam_lstat(path, buf)
+
+/**
+ * Inject a test seam to replace mkdir().
+ */
+#define mkdir test_seam_mkdir
+
+/**
+ * Inject a test seam to replace mkdirat().
+ */
+#define mkdirat test_seam_mkdirat
+
+/**
+ * Inject a test seam to replace renameat().
+ */
+#define renameat test_seam_renameat
+
+/**
+ * Inject a test seam to replace stat().
+ *
+ * Defined as a function-like macro so that struct stat does not get
+ * renamed.
+ */
+#define stat(path, buf) test_seam_stat(path, buf)
+
+/**
+ * Inject a test seam to replace symlink().
+ */
+#define symlink test_seam_symlink
+
+/**
+ * Inject a test seam to replace symlinkat().
+ */
+#define symlinkat test_seam_symlinkat
+
+/**
+ * Inject a test seam to replace unlink().
+ */
+#define unlink test_seam_unlink
+
+/**
+ * Inject a test seam to replace unlinkat().
+ */
+#define unlinkat test_seam_unlinkat
 
 /**
  * Inject a test seam to replace malloc().
  */
 #define malloc test_seam_malloc
 
+/**
+ * Inject a test seam to replace realloc().
+ */
+#define realloc test_seam_realloc
+
 /**
  * Inject a test seam to replace strdup().
  */
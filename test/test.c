@@ -6,14 +6,25 @@
  * This software has been placed into the public domain using CC0.
  */
 
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "../src/liblink.h"
 #include "test.h"
 
 /**
@@ -46,6 +57,11 @@
  */
 #define PATH_XDEV_DEST          "build/test-ln.txt"
 
+/**
+ * Target directory on the same device as @ref PATH_XDEV_DEST.
+ */
+#define PATH_XDEV_DIR           "build/test-ln-dir"
+
 /**
  * Create test links to the project COPYING file.
  */
@@ -71,6 +87,58 @@
  */
 #define PATH_TARGET_DIR_README  (PATH_TARGET_DIR "/" PATH_README)
 
+/**
+ * List of source files to read with the (-l) argument.
+ */
+#define PATH_LIST               "test-ln-list.txt"
+
+/**
+ * Source directory tree to mirror with the (-R) argument.
+ */
+#define PATH_TREE_SOURCE        "test-ln-tree"
+
+/**
+ * Target directory of the (-R) argument which does not exist yet.
+ */
+#define PATH_TREE_TARGET        "test-ln-tree-target"
+
+/**
+ * Index file of the deduplication (-D) argument.
+ */
+#define PATH_DEDUP_INDEX        "test-ln-dedup.idx"
+
+/**
+ * Sparse file copied to @ref PATH_XDEV_DEST by the copy (-C) tests.
+ */
+#define PATH_SPARSE             "test-ln-sparse.bin"
+
+/**
+ * FIFO that the clone (-c) and copy (-C) tests must refuse without opening
+ * it for a blocking read.
+ */
+#define PATH_FIFO               "test-ln-fifo"
+
+/**
+ * Content-addressable store read by the checkout (-M) tests.
+ */
+#define PATH_STORE              "test-ln-store"
+
+/**
+ * Manifest file read by the checkout (-M) tests.
+ */
+#define PATH_MANIFEST           "test-ln-manifest.txt"
+
+/**
+ * Socket of the link daemon.
+ */
+#define PATH_LINKD_SOCKET       "test-linkd.sock"
+
+/**
+ * Number of files removed through the link daemon in a single client call,
+ * more than the number of requests a client keeps in flight.
+ */
+#define LINKD_NFILE             300
+
 /**
  * Number of arguments in @ref g_argv.
  */
@@ -126,6 +194,30 @@ test_ln_soft_check(const char *const file_1,
   assert(sb_1.st_ino == sb_rl.st_ino);
 }
 
+/**
+ * Get the number of entries in a directory, excluding "." and "..".
+ *
+ * @param[in] path Directory to count.
+ * @return         Number of entries in @p path.
+ */
+static size_t
+test_ln_dir_count(const char *const path){
+  DIR *dir;
+  struct dirent *ent;
+  size_t count;
+
+  count = 0;
+  dir = opendir(path);
+  assert(dir);
+  while((ent = readdir(dir)) != NULL){
+    if(strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0){
+      count += 1;
+    }
+  }
+  assert(closedir(dir) == 0);
+  return count;
+}
+
 /**
  * Call @ref link_main with the given arguments.
  *
@@ -211,6 +303,59 @@ test_ln_main(const bool f,
   assert(exit_status == expect_exit_status);
 }
 
+/**
+ * Call @ref ln_main with an arbitrary argument list.
+ *
+ * @param[in] expect_exit_status Expected exit status code, or -1 if the
+ *                               result depends on the file system.
+ * @param[in] arg_list           List of options and operands to send to ln.
+ *                               Terminate list with NULL.
+ */
+static void
+test_ln_main_args(const int expect_exit_status,
+                  const char *const arg_list, ...){
+  int exit_status;
+  const char *arg;
+  va_list ap;
+
+  g_argc = 0;
+  strcpy(g_argv[g_argc++], "ln");
+  va_start(ap, arg_list);
+  for(arg = arg_list; arg; arg = va_arg(ap, const char *const)){
+    strcpy(g_argv[g_argc++], arg);
+  }
+  va_end(ap);
+  optind = 0;
+  exit_status = ln_main(g_argc, g_argv);
+  assert(expect_exit_status < 0 || exit_status == expect_exit_status);
+}
+
+/**
+ * Write a list of entries to a file, each one followed by a delimiter.
+ *
+ * @param[in] path      Path to the new list file.
+ * @param[in] delim     Character written after each entry.
+ * @param[in] path_list List of entries to write. Terminate list with NULL.
+ */
+static void
+test_ln_write_list(const char *const path,
+                   const int delim,
+                   const char *const path_list, ...){
+  FILE *fp;
+  const char *entry;
+  va_list ap;
+
+  fp = fopen(path, "w");
+  assert(fp);
+  va_start(ap, path_list);
+  for(entry = path_list; entry; entry = va_arg(ap, const char *const)){
+    assert(fputs(entry, fp) >= 0);
+    assert(fputc(delim, fp) == delim);
+  }
+  va_end(ap);
+  assert(fclose(fp) == 0);
+}
+
 /**
  * Create a blank test file.
  *
@@ -224,6 +369,65 @@ test_ln_create_file(const char *const path){
   assert(system(cmd) == 0);
 }
 
+/**
+ * Create a test file filled with a repeated byte.
+ *
+ * @param[in] path Path to create new file.
+ * @param[in] fill Byte written to every position except the last.
+ * @param[in] last Byte written to the final position.
+ * @param[in] size Number of bytes to write.
+ */
+static void
+test_ln_write_file(const char *const path,
+                   const int fill,
+                   const int last,
+                   const size_t size){
+  FILE *fp;
+  size_t i;
+
+  fp = fopen(path, "w");
+  assert(fp);
+  for(i = 1; i < size; i++){
+    assert(fputc(fill, fp) == fill);
+  }
+  if(size > 0){
+    assert(fputc(last, fp) == last);
+  }
+  assert(fclose(fp) == 0);
+}
+
+/**
+ * Check if two paths refer to the same inode.
+ *
+ * @param[in] path_1 Compare with @p path_2.
+ * @param[in] path_2 Compare with @p path_1.
+ * @retval    true   Same inode.
+ * @retval    false  Different files.
+ */
+static bool
+test_ln_same_inode(const char *const path_1,
+                   const char *const path_2){
+  struct stat sb_1;
+  struct stat sb_2;
+
+  assert(stat(path_1, &sb_1) == 0);
+  assert(stat(path_2, &sb_2) == 0);
+  return sb_1.st_dev == sb_2.st_dev && sb_1.st_ino == sb_2.st_ino;
+}
+
+/**
+ * Remove a directory tree if it exists.
+ *
+ * @param[in] path Directory to remove along with all of its contents.
+ */
+static void
+test_ln_rm_tree(const char *const path){
+  char cmd[1000];
+
+  sprintf(cmd, "rm -rf \'%s\'", path);
+  assert(system(cmd) == 0);
+}
+
 /**
  * Call @ref unlink_main with the given arguments.
  *
@@ -307,12 +511,129 @@ test_all_link(void){
   test_link_main(PATH_SOURCE_1, PATH_SOURCE_2, PATH_README, EXIT_FAILURE);
 }
 
+/**
+ * Call @ref link_main in batch mode with a list file.
+ *
+ * @param[in] nul                Pairs separated by null characters (-0).
+ * @param[in] expect_exit_status Expected exit status code.
+ */
+static void
+test_link_main_batch(const bool nul,
+                     const int expect_exit_status){
+  int exit_status;
+
+  g_argc = 0;
+  strcpy(g_argv[g_argc++], "link");
+  strcpy(g_argv[g_argc++], "-b");
+  if(nul){
+    strcpy(g_argv[g_argc++], "-0");
+  }
+  strcpy(g_argv[g_argc++], "-l");
+  strcpy(g_argv[g_argc++], PATH_LIST);
+  optind = 0;
+  exit_status = link_main(g_argc, g_argv);
+  assert(exit_status == expect_exit_status);
+}
+
+/**
+ * Run all tests for the link batch (-b) argument.
+ */
+static void
+test_all_link_batch(void){
+  FILE *fp;
+
+  /* Create links for null separated pairs, continuing after a failure. */
+  test_ln_write_list(PATH_LIST,
+                     '\0',
+                     PATH_README,
+                     PATH_SOURCE_1,
+                     "noexist",
+                     PATH_TARGET_FILE,
+                     PATH_COPYING,
+                     PATH_SOURCE_2,
+                     NULL);
+  test_link_main_batch(true, EXIT_FAILURE);
+  test_ln_hard_check(PATH_README, PATH_SOURCE_1);
+  test_ln_hard_check(PATH_COPYING, PATH_SOURCE_2);
+  assert(access(PATH_TARGET_FILE, F_OK) != 0);
+  assert(remove(PATH_SOURCE_1) == 0);
+  assert(remove(PATH_SOURCE_2) == 0);
+
+  /* Create links for newline separated pairs. */
+  test_ln_write_list(PATH_LIST, '\n', PATH_README, PATH_SOURCE_1, NULL);
+  test_link_main_batch(false, EXIT_SUCCESS);
+  test_ln_hard_check(PATH_README, PATH_SOURCE_1);
+  assert(remove(PATH_SOURCE_1) == 0);
+
+  /* Empty entries at the end of the list get ignored. */
+  test_ln_write_list(PATH_LIST,
+                     '\n',
+                     PATH_README,
+                     PATH_SOURCE_1,
+                     "",
+                     "",
+                     NULL);
+  test_link_main_batch(false, EXIT_SUCCESS);
+  test_ln_hard_check(PATH_README, PATH_SOURCE_1);
+  assert(remove(PATH_SOURCE_1) == 0);
+
+  /* Any other empty entry fails its pair without shifting the others. */
+  test_ln_write_list(PATH_LIST,
+                     '\n',
+                     PATH_README,
+                     "",
+                     PATH_COPYING,
+                     PATH_SOURCE_1,
+                     NULL);
+  test_link_main_batch(false, EXIT_FAILURE);
+  test_ln_hard_check(PATH_COPYING, PATH_SOURCE_1);
+  assert(remove(PATH_SOURCE_1) == 0);
+  test_ln_write_list(PATH_LIST,
+                     '\0',
+                     "",
+                     PATH_SOURCE_2,
+                     PATH_README,
+                     "",
+                     PATH_SOURCE_1,
+                     "",
+                     NULL);
+  test_link_main_batch(true, EXIT_FAILURE);
+  assert(access(PATH_SOURCE_1, F_OK) != 0);
+  assert(access(PATH_SOURCE_2, F_OK) != 0);
+
+  /* Odd number of entries. */
+  test_ln_write_list(PATH_LIST, '\n', PATH_README, NULL);
+  test_link_main_batch(false, EXIT_FAILURE);
+
+  /* List file does not exist. */
+  assert(remove(PATH_LIST) == 0);
+  test_link_main_batch(false, EXIT_FAILURE);
+
+  /* Operands not allowed with -b, list file only allowed with -b. */
+  test_link_main("-b", PATH_README, NULL, EXIT_FAILURE);
+  test_link_main("-l", PATH_LIST, NULL, EXIT_FAILURE);
+
+  /* Invalid argument. */
+  test_link_main("-b", "-x", NULL, EXIT_FAILURE);
+
+  /* File operands can start with '-' without needing "--". */
+  test_link_main(PATH_README, "-test-link.txt", NULL, EXIT_SUCCESS);
+  assert(remove("-test-link.txt") == 0);
+  fp = fopen("-test-link.txt", "w");
+  assert(fp);
+  assert(fclose(fp) == 0);
+  test_link_main("-test-link.txt", PATH_SOURCE_1, NULL, EXIT_SUCCESS);
+  assert(remove("-test-link.txt") == 0);
+  assert(remove(PATH_SOURCE_1) == 0);
+}
+
 /**
  * Run all tests for ln utility.
  */
 static void
 test_all_ln(void){
   int i;
+  struct stat sb;
 
   /* Too few arguments. */
   test_ln_main(false,
@@ -585,9 +906,12 @@ test_all_ln(void){
   assert(remove(PATH_TARGET_DIR "/hosts") == 0);
   assert(rmdir(PATH_TARGET_DIR) == 0);
 
-  /* Failed to strdup source file. */
+  /*
+   * Failed to allocate the target_dir prefix, after the parent directory
+   * path of the cross-device preflight.
+   */
   assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
-  g_test_seam_err_ctr_malloc = 0;
+  g_test_seam_err_ctr_realloc = 1;
   test_ln_main(false,
                false,
                false,
@@ -597,12 +921,12 @@ test_all_ln(void){
                PATH_README,
                PATH_TARGET_DIR,
                NULL);
-  g_test_seam_err_ctr_malloc = -1;
+  g_test_seam_err_ctr_realloc = -1;
   assert(rmdir(PATH_TARGET_DIR) == 0);
 
-  /* Failed to malloc path. */
+  /* Failed to grow the path buffer. */
   assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
-  g_test_seam_err_ctr_strdup = 0;
+  g_test_seam_err_ctr_realloc = 2;
   test_ln_main(false,
                false,
                false,
@@ -612,7 +936,7 @@ test_all_ln(void){
                PATH_README,
                PATH_TARGET_DIR,
                NULL);
-  g_test_seam_err_ctr_strdup = -1;
+  g_test_seam_err_ctr_realloc = -1;
   assert(rmdir(PATH_TARGET_DIR) == 0);
 
   /* Wrap while adding size_t. */
@@ -631,30 +955,1872 @@ test_all_ln(void){
     assert(rmdir(PATH_TARGET_DIR) == 0);
     g_test_seam_err_ctr_si_add_size_t = -1;
   }
+
+  /* Trailing slashes get ignored when finding the basename. */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  test_ln_main_args(EXIT_SUCCESS, "-s", "build//", PATH_TARGET_DIR "/", NULL);
+  assert(lstat(PATH_TARGET_DIR "/build", &sb) == 0);
+  assert(S_ISLNK(sb.st_mode));
+  assert(remove(PATH_TARGET_DIR "/build") == 0);
+  assert(rmdir(PATH_TARGET_DIR) == 0);
 }
 
 /**
- * Run all tests for unlink utility.
+ * Run all tests for the ln list file (-l) argument.
  */
 static void
-test_all_unlink(void){
-  FILE *fp;
-  const char *const PATH_TMP_FILE = "build/test-unlink.txt";
+test_all_ln_list(void){
+  /* Create links inside a target_dir for each entry in a list file. */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  test_ln_write_list(PATH_LIST, '\n', PATH_README, "", PATH_COPYING, NULL);
+  test_ln_main_args(EXIT_SUCCESS, "-l", PATH_LIST, PATH_TARGET_DIR, NULL);
+  test_ln_hard_check(PATH_COPYING, PATH_TARGET_DIR_COPYING);
+  test_ln_hard_check(PATH_README, PATH_TARGET_DIR_README);
+  assert(remove(PATH_TARGET_DIR_COPYING) == 0);
+  assert(remove(PATH_TARGET_DIR_README) == 0);
+  assert(rmdir(PATH_TARGET_DIR) == 0);
 
-  /* Successfully unlink a file. */
-  fp = fopen(PATH_TMP_FILE, "w");
-  assert(fp);
-  assert(fclose(fp) == 0);
-  test_unlink_main(PATH_TMP_FILE, NULL, EXIT_SUCCESS);
+  /* Null-separated list combined with a source_file operand (-0). */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  test_ln_write_list(PATH_LIST, '\0', PATH_COPYING, NULL);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-0",
+                    "-l",
+                    PATH_LIST,
+                    PATH_README,
+                    PATH_TARGET_DIR,
+                    NULL);
+  test_ln_hard_check(PATH_COPYING, PATH_TARGET_DIR_COPYING);
+  test_ln_hard_check(PATH_README, PATH_TARGET_DIR_README);
+  assert(remove(PATH_TARGET_DIR_COPYING) == 0);
+  assert(remove(PATH_TARGET_DIR_README) == 0);
+  assert(rmdir(PATH_TARGET_DIR) == 0);
 
-  /* Try to unlink a file that does not exist. */
-  test_unlink_main(PATH_TMP_FILE, NULL, EXIT_FAILURE);
+  /* One entry in the list fails, but the rest still get linked. */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  test_ln_write_list(PATH_LIST, '\n', "noexist", PATH_README, NULL);
+  test_ln_main_args(EXIT_FAILURE, "-l", PATH_LIST, PATH_TARGET_DIR, NULL);
+  test_ln_hard_check(PATH_README, PATH_TARGET_DIR_README);
+  assert(remove(PATH_TARGET_DIR_README) == 0);
+  assert(rmdir(PATH_TARGET_DIR) == 0);
+  assert(remove(PATH_LIST) == 0);
 
-  /* Too few operands. */
-  test_unlink_main(NULL, NULL, EXIT_FAILURE);
+  /* List file does not exist. */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  test_ln_main_args(EXIT_FAILURE, "-l", PATH_LIST, PATH_TARGET_DIR, NULL);
+  assert(rmdir(PATH_TARGET_DIR) == 0);
 
-  /* Too many operands. */
-  test_unlink_main(PATH_TMP_FILE, PATH_TMP_FILE, EXIT_FAILURE);
+  /* Missing target_dir operand. */
+  test_ln_main_args(EXIT_FAILURE, "-l", PATH_LIST, NULL);
+
+  /* Final operand not a directory. */
+  test_ln_main_args(EXIT_FAILURE, "-l", PATH_LIST, PATH_README, NULL);
+}
+
+/**
+ * Run all tests for the error paths after an optimistic link attempt fails.
+ */
+static void
+test_all_ln_optimistic(void){
+  /* Destination is a dangling symlink. */
+  assert(symlink("noexist", PATH_SYM) == 0);
+  test_ln_main_args(EXIT_FAILURE, PATH_README, PATH_SYM, NULL);
+  test_ln_main_args(EXIT_FAILURE, "-s", PATH_README, PATH_SYM, NULL);
+
+  /* Destination already exists. */
+  test_ln_main_args(EXIT_FAILURE, "-s", PATH_README, PATH_COPYING, NULL);
+
+  /* Source is a directory. */
+  test_ln_main_args(EXIT_FAILURE, "build", PATH_SOURCE_1, NULL);
+  assert(access(PATH_SOURCE_1, F_OK) != 0);
+
+  /* Hard link to the file pointed to by a symlink (-L). */
+  assert(remove(PATH_SYM) == 0);
+  assert(symlink(PATH_README, PATH_SYM) == 0);
+  test_ln_main_args(EXIT_SUCCESS, "-L", PATH_SYM, PATH_SOURCE_1, NULL);
+  test_ln_hard_check(PATH_README, PATH_SOURCE_1);
+  assert(remove(PATH_SOURCE_1) == 0);
+  assert(remove(PATH_SYM) == 0);
+}
+
+/**
+ * Run all tests for atomically replacing the destination (-f).
+ */
+static void
+test_all_ln_replace(void){
+  struct stat sb;
+
+  /* Replace a destination inside another directory. */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  test_ln_create_file(PATH_TARGET_DIR_README);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-f",
+                    PATH_README,
+                    PATH_TARGET_DIR_README,
+                    NULL);
+  test_ln_hard_check(PATH_README, PATH_TARGET_DIR_README);
+  assert(test_ln_dir_count(PATH_TARGET_DIR) == 1);
+
+  /* Replace destinations inside a target_dir with symlinks. */
+  test_ln_create_file(PATH_TARGET_DIR_COPYING);
+  assert(remove(PATH_TARGET_DIR_README) == 0);
+  test_ln_create_file(PATH_TARGET_DIR_README);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-f",
+                    "-s",
+                    PATH_README,
+                    PATH_COPYING,
+                    PATH_TARGET_DIR,
+                    NULL);
+  test_ln_soft_check(PATH_COPYING, PATH_TARGET_DIR_COPYING);
+  test_ln_soft_check(PATH_README, PATH_TARGET_DIR_README);
+  assert(test_ln_dir_count(PATH_TARGET_DIR) == 2);
+  assert(remove(PATH_TARGET_DIR_COPYING) == 0);
+  assert(remove(PATH_TARGET_DIR_README) == 0);
+
+  /* Failed to rename over a destination directory. */
+  assert(mkdir(PATH_TARGET_DIR_README, 0777) == 0);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-f",
+                    PATH_README,
+                    PATH_TARGET_DIR,
+                    NULL);
+  assert(test_ln_dir_count(PATH_TARGET_DIR) == 1);
+  assert(rmdir(PATH_TARGET_DIR_README) == 0);
+
+  /* Failed to allocate the temporary path. */
+  test_ln_create_file(PATH_TARGET_DIR_README);
+  g_test_seam_err_ctr_malloc = 0;
+  test_ln_main_args(EXIT_FAILURE,
+                    "-f",
+                    PATH_README,
+                    PATH_TARGET_DIR_README,
+                    NULL);
+  g_test_seam_err_ctr_malloc = -1;
+
+  /* Wrap while calculating the temporary path size. */
+  g_test_seam_err_ctr_si_add_size_t = 0;
+  test_ln_main_args(EXIT_FAILURE,
+                    "-f",
+                    PATH_README,
+                    PATH_TARGET_DIR_README,
+                    NULL);
+  g_test_seam_err_ctr_si_add_size_t = -1;
+  assert(test_ln_dir_count(PATH_TARGET_DIR) == 1);
+
+  /* Failed to rename, the temporary link gets removed. */
+  g_test_seam_err_ctr_renameat = 0;
+  test_seam_count_reset();
+  test_ln_main_args(EXIT_FAILURE,
+                    "-f",
+                    PATH_README,
+                    PATH_TARGET_DIR_README,
+                    NULL);
+  g_test_seam_err_ctr_renameat = -1;
+  assert(g_test_seam_count.unlinkat == 1);
+  assert(test_ln_dir_count(PATH_TARGET_DIR) == 1);
+  assert(remove(PATH_TARGET_DIR_README) == 0);
+
+  /*
+   * Following a symbolic link (-L) to a file the destination already links
+   * to, which must not leave the temporary link behind.
+   */
+  test_ln_create_file(PATH_TARGET_DIR "/x");
+  assert(symlink("x", PATH_TARGET_DIR "/s") == 0);
+  assert(link(PATH_TARGET_DIR "/x", PATH_TARGET_DIR "/d") == 0);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-f",
+                    "-L",
+                    PATH_TARGET_DIR "/s",
+                    PATH_TARGET_DIR "/d",
+                    NULL);
+  assert(test_ln_dir_count(PATH_TARGET_DIR) == 3);
+  assert(test_ln_same_inode(PATH_TARGET_DIR "/x", PATH_TARGET_DIR "/d"));
+  assert(stat(PATH_TARGET_DIR "/x", &sb) == 0);
+  assert(sb.st_nlink == 2);
+
+  /* Same through io_uring (-u). */
+  assert(mkdir(PATH_TREE_TARGET, 0777) == 0);
+  assert(link(PATH_TARGET_DIR "/x", PATH_TREE_TARGET "/s") == 0);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-f",
+                    "-L",
+                    "-u",
+                    PATH_TARGET_DIR "/s",
+                    PATH_TREE_TARGET,
+                    NULL);
+  assert(test_ln_dir_count(PATH_TREE_TARGET) == 1);
+  assert(stat(PATH_TARGET_DIR "/x", &sb) == 0);
+  assert(sb.st_nlink == 3);
+  test_ln_rm_tree(PATH_TREE_TARGET);
+
+  /*
+   * Hard link to a symbolic link itself, when the destination already is a
+   * link to that symbolic link.
+   */
+  assert(link(PATH_TARGET_DIR "/s", PATH_TARGET_DIR "/t") == 0);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-f",
+                    "-P",
+                    PATH_TARGET_DIR "/s",
+                    PATH_TARGET_DIR "/t",
+                    NULL);
+  assert(test_ln_dir_count(PATH_TARGET_DIR) == 4);
+  assert(lstat(PATH_TARGET_DIR "/s", &sb) == 0);
+  assert(sb.st_nlink == 2);
+
+  /* Same through io_uring (-u). */
+  assert(mkdir(PATH_TREE_TARGET, 0777) == 0);
+  assert(link(PATH_TARGET_DIR "/s", PATH_TREE_TARGET "/s") == 0);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-f",
+                    "-P",
+                    "-u",
+                    PATH_TARGET_DIR "/s",
+                    PATH_TREE_TARGET,
+                    NULL);
+  assert(test_ln_dir_count(PATH_TREE_TARGET) == 1);
+  assert(lstat(PATH_TARGET_DIR "/s", &sb) == 0);
+  assert(sb.st_nlink == 3);
+  test_ln_rm_tree(PATH_TREE_TARGET);
+  test_ln_rm_tree(PATH_TARGET_DIR);
+}
+
+/**
+ * Run all tests for the ln worker threads (-j) argument.
+ */
+static void
+test_all_ln_thread(void){
+  /* Create symlinks inside a target_dir using multiple threads. */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-s",
+                    "-j",
+                    "4",
+                    PATH_README,
+                    PATH_COPYING,
+                    PATH_HOSTS,
+                    PATH_TARGET_DIR,
+                    NULL);
+  test_ln_soft_check(PATH_COPYING, PATH_TARGET_DIR_COPYING);
+  test_ln_soft_check(PATH_README, PATH_TARGET_DIR_README);
+  test_ln_soft_check(PATH_HOSTS, PATH_TARGET_DIR "/hosts");
+  assert(remove(PATH_TARGET_DIR_COPYING) == 0);
+  assert(remove(PATH_TARGET_DIR_README) == 0);
+  assert(remove(PATH_TARGET_DIR "/hosts") == 0);
+  assert(rmdir(PATH_TARGET_DIR) == 0);
+
+  /* Failure in one worker thread sets the exit status. */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  test_ln_write_list(PATH_LIST, '\n', PATH_COPYING, "noexist", NULL);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-j",
+                    "2",
+                    "-l",
+                    PATH_LIST,
+                    PATH_README,
+                    PATH_TARGET_DIR,
+                    NULL);
+  test_ln_hard_check(PATH_COPYING, PATH_TARGET_DIR_COPYING);
+  test_ln_hard_check(PATH_README, PATH_TARGET_DIR_README);
+  assert(remove(PATH_TARGET_DIR_COPYING) == 0);
+  assert(remove(PATH_TARGET_DIR_README) == 0);
+  assert(rmdir(PATH_TARGET_DIR) == 0);
+  assert(remove(PATH_LIST) == 0);
+
+  /* Failed to copy the source file onto the queue. */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  g_test_seam_err_ctr_realloc = 2;
+  test_ln_main_args(EXIT_FAILURE,
+                    "-j",
+                    "2",
+                    PATH_README,
+                    PATH_TARGET_DIR,
+                    NULL);
+  g_test_seam_err_ctr_realloc = -1;
+  remove(PATH_TARGET_DIR_README);
+  assert(rmdir(PATH_TARGET_DIR) == 0);
+
+  /* Failed to allocate the queue. */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  g_test_seam_err_ctr_malloc = 0;
+  test_ln_main_args(EXIT_FAILURE,
+                    "-j",
+                    "2",
+                    PATH_README,
+                    PATH_TARGET_DIR,
+                    NULL);
+  g_test_seam_err_ctr_malloc = -1;
+  assert(remove(PATH_TARGET_DIR_README) == 0);
+  assert(rmdir(PATH_TARGET_DIR) == 0);
+
+  /* Invalid number of threads. */
+  test_ln_main_args(EXIT_FAILURE, "-j", "0", PATH_README, "x", NULL);
+  test_ln_main_args(EXIT_FAILURE, "-j", "1x", PATH_README, "x", NULL);
+  test_ln_main_args(EXIT_FAILURE, "-j", "1025", PATH_README, "x", NULL);
+}
+
+/**
+ * Run all tests for the ln io_uring (-u) argument.
+ *
+ * These also pass when io_uring not available because the links then get
+ * created with the blocking system calls.
+ */
+static void
+test_all_ln_uring(void){
+  /* Create hard links inside a target_dir. */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-u",
+                    PATH_README,
+                    PATH_COPYING,
+                    PATH_TARGET_DIR,
+                    NULL);
+  test_ln_hard_check(PATH_COPYING, PATH_TARGET_DIR_COPYING);
+  test_ln_hard_check(PATH_README, PATH_TARGET_DIR_README);
+
+  /* Destination already exists. */
+  test_ln_main_args(EXIT_FAILURE, "-u", PATH_README, PATH_TARGET_DIR, NULL);
+  assert(remove(PATH_TARGET_DIR_COPYING) == 0);
+  assert(remove(PATH_TARGET_DIR_README) == 0);
+
+  /* Replace the existing destinations with symlinks (-f). */
+  test_ln_create_file(PATH_TARGET_DIR_COPYING);
+  test_ln_create_file(PATH_TARGET_DIR_README);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-u",
+                    "-f",
+                    "-s",
+                    PATH_README,
+                    PATH_COPYING,
+                    PATH_TARGET_DIR,
+                    NULL);
+  test_ln_soft_check(PATH_COPYING, PATH_TARGET_DIR_COPYING);
+  test_ln_soft_check(PATH_README, PATH_TARGET_DIR_README);
+
+  /* Replace existing files with hard links (-f). */
+  assert(remove(PATH_TARGET_DIR_COPYING) == 0);
+  assert(remove(PATH_TARGET_DIR_README) == 0);
+  test_ln_create_file(PATH_TARGET_DIR_COPYING);
+  test_ln_create_file(PATH_TARGET_DIR_README);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-u",
+                    "-f",
+                    PATH_README,
+                    PATH_COPYING,
+                    PATH_TARGET_DIR,
+                    NULL);
+  test_ln_hard_check(PATH_COPYING, PATH_TARGET_DIR_COPYING);
+  test_ln_hard_check(PATH_README, PATH_TARGET_DIR_README);
+
+  /* Source and destination same file (-f). */
+  test_ln_main_args(EXIT_FAILURE,
+                    "-u",
+                    "-f",
+                    PATH_README,
+                    PATH_TARGET_DIR,
+                    NULL);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-u",
+                    "-f",
+                    PATH_TARGET_DIR_README,
+                    PATH_TARGET_DIR,
+                    NULL);
+  test_ln_hard_check(PATH_README, PATH_TARGET_DIR_README);
+  assert(remove(PATH_TARGET_DIR_COPYING) == 0);
+  assert(remove(PATH_TARGET_DIR_README) == 0);
+
+  /* Failed to replace destination directory (-f). */
+  assert(mkdir(PATH_TARGET_DIR_README, 0777) == 0);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-u",
+                    "-f",
+                    PATH_README,
+                    PATH_TARGET_DIR,
+                    NULL);
+  assert(test_ln_dir_count(PATH_TARGET_DIR) == 1);
+  assert(rmdir(PATH_TARGET_DIR_README) == 0);
+
+  /* Source files do not exist. */
+  test_ln_main_args(EXIT_FAILURE, "-u", "noexist", PATH_TARGET_DIR, NULL);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-u",
+                    "-s",
+                    "noexist",
+                    PATH_TARGET_DIR,
+                    NULL);
+  assert(access(PATH_TARGET_DIR "/noexist", F_OK) != 0);
+
+  /* Failed to allocate the source file copy. */
+  g_test_seam_err_ctr_realloc = 2;
+  test_ln_main_args(EXIT_FAILURE, "-u", PATH_README, PATH_TARGET_DIR, NULL);
+  g_test_seam_err_ctr_realloc = -1;
+  remove(PATH_TARGET_DIR_README);
+  assert(rmdir(PATH_TARGET_DIR) == 0);
+}
+
+/**
+ * Call @ref unlink_main with an arbitrary argument list.
+ *
+ * @param[in] expect_exit_status Expected exit status code.
+ * @param[in] arg_list           List of options and operands to send to
+ *                               unlink. Terminate list with NULL.
+ */
+static void
+test_unlink_main_args(const int expect_exit_status,
+                      const char *const arg_list, ...){
+  int exit_status;
+  const char *arg;
+  va_list ap;
+
+  g_argc = 0;
+  strcpy(g_argv[g_argc++], "unlink");
+  va_start(ap, arg_list);
+  for(arg = arg_list; arg; arg = va_arg(ap, const char *const)){
+    strcpy(g_argv[g_argc++], arg);
+  }
+  va_end(ap);
+  optind = 0;
+  exit_status = unlink_main(g_argc, g_argv);
+  assert(exit_status == expect_exit_status);
+}
+
+/**
+ * Check that the calls counted by the test seams exactly match a budget.
+ *
+ * @param[in] budget Expected number of calls to each function.
+ */
+static void
+test_seam_count_check(const struct test_seam_count *const budget){
+  assert(memcmp(&g_test_seam_count, budget, sizeof(*budget)) == 0);
+}
+
+/**
+ * Run all tests for the ln system call and memory allocation budgets.
+ *
+ * Each ln mode must not make more system calls or allocations per link
+ * than listed here. An extra stat or allocation on one of these paths
+ * fails the test.
+ */
+static void
+test_all_ln_budget(void){
+  struct test_seam_count budget;
+
+  /* Hard link, optimistic linkat with no stat of the source. */
+  memset(&budget, 0, sizeof(budget));
+  budget.stat = 1;
+  budget.linkat = 1;
+  test_seam_count_reset();
+  test_ln_main_args(EXIT_SUCCESS, PATH_README, PATH_SOURCE_1, NULL);
+  test_seam_count_check(&budget);
+
+  /* Symbolic link, lstat of the source then symlinkat. */
+  memset(&budget, 0, sizeof(budget));
+  budget.stat = 1;
+  budget.fstatat = 1;
+  budget.symlinkat = 1;
+  test_seam_count_reset();
+  test_ln_main_args(EXIT_SUCCESS, "-s", PATH_README, PATH_SOURCE_2, NULL);
+  test_seam_count_check(&budget);
+
+  /* Replace (-f), link to a temporary name and rename over destination. */
+  memset(&budget, 0, sizeof(budget));
+  budget.stat = 1;
+  budget.fstatat = 2;
+  budget.linkat = 1;
+  budget.renameat = 1;
+  test_seam_count_reset();
+  test_ln_main_args(EXIT_SUCCESS, "-f", PATH_COPYING, PATH_SOURCE_1, NULL);
+  test_seam_count_check(&budget);
+
+  /* Replace (-f) with a symbolic link. */
+  memset(&budget, 0, sizeof(budget));
+  budget.stat = 1;
+  budget.fstatat = 2;
+  budget.symlinkat = 1;
+  budget.renameat = 1;
+  test_seam_count_reset();
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-f",
+                    "-s",
+                    PATH_COPYING,
+                    PATH_SOURCE_2,
+                    NULL);
+  test_seam_count_check(&budget);
+  assert(remove(PATH_SOURCE_1) == 0);
+  assert(remove(PATH_SOURCE_2) == 0);
+
+  /*
+   * Links inside a target_dir. The path buffer only gets allocated for the
+   * target_dir prefix and then grown once, not for each link. The parent
+   * directory shared by both sources gets copied and checked once by the
+   * cross-device preflight, and the sources themselves do not get checked
+   * because the parent is on the same device.
+   */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  memset(&budget, 0, sizeof(budget));
+  budget.stat = 2;
+  budget.linkat = 2;
+  budget.realloc = 3;
+  test_seam_count_reset();
+  test_ln_main_args(EXIT_SUCCESS,
+                    PATH_README,
+                    PATH_COPYING,
+                    PATH_TARGET_DIR,
+                    NULL);
+  test_seam_count_check(&budget);
+  assert(remove(PATH_TARGET_DIR_COPYING) == 0);
+  assert(remove(PATH_TARGET_DIR_README) == 0);
+  assert(rmdir(PATH_TARGET_DIR) == 0);
+
+  /*
+   * Recursive (-R), one directory allocation and fstatat per directory.
+   * Files cost no fstatat because readdir returns their type in d_type.
+   */
+  assert(mkdir(PATH_TREE_SOURCE, 0777) == 0);
+  assert(mkdir(PATH_TREE_SOURCE "/a", 0777) == 0);
+  test_ln_create_file(PATH_TREE_SOURCE "/1.txt");
+  test_ln_create_file(PATH_TREE_SOURCE "/a/2.txt");
+  memset(&budget, 0, sizeof(budget));
+  budget.stat = 2;
+  budget.mkdirat = 2;
+  budget.fstatat = 1;
+  budget.linkat = 2;
+  budget.malloc = 2;
+  budget.realloc = 4;
+  test_seam_count_reset();
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-R",
+                    PATH_TREE_SOURCE,
+                    PATH_TREE_TARGET,
+                    NULL);
+  test_seam_count_check(&budget);
+  test_ln_rm_tree(PATH_TREE_TARGET);
+  test_ln_rm_tree(PATH_TREE_SOURCE);
+}
+
+/**
+ * Run all tests for the ln recursive (-R) argument.
+ */
+static void
+test_all_ln_recursive(void){
+  struct stat sb_1;
+  struct stat sb_2;
+
+  /* Mirror a tree into a new target directory using multiple threads. */
+  assert(mkdir(PATH_TREE_SOURCE, 0777) == 0);
+  assert(mkdir(PATH_TREE_SOURCE "/a", 0777) == 0);
+  assert(mkdir(PATH_TREE_SOURCE "/a/b", 0777) == 0);
+  test_ln_create_file(PATH_TREE_SOURCE "/1.txt");
+  test_ln_create_file(PATH_TREE_SOURCE "/a/2.txt");
+  test_ln_create_file(PATH_TREE_SOURCE "/a/b/3.txt");
+  assert(symlink("a", PATH_TREE_SOURCE "/sym") == 0);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-R",
+                    "-j",
+                    "4",
+                    PATH_TREE_SOURCE,
+                    PATH_TARGET_DIR,
+                    NULL);
+  test_ln_hard_check(PATH_TREE_SOURCE "/1.txt", PATH_TARGET_DIR "/1.txt");
+  test_ln_hard_check(PATH_TREE_SOURCE "/a/2.txt", PATH_TARGET_DIR "/a/2.txt");
+  test_ln_hard_check(PATH_TREE_SOURCE "/a/b/3.txt",
+                     PATH_TARGET_DIR "/a/b/3.txt");
+  assert(lstat(PATH_TREE_SOURCE "/sym", &sb_1) == 0);
+  assert(lstat(PATH_TARGET_DIR "/sym", &sb_2) == 0);
+  assert(S_ISLNK(sb_2.st_mode));
+  assert(sb_1.st_ino == sb_2.st_ino);
+  assert(test_ln_dir_count(PATH_TARGET_DIR) == 3);
+  assert(test_ln_dir_count(PATH_TARGET_DIR "/a") == 2);
+
+  /* Destinations already exist. */
+  test_ln_main_args(EXIT_FAILURE,
+                    "-R",
+                    PATH_TREE_SOURCE,
+                    PATH_TARGET_DIR,
+                    NULL);
+
+  test_ln_rm_tree(PATH_TARGET_DIR);
+
+  /* Replace an existing destination with symlinks (-f). */
+  assert(mkdir(PATH_TREE_TARGET, 0777) == 0);
+  test_ln_create_file(PATH_TREE_TARGET "/1.txt");
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-R",
+                    "-f",
+                    "-s",
+                    PATH_TREE_SOURCE,
+                    PATH_TREE_TARGET,
+                    NULL);
+  test_ln_soft_check(PATH_TREE_SOURCE "/a/b/3.txt",
+                     PATH_TREE_TARGET "/a/b/3.txt");
+  test_ln_soft_check(PATH_TREE_SOURCE "/1.txt", PATH_TREE_TARGET "/1.txt");
+  assert(test_ln_dir_count(PATH_TREE_TARGET "/a/b") == 1);
+  test_ln_rm_tree(PATH_TREE_TARGET);
+
+  /* Target directory inside the source tree does not get descended into. */
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-R",
+                    PATH_TREE_SOURCE,
+                    PATH_TREE_SOURCE "/a/b/t",
+                    NULL);
+  test_ln_hard_check(PATH_TREE_SOURCE "/a/2.txt",
+                     PATH_TREE_SOURCE "/a/b/t/a/2.txt");
+  assert(test_ln_dir_count(PATH_TREE_SOURCE "/a/b/t/a/b") == 1);
+  test_ln_rm_tree(PATH_TREE_SOURCE "/a/b/t");
+
+  /*
+   * Failed to get the status of a subdirectory or create it. The source
+   * only holds the one subdirectory, so the first fstatat call and the
+   * mkdirat call after the one for the target root are for it in any
+   * readdir order.
+   */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  assert(mkdir(PATH_TARGET_DIR "/d", 0777) == 0);
+  g_test_seam_err_ctr_fstatat = 0;
+  test_ln_main_args(EXIT_FAILURE,
+                    "-R",
+                    PATH_TARGET_DIR,
+                    PATH_TREE_TARGET,
+                    NULL);
+  g_test_seam_err_ctr_fstatat = -1;
+  assert(access(PATH_TREE_TARGET "/d", F_OK) != 0);
+  g_test_seam_err_ctr_mkdirat = 1;
+  test_ln_main_args(EXIT_FAILURE,
+                    "-R",
+                    PATH_TARGET_DIR,
+                    PATH_TREE_TARGET,
+                    NULL);
+  g_test_seam_err_ctr_mkdirat = -1;
+  assert(access(PATH_TREE_TARGET "/d", F_OK) != 0);
+  test_ln_rm_tree(PATH_TREE_TARGET);
+  test_ln_rm_tree(PATH_TARGET_DIR);
+
+  /*
+   * Read-only source directories, whose target directories only become
+   * read-only once their entries have been linked.
+   */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  assert(mkdir(PATH_TARGET_DIR "/d", 0777) == 0);
+  test_ln_create_file(PATH_TARGET_DIR "/d/f");
+  assert(chmod(PATH_TARGET_DIR "/d", 0555) == 0);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-R",
+                    PATH_TARGET_DIR,
+                    PATH_TREE_TARGET,
+                    NULL);
+  test_ln_hard_check(PATH_TARGET_DIR "/d/f", PATH_TREE_TARGET "/d/f");
+  assert(stat(PATH_TREE_TARGET "/d", &sb_1) == 0);
+  assert((sb_1.st_mode & 07777) == 0555);
+  assert(chmod(PATH_TREE_TARGET "/d", 0755) == 0);
+  assert(chmod(PATH_TARGET_DIR "/d", 0755) == 0);
+  test_ln_rm_tree(PATH_TREE_TARGET);
+  test_ln_rm_tree(PATH_TARGET_DIR);
+
+  /* Failed to allocate the first directory on the stack. */
+  g_test_seam_err_ctr_malloc = 0;
+  test_ln_main_args(EXIT_FAILURE,
+                    "-R",
+                    PATH_TREE_SOURCE,
+                    PATH_TREE_TARGET,
+                    NULL);
+  g_test_seam_err_ctr_malloc = -1;
+  assert(test_ln_dir_count(PATH_TREE_TARGET) == 0);
+  assert(rmdir(PATH_TREE_TARGET) == 0);
+
+  /* Source or target not a directory. */
+  test_ln_main_args(EXIT_FAILURE, "-R", PATH_README, PATH_TREE_TARGET, NULL);
+  test_ln_main_args(EXIT_FAILURE, "-R", "noexist", PATH_TREE_TARGET, NULL);
+  test_ln_main_args(EXIT_FAILURE, "-R", PATH_TREE_SOURCE, PATH_README, NULL);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-R",
+                    PATH_TREE_SOURCE,
+                    "noexist/noexist",
+                    NULL);
+  assert(access(PATH_TREE_TARGET, F_OK) != 0);
+
+  /* Wrong number of operands. */
+  test_ln_main_args(EXIT_FAILURE, "-R", PATH_TREE_SOURCE, NULL);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-R",
+                    "-l",
+                    PATH_LIST,
+                    PATH_TREE_SOURCE,
+                    PATH_TREE_TARGET,
+                    NULL);
+  test_ln_rm_tree(PATH_TREE_SOURCE);
+}
+
+/**
+ * Run all tests for the embeddable library interface.
+ */
+static void
+test_all_ln_lib(void){
+  struct ln_ctx *ln_ctx;
+  struct ln_lib_op op_list[8];
+  char path_list[8][64];
+  size_t i;
+  struct stat sb_source;
+  struct stat sb;
+
+  /* Unsupported flags and too many threads. */
+  errno = 0;
+  assert(ln_lib_new(LN_FLAG_URING, 1) == NULL);
+  assert(errno == EINVAL);
+  errno = 0;
+  assert(ln_lib_new(0, 100000) == NULL);
+  assert(errno == EINVAL);
+
+  /* Failed to allocate the context. */
+  g_test_seam_err_ctr_malloc = 0;
+  assert(ln_lib_new(0, 1) == NULL);
+  g_test_seam_err_ctr_malloc = -1;
+
+  /* Per-operation results, continuing after a failure. */
+  ln_ctx = ln_lib_new(0, 0);
+  assert(ln_ctx);
+  op_list[0].source = PATH_README;
+  op_list[0].dest = PATH_SOURCE_1;
+  op_list[1].source = "noexist";
+  op_list[1].dest = PATH_SOURCE_2;
+  op_list[2].source = PATH_COPYING;
+  op_list[2].dest = PATH_SOURCE_1;
+  assert(ln_lib_submit(ln_ctx, op_list, 0) == 0);
+  assert(ln_lib_status(ln_ctx) == EXIT_SUCCESS);
+  assert(ln_lib_submit(ln_ctx, op_list, 3) == 2);
+  assert(op_list[0].error == 0);
+  assert(op_list[1].error == ENOENT);
+  assert(op_list[2].error == EEXIST);
+  test_ln_hard_check(PATH_README, PATH_SOURCE_1);
+  assert(access(PATH_SOURCE_2, F_OK) != 0);
+  assert(ln_lib_status(ln_ctx) == EXIT_FAILURE);
+  ln_lib_free(ln_ctx);
+
+  /* Replace the destination with a symbolic link. */
+  ln_ctx = ln_lib_new(LN_FLAG_REMOVE_DEST | LN_FLAG_SYMBOLIC, 1);
+  assert(ln_ctx);
+  op_list[0].source = PATH_COPYING;
+  op_list[0].dest = PATH_SOURCE_1;
+  assert(ln_lib_submit(ln_ctx, op_list, 1) == 0);
+  assert(op_list[0].error == 0);
+  test_ln_soft_check(PATH_COPYING, PATH_SOURCE_1);
+  assert(ln_lib_status(ln_ctx) == EXIT_SUCCESS);
+  ln_lib_free(ln_ctx);
+  assert(remove(PATH_SOURCE_1) == 0);
+
+  /* Split the operations between threads. */
+  ln_ctx = ln_lib_new(0, 3);
+  assert(ln_ctx);
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  for(i = 0; i < 8; i++){
+    sprintf(path_list[i], "%s/%zu", PATH_TARGET_DIR, i);
+    op_list[i].source = PATH_README;
+    op_list[i].dest = path_list[i];
+    op_list[i].error = -1;
+  }
+  assert(ln_lib_submit(ln_ctx, op_list, 8) == 0);
+  assert(stat(PATH_README, &sb_source) == 0);
+  assert(sb_source.st_nlink == 9);
+  for(i = 0; i < 8; i++){
+    assert(op_list[i].error == 0);
+    assert(stat(path_list[i], &sb) == 0);
+    assert(sb.st_ino == sb_source.st_ino);
+  }
+
+  /* Run every operation on the calling thread if out of memory. */
+  g_test_seam_err_ctr_malloc = 0;
+  assert(ln_lib_submit(ln_ctx, op_list, 8) == 8);
+  g_test_seam_err_ctr_malloc = -1;
+  for(i = 0; i < 8; i++){
+    assert(op_list[i].error == EEXIST);
+    assert(remove(path_list[i]) == 0);
+  }
+  assert(ln_lib_status(ln_ctx) == EXIT_FAILURE);
+  ln_lib_free(ln_ctx);
+  assert(rmdir(PATH_TARGET_DIR) == 0);
+  ln_lib_free(NULL);
+
+  /* Destination in a directory that does not exist. */
+  ln_ctx = ln_lib_new(LN_FLAG_WARN, 1);
+  assert(ln_ctx);
+  op_list[0].source = PATH_README;
+  op_list[0].dest = PATH_TARGET_DIR "/" PATH_README;
+  assert(ln_lib_submit(ln_ctx, op_list, 1) == 1);
+  assert(op_list[0].error == ENOENT);
+  assert(lstat(PATH_TARGET_DIR, &sb) != 0);
+  ln_lib_free(ln_ctx);
+}
+
+/**
+ * Check the result of creating a clone (-c).
+ *
+ * Cloning only succeeds if built with LINK_REFLINK and the test directory
+ * supports reflinks. A clone must be a separate inode with the same size
+ * as the source, and a failed clone must not leave a file behind.
+ *
+ * @param[in] source      Source file.
+ * @param[in] dest        Clone of @p source, if created.
+ * @param[in] exit_status Exit status of ln.
+ */
+static void
+test_ln_clone_check(const char *const source,
+                    const char *const dest,
+                    const int exit_status){
+  struct stat sb_source;
+  struct stat sb_dest;
+
+  assert(stat(source, &sb_source) == 0);
+  if(exit_status == EXIT_SUCCESS){
+    assert(lstat(dest, &sb_dest) == 0);
+    assert(S_ISREG(sb_dest.st_mode));
+    assert(sb_dest.st_ino != sb_source.st_ino);
+    assert(sb_dest.st_size == sb_source.st_size);
+  }
+  else{
+    assert(lstat(dest, &sb_dest) != 0);
+  }
+}
+
+/**
+ * Run all tests for the ln clone (-c) argument.
+ */
+static void
+test_all_ln_reflink(void){
+  struct ln_ctx *ln_ctx;
+  struct ln_lib_op op;
+  int exit_status;
+
+  /* Invalid arguments. */
+  test_ln_main_args(EXIT_FAILURE, "-c", "-s", PATH_README, PATH_SOURCE_1, NULL);
+  assert(access(PATH_SOURCE_1, F_OK) != 0);
+  errno = 0;
+  assert(ln_lib_new(LN_FLAG_SYMBOLIC | LN_FLAG_REFLINK, 1) == NULL);
+  assert(errno == EINVAL);
+
+  /*
+   * Clone a single file. The result tells whether the test directory
+   * supports reflinks for the remaining tests.
+   */
+  g_argc = 0;
+  strcpy(g_argv[g_argc++], "ln");
+  strcpy(g_argv[g_argc++], "-c");
+  strcpy(g_argv[g_argc++], PATH_README);
+  strcpy(g_argv[g_argc++], PATH_SOURCE_1);
+  optind = 0;
+  exit_status = ln_main(g_argc, g_argv);
+#ifndef LINK_REFLINK
+  assert(exit_status == EXIT_FAILURE);
+#endif /* LINK_REFLINK */
+  test_ln_clone_check(PATH_README, PATH_SOURCE_1, exit_status);
+  remove(PATH_SOURCE_1);
+
+  /* Only regular files get cloned, and a FIFO must not block. */
+  assert(mkfifo(PATH_FIFO, 0644) == 0);
+  test_ln_main_args(EXIT_FAILURE, "-c", PATH_FIFO, PATH_SOURCE_1, NULL);
+  assert(access(PATH_SOURCE_1, F_OK) != 0);
+  assert(remove(PATH_FIFO) == 0);
+
+  /* Destination exists. */
+  test_ln_create_file(PATH_SOURCE_2);
+  test_ln_main_args(EXIT_FAILURE, "-c", PATH_README, PATH_SOURCE_2, NULL);
+
+  /* Replace the destination, which stays unchanged if cloning fails. */
+  test_ln_main_args(exit_status,
+                    "-c",
+                    "-f",
+                    PATH_README,
+                    PATH_SOURCE_2,
+                    NULL);
+  if(exit_status == EXIT_SUCCESS){
+    test_ln_clone_check(PATH_README, PATH_SOURCE_2, exit_status);
+  }
+  assert(remove(PATH_SOURCE_2) == 0);
+
+  /* Clone into a target_dir with worker threads, never through io_uring. */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  test_ln_main_args(exit_status,
+                    "-c",
+                    "-u",
+                    "-j",
+                    "2",
+                    PATH_README,
+                    PATH_COPYING,
+                    PATH_TARGET_DIR,
+                    NULL);
+  test_ln_clone_check(PATH_README, PATH_TARGET_DIR_README, exit_status);
+  test_ln_clone_check(PATH_COPYING, PATH_TARGET_DIR_COPYING, exit_status);
+  remove(PATH_TARGET_DIR_README);
+  remove(PATH_TARGET_DIR_COPYING);
+  assert(rmdir(PATH_TARGET_DIR) == 0);
+
+  /* Clone through the library. */
+  ln_ctx = ln_lib_new(LN_FLAG_REFLINK, 1);
+  assert(ln_ctx);
+  op.source = PATH_README;
+  op.dest = PATH_SOURCE_1;
+  assert((ln_lib_submit(ln_ctx, &op, 1) == 0) ==
+         (exit_status == EXIT_SUCCESS));
+  test_ln_clone_check(PATH_README, PATH_SOURCE_1, exit_status);
+  remove(PATH_SOURCE_1);
+  ln_lib_free(ln_ctx);
+}
+
+/**
+ * Check that a file got copied into a separate inode with the same
+ * contents (-C).
+ *
+ * @param[in] source Source file.
+ * @param[in] dest   Copy of @p source.
+ */
+static void
+test_ln_copy_check(const char *const source,
+                   const char *const dest){
+  char cmd[1000];
+
+  assert(!test_ln_same_inode(source, dest));
+  sprintf(cmd, "cmp -s \'%s\' \'%s\'", source, dest);
+  assert(system(cmd) == 0);
+}
+
+/**
+ * Run all tests for the ln cross-device copy (-C) argument.
+ *
+ * The file path pointed to by @ref PATH_XDEV_DEST must point to a
+ * different device ID for these tests to work.
+ */
+static void
+test_all_ln_copy(void){
+  struct ln_ctx *ln_ctx;
+  struct ln_lib_op op;
+  struct stat sb;
+  int fd;
+
+  /* Hard links across devices still fail without the copy fallback. */
+  test_ln_main_args(EXIT_FAILURE, PATH_README, PATH_XDEV_DEST, NULL);
+  assert(access(PATH_XDEV_DEST, F_OK) != 0);
+
+  /* Copy a file to a different device. */
+  test_ln_main_args(EXIT_SUCCESS, "-C", PATH_README, PATH_XDEV_DEST, NULL);
+  test_ln_copy_check(PATH_README, PATH_XDEV_DEST);
+
+  /* Destination exists. */
+  test_ln_main_args(EXIT_FAILURE, "-C", PATH_COPYING, PATH_XDEV_DEST, NULL);
+  test_ln_copy_check(PATH_README, PATH_XDEV_DEST);
+
+  /* Replace the destination. */
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-C",
+                    "-f",
+                    PATH_COPYING,
+                    PATH_XDEV_DEST,
+                    NULL);
+  test_ln_copy_check(PATH_COPYING, PATH_XDEV_DEST);
+  assert(remove(PATH_XDEV_DEST) == 0);
+
+  /* A FIFO must fail with EXDEV instead of blocking or getting copied. */
+  assert(mkfifo(PATH_FIFO, 0644) == 0);
+  test_ln_main_args(EXIT_FAILURE, "-C", PATH_FIFO, PATH_XDEV_DEST, NULL);
+  assert(access(PATH_XDEV_DEST, F_OK) != 0);
+  assert(symlink(PATH_FIFO, PATH_SYM) == 0);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-C",
+                    "-L",
+                    PATH_SYM,
+                    PATH_XDEV_DEST,
+                    NULL);
+  assert(access(PATH_XDEV_DEST, F_OK) != 0);
+  assert(remove(PATH_SYM) == 0);
+  assert(remove(PATH_FIFO) == 0);
+
+  /* Symbolic links only get copied when followed. */
+  assert(symlink(PATH_README, PATH_SYM) == 0);
+  test_ln_main_args(EXIT_FAILURE, "-C", PATH_SYM, PATH_XDEV_DEST, NULL);
+  assert(access(PATH_XDEV_DEST, F_OK) != 0);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-C",
+                    "-L",
+                    PATH_SYM,
+                    PATH_XDEV_DEST,
+                    NULL);
+  test_ln_copy_check(PATH_README, PATH_XDEV_DEST);
+  assert(remove(PATH_XDEV_DEST) == 0);
+  assert(remove(PATH_SYM) == 0);
+
+  /*
+   * Copy a sparse file spanning several chunks with worker threads. The
+   * holes must stay holes.
+   */
+  fd = open(PATH_SPARSE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert(fd >= 0);
+  assert(ftruncate(fd, 32 * 1024 * 1024 + 3) == 0);
+  assert(pwrite(fd, "head", 4, 0) == 4);
+  assert(pwrite(fd, "middle", 6, 17 * 1024 * 1024) == 6);
+  assert(pwrite(fd, "end", 3, 32 * 1024 * 1024) == 3);
+  assert(close(fd) == 0);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-C",
+                    "-j",
+                    "4",
+                    PATH_SPARSE,
+                    PATH_XDEV_DEST,
+                    NULL);
+  test_ln_copy_check(PATH_SPARSE, PATH_XDEV_DEST);
+  assert(stat(PATH_XDEV_DEST, &sb) == 0);
+  assert(sb.st_size == 32 * 1024 * 1024 + 3);
+  assert(sb.st_blocks < 1024);
+  assert(remove(PATH_XDEV_DEST) == 0);
+  assert(remove(PATH_SPARSE) == 0);
+
+  /* Copy through the library. */
+  ln_ctx = ln_lib_new(LN_FLAG_COPY, 1);
+  assert(ln_ctx);
+  op.source = PATH_README;
+  op.dest = PATH_XDEV_DEST;
+  assert(ln_lib_submit(ln_ctx, &op, 1) == 0);
+  test_ln_copy_check(PATH_README, PATH_XDEV_DEST);
+  assert(remove(PATH_XDEV_DEST) == 0);
+  ln_lib_free(ln_ctx);
+
+  /* Fail before creating any link if some operands cross devices. */
+  assert(mkdir(PATH_XDEV_DIR, 0777) == 0);
+  test_ln_create_file(PATH_XDEV_DEST);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-j",
+                    "2",
+                    PATH_XDEV_DEST,
+                    PATH_README,
+                    PATH_COPYING,
+                    PATH_XDEV_DIR,
+                    NULL);
+  assert(test_ln_dir_count(PATH_XDEV_DIR) == 0);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-c",
+                    PATH_README,
+                    PATH_XDEV_DIR,
+                    NULL);
+  assert(test_ln_dir_count(PATH_XDEV_DIR) == 0);
+
+  /* Same device operands still get hard linked alongside copies. */
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-C",
+                    PATH_XDEV_DEST,
+                    PATH_README,
+                    PATH_XDEV_DIR,
+                    NULL);
+  assert(test_ln_same_inode(PATH_XDEV_DEST, PATH_XDEV_DIR "/test-ln.txt"));
+  test_ln_copy_check(PATH_README, PATH_XDEV_DIR "/" PATH_README);
+  test_ln_rm_tree(PATH_XDEV_DIR);
+
+  /*
+   * A symbolic link whose parent crosses devices, pointing to a file on the
+   * same device as the target_dir, only crosses devices when not followed.
+   */
+  assert(mkdir(PATH_XDEV_DIR, 0777) == 0);
+  assert(symlink(PATH_XDEV_DEST, PATH_SYM) == 0);
+  test_ln_main_args(EXIT_FAILURE, "-P", PATH_SYM, PATH_XDEV_DIR, NULL);
+  assert(test_ln_dir_count(PATH_XDEV_DIR) == 0);
+  test_ln_main_args(EXIT_SUCCESS, "-L", PATH_SYM, PATH_XDEV_DIR, NULL);
+  assert(test_ln_same_inode(PATH_XDEV_DEST, PATH_XDEV_DIR "/" PATH_SYM));
+  assert(remove(PATH_SYM) == 0);
+  test_ln_rm_tree(PATH_XDEV_DIR);
+
+  /* Every operand crosses devices, so copy without io_uring. */
+  assert(mkdir(PATH_XDEV_DIR, 0777) == 0);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-C",
+                    "-u",
+                    "-j",
+                    "2",
+                    PATH_README,
+                    PATH_COPYING,
+                    PATH_XDEV_DIR,
+                    NULL);
+  test_ln_copy_check(PATH_README, PATH_XDEV_DIR "/" PATH_README);
+  test_ln_copy_check(PATH_COPYING, PATH_XDEV_DIR "/" PATH_COPYING);
+  test_ln_rm_tree(PATH_XDEV_DIR);
+
+  /* A FIFO crossing devices into a target_dir fails without an entry. */
+  assert(mkdir(PATH_XDEV_DIR, 0777) == 0);
+  assert(mkfifo(PATH_FIFO, 0644) == 0);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-C",
+                    PATH_FIFO,
+                    PATH_README,
+                    PATH_XDEV_DIR,
+                    NULL);
+  assert(access(PATH_XDEV_DIR "/" PATH_FIFO, F_OK) != 0);
+  test_ln_copy_check(PATH_README, PATH_XDEV_DIR "/" PATH_README);
+  assert(remove(PATH_FIFO) == 0);
+  test_ln_rm_tree(PATH_XDEV_DIR);
+  assert(remove(PATH_XDEV_DEST) == 0);
+}
+
+/**
+ * Run all tests for the ln store checkout (-M) argument.
+ */
+static void
+test_all_ln_checkout(void){
+  char path[1000];
+  struct stat sb;
+
+  assert(mkdir(PATH_STORE, 0777) == 0);
+  test_ln_write_file(PATH_STORE "/aaa", 'a', 'a', 100);
+  test_ln_write_file(PATH_STORE "/bbb", 'b', 'b', 100);
+
+  /* Invalid arguments. */
+  test_ln_write_list(PATH_MANIFEST, '\n', "aaa a.txt", NULL);
+  test_ln_main_args(EXIT_FAILURE, "-M", PATH_MANIFEST, PATH_STORE, NULL);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-M",
+                    PATH_MANIFEST,
+                    "-R",
+                    PATH_STORE,
+                    PATH_TREE_TARGET,
+                    NULL);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-M",
+                    PATH_MANIFEST,
+                    "-D",
+                    PATH_STORE,
+                    NULL);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-M",
+                    "noexist",
+                    PATH_STORE,
+                    PATH_TREE_TARGET,
+                    NULL);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-M",
+                    PATH_MANIFEST,
+                    "noexist",
+                    PATH_TREE_TARGET,
+                    NULL);
+  assert(access(PATH_TREE_TARGET, F_OK) != 0);
+
+  /* Invalid manifest entries fail before creating anything. */
+  test_ln_write_list(PATH_MANIFEST,
+                     '\n',
+                     "aaa a.txt",
+                     "aaa",
+                     "aaa ../a.txt",
+                     "aaa /a.txt",
+                     "aaa dir/../a.txt",
+                     "aaa dir//a.txt",
+                     "aaa dir/",
+                     "../aaa a.txt",
+                     NULL);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-M",
+                    PATH_MANIFEST,
+                    PATH_STORE,
+                    PATH_TREE_TARGET,
+                    NULL);
+  assert(access(PATH_TREE_TARGET, F_OK) != 0);
+
+  /* Check out a tree with worker threads, creating the directories. */
+  test_ln_write_list(PATH_MANIFEST,
+                     '\n',
+                     "aaa a.txt",
+                     "bbb\t dir/sub/b.txt",
+                     "",
+                     "aaa dir/a.txt",
+                     "bbb dir/sub/c d.txt",
+                     "aaa dir/sub/deep/a.txt",
+                     NULL);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-M",
+                    PATH_MANIFEST,
+                    "-j",
+                    "3",
+                    PATH_STORE,
+                    PATH_TREE_TARGET,
+                    NULL);
+  assert(test_ln_same_inode(PATH_STORE "/aaa", PATH_TREE_TARGET "/a.txt"));
+  assert(test_ln_same_inode(PATH_STORE "/aaa",
+                            PATH_TREE_TARGET "/dir/a.txt"));
+  assert(test_ln_same_inode(PATH_STORE "/aaa",
+                            PATH_TREE_TARGET "/dir/sub/deep/a.txt"));
+  assert(test_ln_same_inode(PATH_STORE "/bbb",
+                            PATH_TREE_TARGET "/dir/sub/b.txt"));
+  assert(test_ln_same_inode(PATH_STORE "/bbb",
+                            PATH_TREE_TARGET "/dir/sub/c d.txt"));
+
+  /* Links exist, then replace them (-f). */
+  test_ln_main_args(EXIT_FAILURE,
+                    "-M",
+                    PATH_MANIFEST,
+                    PATH_STORE,
+                    PATH_TREE_TARGET,
+                    NULL);
+  test_ln_write_list(PATH_MANIFEST, '\0', "bbb a.txt", "aaa dir/x", NULL);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-M",
+                    PATH_MANIFEST,
+                    "-f",
+                    "-0",
+                    PATH_STORE,
+                    PATH_TREE_TARGET,
+                    NULL);
+  assert(test_ln_same_inode(PATH_STORE "/bbb", PATH_TREE_TARGET "/a.txt"));
+  assert(test_ln_same_inode(PATH_STORE "/aaa", PATH_TREE_TARGET "/dir/x"));
+  test_ln_rm_tree(PATH_TREE_TARGET);
+
+  /*
+   * Missing objects and directories that cannot get created fail, but the
+   * other entries still get linked.
+   */
+  assert(mkdir(PATH_TREE_TARGET, 0777) == 0);
+  test_ln_create_file(PATH_TREE_TARGET "/file");
+  test_ln_write_list(PATH_MANIFEST,
+                     '\n',
+                     "ccc c.txt",
+                     "aaa file/a.txt",
+                     "aaa file/b.txt",
+                     "bbb b.txt",
+                     NULL);
+  test_ln_main_args(EXIT_FAILURE,
+                    "-M",
+                    PATH_MANIFEST,
+                    PATH_STORE,
+                    PATH_TREE_TARGET,
+                    NULL);
+  assert(access(PATH_TREE_TARGET "/c.txt", F_OK) != 0);
+  assert(test_ln_same_inode(PATH_STORE "/bbb", PATH_TREE_TARGET "/b.txt"));
+  test_ln_rm_tree(PATH_TREE_TARGET);
+
+  /* Symbolic links (-s) point to the absolute path of the object. */
+  test_ln_write_list(PATH_MANIFEST, '\n', "aaa dir/a.txt", NULL);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-M",
+                    PATH_MANIFEST,
+                    "-s",
+                    PATH_STORE,
+                    PATH_TREE_TARGET,
+                    NULL);
+  assert(lstat(PATH_TREE_TARGET "/dir/a.txt", &sb) == 0);
+  assert(S_ISLNK(sb.st_mode));
+  memset(path, 0, sizeof(path));
+  assert(readlink(PATH_TREE_TARGET "/dir/a.txt",
+                  path,
+                  sizeof(path) - 1) > 0);
+  assert(path[0] == '/');
+  assert(test_ln_same_inode(PATH_STORE "/aaa",
+                            PATH_TREE_TARGET "/dir/a.txt"));
+  test_ln_rm_tree(PATH_TREE_TARGET);
+
+  assert(remove(PATH_MANIFEST) == 0);
+  test_ln_rm_tree(PATH_STORE);
+}
+
+/**
+ * Run all tests for the ln deduplication (-D) argument.
+ */
+static void
+test_all_ln_dedup(void){
+  struct stat sb;
+  int exit_status;
+
+  assert(mkdir(PATH_TREE_SOURCE, 0777) == 0);
+  assert(mkdir(PATH_TREE_SOURCE "/a", 0777) == 0);
+  test_ln_write_file(PATH_TREE_SOURCE "/1", 'x', 'x', 10000);
+  test_ln_write_file(PATH_TREE_SOURCE "/2", 'x', 'x', 10000);
+  test_ln_write_file(PATH_TREE_SOURCE "/a/3", 'x', 'x', 10000);
+  assert(link(PATH_TREE_SOURCE "/a/3", PATH_TREE_SOURCE "/a/4") == 0);
+  test_ln_write_file(PATH_TREE_SOURCE "/mode", 'x', 'x', 10000);
+  assert(chmod(PATH_TREE_SOURCE "/mode", 0600) == 0);
+  test_ln_write_file(PATH_TREE_SOURCE "/tail", 'x', 'y', 10000);
+  test_ln_write_file(PATH_TREE_SOURCE "/small-1", 'z', 'z', 10);
+  test_ln_write_file(PATH_TREE_SOURCE "/a/small-2", 'z', 'z', 10);
+  test_ln_write_file(PATH_TREE_SOURCE "/other", 'y', 'y', 10);
+  test_ln_create_file(PATH_TREE_SOURCE "/empty-1");
+  test_ln_create_file(PATH_TREE_SOURCE "/empty-2");
+  assert(symlink("1", PATH_TREE_SOURCE "/sym") == 0);
+
+  /* Invalid arguments. */
+  test_ln_main_args(EXIT_FAILURE, "-D", NULL);
+  test_ln_main_args(EXIT_FAILURE, "-D", "-s", PATH_TREE_SOURCE, NULL);
+  test_ln_main_args(EXIT_FAILURE, "-D", "-R", PATH_TREE_SOURCE, NULL);
+  test_ln_main_args(EXIT_FAILURE, "-D", "noexist", NULL);
+  test_ln_main_args(EXIT_FAILURE, "-D", PATH_README, NULL);
+  test_ln_main_args(EXIT_FAILURE, "-c", PATH_README, PATH_SOURCE_1, NULL);
+  assert(!test_ln_same_inode(PATH_TREE_SOURCE "/1", PATH_TREE_SOURCE "/2"));
+
+  /*
+   * Sharing extents (-c) keeps every inode and its mode. Only succeeds if
+   * built with LINK_REFLINK and the test directory supports reflinks.
+   */
+#ifdef LINK_REFLINK
+  exit_status = -1;
+#else /* !(LINK_REFLINK) */
+  exit_status = EXIT_FAILURE;
+#endif /* LINK_REFLINK */
+  test_ln_main_args(exit_status, "-D", "-c", "-j", "2", PATH_TREE_SOURCE, NULL);
+  assert(!test_ln_same_inode(PATH_TREE_SOURCE "/1", PATH_TREE_SOURCE "/2"));
+  assert(!test_ln_same_inode(PATH_TREE_SOURCE "/1", PATH_TREE_SOURCE "/mode"));
+  assert(stat(PATH_TREE_SOURCE "/mode", &sb) == 0);
+  assert((sb.st_mode & 0777) == 0600);
+
+  /* Link identical files to the inode which already has the most links. */
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-D",
+                    "-j",
+                    "4",
+                    PATH_TREE_SOURCE,
+                    NULL);
+  assert(test_ln_same_inode(PATH_TREE_SOURCE "/1", PATH_TREE_SOURCE "/a/3"));
+  assert(test_ln_same_inode(PATH_TREE_SOURCE "/2", PATH_TREE_SOURCE "/a/3"));
+  assert(test_ln_same_inode(PATH_TREE_SOURCE "/a/4", PATH_TREE_SOURCE "/a/3"));
+  assert(stat(PATH_TREE_SOURCE "/1", &sb) == 0);
+  assert(sb.st_nlink == 4);
+  assert(test_ln_same_inode(PATH_TREE_SOURCE "/small-1",
+                            PATH_TREE_SOURCE "/a/small-2"));
+
+  /* Different mode, different content, and empty files stay separate. */
+  assert(!test_ln_same_inode(PATH_TREE_SOURCE "/1", PATH_TREE_SOURCE "/mode"));
+  assert(!test_ln_same_inode(PATH_TREE_SOURCE "/1", PATH_TREE_SOURCE "/tail"));
+  assert(!test_ln_same_inode(PATH_TREE_SOURCE "/small-1",
+                             PATH_TREE_SOURCE "/other"));
+  assert(!test_ln_same_inode(PATH_TREE_SOURCE "/empty-1",
+                             PATH_TREE_SOURCE "/empty-2"));
+  assert(lstat(PATH_TREE_SOURCE "/sym", &sb) == 0);
+  assert(S_ISLNK(sb.st_mode));
+
+  /* Running again does not change anything. */
+  test_ln_main_args(EXIT_SUCCESS, "-D", PATH_TREE_SOURCE, NULL);
+  assert(stat(PATH_TREE_SOURCE "/1", &sb) == 0);
+  assert(sb.st_nlink == 4);
+
+  /* Index file only used with -D. */
+  test_ln_main_args(EXIT_FAILURE, "-I", PATH_DEDUP_INDEX, PATH_README, NULL);
+
+  /*
+   * Store the hashes of the four inodes that share their size with another
+   * inode, and link a new copy to the kept inode.
+   */
+  test_ln_write_file(PATH_TREE_SOURCE "/new", 'x', 'x', 10000);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-D",
+                    "-I",
+                    PATH_DEDUP_INDEX,
+                    PATH_TREE_SOURCE,
+                    NULL);
+  assert(test_ln_same_inode(PATH_TREE_SOURCE "/1", PATH_TREE_SOURCE "/new"));
+  assert(stat(PATH_DEDUP_INDEX, &sb) == 0);
+  assert(sb.st_size == 32 + 4 * 64);
+
+  /* Reuse the index. */
+  test_ln_write_file(PATH_TREE_SOURCE "/a/new", 'x', 'x', 10000);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-D",
+                    "-I",
+                    PATH_DEDUP_INDEX,
+                    PATH_TREE_SOURCE,
+                    NULL);
+  assert(test_ln_same_inode(PATH_TREE_SOURCE "/1",
+                            PATH_TREE_SOURCE "/a/new"));
+  assert(stat(PATH_TREE_SOURCE "/1", &sb) == 0);
+  assert(sb.st_nlink == 6);
+  assert(stat(PATH_DEDUP_INDEX, &sb) == 0);
+  assert(sb.st_size == 32 + 4 * 64);
+
+  /* Damaged index gets ignored and replaced. */
+  test_ln_write_file(PATH_DEDUP_INDEX, 'x', 'x', 100);
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-D",
+                    "-I",
+                    PATH_DEDUP_INDEX,
+                    PATH_TREE_SOURCE,
+                    NULL);
+  assert(stat(PATH_DEDUP_INDEX, &sb) == 0);
+  assert(sb.st_size == 32 + 4 * 64);
+  assert(remove(PATH_DEDUP_INDEX) == 0);
+
+  /* Index inside another directory, which gets flushed after the rename. */
+  test_ln_main_args(EXIT_SUCCESS,
+                    "-D",
+                    "-I",
+                    PATH_TREE_SOURCE "/" PATH_DEDUP_INDEX,
+                    PATH_TREE_SOURCE "/a",
+                    NULL);
+  assert(access(PATH_TREE_SOURCE "/" PATH_DEDUP_INDEX, F_OK) == 0);
+  test_ln_rm_tree(PATH_TREE_SOURCE);
+}
+
+/**
+ * Call @ref linkd_main with an arbitrary argument list.
+ *
+ * @param[in] expect_exit_status Expected exit status code.
+ * @param[in] arg_list           List of options and operands to send to
+ *                               linkd. Terminate list with NULL.
+ */
+static void
+test_linkd_main(const int expect_exit_status,
+                const char *const arg_list, ...){
+  int exit_status;
+  const char *arg;
+  va_list ap;
+
+  g_argc = 0;
+  strcpy(g_argv[g_argc++], "linkd");
+  va_start(ap, arg_list);
+  for(arg = arg_list; arg; arg = va_arg(ap, const char *const)){
+    strcpy(g_argv[g_argc++], arg);
+  }
+  va_end(ap);
+  optind = 0;
+  exit_status = linkd_main(g_argc, g_argv);
+  assert(exit_status == expect_exit_status);
+}
+
+/**
+ * Thread running the link daemon until it receives SIGTERM.
+ *
+ * @param[out] arg  Store the exit status of the daemon here.
+ * @retval     NULL Always returns NULL.
+ */
+static void *
+test_linkd_server(void *arg){
+  *(int *)arg = linkd_server(PATH_LINKD_SOCKET, 2);
+  return NULL;
+}
+
+/**
+ * Wait until the link daemon accepts connections.
+ */
+static void
+test_linkd_wait(void){
+  struct sockaddr_un sun;
+  struct timespec ts;
+  int fd;
+  int rc;
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  strcpy(sun.sun_path, PATH_LINKD_SOCKET);
+  ts.tv_sec = 0;
+  ts.tv_nsec = 1000000;
+  do{
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    rc = connect(fd, (struct sockaddr *)&sun, sizeof(sun));
+    assert(close(fd) == 0);
+    if(rc != 0){
+      nanosleep(&ts, NULL);
+    }
+  } while(rc != 0);
+}
+
+/**
+ * Run all tests for the link daemon and client.
+ */
+static void
+test_all_linkd(void){
+  pthread_t thread;
+  int server_status;
+  char path_list[LINKD_NFILE][32];
+  char path_long[200];
+  char *argv[LINKD_NFILE + 5];
+  char arg_list[4][16];
+  FILE *fp;
+  struct stat sb;
+  int argc;
+  int i;
+
+  /* Invalid arguments. */
+  test_linkd_main(EXIT_FAILURE, NULL);
+  test_linkd_main(EXIT_FAILURE, "-j", "0", "-s", PATH_LINKD_SOCKET, NULL);
+  test_linkd_main(EXIT_FAILURE, "-x", NULL);
+  test_linkd_main(EXIT_FAILURE, "-c", PATH_LINKD_SOCKET, NULL);
+  test_linkd_main(EXIT_FAILURE,
+                  "-s",
+                  PATH_LINKD_SOCKET,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "ln",
+                  NULL);
+
+  /* Daemon not running. */
+  test_linkd_main(EXIT_FAILURE,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "unlink",
+                  PATH_SOURCE_1,
+                  NULL);
+
+  assert(pthread_create(&thread,
+                        NULL,
+                        test_linkd_server,
+                        &server_status) == 0);
+  test_linkd_wait();
+
+  /* Only the owner may connect. */
+  assert(stat(PATH_LINKD_SOCKET, &sb) == 0);
+  assert((sb.st_mode & 0777) == 0600);
+
+  /* Hard link, then fail because the destination exists. */
+  test_linkd_main(EXIT_SUCCESS,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "ln",
+                  PATH_README,
+                  PATH_SOURCE_1,
+                  NULL);
+  test_ln_hard_check(PATH_README, PATH_SOURCE_1);
+  test_linkd_main(EXIT_FAILURE,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "ln",
+                  PATH_COPYING,
+                  PATH_SOURCE_1,
+                  NULL);
+  test_ln_hard_check(PATH_README, PATH_SOURCE_1);
+
+  /* Replace the destination with a symbolic link. */
+  test_linkd_main(EXIT_SUCCESS,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "ln",
+                  "-fs",
+                  PATH_COPYING,
+                  PATH_SOURCE_1,
+                  NULL);
+  test_ln_soft_check(PATH_COPYING, PATH_SOURCE_1);
+
+  /* Several source files into a target directory. */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  test_linkd_main(EXIT_SUCCESS,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "ln",
+                  PATH_README,
+                  PATH_COPYING,
+                  PATH_TARGET_DIR "/",
+                  NULL);
+  test_ln_hard_check(PATH_README, PATH_TARGET_DIR_README);
+  test_ln_hard_check(PATH_COPYING, PATH_TARGET_DIR_COPYING);
+
+  /* Remove them again, continuing after a failure. */
+  test_linkd_main(EXIT_FAILURE,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "unlink",
+                  "-b",
+                  PATH_TARGET_DIR_README,
+                  "noexist",
+                  PATH_TARGET_DIR_COPYING,
+                  PATH_SOURCE_1,
+                  NULL);
+  assert(rmdir(PATH_TARGET_DIR) == 0);
+  assert(lstat(PATH_SOURCE_1, &sb) != 0);
+
+  /* link, and the operand counts of link and unlink. */
+  test_linkd_main(EXIT_SUCCESS,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "link",
+                  PATH_README,
+                  PATH_SOURCE_1,
+                  NULL);
+  test_ln_hard_check(PATH_README, PATH_SOURCE_1);
+  test_linkd_main(EXIT_FAILURE,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "link",
+                  PATH_README,
+                  NULL);
+  test_linkd_main(EXIT_FAILURE,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "unlink",
+                  PATH_SOURCE_1,
+                  PATH_SOURCE_2,
+                  NULL);
+  test_linkd_main(EXIT_SUCCESS,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "unlink",
+                  PATH_SOURCE_1,
+                  NULL);
+  assert(access(PATH_SOURCE_1, F_OK) != 0);
+
+  /* link and unlink operands which begin with '-'. */
+  fp = fopen("-test-linkd.txt", "w");
+  assert(fp);
+  assert(fclose(fp) == 0);
+  test_linkd_main(EXIT_SUCCESS,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "link",
+                  "-test-linkd.txt",
+                  PATH_SOURCE_1,
+                  NULL);
+  test_ln_hard_check("-test-linkd.txt", PATH_SOURCE_1);
+  test_linkd_main(EXIT_SUCCESS,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "unlink",
+                  "-test-linkd.txt",
+                  NULL);
+  assert(access("-test-linkd.txt", F_OK) != 0);
+  test_linkd_main(EXIT_SUCCESS,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "unlink",
+                  PATH_SOURCE_1,
+                  NULL);
+
+  /* Invalid utility, option, and operands. */
+  test_linkd_main(EXIT_FAILURE, "-c", PATH_LINKD_SOCKET, "cp", NULL);
+  test_linkd_main(EXIT_FAILURE,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "ln",
+                  "-u",
+                  PATH_README,
+                  PATH_SOURCE_1,
+                  NULL);
+  test_linkd_main(EXIT_FAILURE,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "ln",
+                  PATH_README,
+                  NULL);
+  test_linkd_main(EXIT_FAILURE,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "ln",
+                  PATH_README,
+                  PATH_COPYING,
+                  PATH_SOURCE_1,
+                  NULL);
+  test_linkd_main(EXIT_FAILURE,
+                  "-c",
+                  PATH_LINKD_SOCKET,
+                  "ln",
+                  "",
+                  PATH_SOURCE_1,
+                  NULL);
+
+  /* More requests than the client keeps in flight. */
+  strcpy(arg_list[0], "linkd");
+  strcpy(arg_list[1], "-c");
+  strcpy(arg_list[2], "unlink");
+  strcpy(arg_list[3], "-b");
+  argc = 0;
+  argv[argc++] = arg_list[0];
+  argv[argc++] = arg_list[1];
+  argv[argc++] = g_argv[0];
+  strcpy(g_argv[0], PATH_LINKD_SOCKET);
+  argv[argc++] = arg_list[2];
+  argv[argc++] = arg_list[3];
+  for(i = 0; i < LINKD_NFILE; i++){
+    sprintf(path_list[i], "test-linkd-%d", i);
+    fp = fopen(path_list[i], "w");
+    assert(fp);
+    assert(fclose(fp) == 0);
+    argv[argc++] = path_list[i];
+  }
+  optind = 0;
+  assert(linkd_main(argc, argv) == EXIT_SUCCESS);
+  for(i = 0; i < LINKD_NFILE; i++){
+    assert(access(path_list[i], F_OK) != 0);
+  }
+
+  assert(pthread_kill(thread, SIGTERM) == 0);
+  assert(pthread_join(thread, NULL) == 0);
+  assert(server_status == EXIT_SUCCESS);
+  assert(access(PATH_LINKD_SOCKET, F_OK) != 0);
+
+  /* Socket path too long. */
+  memset(path_long, 'a', sizeof(path_long) - 1);
+  path_long[sizeof(path_long) - 1] = '\0';
+  assert(linkd_server(path_long, 1) == EXIT_FAILURE);
+}
+
+/**
+ * Call @ref multicall_main with an arbitrary argument list.
+ *
+ * @param[in] expect_exit_status Expected exit status code.
+ * @param[in] arg_list           Complete argument list, including argv[0].
+ *                               Terminate list with NULL.
+ */
+static void
+test_multicall_main(const int expect_exit_status,
+                    const char *const arg_list, ...){
+  int exit_status;
+  const char *arg;
+  va_list ap;
+
+  g_argc = 0;
+  va_start(ap, arg_list);
+  for(arg = arg_list; arg; arg = va_arg(ap, const char *const)){
+    strcpy(g_argv[g_argc++], arg);
+  }
+  va_end(ap);
+  optind = 0;
+  exit_status = multicall_main(g_argc, g_argv);
+  assert(exit_status == expect_exit_status);
+}
+
+/**
+ * Run all tests for the multi-call binary.
+ */
+static void
+test_all_multicall(void){
+  struct stat sb;
+
+  /* Utility named by argv[0], with or without a directory. */
+  test_multicall_main(EXIT_SUCCESS,
+                      "/usr/local/bin/link",
+                      PATH_README,
+                      PATH_SOURCE_1,
+                      NULL);
+  test_ln_hard_check(PATH_README, PATH_SOURCE_1);
+  test_multicall_main(EXIT_SUCCESS, "unlink", PATH_SOURCE_1, NULL);
+  assert(access(PATH_SOURCE_1, F_OK) != 0);
+
+  /* Utility named by the first argument. */
+  test_multicall_main(EXIT_SUCCESS,
+                      "linkutils",
+                      "ln",
+                      "-s",
+                      PATH_README,
+                      PATH_SOURCE_1,
+                      NULL);
+  assert(lstat(PATH_SOURCE_1, &sb) == 0);
+  assert(S_ISLNK(sb.st_mode));
+  test_multicall_main(EXIT_SUCCESS,
+                      "./linkutils",
+                      "unlink",
+                      PATH_SOURCE_1,
+                      NULL);
+  assert(access(PATH_SOURCE_1, F_OK) != 0);
+
+  /* Exit status of the utility gets returned. */
+  test_multicall_main(EXIT_FAILURE, "linkutils", "unlink", "noexist", NULL);
+
+  /* No utility named. */
+  test_multicall_main(EXIT_FAILURE, "linkutils", NULL);
+  test_multicall_main(EXIT_FAILURE, "linkutils", "cp", PATH_README, NULL);
+  test_multicall_main(EXIT_FAILURE, "linkutils", "linkutils", NULL);
+  test_multicall_main(EXIT_FAILURE, NULL);
+}
+
+/**
+ * Run all tests for unlink utility.
+ */
+static void
+test_all_unlink(void){
+  FILE *fp;
+  const char *const PATH_TMP_FILE = "build/test-unlink.txt";
+
+  /* Successfully unlink a file. */
+  fp = fopen(PATH_TMP_FILE, "w");
+  assert(fp);
+  assert(fclose(fp) == 0);
+  test_unlink_main(PATH_TMP_FILE, NULL, EXIT_SUCCESS);
+
+  /* Try to unlink a file that does not exist. */
+  test_unlink_main(PATH_TMP_FILE, NULL, EXIT_FAILURE);
+
+  /* Too few operands. */
+  test_unlink_main(NULL, NULL, EXIT_FAILURE);
+
+  /* Too many operands. */
+  test_unlink_main(PATH_TMP_FILE, PATH_TMP_FILE, EXIT_FAILURE);
+  test_unlink_main_args(EXIT_FAILURE, "-l", PATH_LIST, NULL);
+
+  /* The single operand can start with '-' without needing "--". */
+  fp = fopen("-test-unlink.txt", "w");
+  assert(fp);
+  assert(fclose(fp) == 0);
+  test_unlink_main("-test-unlink.txt", NULL, EXIT_SUCCESS);
+  assert(access("-test-unlink.txt", F_OK) != 0);
+  test_unlink_main("-b", NULL, EXIT_FAILURE);
+}
+
+/**
+ * Run all tests for the unlink batch (-b) argument.
+ */
+static void
+test_all_unlink_batch(void){
+  /* Remove files in several directories, continuing after a failure. */
+  assert(mkdir(PATH_TARGET_DIR, 0777) == 0);
+  test_ln_create_file(PATH_SOURCE_1);
+  test_ln_create_file(PATH_TARGET_DIR_COPYING);
+  test_ln_create_file(PATH_TARGET_DIR_README);
+  test_ln_create_file(PATH_XDEV_DEST);
+  test_unlink_main_args(EXIT_FAILURE,
+                        "-b",
+                        PATH_TARGET_DIR_COPYING,
+                        "noexist",
+                        PATH_TARGET_DIR_README,
+                        PATH_XDEV_DEST,
+                        PATH_SOURCE_1,
+                        PATH_TARGET_DIR "/",
+                        NULL);
+  assert(access(PATH_SOURCE_1, F_OK) != 0);
+  assert(access(PATH_XDEV_DEST, F_OK) != 0);
+  assert(test_ln_dir_count(PATH_TARGET_DIR) == 0);
+
+  /* Remove files read from a null separated list (-0). */
+  test_ln_create_file(PATH_TARGET_DIR_COPYING);
+  test_ln_create_file(PATH_TARGET_DIR_README);
+  test_ln_write_list(PATH_LIST,
+                     '\0',
+                     PATH_TARGET_DIR_COPYING,
+                     "",
+                     PATH_TARGET_DIR_README,
+                     NULL);
+  test_unlink_main_args(EXIT_SUCCESS, "-b", "-0", "-l", PATH_LIST, NULL);
+  assert(test_ln_dir_count(PATH_TARGET_DIR) == 0);
+
+  /* Failed to remove one file, the rest still get removed. */
+  test_ln_create_file(PATH_TARGET_DIR_COPYING);
+  test_ln_create_file(PATH_TARGET_DIR_README);
+  g_test_seam_err_ctr_unlinkat = 0;
+  test_unlink_main_args(EXIT_FAILURE,
+                        "-b",
+                        PATH_TARGET_DIR_COPYING,
+                        PATH_TARGET_DIR_README,
+                        NULL);
+  g_test_seam_err_ctr_unlinkat = -1;
+  assert(access(PATH_TARGET_DIR_COPYING, F_OK) == 0);
+  assert(access(PATH_TARGET_DIR_README, F_OK) != 0);
+  assert(remove(PATH_TARGET_DIR_COPYING) == 0);
+
+  /*
+   * Same through io_uring (-u), which also passes when io_uring not
+   * available because the files then get removed with unlinkat.
+   */
+  test_ln_create_file(PATH_SOURCE_1);
+  test_ln_create_file(PATH_TARGET_DIR_COPYING);
+  test_ln_create_file(PATH_TARGET_DIR_README);
+  test_ln_write_list(PATH_LIST, '\n', PATH_TARGET_DIR_README, NULL);
+  test_unlink_main_args(EXIT_FAILURE,
+                        "-b",
+                        "-u",
+                        "-l",
+                        PATH_LIST,
+                        PATH_TARGET_DIR_COPYING,
+                        "noexist",
+                        PATH_SOURCE_1,
+                        NULL);
+  assert(access(PATH_SOURCE_1, F_OK) != 0);
+  assert(test_ln_dir_count(PATH_TARGET_DIR) == 0);
+
+  /* Parent directory does not exist. */
+  test_unlink_main_args(EXIT_FAILURE, "-b", "noexist/noexist", NULL);
+  test_unlink_main_args(EXIT_FAILURE, "-b", "/noexist", NULL);
+
+  /* List file does not exist. */
+  assert(remove(PATH_LIST) == 0);
+  test_unlink_main_args(EXIT_FAILURE, "-b", "-l", PATH_LIST, NULL);
+  assert(rmdir(PATH_TARGET_DIR) == 0);
+
+  /* No file operands or invalid argument. */
+  test_unlink_main_args(EXIT_FAILURE, "-b", NULL);
+  test_unlink_main_args(EXIT_FAILURE, "-x", PATH_README, NULL);
 }
 
 /**
@@ -671,11 +2837,34 @@ test_all(void){
   remove(PATH_TARGET_DIR_README);
   remove(PATH_TARGET_DIR "/hosts");
   rmdir(PATH_TARGET_DIR);
+  remove(PATH_LIST);
+  remove(PATH_SPARSE);
+  remove(PATH_MANIFEST);
+  test_ln_rm_tree(PATH_STORE);
+  test_ln_rm_tree(PATH_XDEV_DIR);
+  test_ln_rm_tree(PATH_TREE_SOURCE);
+  test_ln_rm_tree(PATH_TREE_TARGET);
 
   test_all_unit();
   test_all_link();
+  test_all_link_batch();
   test_all_ln();
+  test_all_ln_list();
+  test_all_ln_optimistic();
+  test_all_ln_replace();
+  test_all_ln_thread();
+  test_all_ln_uring();
+  test_all_ln_recursive();
+  test_all_ln_budget();
+  test_all_ln_lib();
+  test_all_ln_dedup();
+  test_all_ln_reflink();
+  test_all_ln_copy();
+  test_all_ln_checkout();
+  test_all_linkd();
   test_all_unlink();
+  test_all_unlink_batch();
+  test_all_multicall();
 }
 
 /**
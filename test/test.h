@@ -8,7 +8,9 @@
 #ifndef LINK_TEST_H
 #define LINK_TEST_H
 
+#include <sys/stat.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 int
 link_main(int argc,
@@ -22,6 +24,18 @@ int
 unlink_main(int argc,
             char *const argv[]);
 
+int
+multicall_main(int argc,
+               char *argv[]);
+
+int
+linkd_main(int argc,
+           char *argv[]);
+
+int
+linkd_server(const char *const path,
+             const size_t nthread);
+
 bool
 si_add_size_t(const size_t a,
               const size_t b,
@@ -44,6 +58,246 @@ si_add_size_t(const size_t a,
 bool
 test_seam_dec_err_ctr(int *const err_ctr);
 
+/**
+ * Number of calls made through each test seam since the last call to
+ * @ref test_seam_count_reset.
+ *
+ * Used to check that an operation stays within its budget of system calls
+ * and memory allocations.
+ */
+struct test_seam_count{
+  /**
+   * Number of calls to fstatat().
+   */
+  size_t fstatat;
+
+  /**
+   * Number of calls to link().
+   */
+  size_t link;
+
+  /**
+   * Number of calls to linkat().
+   */
+  size_t linkat;
+
+  /**
+   * Number of calls to lstat().
+   */
+  size_t lstat;
+
+  /**
+   * Number of calls to malloc().
+   */
+  size_t malloc;
+
+  /**
+   * Number of calls to mkdir().
+   */
+  size_t mkdir;
+
+  /**
+   * Number of calls to mkdirat().
+   */
+  size_t mkdirat;
+
+  /**
+   * Number of calls to realloc().
+   */
+  size_t realloc;
+
+  /**
+   * Number of calls to renameat().
+   */
+  size_t renameat;
+
+  /**
+   * Number of calls to stat().
+   */
+  size_t stat;
+
+  /**
+   * Number of calls to strdup().
+   */
+  size_t strdup;
+
+  /**
+   * Number of calls to symlink().
+   */
+  size_t symlink;
+
+  /**
+   * Number of calls to symlinkat().
+   */
+  size_t symlinkat;
+
+  /**
+   * Number of calls to unlink().
+   */
+  size_t unlink;
+
+  /**
+   * Number of calls to unlinkat().
+   */
+  size_t unlinkat;
+};
+
+/**
+ * Set all counts in @ref g_test_seam_count to zero.
+ */
+void
+test_seam_count_reset(void);
+
+/**
+ * Count calls to fstatat() and control when it fails.
+ *
+ * @param[in]  fd   See fstatat().
+ * @param[in]  path See fstatat().
+ * @param[out] buf  See fstatat().
+ * @param[in]  flag See fstatat().
+ * @return          See fstatat().
+ */
+int
+test_seam_fstatat(int fd,
+                  const char *path,
+                  struct stat *buf,
+                  int flag);
+
+/**
+ * Count calls to link() and control when it fails.
+ *
+ * @param[in]  path1 See link().
+ * @param[in]  path2 See link().
+ * @return           See link().
+ */
+int
+test_seam_link(const char *path1,
+               const char *path2);
+
+/**
+ * Count calls to linkat() and control when it fails.
+ *
+ * @param[in]  fd1   See linkat().
+ * @param[in]  path1 See linkat().
+ * @param[in]  fd2   See linkat().
+ * @param[in]  path2 See linkat().
+ * @param[in]  flag  See linkat().
+ * @return           See linkat().
+ */
+int
+test_seam_linkat(int fd1,
+                 const char *path1,
+                 int fd2,
+                 const char *path2,
+                 int flag);
+
+/**
+ * Count calls to lstat() and control when it fails.
+ *
+ * @param[in]  path See lstat().
+ * @param[out] buf  See lstat().
+ * @return          See lstat().
+ */
+int
+test_seam_lstat(const char *path,
+                struct stat *buf);
+
+/**
+ * Count calls to mkdir() and control when it fails.
+ *
+ * @param[in]  path See mkdir().
+ * @param[in]  mode See mkdir().
+ * @return          See mkdir().
+ */
+int
+test_seam_mkdir(const char *path,
+                mode_t mode);
+
+/**
+ * Count calls to mkdirat() and control when it fails.
+ *
+ * @param[in]  fd   See mkdirat().
+ * @param[in]  path See mkdirat().
+ * @param[in]  mode See mkdirat().
+ * @return          See mkdirat().
+ */
+int
+test_seam_mkdirat(int fd,
+                  const char *path,
+                  mode_t mode);
+
+/**
+ * Count calls to renameat() and control when it fails.
+ *
+ * @param[in]  oldfd See renameat().
+ * @param[in]  old   See renameat().
+ * @param[in]  newfd See renameat().
+ * @param[in]  new   See renameat().
+ * @return           See renameat().
+ */
+int
+test_seam_renameat(int oldfd,
+                   const char *old,
+                   int newfd,
+                   const char *new);
+
+/**
+ * Count calls to stat() and control when it fails.
+ *
+ * @param[in]  path See stat().
+ * @param[out] buf  See stat().
+ * @return          See stat().
+ */
+int
+test_seam_stat(const char *path,
+               struct stat *buf);
+
+/**
+ * Count calls to symlink() and control when it fails.
+ *
+ * @param[in]  path1 See symlink().
+ * @param[in]  path2 See symlink().
+ * @return           See symlink().
+ */
+int
+test_seam_symlink(const char *path1,
+                  const char *path2);
+
+/**
+ * Count calls to symlinkat() and control when it fails.
+ *
+ * @param[in]  path1 See symlinkat().
+ * @param[in]  fd    See symlinkat().
+ * @param[in]  path2 See symlinkat().
+ * @return           See symlinkat().
+ */
+int
+test_seam_symlinkat(const char *path1,
+                    int fd,
+                    const char *path2);
+
+/**
+ * Count calls to unlink() and control when it fails.
+ *
+ * @param[in]  path See unlink().
+ * @return          See unlink().
+ */
+int
+test_seam_unlink(const char *path);
+
+/**
+ * Count calls to unlinkat() and control when it fails.
+ *
+ * @param[in]  fd   See unlinkat().
+ * @param[in]  path See unlinkat().
+ * @param[in]  flag See unlinkat().
+ * @return          See unlinkat().
+ */
+int
+test_seam_unlinkat(int fd,
+                   const char *path,
+                   int flag);
+
 /**
  * Control when malloc() fails.
  *
@@ -54,6 +308,18 @@ test_seam_dec_err_ctr(int *const err_ctr);
 void *
 test_seam_malloc(size_t size);
 
+/**
+ * Control when realloc() fails.
+ *
+ * @param[in] ptr   Memory to resize.
+ * @param[in] size  New size in bytes.
+ * @retval    void* Resized memory.
+ * @retval    NULL  Failed to allocate memory.
+ */
+void *
+test_seam_realloc(void *ptr,
+                  size_t size);
+
 /**
  * Control when strdup() fails.
  *
@@ -64,11 +330,86 @@ test_seam_malloc(size_t size);
 char *
 test_seam_strdup(const char *s);
 
+/**
+ * Calls counted by the test seams.
+ */
+extern struct test_seam_count g_test_seam_count;
+
+/**
+ * Value of errno set by a system call test seam when made to fail.
+ */
+extern int g_test_seam_errno;
+
+/**
+ * Error counter for @ref test_seam_fstatat.
+ */
+extern int g_test_seam_err_ctr_fstatat;
+
+/**
+ * Error counter for @ref test_seam_link.
+ */
+extern int g_test_seam_err_ctr_link;
+
+/**
+ * Error counter for @ref test_seam_linkat.
+ */
+extern int g_test_seam_err_ctr_linkat;
+
+/**
+ * Error counter for @ref test_seam_lstat.
+ */
+extern int g_test_seam_err_ctr_lstat;
+
+/**
+ * Error counter for @ref test_seam_mkdir.
+ */
+extern int g_test_seam_err_ctr_mkdir;
+
+/**
+ * Error counter for @ref test_seam_mkdirat.
+ */
+extern int g_test_seam_err_ctr_mkdirat;
+
+/**
+ * Error counter for @ref test_seam_renameat.
+ */
+extern int g_test_seam_err_ctr_renameat;
+
+/**
+ * Error counter for @ref test_seam_stat.
+ */
+extern int g_test_seam_err_ctr_stat;
+
+/**
+ * Error counter for @ref test_seam_symlink.
+ */
+extern int g_test_seam_err_ctr_symlink;
+
+/**
+ * Error counter for @ref test_seam_symlinkat.
+ */
+extern int g_test_seam_err_ctr_symlinkat;
+
+/**
+ * Error counter for @ref test_seam_unlink.
+ */
+extern int g_test_seam_err_ctr_unlink;
+
+/**
+ * Error counter for @ref test_seam_unlinkat.
+ */
+extern int g_test_seam_err_ctr_unlinkat;
+
 /**
  * Error counter for @ref test_seam_malloc.
  */
 extern int g_test_seam_err_ctr_malloc;
 
+/**
+ * Error counter for @ref test_seam_realloc.
+ */
+extern int g_test_seam_err_ctr_realloc;
+
 /**
  * Error counter for @ref si_add_size_t.
  */